@@ -14,6 +14,7 @@ FrameBuffer::FrameBuffer(uint width, uint height)
       Width(width),
 	  Height(height),
       ColorData(new float3[width * height]),
+      HalfColorData(new float3[width * height]),
       Bounces(new uint[width * height]),
       ColorSampleCount(new uint[width * height]) {
 	Reset();
@@ -21,6 +22,7 @@ FrameBuffer::FrameBuffer(uint width, uint height)
 
 FrameBuffer::~FrameBuffer() {
 	delete[] ColorData;
+	delete[] HalfColorData;
 	delete[] ColorSampleCount;
 	delete[] Bounces;
 }
@@ -28,6 +30,7 @@ FrameBuffer::~FrameBuffer() {
 void FrameBuffer::Reset() {
 	// We rely on the fact that 0x0000 == 0.0f
 	memset(&ColorData[0], 0, Width * Height * sizeof(float3));
+	memset(&HalfColorData[0], 0, Width * Height * sizeof(float3));
 	memset(&Bounces[0], 0, Width * Height * sizeof(uint));
 	memset(&ColorSampleCount[0], 0, Width * Height * sizeof(uint));
 	Empty = true;
@@ -26,6 +26,9 @@ public:
 	uint Height;
 
 	float3 *ColorData;
+	// The sum of every other sample, starting with the first
+	// Comparing the two halves of the samples gives an estimate of each pixel's error
+	float3 *HalfColorData;
 	uint *Bounces;
 	uint *ColorSampleCount;
 
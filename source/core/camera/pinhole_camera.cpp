@@ -19,7 +19,8 @@ PinholeCamera::PinholeCamera()
 		  m_up(1.0f),
 		  m_target(0.0f, 0.0f, 0.0f),
 		  m_tanFovXDiv2(0.5773503f /* tan(60 degrees / 2) */),
-		  m_tanFovYDiv2(tanf(0.5235f /* 60 degrees / 2 */ * 720 / 1280)) {
+		  m_tanFovYDiv2(tanf(0.5235f /* 60 degrees / 2 */ * 720 / 1280)),
+		  m_pixelSpreadAngle(0.0f) {
 	UpdateOrigin();
 	UpdateCartesianCoordSystem();
 }
@@ -34,7 +35,8 @@ PinholeCamera::PinholeCamera(float phi, float theta, float radius, uint clientWi
 		  m_up(1.0f),
 		  m_target(target),
 		  m_tanFovXDiv2(tanf(fov * 0.5f)),
-		  m_tanFovYDiv2(tanf(fov * 0.5f * clientHeight / clientWidth)) {
+		  m_tanFovYDiv2(tanf(fov * 0.5f * clientHeight / clientWidth)),
+		  m_pixelSpreadAngle(atanf(2.0f * m_tanFovYDiv2 / clientHeight)) {
 	UpdateOrigin();
 	UpdateCartesianCoordSystem();
 }
@@ -85,7 +87,7 @@ void PinholeCamera::Pan(float dx, float dy) {
 	UpdateOrigin();
 }
 
-RTCRay PinholeCamera::CalculateRayFromPixel(uint x, uint y, UniformSampler *sampler) const {
+RTCRay PinholeCamera::CalculateRayFromPixel(uint x, uint y, float2 u, float *spreadAngle) const {
 	RTCRay ray;
 	memset(&ray, 0, sizeof(ray));
 
@@ -97,18 +99,21 @@ RTCRay PinholeCamera::CalculateRayFromPixel(uint x, uint y, UniformSampler *samp
 	ray.tfar = embree::inf;
 	ray.mask = 0xFFFFFFFF;
 
-	float u = m_filter.Sample(sampler->NextFloat());
-	float v = m_filter.Sample(sampler->NextFloat());
+	float filterX = m_filter.Sample(u.x);
+	float filterY = m_filter.Sample(u.y);
 
-	float3a viewVector((((x + 0.5f + u) / FrameBufferWidth) * 2.0f - 1.0f) * m_tanFovXDiv2,
-		-(((y + 0.5f + v) / FrameBufferHeight) * 2.0f - 1.0f) * m_tanFovYDiv2,
+	float3a viewVector((((x + 0.5f + filterX) / FrameBufferWidth) * 2.0f - 1.0f) * m_tanFovXDiv2,
+		-(((y + 0.5f + filterY) / FrameBufferHeight) * 2.0f - 1.0f) * m_tanFovYDiv2,
 		-1.0f);
+	viewVector = normalize(viewVector);
 
 	// Matrix multiply
 	ray.dir_x = dot(viewVector, m_matrixMulXAxis);
 	ray.dir_y = dot(viewVector, m_matrixMulYAxis);
 	ray.dir_z = dot(viewVector, m_matrixMulZAxis);
 
+	*spreadAngle = m_pixelSpreadAngle;
+
 	return ray;
 }
 
@@ -8,7 +8,6 @@
 
 #include "math/int_types.h"
 #include "math/vector_types.h"
-#include "math/uniform_sampler.h"
 
 #include "camera/frame_buffer.h"
 #include "camera/reconstruction_filter.h"
@@ -50,6 +49,8 @@ private:
 	// Ray Transform Data
 	float m_tanFovXDiv2;
 	float m_tanFovYDiv2;
+	// The angle a single pixel subtends, used as the spread of each ray's cone
+	float m_pixelSpreadAngle;
 
 	float3a m_matrixMulXAxis;
 	float3a m_matrixMulYAxis;
@@ -89,8 +90,11 @@ public:
 	 *
 	 * @param x         The x coordinate of the pixel
 	 * @param y         The y coordinate of the pixel
+	 * @param u              A uniform random point in [0, 1)^2, used to pick the offset within the pixel filter
+	 * @param spreadAngle    The angle the ray's cone widens by. Ray cones let textures choose a mip level
+	 * @return               The ray, with a normalized direction
 	 */
-	RTCRay CalculateRayFromPixel(uint x, uint y, UniformSampler *sampler) const;
+	RTCRay CalculateRayFromPixel(uint x, uint y, float2 u, float *spreadAngle) const;
 
 private:
 	/**
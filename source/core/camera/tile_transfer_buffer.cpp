@@ -0,0 +1,109 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "camera/tile_transfer_buffer.h"
+
+#include "camera/frame_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace Lantern {
+
+TileTransferBuffer::TileTransferBuffer(uint width, uint height, uint tileSize)
+	: Width(width),
+	  Height(height),
+	  TileSize(tileSize),
+	  NumTilesX((width + tileSize - 1) / tileSize),
+	  NumTilesY((height + tileSize - 1) / tileSize),
+	  m_tileStates(new TileState[NumTilesX * NumTilesY]),
+	  m_colorData(new float3[NumTilesX * NumTilesY * tileSize * tileSize]),
+	  m_bounces(new uint[NumTilesX * NumTilesY * tileSize * tileSize]),
+	  m_colorSampleCount(new uint[NumTilesX * NumTilesY * tileSize * tileSize]) {
+	const std::size_t numPixels = (std::size_t)NumTilesX * NumTilesY * tileSize * tileSize;
+
+	// We rely on the fact that 0x0000 == 0.0f
+	memset(&m_colorData[0], 0, numPixels * sizeof(float3));
+	memset(&m_bounces[0], 0, numPixels * sizeof(uint));
+	memset(&m_colorSampleCount[0], 0, numPixels * sizeof(uint));
+}
+
+TileTransferBuffer::~TileTransferBuffer() {
+	delete[] m_tileStates;
+	delete[] m_colorData;
+	delete[] m_bounces;
+	delete[] m_colorSampleCount;
+}
+
+void TileTransferBuffer::Publish(uint tileIndex, const float3 *color, const uint *bounces, const uint *sampleCount) {
+	const uint tilePixels = TileSize * TileSize;
+	const std::size_t offset = (std::size_t)tileIndex * tilePixels;
+
+	TileState &state = m_tileStates[tileIndex];
+	bool queue;
+	{
+		tbb::spin_mutex::scoped_lock lock(state.Lock);
+		for (uint i = 0; i < tilePixels; ++i) {
+			m_colorData[offset + i] += color[i];
+			m_bounces[offset + i] += bounces[i];
+			m_colorSampleCount[offset + i] += sampleCount[i];
+		}
+
+		queue = !state.Queued;
+		state.Queued = true;
+	}
+
+	// If the tile is already queued, the consumer will pick up the new samples along with the old ones
+	if (queue) {
+		m_queuedTiles.push(tileIndex);
+	}
+}
+
+uint TileTransferBuffer::Consume(FrameBuffer *accumulationFrameBuffer) {
+	const uint tilePixels = TileSize * TileSize;
+
+	// Tiles can be re-queued while we work, so cap how many we take, to keep the caller responsive
+	const uint maxTiles = NumTilesX * NumTilesY;
+
+	uint numMerged = 0;
+	uint tileIndex;
+	while (numMerged < maxTiles && m_queuedTiles.try_pop(tileIndex)) {
+		const uint tileY = tileIndex / NumTilesX;
+		const uint tileX = tileIndex - tileY * NumTilesX;
+		const uint x0 = tileX * TileSize;
+		const uint x1 = std::min(x0 + TileSize, Width);
+		const uint y0 = tileY * TileSize;
+		const uint y1 = std::min(y0 + TileSize, Height);
+
+		const std::size_t offset = (std::size_t)tileIndex * tilePixels;
+
+		TileState &state = m_tileStates[tileIndex];
+		tbb::spin_mutex::scoped_lock lock(state.Lock);
+
+		for (uint y = y0; y < y1; ++y) {
+			for (uint x = x0; x < x1; ++x) {
+				const std::size_t src = offset + (y - y0) * TileSize + (x - x0);
+				const std::size_t dst = (std::size_t)y * Width + x;
+
+				accumulationFrameBuffer->ColorData[dst] += m_colorData[src];
+				accumulationFrameBuffer->Bounces[dst] += m_bounces[src];
+				accumulationFrameBuffer->ColorSampleCount[dst] += m_colorSampleCount[src];
+			}
+		}
+
+		memset(&m_colorData[offset], 0, tilePixels * sizeof(float3));
+		memset(&m_bounces[offset], 0, tilePixels * sizeof(uint));
+		memset(&m_colorSampleCount[offset], 0, tilePixels * sizeof(uint));
+		state.Queued = false;
+
+		++numMerged;
+	}
+
+	return numMerged;
+}
+
+} // End of namespace Lantern
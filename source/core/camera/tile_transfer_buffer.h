@@ -0,0 +1,82 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+#include "math/vector_types.h"
+
+#include "tbb/spin_mutex.h"
+#include "tbb/concurrent_queue.h"
+
+
+namespace Lantern {
+
+class FrameBuffer;
+
+/**
+ * Hands finished tiles from the integrator to a consumer, like the Visualizer
+ *
+ * Each tile has its own staging area. Publishing adds a tile's samples to its staging area,
+ * and queues the tile if it isn't already waiting to be consumed. So the consumer only ever
+ * touches the tiles that changed, and a slow consumer just means more samples per queued tile,
+ * rather than an ever growing queue
+ *
+ * Data is stored tile by tile. Within a tile, pixels are indexed by (y - tileY0) * TileSize + (x - tileX0)
+ */
+class TileTransferBuffer {
+public:
+	TileTransferBuffer(uint width, uint height, uint tileSize);
+	~TileTransferBuffer();
+
+public:
+	const uint Width;
+	const uint Height;
+	const uint TileSize;
+	const uint NumTilesX;
+	const uint NumTilesY;
+
+private:
+	struct TileState {
+		TileState() : Queued(false) {}
+
+		// Only contended when the consumer merges a tile at the same time the integrator publishes it
+		tbb::spin_mutex Lock;
+		bool Queued;
+	};
+	TileState *m_tileStates;
+
+	float3 *m_colorData;
+	uint *m_bounces;
+	uint *m_colorSampleCount;
+
+	// Indices of the tiles with samples the consumer hasn't merged yet. Each tile is in here at most once
+	tbb::concurrent_queue<uint> m_queuedTiles;
+
+public:
+	/**
+	 * Adds samples to a tile, and queues it for the consumer
+	 *
+	 * Safe to call from many threads at once
+	 *
+	 * @param tileIndex      The index of the tile. Tiles are numbered row by row
+	 * @param color          The sum of the new samples of each pixel, in tile order
+	 * @param bounces        The sum of the bounces of the new samples of each pixel, in tile order
+	 * @param sampleCount    The number of new samples of each pixel, in tile order
+	 */
+	void Publish(uint tileIndex, const float3 *color, const uint *bounces, const uint *sampleCount);
+	/**
+	 * Merges every queued tile into a frame buffer, and clears their staging areas
+	 *
+	 * Only one thread can consume at a time
+	 *
+	 * @param accumulationFrameBuffer    The frame buffer to add the samples to
+	 * @return                           The number of tiles merged
+	 */
+	uint Consume(FrameBuffer *accumulationFrameBuffer);
+};
+
+} // End of namespace Lantern
@@ -7,72 +7,106 @@
 #include "integrator/integrator.h"
 
 #include "integrator/surface_interaction.h"
+#include "integrator/path_state.h"
 
 #include "scene/scene.h"
 
+#include "camera/frame_buffer.h"
+#include "camera/tile_transfer_buffer.h"
+
 #include "materials/material.h"
 #include "materials/bsdfs/bsdf.h"
 #include "materials/media/medium.h"
+#include "materials/textures/texture.h"
 
 #include "math/uniform_sampler.h"
+#include "math/sobol_sampler.h"
+#include "math/pmj02_sampler.h"
+#include "math/hash.h"
 #include "math/vector_math.h"
 #include "math/sampling.h"
 
-#include "tbb/parallel_for.h"
+#include "tbb/task_group.h"
+#include "tbb/task_scheduler_init.h"
+#include "tbb/concurrent_queue.h"
 
 #include <algorithm>
+#include <cmath>
 
 
 namespace Lantern {
 
-void Integrator::RenderFrame() {
-	uint width = m_scene->Camera->FrameBufferWidth;
-	uint height = m_scene->Camera->FrameBufferHeight;
-
-	const uint numTilesX = (width + kTileSize - 1) / kTileSize;
-	const uint numTilesY = (height + kTileSize - 1) / kTileSize;
-
-	m_currentFrameBuffer = std::atomic_exchange(m_swapFrameBuffer, m_currentFrameBuffer);
-	m_currentFrameBuffer->Empty = false;
+Integrator::Integrator(Scene *scene, TileTransferBuffer *transferBuffer)
+	: m_scene(scene),
+	  m_transferBuffer(transferBuffer),
+	  m_frameNumber(0u),
+	  m_convergenceBuffer(new FrameBuffer(scene->Camera->FrameBufferWidth, scene->Camera->FrameBufferHeight)),
+	  m_width(scene->Camera->FrameBufferWidth),
+	  m_pixelConverged(scene->Camera->FrameBufferWidth * scene->Camera->FrameBufferHeight, 0),
+	  m_meanTileError(0.0f),
+	  m_tilesFinishedThisPass(0u),
+	  m_noiseThreshold(0.0f),
+	  m_maxSamples(0u),
+	  m_samplerType(SamplerType::Sobol),
+	  m_samplesPerPass(1u) {
+	const uint numTilesX = (scene->Camera->FrameBufferWidth + kTileSize - 1) / kTileSize;
+	const uint numTilesY = (scene->Camera->FrameBufferHeight + kTileSize - 1) / kTileSize;
+
+	m_tileError.resize(numTilesX * numTilesY, 0.0f);
+	m_tileActive.resize(numTilesX * numTilesY, 1);
+	m_tilePass.resize(numTilesX * numTilesY, 0u);
+	m_numActiveTiles = numTilesX * numTilesY;
+}
 
-	tbb::parallel_for(uint(0), uint(numTilesX * numTilesY), [=](uint i) {
-		RenderTile(i, width, height, numTilesX, numTilesY);
-	});
+Integrator::~Integrator() {
+	delete m_convergenceBuffer;
+}
 
-	++m_frameNumber;
+void Integrator::SetSamplerType(SamplerType samplerType) {
+	m_samplerType = samplerType;
 }
 
-// MurmurHash3
-inline uint HashMix(uint hash, uint k) {
-	const uint c1 = 0xcc9e2d51;
-	const uint c2 = 0x1b873593;
-	const uint r1 = 15;
-	const uint r2 = 13;
-	const uint m = 5;
-	const uint n = 0xe6546b64;
+void Integrator::SetSamplesPerPass(uint samplesPerPass) {
+	m_samplesPerPass = std::max(samplesPerPass, 1u);
+}
 
-	k *= c1;
-	k = (k << r1) | (k >> (32 - r1));
-	k *= c2;
+void Integrator::SetConvergenceCriteria(float noiseThreshold, uint maxSamples) {
+	m_noiseThreshold = noiseThreshold;
+	m_maxSamples = maxSamples;
+}
 
-	hash ^= k;
-	hash = ((hash << r2) | (hash >> (32 - r2))) * m + n;
+void Integrator::Run(std::atomic_bool *quit) {
+	uint width = m_scene->Camera->FrameBufferWidth;
+	uint height = m_scene->Camera->FrameBufferHeight;
 
-	return hash;
-}
+	const uint numTilesX = (width + kTileSize - 1) / kTileSize;
+	const uint numTilesY = (height + kTileSize - 1) / kTileSize;
 
-// MurmurHash3
-inline uint HashFinalize(uint hash) {
-	hash ^= hash >> 16;
-	hash *= 0x85ebca6b;
-	hash ^= hash >> 13;
-	hash *= 0xc2b2ae35;
-	hash ^= hash >> 16;
+	tbb::concurrent_queue<uint> tileQueue;
+	for (uint i = 0; i < numTilesX * numTilesY; ++i) {
+		if (m_tileActive[i] != 0) {
+			tileQueue.push(i);
+		}
+	}
 
-	return hash;
+	// One long-running task per thread. Each keeps cycling tiles through the queue until
+	// it runs dry, which only happens once the remaining tiles are all in flight, or converged
+	tbb::task_group workers;
+	const int numWorkers = tbb::task_scheduler_init::default_num_threads();
+	for (int i = 0; i < numWorkers; ++i) {
+		workers.run([=, &tileQueue] {
+			uint index;
+			while (!quit->load(std::memory_order_relaxed) && tileQueue.try_pop(index)) {
+				if (RenderTile(index, width, height, numTilesX, numTilesY)) {
+					tileQueue.push(index);
+				}
+			}
+		});
+	}
+	workers.wait();
 }
 
-void Integrator::RenderTile(uint index, uint width, uint height, uint numTilesX, uint numTilesY) const {
+bool Integrator::RenderTile(uint index, uint width, uint height, uint numTilesX, uint numTilesY) {
 	uint tileY = index / numTilesX;
 	uint tileX = index - tileY * numTilesX;
 
@@ -83,235 +117,482 @@ void Integrator::RenderTile(uint index, uint width, uint height, uint numTilesX,
 
 	uint hash = 0u;
 	hash = HashMix(hash, index);
-	hash = HashMix(hash, m_frameNumber);
+	hash = HashMix(hash, m_tilePass[index]);
 	hash = HashFinalize(hash);
 	
-	UniformSampler sampler(hash, m_frameNumber);
+	UniformSampler uniformSampler(hash, m_tilePass[index]);
+	SobolSampler sobolSampler;
+	PMJ02Sampler pmj02Sampler;
+
+	Sampler *sampler;
+	switch (m_samplerType) {
+	case SamplerType::Uniform:
+		sampler = &uniformSampler;
+		break;
+	case SamplerType::PMJ02:
+		sampler = &pmj02Sampler;
+		break;
+	case SamplerType::Sobol:
+	default:
+		sampler = &sobolSampler;
+		break;
+	}
 
+	Tile tile;
+	tile.X0 = x0;
+	tile.X1 = x1;
+	tile.Y0 = y0;
+	tile.Y1 = y1;
+	// Edge tiles are only partially covered, but the whole tile is published, so clear all of it
+	for (uint i = 0; i < kTileSize * kTileSize; ++i) {
+		tile.Color[i] = float3(0.0f);
+		tile.HalfColor[i] = float3(0.0f);
+		tile.Bounces[i] = 0u;
+		tile.SampleCount[i] = 0u;
+	}
 	for (uint y = y0; y < y1; ++y) {
 		for (uint x = x0; x < x1; ++x) {
-			RenderPixel(x, y, &sampler);
+			tile.BaseSampleCount[tile.Index(x, y)] = m_convergenceBuffer->ColorSampleCount[y * m_width + x];
 		}
 	}
-}
 
-void Integrator::RenderPixel(uint x, uint y, UniformSampler *sampler) const {
-	RTC_ALIGN(16) RTCRayHit rayHit;
-	rayHit.ray = m_scene->Camera->CalculateRayFromPixel(x, y, sampler);
-	rayHit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
-	rayHit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
-	rayHit.hit.primID = RTC_INVALID_GEOMETRY_ID;
-
-	float3 color(0.0f);
-	float3 throughput(1.0f);
-	SurfaceInteraction interaction;
-	interaction.IORi = 1.0f; // Air
-	Medium *medium = nullptr;
-	bool hitSurface = false;
+	// Noisy tiles get more samples than quiet ones
+	// Tiles without an error estimate yet get the same as the average tile
+	float tileError, meanTileError;
+	{
+		tbb::spin_mutex::scoped_lock lock(m_tileStatsLock);
+		tileError = m_tileError[index];
+		meanTileError = m_meanTileError;
+	}
 
-	// Bounce the ray around the scene
-	uint bounces = 0;
-	const uint maxBounces = 1500;
-	for (; bounces < maxBounces; ++bounces) {
-		m_scene->Intersect(rayHit);
+	uint numSamples = m_samplesPerPass;
+	if (tileError > 0.0f && meanTileError > 0.0f) {
+		float ratio = tileError / meanTileError;
+		numSamples = (uint)(m_samplesPerPass * std::min(ratio, (float)kMaxAdaptiveSampleRatio) + 0.5f);
+		numSamples = std::max(1u, numSamples);
+	}
+
+	for (uint i = 0; i < numSamples; ++i) {
+		RenderTilePixels(&tile, sampler);
+	}
+	FlushTile(index, tile);
+	++m_tilePass[index];
 
-		// The ray missed. Return the background color
-		if (rayHit.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
-			color += throughput * m_scene->BackgroundColor;
-			break;
+	bool active = UpdateConvergence(x0, x1, y0, y1, &tileError);
+
+	{
+		tbb::spin_mutex::scoped_lock lock(m_tileStatsLock);
+		m_tileError[index] = tileError;
+		if (!active) {
+			m_tileActive[index] = 0;
+			--m_numActiveTiles;
 		}
 
-		float3a origin = float3a(rayHit.ray.org_x, rayHit.ray.org_y, rayHit.ray.org_z);
-		float3a direction = normalize(float3a(rayHit.ray.dir_x, rayHit.ray.dir_y, rayHit.ray.dir_z));
-
-		// We hit an object
-		hitSurface = true;
-		
-		// Calculate any transmission
-		if (medium != nullptr) {
-			float weight = 1.0f;
-			float pdf = 1.0f;
-			float distance = medium->SampleDistance(sampler, rayHit.ray.tfar, &weight, &pdf);
-			float3 transmission = medium->Transmission(distance);
-			throughput = throughput * weight * transmission;
-
-			if (distance < rayHit.ray.tfar) {
-				// Create a scatter event
-				hitSurface = false;
-
-				float3a newOrigin = origin + direction * distance;
-				rayHit.ray.org_x = newOrigin.x;
-				rayHit.ray.org_y = newOrigin.y;
-				rayHit.ray.org_z = newOrigin.z;
-
-				// Reset the other ray properties
-				float directionPdf;
-				float3a newDirection = medium->SampleScatterDirection(sampler, direction, &directionPdf);
-				rayHit.ray.dir_x = newDirection.x;
-				rayHit.ray.dir_y = newDirection.y;
-				rayHit.ray.dir_z = newDirection.z;
-
-				rayHit.ray.tnear = 0.001f;
-				rayHit.ray.tfar = embree::inf;
-				rayHit.ray.mask = 0xFFFFFFFF;
-				rayHit.ray.time = 0.0f;
-
-				rayHit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
-				rayHit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
-				rayHit.hit.primID = RTC_INVALID_GEOMETRY_ID;
+		// Once a pass worth of tiles have finished, gather the tile errors for the next pass
+		++m_tilesFinishedThisPass;
+		if (m_tilesFinishedThisPass >= m_numActiveTiles) {
+			m_tilesFinishedThisPass = 0;
+			++m_frameNumber;
+
+			float errorSum = 0.0f;
+			uint numEstimatedTiles = 0;
+			for (std::size_t i = 0; i < m_tileActive.size(); ++i) {
+				if (m_tileActive[i] != 0 && m_tileError[i] > 0.0f) {
+					errorSum += m_tileError[i];
+					++numEstimatedTiles;
+				}
 			}
+			m_meanTileError = numEstimatedTiles > 0 ? errorSum / numEstimatedTiles : 0.0f;
 		}
+	}
 
-		if (hitSurface) {
-			// Fetch the material
-			Material *material = m_scene->GetMaterial(rayHit.hit.geomID);
-			// The object might be emissive. If so, it will have a corresponding light
-			// Otherwise, GetLight will return nullptr
-			Light *light = m_scene->GetLight(rayHit.hit.geomID);
+	return active;
+}
 
-			// If this is the first bounce or if we just had a specular bounce,
-			// we need to add the emmisive light
-			if ((bounces == 0 || (interaction.SampledLobe & BSDFLobe::Specular) != 0) && light != nullptr) {
-				color += throughput * light->Le();
-			}
+void Integrator::FlushTile(uint index, const Tile &tile) const {
+	m_transferBuffer->Publish(index, tile.Color, tile.Bounces, tile.SampleCount);
 
-			interaction.Position = origin + direction * rayHit.ray.tfar;
-			if (m_scene->HasNormals(rayHit.hit.geomID)) {
-				interaction.Normal = normalize(m_scene->InterpolateNormal(rayHit.hit.geomID, rayHit.hit.primID, rayHit.hit.u, rayHit.hit.v));
-			} else {
-				interaction.Normal = normalize(float3a());
+	// Tiles never overlap, and only one thread renders a tile at a time, so no locking is needed here
+	for (uint y = tile.Y0; y < tile.Y1; ++y) {
+		for (uint x = tile.X0; x < tile.X1; ++x) {
+			uint i = tile.Index(x, y);
+			if (tile.SampleCount[i] == 0) {
+				continue;
 			}
-			if (m_scene->HasTexCoords(rayHit.hit.geomID)) {
-				interaction.TexCoord = m_scene->InterpolateTexCoord(rayHit.hit.geomID, rayHit.hit.primID, rayHit.hit.u, rayHit.hit.v);
-			} else {
-				interaction.TexCoord = float2(0.0f, 0.0f);
+
+			std::size_t pixelIndex = y * m_width + x;
+			m_convergenceBuffer->ColorData[pixelIndex] += tile.Color[i];
+			m_convergenceBuffer->HalfColorData[pixelIndex] += tile.HalfColor[i];
+			m_convergenceBuffer->Bounces[pixelIndex] += tile.Bounces[i];
+			m_convergenceBuffer->ColorSampleCount[pixelIndex] += tile.SampleCount[i];
+		}
+	}
+}
+
+bool Integrator::UpdateConvergence(uint x0, uint x1, uint y0, uint y1, float *tileError) {
+	float errorSum = 0.0f;
+	uint numEstimated = 0;
+	bool active = false;
+
+	for (uint y = y0; y < y1; ++y) {
+		for (uint x = x0; x < x1; ++x) {
+			const std::size_t index = y * m_convergenceBuffer->Width + x;
+			if (m_pixelConverged[index] != 0) {
+				continue;
 			}
-			interaction.OutputDirection = -direction;
-			interaction.IORo = 0.0f;
 
+			uint sampleCount = m_convergenceBuffer->ColorSampleCount[index];
+			if (m_maxSamples != 0 && sampleCount >= m_maxSamples) {
+				m_pixelConverged[index] = 1;
+				continue;
+			}
+			active = true;
 
-			// Calculate the direct lighting
-			color += throughput * SampleOneLight(sampler, interaction, material->bsdf, light);
+			if (m_noiseThreshold <= 0.0f || sampleCount < kMinAdaptiveSamples) {
+				continue;
+			}
 
+			// Compare the mean of the even samples with the mean of the odd ones
+			// The difference, relative to the square root of the brightness, estimates the pixel's error
+			// Dammertz et al. 2010 "A Hierarchical Automatic Stopping Condition for Monte Carlo Global Illumination"
+			float3 color = m_convergenceBuffer->ColorData[index];
+			float3 half = m_convergenceBuffer->HalfColorData[index];
+			float3 even = half / float((sampleCount + 1) / 2);
+			float3 odd = (color - half) / float(sampleCount / 2);
+			float3 mean = color / float(sampleCount);
+
+			float3 difference = abs(even - odd);
+			float error = 0.5f * (difference.x + difference.y + difference.z) / std::sqrt(std::max(mean.x + mean.y + mean.z, 1.0e-4f));
+			if (error < m_noiseThreshold) {
+				m_pixelConverged[index] = 1;
+				continue;
+			}
 
-			// Get the new ray direction
-			// Choose the direction based on the bsdf		
-			material->bsdf->Sample(interaction, sampler);
-			float pdf = material->bsdf->Pdf(interaction);
+			errorSum += error;
+			++numEstimated;
+		}
+	}
 
-			// Accumulate the weight
-			throughput = throughput * material->bsdf->Eval(interaction) / pdf;
+	*tileError = numEstimated > 0 ? errorSum / numEstimated : 0.0f;
+	return active;
+}
 
-			// Update the current IOR and medium if we refracted
-			if (interaction.SampledLobe == BSDFLobe::SpecularTransmission) {
-				interaction.IORi = interaction.IORo;
-				medium = material->medium;
+void Integrator::RenderTilePixels(Tile *tile, Sampler *sampler) const {
+	for (uint y = tile->Y0; y < tile->Y1; ++y) {
+		for (uint x = tile->X0; x < tile->X1; ++x) {
+			if (!PixelNeedsSample(*tile, x, y)) {
+				continue;
 			}
+			RenderPixel(tile, x, y, sampler);
+		}
+	}
+}
+
+void Integrator::RenderPixel(Tile *tile, uint x, uint y, Sampler *sampler) const {
+	RTC_ALIGN(16) RTCRayHit rayHit;
+	PathState path;
+	StartPath(x, y, tile->SampleIndex(x, y), sampler, &path, &rayHit);
+
+	// Bounce the ray around the scene
+	bool alive;
+	do {
+		m_scene->Intersect(rayHit);
+		alive = ExtendPath(&path, &rayHit, sampler);
+		ResolveShadowRay(&path);
+	} while (alive);
+
+	SplatPath(tile, path);
+}
+
+void Integrator::StartPath(uint x, uint y, uint sampleIndex, Sampler *sampler, PathState *path, RTCRayHit *rayHit) const {
+	*path = PathState();
+	path->PixelX = x;
+	path->PixelY = y;
+	path->SampleIndex = sampleIndex;
+
+	sampler->StartPixelSample(x, y, path->SampleIndex);
+	rayHit->ray = m_scene->Camera->CalculateRayFromPixel(x, y, sampler->Get2D(SampleDimension::CameraFilter), &path->ConeSpreadAngle);
+	rayHit->hit.geomID = RTC_INVALID_GEOMETRY_ID;
+	rayHit->hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+	rayHit->hit.primID = RTC_INVALID_GEOMETRY_ID;
+}
+
+bool Integrator::ExtendPath(PathState *path, RTCRayHit *rayHit, Sampler *sampler) const {
+	if (!BeginVertex(path, rayHit, sampler)) {
+		return false;
+	}
+
+	if (rayHit->hit.geomID != RTC_INVALID_GEOMETRY_ID) {
+		SurfaceInteraction &interaction = path->Interaction;
+		Material *material = m_scene->GetMaterial(rayHit->hit.geomID);
+		interaction.Albedo = material->bsdf->GetAlbedoTexture()->Sample(interaction.TexCoord, interaction.TexCoordFootprint);
+	}
+
+	return FinishVertex(path, rayHit, sampler);
+}
+
+bool Integrator::BeginVertex(PathState *path, RTCRayHit *rayHit, Sampler *sampler) const {
+	SurfaceInteraction &interaction = path->Interaction;
+	float3 &throughput = path->Throughput;
+
+	// Paths can be interleaved, ie. by WavefrontIntegrator, so point the sampler back at this path's sample
+	sampler->StartPixelSample(path->PixelX, path->PixelY, path->SampleIndex);
+
+	path->ShadowContribution = float3(0.0f);
+
+	// The ray missed. Return the environment, or the background color if there isn't one
+	if (rayHit->hit.geomID == RTC_INVALID_GEOMETRY_ID) {
+		Light *environment = m_scene->GetEnvironmentLight();
+		if (environment == nullptr) {
+			path->Color += throughput * m_scene->BackgroundColor;
+			return false;
+		}
+
+		float3a direction(rayHit->ray.dir_x, rayHit->ray.dir_y, rayHit->ray.dir_z);
+		if (path->Bounces == 0 || (path->Interaction.SampledLobe & BSDFLobe::Specular) != 0) {
+			path->Color += throughput * environment->Le(direction);
+		} else if (path->LastScatteringPdf != 0.0f) {
+			// Like hitting an area light, this is the bsdf-sampled half of the last vertex's direct lighting
+			float3a origin(rayHit->ray.org_x, rayHit->ray.org_y, rayHit->ray.org_z);
+			float lightPdf = m_scene->LightSelectionPdf(origin, path->Interaction.Normal, environment) * environment->PdfLi(m_scene, *rayHit);
+			float weight = PowerHeuristic(1, path->LastScatteringPdf, 1, lightPdf);
+			path->Color += throughput * environment->Le(direction) * weight;
+		}
+		return false;
+	}
 
-			// Shoot a new ray
+	float3a origin = float3a(rayHit->ray.org_x, rayHit->ray.org_y, rayHit->ray.org_z);
+	float3a direction = normalize(float3a(rayHit->ray.dir_x, rayHit->ray.dir_y, rayHit->ray.dir_z));
 
-			// Set the origin at the intersection point
-			rayHit.ray.org_x = interaction.Position.x;
-			rayHit.ray.org_y = interaction.Position.y;
-			rayHit.ray.org_z = interaction.Position.z;
+	// We hit an object
+	bool hitSurface = true;
+	
+	// Calculate any transmission
+	if (path->CurrentMedium != nullptr) {
+		float weight = 1.0f;
+		float pdf = 1.0f;
+		float distance = path->CurrentMedium->SampleDistance(sampler->Get1D(BounceDimension(path->Bounces, SampleDimension::MediumDistance)), rayHit->ray.tfar, &weight, &pdf);
+		float3 transmission = path->CurrentMedium->Transmission(distance);
+		throughput = throughput * weight * transmission;
+
+		if (distance < rayHit->ray.tfar) {
+			// Create a scatter event
+			hitSurface = false;
+
+			// We don't sample lights from inside a medium
+			path->LastScatteringPdf = 0.0f;
+			path->LastLight = nullptr;
+
+			float3a newOrigin = origin + direction * distance;
+			path->ConeWidth += path->ConeSpreadAngle * distance;
+			rayHit->ray.org_x = newOrigin.x;
+			rayHit->ray.org_y = newOrigin.y;
+			rayHit->ray.org_z = newOrigin.z;
 
 			// Reset the other ray properties
 			float directionPdf;
-			rayHit.ray.dir_x = interaction.InputDirection.x;
-			rayHit.ray.dir_y = interaction.InputDirection.y;
-			rayHit.ray.dir_z = interaction.InputDirection.z;
-
-			rayHit.ray.tnear = 0.001f;
-			rayHit.ray.tfar = embree::inf;
-			rayHit.ray.mask = 0xFFFFFFFF;
-			rayHit.ray.time = 0.0f;
-
-			rayHit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
-			rayHit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
-			rayHit.hit.primID = RTC_INVALID_GEOMETRY_ID;
+			float3a newDirection = path->CurrentMedium->SampleScatterDirection(sampler->Get2D(BounceDimension(path->Bounces, SampleDimension::MediumDirection)), direction, &directionPdf);
+			rayHit->ray.dir_x = newDirection.x;
+			rayHit->ray.dir_y = newDirection.y;
+			rayHit->ray.dir_z = newDirection.z;
+
+			rayHit->ray.tnear = 0.001f;
+			rayHit->ray.tfar = embree::inf;
+			rayHit->ray.mask = 0xFFFFFFFF;
+			rayHit->ray.time = 0.0f;
+
+			rayHit->hit.geomID = RTC_INVALID_GEOMETRY_ID;
+			rayHit->hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+			rayHit->hit.primID = RTC_INVALID_GEOMETRY_ID;
 		}
+	}
 
-		// Russian Roulette
-		if (bounces > 3) {
-			float p = std::max(throughput.x, std::max(throughput.y, throughput.z));
-			if (sampler->NextFloat() > p) {
-				break;
+	if (hitSurface) {
+		// The object might be emissive. If so, it will have a corresponding light
+		// Otherwise, GetLight will return nullptr
+		Light *light = m_scene->GetLight(rayHit->hit.geomID);
+
+		if (light != nullptr) {
+			// If this is the first bounce or if we just had a specular bounce,
+			// we need to add the emmisive light
+			if (path->Bounces == 0 || (interaction.SampledLobe & BSDFLobe::Specular) != 0) {
+				path->Color += throughput * light->Le(direction);
+			} else if (path->LastScatteringPdf != 0.0f && light != path->LastLight) {
+				// Otherwise, this is the bsdf-sampled half of the last vertex's direct lighting
+				// Lights can't light themselves, so they're skipped in SampleOneLight, and here
+				// The last vertex is still in interaction, since we haven't updated it yet
+				float lightPdf = m_scene->LightSelectionPdf(origin, interaction.Normal, light) * light->PdfLi(m_scene, *rayHit);
+				float weight = PowerHeuristic(1, path->LastScatteringPdf, 1, lightPdf);
+				path->Color += throughput * light->Le(direction) * weight;
 			}
+		}
+
+		interaction.Position = origin + direction * rayHit->ray.tfar;
+		float texCoordScale;
+		m_scene->GetSurfaceAttributes(*rayHit, interaction.Position, &interaction.Normal, &interaction.TexCoord, &texCoordScale);
+
+		// Grow the ray cone to the hit. Its footprint stretches as the surface turns away from the ray
+		// The spread is kept as is for the next ray. Curved surfaces would change it, but we ignore curvature
+		path->ConeWidth += path->ConeSpreadAngle * rayHit->ray.tfar;
+		float cosTheta = std::max(std::abs(dot(direction, interaction.Normal)), 0.01f);
+		interaction.TexCoordFootprint = path->ConeWidth * texCoordScale / cosTheta;
+		interaction.OutputDirection = -direction;
+		interaction.IORo = 0.0f;
+	}
+
+	return true;
+}
+
+bool Integrator::FinishVertex(PathState *path, RTCRayHit *rayHit, Sampler *sampler) const {
+	SurfaceInteraction &interaction = path->Interaction;
+	float3 &throughput = path->Throughput;
+
+	// The paths may have been interleaved again since BeginVertex()
+	sampler->StartPixelSample(path->PixelX, path->PixelY, path->SampleIndex);
+
+	// BeginVertex() clears the hit if the path scattered in a medium instead
+	if (rayHit->hit.geomID != RTC_INVALID_GEOMETRY_ID) {
+		Material *material = m_scene->GetMaterial(rayHit->hit.geomID);
+		Light *light = m_scene->GetLight(rayHit->hit.geomID);
+
+		// Calculate the direct lighting
+		// The contribution is deferred until its shadow ray is traced
+		float3 unoccludedLighting;
+		float uLight = sampler->Get1D(BounceDimension(path->Bounces, SampleDimension::LightSelection));
+		float uLightElement = sampler->Get1D(BounceDimension(path->Bounces, SampleDimension::LightElement));
+		float2 uLightPosition = sampler->Get2D(BounceDimension(path->Bounces, SampleDimension::LightPosition));
+		SampleOneLight(uLight, uLightElement, uLightPosition, interaction, material->bsdf, light, &unoccludedLighting, &path->ShadowRay);
+		path->ShadowContribution = throughput * unoccludedLighting;
+
+
+		// Get the new ray direction
+		// Choose the direction based on the bsdf		
+		float uLobe = sampler->Get1D(BounceDimension(path->Bounces, SampleDimension::BSDFLobe));
+		float2 uDirection = sampler->Get2D(BounceDimension(path->Bounces, SampleDimension::BSDFDirection));
+		material->bsdf->Sample(interaction, uLobe, uDirection);
+		float pdf = material->bsdf->Pdf(interaction);
+		// A sample right on the horizon can't carry any light, and would divide by zero
+		if (pdf <= 0.0f) {
+			return false;
+		}
+
+		// Remember enough about the sample to weight any light the new ray hits
+		path->LastScatteringPdf = m_scene->NumLights() != 0 ? pdf : 0.0f;
+		path->LastLight = light;
 
-			throughput *= 1 / p;
+		// Accumulate the weight
+		throughput = throughput * material->bsdf->Eval(interaction) / pdf;
+
+		// Update the current IOR and medium if we refracted
+		if (interaction.SampledLobe == BSDFLobe::SpecularTransmission) {
+			interaction.IORi = interaction.IORo;
+			path->CurrentMedium = material->medium;
 		}
+
+		// Shoot a new ray
+
+		// Set the origin at the intersection point
+		rayHit->ray.org_x = interaction.Position.x;
+		rayHit->ray.org_y = interaction.Position.y;
+		rayHit->ray.org_z = interaction.Position.z;
+
+		// Reset the other ray properties
+		rayHit->ray.dir_x = interaction.InputDirection.x;
+		rayHit->ray.dir_y = interaction.InputDirection.y;
+		rayHit->ray.dir_z = interaction.InputDirection.z;
+
+		rayHit->ray.tnear = 0.001f;
+		rayHit->ray.tfar = embree::inf;
+		rayHit->ray.mask = 0xFFFFFFFF;
+		rayHit->ray.time = 0.0f;
+
+		rayHit->hit.geomID = RTC_INVALID_GEOMETRY_ID;
+		rayHit->hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+		rayHit->hit.primID = RTC_INVALID_GEOMETRY_ID;
 	}
 
-	size_t index = y * m_currentFrameBuffer->Width + x;
+	// Russian Roulette
+	if (path->Bounces > 3) {
+		float p = std::max(throughput.x, std::max(throughput.y, throughput.z));
+		if (sampler->Get1D(BounceDimension(path->Bounces, SampleDimension::RussianRoulette)) > p) {
+			return false;
+		}
 
-	m_currentFrameBuffer->ColorData[index] += color;
-	m_currentFrameBuffer->Bounces[index] += bounces;
-	m_currentFrameBuffer->ColorSampleCount[index] += 1u;
+		throughput *= 1 / p;
+	}
+
+	++path->Bounces;
+	return path->Bounces < kMaxBounces;
 }
 
-float3 Integrator::SampleOneLight(UniformSampler *sampler, SurfaceInteraction interaction, BSDF *bsdf, Light *hitLight) const {
-	std::size_t numLights = m_scene->NumLights();
-	
-	// Return black if there are no lights
-	// And don't let a light contribute light to itself
-	// Aka, if we hit a light
-	// This is the special case where there is only 1 light
-	if (numLights == 0 || numLights == 1 && hitLight != nullptr) {
-		return float3(0.0f);
+void Integrator::ResolveShadowRay(PathState *path) const {
+	if (all(path->ShadowContribution)) {
+		return;
 	}
 
-	// Don't let a light contribute light to itself
-	// Choose another one
-	Light *light;
-	do {
-		light = m_scene->RandomOneLight(sampler);
-	} while (light == hitLight);
+	if (!m_scene->Occluded(path->ShadowRay)) {
+		path->Color += path->ShadowContribution;
+	}
+	path->ShadowContribution = float3(0.0f);
+}
 
-	return (float)numLights * EstimateDirect(light, sampler, interaction, bsdf);
+void Integrator::SplatPath(Tile *tile, const PathState &path) const {
+	uint i = tile->Index(path.PixelX, path.PixelY);
+
+	// Every other sample also goes into the half buffers, so we can estimate the error
+	if ((path.SampleIndex & 1u) == 0) {
+		tile->HalfColor[i] += path.Color;
+	}
+
+	tile->Color[i] += path.Color;
+	tile->Bounces[i] += path.Bounces;
+	tile->SampleCount[i] += 1u;
 }
 
-float3 Integrator::EstimateDirect(Light *light, UniformSampler *sampler, SurfaceInteraction &interaction, BSDF *bsdf) const {
-	float3 directLighting = float3(0.0f);
-	float3 f;
-	float lightPdf, scatteringPdf;
+void Integrator::SampleOneLight(float uLight, float uLightElement, float2 uLightPosition, SurfaceInteraction interaction, BSDF *bsdf, Light *hitLight, float3 *unoccludedLighting, RTCRay *shadowRay) const {
+	*unoccludedLighting = float3(0.0f);
+
+	// Don't let a light contribute light to itself
+	// Aka, if we hit a light, it can't be picked
+	float selectionPdf;
+	Light *light = m_scene->RandomOneLight(uLight, interaction.Position, interaction.Normal, hitLight, &selectionPdf);
+
+	// Return black if there are no lights to choose from
+	if (light == nullptr) {
+		return;
+	}
 
+	*unoccludedLighting = EstimateDirect(light, selectionPdf, uLightElement, uLightPosition, interaction, bsdf, shadowRay);
+}
 
+float3 Integrator::EstimateDirect(Light *light, float selectionPdf, float uLightElement, float2 uLightPosition, SurfaceInteraction &interaction, BSDF *bsdf, RTCRay *shadowRay) const {
 	// Sample lighting with multiple importance sampling
 	// Only sample if the BRDF is non-specular 
-	if ((bsdf->SupportedLobes & ~BSDFLobe::Specular) != 0) {
-		float3 Li = light->SampleLi(sampler, m_scene, interaction, &lightPdf);
-
-		// Make sure the pdf isn't zero and the radiance isn't black
-		if (lightPdf != 0.0f && !all(Li)) {
-			// Calculate the brdf value
-			f = bsdf->Eval(interaction);
-			scatteringPdf = bsdf->Pdf(interaction);
-
-			if (scatteringPdf != 0.0f && !all(f)) {
-				float weight = PowerHeuristic(1, lightPdf, 1, scatteringPdf);
-				directLighting += f * Li * weight / lightPdf;
-			}
-		}
+	if ((bsdf->SupportedLobes & ~BSDFLobe::Specular) == 0) {
+		return float3(0.0f);
 	}
 
+	float lightPdf;
+	float3 Li = light->SampleLi(uLightElement, uLightPosition, m_scene, interaction, &lightPdf, shadowRay);
+	// The pdf of the light sampling strategy includes picking the light
+	// ExtendPath() uses the same pdf to weight the bsdf sampling strategy
+	lightPdf *= selectionPdf;
 
-	// Sample brdf with multiple importance sampling
-	bsdf->Sample(interaction, sampler);
-	f = bsdf->Eval(interaction);
-	scatteringPdf = bsdf->Pdf(interaction);
-	if (scatteringPdf != 0.0f && !all(f)) {
-		lightPdf = light->PdfLi(m_scene, interaction);
-		if (lightPdf == 0.0f) {
-			// We didn't hit anything, so ignore the brdf sample
-			return directLighting;
-		}
+	// Make sure the pdf isn't zero and the radiance isn't black
+	if (lightPdf == 0.0f || all(Li)) {
+		return float3(0.0f);
+	}
 
-		float weight = PowerHeuristic(1, scatteringPdf, 1, lightPdf);
-		float3 Li = light->Le();
-		directLighting += f * Li * weight / scatteringPdf;
+	// Calculate the brdf value
+	float3 f = bsdf->Eval(interaction);
+	float scatteringPdf = bsdf->Pdf(interaction);
+	// The bsdf can't scatter light from the sampled direction, ie. it's below the surface
+	if (scatteringPdf <= 0.0f || all(f)) {
+		return float3(0.0f);
 	}
 
-	return directLighting;
+	float weight = PowerHeuristic(1, lightPdf, 1, scatteringPdf);
+	return f * Li * weight / lightPdf;
 }
 
 
@@ -8,46 +8,212 @@
 
 #include "math/int_types.h"
 #include "math/vector_types.h"
+#include "math/sampler.h"
+
+#define EMBREE_STATIC_LIB
+#include "embree3/rtcore.h"
+
+#include "tbb/spin_mutex.h"
 
 #include <atomic>
+#include <vector>
 
 
 namespace Lantern {
 
-class UniformSampler;
 struct SurfaceInteraction;
+struct PathState;
 class BSDF;
 class Scene;
 class Light;
 class FrameBuffer;
+class TileTransferBuffer;
 
 class Integrator {
 public:
-	Integrator(Scene *scene, FrameBuffer *currentFrameBuffer, std::atomic<FrameBuffer *> *swapFrameBuffer)
-		: m_scene(scene),
-	      m_currentFrameBuffer(currentFrameBuffer),
-	      m_swapFrameBuffer(swapFrameBuffer),
-		  m_frameNumber(0u) {
-	};
+	Integrator(Scene *scene, TileTransferBuffer *transferBuffer);
+	virtual ~Integrator();
 
-private:
+public:
+	// The transfer buffer must be created with the same tile size
 	static const uint kTileSize = 8;
 
+protected:
+	static const uint kMaxBounces = 1500;
+	// Pixels need this many samples before we trust their error estimate
+	static const uint kMinAdaptiveSamples = 16;
+	// How many times more samples than the average tile a noisy tile can get in one pass
+	static const uint kMaxAdaptiveSampleRatio = 8;
+
 	Scene *m_scene;
 
-	FrameBuffer *m_currentFrameBuffer;
-	std::atomic<FrameBuffer *> *m_swapFrameBuffer;
+	// Every tile is published here as soon as it finishes a pass
+	TileTransferBuffer *m_transferBuffer;
 
+	// The number of logical passes that have completed
 	uint m_frameNumber;
 
+	// Every sample rendered so far. Unlike the transfer frame buffers, this never gets reset,
+	// so we can use it to decide where to spend the next samples
+	FrameBuffer *m_convergenceBuffer;
+	uint m_width;
+	std::vector<byte> m_pixelConverged;
+	// The mean error of the unconverged pixels in each tile, or zero if they don't have an estimate yet
+	std::vector<float> m_tileError;
+	std::vector<byte> m_tileActive;
+	// How many passes each tile has rendered
+	std::vector<uint> m_tilePass;
+	float m_meanTileError;
+	uint m_numActiveTiles;
+	// How many tiles have finished since the last logical pass ended
+	uint m_tilesFinishedThisPass;
+	// Guards the per-tile statistics above, which are shared between the render threads
+	tbb::spin_mutex m_tileStatsLock;
+
+	float m_noiseThreshold;
+	uint m_maxSamples;
+
+	SamplerType m_samplerType;
+	uint m_samplesPerPass;
+
+	/**
+	 * A tile, and the samples rendered for it during the current pass
+	 *
+	 * Samples are accumulated here while the tile is hot in cache,
+	 * and only flushed to the frame buffers once, at the end of the pass
+	 */
+	struct Tile {
+		uint X0, X1, Y0, Y1;
+
+		// All indexed by (y - Y0) * kTileSize + (x - X0)
+		float3 Color[kTileSize * kTileSize];
+		float3 HalfColor[kTileSize * kTileSize];
+		uint Bounces[kTileSize * kTileSize];
+		uint SampleCount[kTileSize * kTileSize];
+		// How many samples each pixel had before this pass
+		uint BaseSampleCount[kTileSize * kTileSize];
+
+		uint Index(uint x, uint y) const {
+			return (y - Y0) * kTileSize + (x - X0);
+		}
+		uint SampleIndex(uint x, uint y) const {
+			uint index = Index(x, y);
+			return BaseSampleCount[index] + SampleCount[index];
+		}
+	};
+
 public:
-	void RenderFrame();
+	void SetSamplerType(SamplerType samplerType);
+	/**
+	 * Sets how many samples each pixel gets each time its tile is rendered
+	 *
+	 * More samples per pass amortize the cost of publishing and accumulating the frame buffers
+	 * over more work, at the cost of less frequent updates
+	 */
+	void SetSamplesPerPass(uint samplesPerPass);
+	/**
+	 * Sets when pixels should stop receiving samples
+	 *
+	 * With a noise threshold, each pass spends samples on the tiles in proportion to their estimated error
+	 *
+	 * @param noiseThreshold    Pixels stop once their estimated relative error falls below this. Zero disables adaptive sampling
+	 * @param maxSamples        Pixels stop once they have this many samples. Zero means no limit
+	 */
+	void SetConvergenceCriteria(float noiseThreshold, uint maxSamples);
+	/**
+	 * Renders until quit is set, or every pixel has converged
+	 *
+	 * There is no barrier between passes. Each thread takes the next tile from a shared queue,
+	 * renders it, and puts it back at the end of the queue, so no thread waits for the slowest tile of a pass.
+	 * Tiles are published to the transfer buffer as soon as they finish. Passes still exist logically:
+	 * every time a pass worth of tiles have been rendered, the tile errors are gathered for the next pass
+	 *
+	 * Each pixel gets SamplesPerPass samples per pass, scaled by its tile's relative error if adaptive sampling is enabled
+	 *
+	 * @param quit    Set this to stop rendering. Run() returns once the tiles in flight have finished
+	 */
+	void Run(std::atomic_bool *quit);
+
+protected:
+	/**
+	 * Renders one pass of a tile
+	 *
+	 * @return    Whether the tile has unconverged pixels left
+	 */
+	bool RenderTile(uint index, uint width, uint height, uint numTilesX, uint numTilesY);
+	/**
+	 * Updates the convergence of every pixel in the range [x0, x1) x [y0, y1)
+	 *
+	 * @param tileError    The mean error of the unconverged pixels with an error estimate
+	 * @return             Whether any of the pixels are still unconverged
+	 */
+	bool UpdateConvergence(uint x0, uint x1, uint y0, uint y1, float *tileError);
+	/**
+	 * Whether a pixel should get another sample this pass
+	 */
+	bool PixelNeedsSample(const Tile &tile, uint x, uint y) const {
+		if (m_pixelConverged[y * m_width + x] != 0) {
+			return false;
+		}
+
+		return m_maxSamples == 0 || tile.SampleIndex(x, y) < m_maxSamples;
+	}
+	/**
+	 * Publishes the samples accumulated in a tile, and adds them to the convergence buffer
+	 */
+	void FlushTile(uint index, const Tile &tile) const;
+	/**
+	 * Renders one sample for every pixel of the tile that needs one
+	 */
+	virtual void RenderTilePixels(Tile *tile, Sampler *sampler) const;
+	void RenderPixel(Tile *tile, uint x, uint y, Sampler *sampler) const;
+
+	/**
+	 * Creates the camera ray for a pixel and resets the path state
+	 */
+	void StartPath(uint x, uint y, uint sampleIndex, Sampler *sampler, PathState *path, RTCRayHit *rayHit) const;
+	/**
+	 * Shades the result of the last ray cast, and sets up the next ray of the path
+	 *
+	 * @param path       The path to extend
+	 * @param rayHit     The result of tracing the path's last ray. On return, holds the next ray to trace
+	 * @param sampler    The sampler to draw the path's random numbers from
+	 * @return           Whether the path continues. If false, path->Color holds the final radiance
+	 */
+	bool ExtendPath(PathState *path, RTCRayHit *rayHit, Sampler *sampler) const;
+	/**
+	 * The first half of ExtendPath(). Handles misses, media, and emission, and fills in the interaction of a surface hit
+	 *
+	 * If the path hit a surface, rayHit still holds the hit on return, and the caller has to fill in
+	 * path->Interaction.Albedo before calling FinishVertex(). Otherwise, the hit is cleared
+	 *
+	 * @return    Whether the path continues. If false, FinishVertex() must not be called
+	 */
+	bool BeginVertex(PathState *path, RTCRayHit *rayHit, Sampler *sampler) const;
+	/**
+	 * The second half of ExtendPath(). Samples the lights and the bsdf of a surface hit, and sets up the next ray
+	 *
+	 * @return    Whether the path continues
+	 */
+	bool FinishVertex(PathState *path, RTCRayHit *rayHit, Sampler *sampler) const;
+	/**
+	 * Traces the path's pending shadow ray, if any, and adds the light it carries
+	 */
+	void ResolveShadowRay(PathState *path) const;
+	/**
+	 * Adds a finished path to its tile's accumulator
+	 */
+	void SplatPath(Tile *tile, const PathState &path) const;
 
-private:
-	void RenderTile(uint index, uint width, uint height, uint numTilesX, uint numTilesY) const;
-	void RenderPixel(uint x, uint y, UniformSampler *sampler) const;
-	float3 SampleOneLight(UniformSampler *sampler, SurfaceInteraction interaction, BSDF *bsdf, Light *hitLight) const;
-	float3 EstimateDirect(Light *light, UniformSampler *sampler, SurfaceInteraction &interaction, BSDF *bsdf) const;
+	/**
+	 * Estimates the direct lighting at a surface from one randomly chosen light
+	 *
+	 * The estimate is returned through unoccludedLighting and shadowRay, so the caller can choose how to trace
+	 * the visibility test. This only covers the light-sampling half of MIS. The bsdf-sampling half comes from
+	 * the path's continuation ray, when it hits a light
+	 */
+	void SampleOneLight(float uLight, float uLightElement, float2 uLightPosition, SurfaceInteraction interaction, BSDF *bsdf, Light *hitLight, float3 *unoccludedLighting, RTCRay *shadowRay) const;
+	float3 EstimateDirect(Light *light, float selectionPdf, float uLightElement, float2 uLightPosition, SurfaceInteraction &interaction, BSDF *bsdf, RTCRay *shadowRay) const;
 };
 
 } // End of namespace Lantern
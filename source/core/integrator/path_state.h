@@ -0,0 +1,74 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+#include "math/vector_types.h"
+
+#include "integrator/surface_interaction.h"
+
+#define EMBREE_STATIC_LIB
+#include "embree3/rtcore.h"
+
+
+namespace Lantern {
+
+class Medium;
+class Light;
+
+/**
+ * Everything we need to know about a path in between two ray casts
+ *
+ * This lets an integrator suspend a path while its next ray is traced,
+ * for example, when rays are traced in batches
+ */
+struct PathState {
+	PathState()
+		: PixelX(0u),
+		  PixelY(0u),
+		  SampleIndex(0u),
+		  Color(0.0f),
+		  Throughput(1.0f),
+		  CurrentMedium(nullptr),
+		  Bounces(0u),
+		  ConeWidth(0.0f),
+		  ConeSpreadAngle(0.0f),
+		  LastScatteringPdf(0.0f),
+		  LastLight(nullptr),
+		  ShadowContribution(0.0f) {
+		Interaction.IORi = 1.0f; // Air
+	}
+
+	uint PixelX;
+	uint PixelY;
+	// Which sample of the pixel this path is
+	uint SampleIndex;
+
+	float3 Color;
+	float3 Throughput;
+	SurfaceInteraction Interaction;
+	Medium *CurrentMedium;
+	uint Bounces;
+
+	// The ray cone around the path's current ray. The width is the cone's width at the ray's origin,
+	// and the spread is how fast it widens, in radians. Used to pick texture mip levels
+	float ConeWidth;
+	float ConeSpreadAngle;
+
+	// The bsdf pdf of the direction the path left the last vertex in, and the light the last vertex was on
+	// If the path hits a light, these give the MIS weight of its emission. LastScatteringPdf is zero
+	// if the last vertex didn't sample any lights, for example, if it was inside a medium
+	float LastScatteringPdf;
+	Light *LastLight;
+
+	// Direct lighting from the last vertex that still needs a visibility test
+	// If ShadowRay is unoccluded, ShadowContribution should be added to Color
+	RTCRay ShadowRay;
+	float3 ShadowContribution;
+};
+
+} // End of namespace Lantern
@@ -15,7 +15,9 @@ namespace Lantern {
 
 struct SurfaceInteraction {
 	SurfaceInteraction()
-		: SampledLobe(BSDFLobe::Null), 
+		: TexCoordFootprint(0.0f),
+		  Albedo(0.0f),
+		  SampledLobe(BSDFLobe::Null), 
 		  IORi(0.0f), 
 		  IORo(0.0f) {
 	}
@@ -23,6 +25,11 @@ struct SurfaceInteraction {
 	float3a Position;
 	float3a Normal;
 	float2 TexCoord;
+	// The width of the path's ray cone where it hit the surface, in texture coordinates
+	float TexCoordFootprint;
+	// The bsdf's albedo texture at TexCoord. It's looked up once per hit, so the bsdf doesn't sample the
+	// texture again every time it's evaluated
+	float3 Albedo;
 	float3a InputDirection;
 	float3a OutputDirection;
 	BSDFLobe::Type SampledLobe;
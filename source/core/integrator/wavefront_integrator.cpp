@@ -0,0 +1,238 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "integrator/wavefront_integrator.h"
+
+#include "integrator/path_state.h"
+
+#include "scene/scene.h"
+
+#include "materials/material.h"
+#include "materials/bsdfs/bsdf.h"
+#include "materials/textures/texture.h"
+
+#include "math/sampler.h"
+#include "math/vector_math.h"
+
+#include <algorithm>
+#include <cstdint>
+
+
+namespace Lantern {
+
+struct WavefrontPath {
+	PathState State;
+	RTCRayHit RayHit;
+};
+
+inline void StoreRay(const RTCRay &ray, RTCRayHit16 *packet, uint lane) {
+	packet->ray.org_x[lane] = ray.org_x;
+	packet->ray.org_y[lane] = ray.org_y;
+	packet->ray.org_z[lane] = ray.org_z;
+	packet->ray.tnear[lane] = ray.tnear;
+	packet->ray.dir_x[lane] = ray.dir_x;
+	packet->ray.dir_y[lane] = ray.dir_y;
+	packet->ray.dir_z[lane] = ray.dir_z;
+	packet->ray.time[lane] = ray.time;
+	packet->ray.tfar[lane] = ray.tfar;
+	packet->ray.mask[lane] = ray.mask;
+	packet->ray.id[lane] = ray.id;
+	packet->ray.flags[lane] = ray.flags;
+
+	packet->hit.geomID[lane] = RTC_INVALID_GEOMETRY_ID;
+	packet->hit.instID[0][lane] = RTC_INVALID_GEOMETRY_ID;
+	packet->hit.primID[lane] = RTC_INVALID_GEOMETRY_ID;
+}
+
+inline void StoreShadowRay(const RTCRay &ray, RTCRay16 *packet, uint lane) {
+	packet->org_x[lane] = ray.org_x;
+	packet->org_y[lane] = ray.org_y;
+	packet->org_z[lane] = ray.org_z;
+	packet->tnear[lane] = ray.tnear;
+	packet->dir_x[lane] = ray.dir_x;
+	packet->dir_y[lane] = ray.dir_y;
+	packet->dir_z[lane] = ray.dir_z;
+	packet->time[lane] = ray.time;
+	packet->tfar[lane] = ray.tfar;
+	packet->mask[lane] = ray.mask;
+	packet->id[lane] = ray.id;
+	packet->flags[lane] = ray.flags;
+}
+
+inline void LoadHit(const RTCRayHit16 &packet, uint lane, RTCRayHit *rayHit) {
+	rayHit->ray.tfar = packet.ray.tfar[lane];
+
+	rayHit->hit.Ng_x = packet.hit.Ng_x[lane];
+	rayHit->hit.Ng_y = packet.hit.Ng_y[lane];
+	rayHit->hit.Ng_z = packet.hit.Ng_z[lane];
+	rayHit->hit.u = packet.hit.u[lane];
+	rayHit->hit.v = packet.hit.v[lane];
+	rayHit->hit.primID = packet.hit.primID[lane];
+	rayHit->hit.geomID = packet.hit.geomID[lane];
+	rayHit->hit.instID[0] = packet.hit.instID[0][lane];
+}
+
+void WavefrontIntegrator::RenderTilePixels(Tile *tile, Sampler *sampler) const {
+	WavefrontPath paths[kMaxPaths];
+	RTC_ALIGN(64) RTCRayHit16 packets[kMaxPackets];
+	RTC_ALIGN(64) RTCRay16 shadowPackets[kMaxPackets];
+	RTC_ALIGN(64) int valid[kMaxPackets][kPacketSize];
+
+	// The indices of the live paths, in the order they'll be traced and shaded
+	uint queue[kMaxPaths];
+	uint numActive = 0;
+
+	// The material each live path hit, used to sort the queue
+	std::pair<std::uintptr_t, uint> sortKeys[kMaxPaths];
+
+	// The paths that are still alive once their hit is set up, in material order
+	uint hits[kMaxPaths];
+
+	// The texture lookups of one material's hits
+	uint lookups[kMaxPaths];
+	float2 texCoords[kMaxPaths];
+	float footprints[kMaxPaths];
+	float3 albedos[kMaxPaths];
+
+	// The paths with a pending shadow ray, and the paths that terminated this bounce
+	uint shadowQueue[kMaxPaths];
+	uint finished[kMaxPaths];
+
+	for (uint y = tile->Y0; y < tile->Y1; ++y) {
+		for (uint x = tile->X0; x < tile->X1; ++x) {
+			if (!PixelNeedsSample(*tile, x, y)) {
+				continue;
+			}
+
+			WavefrontPath &path = paths[numActive];
+			StartPath(x, y, tile->SampleIndex(x, y), sampler, &path.State, &path.RayHit);
+
+			queue[numActive] = numActive;
+			++numActive;
+		}
+	}
+
+	while (numActive > 0) {
+		// Pack the rays of the live paths into SoA packets
+		const uint numPackets = (numActive + kPacketSize - 1) / kPacketSize;
+		for (uint i = 0; i < numActive; ++i) {
+			StoreRay(paths[queue[i]].RayHit.ray, &packets[i / kPacketSize], i % kPacketSize);
+		}
+
+		// Trace
+		for (uint p = 0; p < numPackets; ++p) {
+			for (uint lane = 0; lane < kPacketSize; ++lane) {
+				valid[p][lane] = (p * kPacketSize + lane < numActive) ? -1 : 0;
+			}
+			m_scene->Intersect(valid[p], packets[p]);
+		}
+
+		// Unpack the hits and sort the paths by the material they hit
+		// Misses sort to the front, since they have a null material
+		for (uint i = 0; i < numActive; ++i) {
+			WavefrontPath &path = paths[queue[i]];
+			LoadHit(packets[i / kPacketSize], i % kPacketSize, &path.RayHit);
+
+			uint geomId = path.RayHit.hit.geomID;
+			Material *material = geomId == RTC_INVALID_GEOMETRY_ID ? nullptr : m_scene->GetMaterial(geomId);
+			sortKeys[i] = std::make_pair((std::uintptr_t)material, queue[i]);
+		}
+		std::sort(sortKeys, sortKeys + numActive);
+
+		// Set up each hit. Misses and absorbed paths end here
+		uint numHits = 0;
+		uint numFinished = 0;
+		for (uint i = 0; i < numActive; ++i) {
+			uint index = sortKeys[i].second;
+			WavefrontPath &path = paths[index];
+			if (BeginVertex(&path.State, &path.RayHit, sampler)) {
+				hits[numHits++] = index;
+			} else {
+				finished[numFinished++] = index;
+			}
+		}
+
+		// Look up the albedo of the surface hits, in one batch per material
+		// The hits are still in material order. Paths that scattered in a medium instead have no hit, and are skipped
+		uint numLookups = 0;
+		Material *lookupMaterial = nullptr;
+		for (uint i = 0; i <= numHits; ++i) {
+			Material *material = nullptr;
+			if (i < numHits) {
+				uint geomId = paths[hits[i]].RayHit.hit.geomID;
+				if (geomId == RTC_INVALID_GEOMETRY_ID) {
+					continue;
+				}
+				material = m_scene->GetMaterial(geomId);
+			}
+
+			if (material != lookupMaterial && numLookups > 0) {
+				lookupMaterial->bsdf->GetAlbedoTexture()->SampleBatch(texCoords, footprints, numLookups, albedos);
+				for (uint j = 0; j < numLookups; ++j) {
+					paths[lookups[j]].State.Interaction.Albedo = albedos[j];
+				}
+				numLookups = 0;
+			}
+			if (material == nullptr) {
+				break;
+			}
+
+			const SurfaceInteraction &interaction = paths[hits[i]].State.Interaction;
+			lookupMaterial = material;
+			lookups[numLookups] = hits[i];
+			texCoords[numLookups] = interaction.TexCoord;
+			footprints[numLookups] = interaction.TexCoordFootprint;
+			++numLookups;
+		}
+
+		// Shade each hit, and compact the survivors into the queue for the next bounce
+		uint numSurvivors = 0;
+		uint numShadowRays = 0;
+		for (uint i = 0; i < numHits; ++i) {
+			uint index = hits[i];
+			WavefrontPath &path = paths[index];
+			if (FinishVertex(&path.State, &path.RayHit, sampler)) {
+				queue[numSurvivors++] = index;
+			} else {
+				finished[numFinished++] = index;
+			}
+
+			if (!all(path.State.ShadowContribution)) {
+				shadowQueue[numShadowRays++] = index;
+			}
+		}
+
+		// Trace the shadow rays of this bounce as occlusion-only packets
+		const uint numShadowPackets = (numShadowRays + kPacketSize - 1) / kPacketSize;
+		for (uint i = 0; i < numShadowRays; ++i) {
+			StoreShadowRay(paths[shadowQueue[i]].State.ShadowRay, &shadowPackets[i / kPacketSize], i % kPacketSize);
+		}
+		for (uint p = 0; p < numShadowPackets; ++p) {
+			for (uint lane = 0; lane < kPacketSize; ++lane) {
+				valid[p][lane] = (p * kPacketSize + lane < numShadowRays) ? -1 : 0;
+			}
+			m_scene->Occluded(valid[p], shadowPackets[p]);
+		}
+		for (uint i = 0; i < numShadowRays; ++i) {
+			PathState &state = paths[shadowQueue[i]].State;
+
+			// Embree sets tfar to -inf for occluded rays
+			if (shadowPackets[i / kPacketSize].tfar[i % kPacketSize] >= 0.0f) {
+				state.Color += state.ShadowContribution;
+			}
+			state.ShadowContribution = float3(0.0f);
+		}
+
+		// Now that their direct lighting is resolved, the finished paths can be splatted
+		for (uint i = 0; i < numFinished; ++i) {
+			WavefrontPath &path = paths[finished[i]];
+			SplatPath(tile, path.State);
+		}
+		numActive = numSurvivors;
+	}
+}
+
+} // End of namespace Lantern
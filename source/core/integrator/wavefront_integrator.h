@@ -0,0 +1,40 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "integrator/integrator.h"
+
+
+namespace Lantern {
+
+/**
+ * A path tracer that advances all the paths of a tile in lock-step
+ *
+ * Each bounce, the rays of every live path are packed into SoA packets and traced
+ * together with rtcIntersect16, so Embree can use its full SIMD width. The hits are then
+ * sorted by material before shading, so each BSDF runs over a coherent batch of paths, and
+ * each material's albedo texture is looked up for all of its hits at once.
+ * The shadow rays of each bounce are batched the same way, and traced with rtcOccluded16.
+ *
+ * The shading itself is shared with Integrator, so both produce the same image
+ */
+class WavefrontIntegrator : public Integrator {
+public:
+	WavefrontIntegrator(Scene *scene, TileTransferBuffer *transferBuffer)
+		: Integrator(scene, transferBuffer) {
+	}
+
+private:
+	static const uint kPacketSize = 16;
+	static const uint kMaxPaths = kTileSize * kTileSize;
+	static const uint kMaxPackets = (kMaxPaths + kPacketSize - 1) / kPacketSize;
+
+protected:
+	void RenderTilePixels(Tile *tile, Sampler *sampler) const override;
+};
+
+} // End of namespace Lantern
@@ -0,0 +1,179 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "io/block_compression.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace Lantern {
+
+static const uint kTexelsPerBlock = kBC1BlockSize * kBC1BlockSize;
+
+static uint16 QuantizeRGB565(const float *color) {
+	uint r = (uint)(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+	uint g = (uint)(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+	uint b = (uint)(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+
+	return (uint16)((r << 11) | (g << 5) | b);
+}
+
+/**
+ * Picks the closest palette color for each texel
+ *
+ * @return    The total squared error of the block
+ */
+static float ChooseIndices(const float *texels, uint16 color0, uint16 color1, uint *out_indices) {
+	float palette[4][4];
+	for (uint i = 0; i < 4; ++i) {
+		_mm_storeu_ps(palette[i], DecodeBC1Color(color0, color1, i));
+	}
+	// With equal endpoints, only the first entry is meaningful. The others could be black
+	uint numColors = color0 == color1 ? 1 : 4;
+
+	float totalError = 0.0f;
+	for (uint t = 0; t < kTexelsPerBlock; ++t) {
+		const float *texel = &texels[t * 3];
+		float bestError = 0.0f;
+		for (uint i = 0; i < numColors; ++i) {
+			float dr = texel[0] - palette[i][0];
+			float dg = texel[1] - palette[i][1];
+			float db = texel[2] - palette[i][2];
+			float error = dr * dr + dg * dg + db * db;
+			if (i == 0 || error < bestError) {
+				bestError = error;
+				out_indices[t] = i;
+			}
+		}
+		totalError += bestError;
+	}
+
+	return totalError;
+}
+
+/**
+ * Orders the endpoints so the block uses the four color palette
+ */
+static void OrderEndpoints(uint16 *color0, uint16 *color1) {
+	if (*color0 < *color1) {
+		std::swap(*color0, *color1);
+	}
+}
+
+static void WriteBlock(uint16 color0, uint16 color1, const uint *indices, byte *out_block) {
+	uint32 packedIndices = 0;
+	for (uint t = 0; t < kTexelsPerBlock; ++t) {
+		packedIndices |= (uint32)indices[t] << (2 * t);
+	}
+
+	out_block[0] = (byte)(color0 & 0xFF);
+	out_block[1] = (byte)(color0 >> 8);
+	out_block[2] = (byte)(color1 & 0xFF);
+	out_block[3] = (byte)(color1 >> 8);
+	memcpy(out_block + 4, &packedIndices, sizeof(packedIndices));
+}
+
+void EncodeBC1Block(const float *texels, byte *out_block) {
+	// Find the principal axis of the colors, with a few rounds of power iteration on their covariance
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (uint t = 0; t < kTexelsPerBlock; ++t) {
+		for (uint c = 0; c < 3; ++c) {
+			mean[c] += texels[t * 3 + c] / kTexelsPerBlock;
+		}
+	}
+
+	float covariance[3][3] = {};
+	for (uint t = 0; t < kTexelsPerBlock; ++t) {
+		float d[3] = { texels[t * 3] - mean[0], texels[t * 3 + 1] - mean[1], texels[t * 3 + 2] - mean[2] };
+		for (uint i = 0; i < 3; ++i) {
+			for (uint j = 0; j < 3; ++j) {
+				covariance[i][j] += d[i] * d[j];
+			}
+		}
+	}
+
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (uint iteration = 0; iteration < 8; ++iteration) {
+		float next[3];
+		for (uint i = 0; i < 3; ++i) {
+			next[i] = covariance[i][0] * axis[0] + covariance[i][1] * axis[1] + covariance[i][2] * axis[2];
+		}
+		float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (length < 1e-6f) {
+			// The block is a single color. Any axis works
+			break;
+		}
+		for (uint i = 0; i < 3; ++i) {
+			axis[i] = next[i] / length;
+		}
+	}
+
+	// The endpoints are the extremes of the colors along the axis
+	float minT = 0.0f;
+	float maxT = 0.0f;
+	for (uint t = 0; t < kTexelsPerBlock; ++t) {
+		float projection = (texels[t * 3] - mean[0]) * axis[0] + (texels[t * 3 + 1] - mean[1]) * axis[1] + (texels[t * 3 + 2] - mean[2]) * axis[2];
+		minT = std::min(minT, projection);
+		maxT = std::max(maxT, projection);
+	}
+	float endpoint0[3];
+	float endpoint1[3];
+	for (uint c = 0; c < 3; ++c) {
+		endpoint0[c] = mean[c] + axis[c] * maxT;
+		endpoint1[c] = mean[c] + axis[c] * minT;
+	}
+
+	uint16 color0 = QuantizeRGB565(endpoint0);
+	uint16 color1 = QuantizeRGB565(endpoint1);
+	OrderEndpoints(&color0, &color1);
+	uint indices[kTexelsPerBlock];
+	float error = ChooseIndices(texels, color0, color1, indices);
+
+	// Refit the endpoints to the chosen indices, with least squares. Keep the result if it's better
+	if (color0 != color1) {
+		static const float kWeights[4][2] = { { 1.0f, 0.0f }, { 0.0f, 1.0f }, { 2.0f / 3.0f, 1.0f / 3.0f }, { 1.0f / 3.0f, 2.0f / 3.0f } };
+		float a = 0.0f;
+		float b = 0.0f;
+		float c = 0.0f;
+		float rhs0[3] = { 0.0f, 0.0f, 0.0f };
+		float rhs1[3] = { 0.0f, 0.0f, 0.0f };
+		for (uint t = 0; t < kTexelsPerBlock; ++t) {
+			float w0 = kWeights[indices[t]][0];
+			float w1 = kWeights[indices[t]][1];
+			a += w0 * w0;
+			b += w0 * w1;
+			c += w1 * w1;
+			for (uint channel = 0; channel < 3; ++channel) {
+				rhs0[channel] += w0 * texels[t * 3 + channel];
+				rhs1[channel] += w1 * texels[t * 3 + channel];
+			}
+		}
+
+		float determinant = a * c - b * b;
+		if (std::abs(determinant) > 1e-6f) {
+			for (uint channel = 0; channel < 3; ++channel) {
+				endpoint0[channel] = (c * rhs0[channel] - b * rhs1[channel]) / determinant;
+				endpoint1[channel] = (a * rhs1[channel] - b * rhs0[channel]) / determinant;
+			}
+
+			uint16 refitColor0 = QuantizeRGB565(endpoint0);
+			uint16 refitColor1 = QuantizeRGB565(endpoint1);
+			OrderEndpoints(&refitColor0, &refitColor1);
+			uint refitIndices[kTexelsPerBlock];
+			float refitError = ChooseIndices(texels, refitColor0, refitColor1, refitIndices);
+			if (refitError < error) {
+				color0 = refitColor0;
+				color1 = refitColor1;
+				std::copy(refitIndices, refitIndices + kTexelsPerBlock, indices);
+			}
+		}
+	}
+
+	WriteBlock(color0, color1, indices, out_block);
+}
+
+} // End of namespace Lantern
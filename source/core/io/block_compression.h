@@ -0,0 +1,78 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+
+#include <cstring>
+#include <emmintrin.h>
+
+
+namespace Lantern {
+
+// BC1 stores each 4x4 block of texels in 8 bytes: two 5:6:5 endpoint colors, then a 2-bit palette index per texel
+static const uint kBC1BlockSize = 4;
+static const std::size_t kBC1BlockBytes = 8;
+
+/**
+ * Expands a 5:6:5 color to floats in [0, 255]. The lanes are r, g, b, 0
+ */
+inline __m128 ExpandRGB565(uint16 color) {
+	// Mask out each channel in its own lane, then rescale it in place, so nothing needs to be shifted
+	__m128i channels = _mm_and_si128(_mm_set1_epi32(color), _mm_setr_epi32(0xF800, 0x07E0, 0x001F, 0));
+	return _mm_mul_ps(_mm_cvtepi32_ps(channels), _mm_setr_ps(255.0f / 0xF800, 255.0f / 0x07E0, 255.0f / 0x001F, 0.0f));
+}
+
+/**
+ * Decodes the color of one palette index of a BC1 block
+ *
+ * @param color0    The first endpoint
+ * @param color1    The second endpoint
+ * @param index     The palette index
+ * @return          The color, in [0, 255]. The lanes are r, g, b, 0
+ */
+inline __m128 DecodeBC1Color(uint16 color0, uint16 color1, uint index) {
+	// If color0 > color1, the palette is the endpoints and two colors between them. Otherwise, it's the endpoints,
+	// their midpoint, and black
+	static const float kWeights[2][4][2] = {
+		{ { 1.0f, 0.0f }, { 0.0f, 1.0f }, { 0.5f, 0.5f }, { 0.0f, 0.0f } },
+		{ { 1.0f, 0.0f }, { 0.0f, 1.0f }, { 2.0f / 3.0f, 1.0f / 3.0f }, { 1.0f / 3.0f, 2.0f / 3.0f } }
+	};
+	const float *weights = kWeights[color0 > color1 ? 1 : 0][index];
+
+	return _mm_add_ps(_mm_mul_ps(ExpandRGB565(color0), _mm_set1_ps(weights[0])), _mm_mul_ps(ExpandRGB565(color1), _mm_set1_ps(weights[1])));
+}
+
+/**
+ * Decodes one texel of a BC1 block
+ *
+ * @param block    The 8 bytes of the block
+ * @param x        The x coordinate of the texel within the block
+ * @param y        The y coordinate of the texel within the block
+ * @return         The texel, in [0, 255]. The lanes are r, g, b, 0
+ */
+inline __m128 DecodeBC1Texel(const byte *block, uint x, uint y) {
+	uint16 color0 = (uint16)(block[0] | (block[1] << 8));
+	uint16 color1 = (uint16)(block[2] | (block[3] << 8));
+	uint32 indices;
+	memcpy(&indices, block + 4, sizeof(indices));
+
+	return DecodeBC1Color(color0, color1, (indices >> (2 * (y * kBC1BlockSize + x))) & 3u);
+}
+
+/**
+ * Encodes a 4x4 block of texels as BC1
+ *
+ * The endpoints are fit along the principal axis of the block's colors, then refined with a least squares fit
+ * to the chosen indices
+ *
+ * @param texels         The 16 texels, row by row, as r, g, b triplets in [0, 255]
+ * @param out_block      The 8 bytes of the block
+ */
+void EncodeBC1Block(const float *texels, byte *out_block);
+
+} // End of namespace Lantern
@@ -9,6 +9,7 @@
 #include "math/int_types.h"
 
 #include <cstdio>
+#include <cstring>
 
 
 namespace Lantern {
@@ -46,10 +47,49 @@ inline float ReadFloat(FILE *file) {
 }
 
 
+/**
+ * Reads a value out of a block of memory, such as a mapped file. The value doesn't need to be aligned
+ *
+ * @param data      The start of the memory
+ * @param offset    The offset to read at. Advanced past the value
+ * @return          The value
+ */
+template <typename T>
+inline T ReadValue(const byte *data, std::size_t *offset) {
+	T value;
+	memcpy(&value, data + *offset, sizeof(T));
+	*offset += sizeof(T);
+
+	return value;
+}
+
+
 inline void Write(FILE *file, void *data, std::size_t length) {
 	fwrite(data, sizeof(char), length, file);
 }
 
+/**
+ * Moves to an offset from the start of a file. Works past 2 GB, unlike fseek()
+ */
+inline bool Seek(FILE *file, uint64 offset) {
+#ifdef _WIN32
+	return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+/**
+ * The current offset from the start of a file. Works past 2 GB, unlike ftell()
+ */
+inline uint64 Tell(FILE *file) {
+#ifdef _WIN32
+	return (uint64)_ftelli64(file);
+#else
+	return (uint64)ftello(file);
+#endif
+}
+
 inline void WriteMagicNumber(FILE *file, char a0, char a1, char a2, char a3) {
 	uint32 number = (uint32)((a0) | ((a1) << 8) | ((a2) << 16) | ((a3) << 24));
 	fwrite(&number, sizeof(uint32), 1, file);
@@ -0,0 +1,170 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "io/image_writer.h"
+
+#include "camera/frame_buffer.h"
+
+#include "stb_image_write.h"
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+
+namespace Lantern {
+
+void ResolveFrameBuffer(FrameBuffer *frameBuffer, std::vector<float3> *out) {
+	const std::size_t numPixels = frameBuffer->Width * frameBuffer->Height;
+	out->resize(numPixels);
+
+	for (std::size_t i = 0; i < numPixels; ++i) {
+		uint sampleCount = frameBuffer->ColorSampleCount[i];
+		if (sampleCount == 0) {
+			(*out)[i] = float3(0.0f);
+		} else {
+			(*out)[i] = frameBuffer->ColorData[i] / float(sampleCount);
+		}
+	}
+}
+
+bool WritePFM(const char *filePath, uint width, uint height, const float3 *data) {
+	FILE *file = fopen(filePath, "wb");
+	if (!file) {
+		printf("Unable to open \"%s\" for writing\n", filePath);
+		return false;
+	}
+
+	// A negative scale marks the data as little-endian
+	fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+
+	// PFM stores its scanlines from the bottom up
+	for (uint y = height; y > 0; --y) {
+		const float3 *row = &data[(y - 1) * width];
+		for (uint x = 0; x < width; ++x) {
+			float rgb[3] = {row[x].x, row[x].y, row[x].z};
+			fwrite(rgb, sizeof(float), 3, file);
+		}
+	}
+
+	bool success = ferror(file) == 0;
+	fclose(file);
+
+	return success;
+}
+
+inline float ClampTonemap(float value) {
+	return std::max(0.0f, std::min(value, 1.0f));
+}
+
+// Jim Hejl and Richard Burgess-Dawson's filmic curve. The gamma correction is baked in
+inline float FilmicTonemap(float value) {
+	float x = std::max(0.0f, value - 0.004f);
+	value = (x * (6.2f * x + 0.5f)) / (x * (6.2f * x + 1.7f) + 0.06f);
+
+	return std::max(0.0f, std::min(value, 1.0f));
+}
+
+bool WritePNG(const char *filePath, uint width, uint height, const float3 *data, ToneMapper toneMapper, float exposure) {
+	const float scale = std::exp2f(exposure);
+
+	std::vector<byte> pixels(width * height * 3);
+	for (std::size_t i = 0; i < (std::size_t)width * height; ++i) {
+		float rgb[3] = {data[i].x * scale, data[i].y * scale, data[i].z * scale};
+		for (uint c = 0; c < 3; ++c) {
+			float value = toneMapper == ToneMapper::Filmic ? FilmicTonemap(rgb[c]) : ClampTonemap(rgb[c]);
+			pixels[i * 3 + c] = (byte)(value * 255.0f + 0.5f);
+		}
+	}
+
+	if (stbi_write_png(filePath, (int)width, (int)height, 3, &pixels[0], (int)width * 3) == 0) {
+		printf("Unable to write \"%s\"\n", filePath);
+		return false;
+	}
+
+	return true;
+}
+
+
+ImageWriter::ImageWriter(ToneMapper toneMapper, float exposure)
+		: m_toneMapper(toneMapper),
+		  m_exposure(exposure),
+		  m_busy(false),
+		  m_quit(false) {
+	m_thread = std::thread(&ImageWriter::ThreadMain, this);
+}
+
+ImageWriter::~ImageWriter() {
+	{
+		std::lock_guard<std::mutex> lock(m_queueLock);
+		m_quit = true;
+	}
+	m_queueCondition.notify_one();
+
+	// ThreadMain drains the queue before exiting
+	m_thread.join();
+}
+
+void ImageWriter::Write(const std::string &basePath, uint width, uint height, std::vector<float3> &&data) {
+	{
+		std::lock_guard<std::mutex> lock(m_queueLock);
+
+		// A newer image supersedes any pending one for the same path
+		// This keeps slow disks from building up a backlog of checkpoints
+		m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(), [&basePath](const WriteRequest &request) {
+			return request.BasePath == basePath;
+		}), m_queue.end());
+
+		WriteRequest request;
+		request.BasePath = basePath;
+		request.Width = width;
+		request.Height = height;
+		request.Data = std::move(data);
+		m_queue.push_back(std::move(request));
+	}
+	m_queueCondition.notify_one();
+}
+
+void ImageWriter::Flush() {
+	std::unique_lock<std::mutex> lock(m_queueLock);
+	m_idleCondition.wait(lock, [this] {
+		return m_queue.empty() && !m_busy;
+	});
+}
+
+void ImageWriter::ThreadMain() {
+	for (;;) {
+		WriteRequest request;
+		{
+			std::unique_lock<std::mutex> lock(m_queueLock);
+			m_queueCondition.wait(lock, [this] {
+				return !m_queue.empty() || m_quit;
+			});
+
+			if (m_queue.empty()) {
+				// We only get here when we've been asked to quit
+				return;
+			}
+
+			request = std::move(m_queue.front());
+			m_queue.pop_front();
+			m_busy = true;
+		}
+
+		std::string pfmPath = request.BasePath + ".pfm";
+		std::string pngPath = request.BasePath + ".png";
+		WritePFM(pfmPath.c_str(), request.Width, request.Height, &request.Data[0]);
+		WritePNG(pngPath.c_str(), request.Width, request.Height, &request.Data[0], m_toneMapper, m_exposure);
+
+		{
+			std::lock_guard<std::mutex> lock(m_queueLock);
+			m_busy = false;
+		}
+		m_idleCondition.notify_all();
+	}
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,112 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+#include "math/vector_types.h"
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace Lantern {
+
+class FrameBuffer;
+
+// These match the tonemappers in visualizer/shaders/final_resolve_ps.glsl
+enum class ToneMapper {
+	Clamp = 0,
+	Filmic = 1
+};
+
+/**
+ * Divides the accumulated color of each pixel by its sample count
+ *
+ * @param frameBuffer    The FrameBuffer to resolve
+ * @param out            The resolved pixels. Resized to Width * Height
+ */
+void ResolveFrameBuffer(FrameBuffer *frameBuffer, std::vector<float3> *out);
+
+/**
+ * Writes linear radiance data to a Portable Float Map file
+ *
+ * @param filePath    The path of the file to write
+ * @param width       The width of the image
+ * @param height      The height of the image
+ * @param data        The pixels of the image, in row-major order, starting from the top left
+ * @return            Whether the write succeeded
+ */
+bool WritePFM(const char *filePath, uint width, uint height, const float3 *data);
+/**
+ * Tonemaps linear radiance data and writes it to an 8-bit PNG file
+ *
+ * @param filePath      The path of the file to write
+ * @param width         The width of the image
+ * @param height        The height of the image
+ * @param data          The pixels of the image, in row-major order, starting from the top left
+ * @param toneMapper    The tonemapping operator to use
+ * @param exposure      The exposure, in stops, to apply before tonemapping
+ * @return              Whether the write succeeded
+ */
+bool WritePNG(const char *filePath, uint width, uint height, const float3 *data, ToneMapper toneMapper, float exposure);
+
+
+/**
+ * Writes resolved images to disk on a background thread, so the caller
+ * never has to wait on file IO or PNG encoding
+ */
+class ImageWriter {
+public:
+	ImageWriter(ToneMapper toneMapper = ToneMapper::Filmic, float exposure = 0.0f);
+	~ImageWriter();
+
+private:
+	struct WriteRequest {
+		std::string BasePath;
+		uint Width;
+		uint Height;
+		std::vector<float3> Data;
+	};
+
+	ToneMapper m_toneMapper;
+	float m_exposure;
+
+	std::deque<WriteRequest> m_queue;
+	std::mutex m_queueLock;
+	std::condition_variable m_queueCondition;
+	std::condition_variable m_idleCondition;
+	bool m_busy;
+	bool m_quit;
+
+	std::thread m_thread;
+
+public:
+	/**
+	 * Queues an image to be written as both <basePath>.pfm and <basePath>.png
+	 *
+	 * Any older write to the same path that hasn't started yet is dropped
+	 *
+	 * @param basePath    The output path, without an extension
+	 * @param width       The width of the image
+	 * @param height      The height of the image
+	 * @param data        The resolved pixels of the image. The writer takes ownership
+	 */
+	void Write(const std::string &basePath, uint width, uint height, std::vector<float3> &&data);
+	/**
+	 * Blocks until all queued writes have finished
+	 */
+	void Flush();
+
+private:
+	void ThreadMain();
+};
+
+} // End of namespace Lantern
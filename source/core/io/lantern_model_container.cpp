@@ -0,0 +1,210 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "io/lantern_model_container.h"
+
+#include "io/file_io.h"
+
+#include <algorithm>
+
+
+namespace Lantern {
+
+/*
+	struct LanternModelContainer_FileFormat {
+		uint32 Magic;
+		uint32 Version;
+		uint64 DirectoryOffset;
+
+		// Each mesh is a whole version 2 LMF file, starting on a 16-byte boundary, so it can be mapped in place
+		byte Meshes[];
+
+		// The directory goes last, so meshes can be appended as soon as they're converted
+		struct {
+			uint32 NumMeshes;
+			uint32 StringsSize;
+			struct {
+				uint64 Offset;
+				uint64 Size;
+				uint32 NameOffset;        // Into Strings
+				uint32 MaterialOffset;    // Into Strings
+			} Entries[NumMeshes];         // Sorted by name
+			char Strings[StringsSize];    // Null terminated
+		} Directory;
+	};
+*/
+
+static const std::size_t kLMCHeaderSize = 2 * sizeof(uint32) + sizeof(uint64);
+static const std::size_t kLMCEntrySize = 2 * sizeof(uint64) + 2 * sizeof(uint32);
+static const std::size_t kLMCMeshAlignment = 16;
+
+bool IsLMCFile(const byte *data, std::size_t size) {
+	if (size < sizeof(uint32)) {
+		return false;
+	}
+
+	std::size_t offset = 0;
+	return VerifyMagicNumber(ReadValue<uint32>(data, &offset), 'L', 'M', 'C', '\0');
+}
+
+bool ReadLMCView(const byte *data, std::size_t size, std::vector<LanternModelContainerEntry> *out_entries) {
+	if (!IsLMCFile(data, size) || size < kLMCHeaderSize) {
+		return false;
+	}
+
+	std::size_t offset = sizeof(uint32);
+	uint32 version = ReadValue<uint32>(data, &offset);
+	if (version != kLMCVersion) {
+		printf("Unsupported LMC version [%u]. Expected [%u]\n", version, kLMCVersion);
+		return false;
+	}
+	uint64 directoryOffset = ReadValue<uint64>(data, &offset);
+	if (directoryOffset > size || size - directoryOffset < 2 * sizeof(uint32)) {
+		return false;
+	}
+
+	offset = (std::size_t)directoryOffset;
+	uint32 numMeshes = ReadValue<uint32>(data, &offset);
+	uint32 stringsSize = ReadValue<uint32>(data, &offset);
+	if ((uint64)numMeshes * kLMCEntrySize + stringsSize > size - offset) {
+		return false;
+	}
+	const char *strings = (const char *)data + offset + numMeshes * kLMCEntrySize;
+	// Make sure every string is terminated before the end of the table
+	if (stringsSize == 0 || strings[stringsSize - 1] != '\0') {
+		return false;
+	}
+
+	out_entries->resize(numMeshes);
+	for (uint32 i = 0; i < numMeshes; ++i) {
+		uint64 meshOffset = ReadValue<uint64>(data, &offset);
+		uint64 meshSize = ReadValue<uint64>(data, &offset);
+		uint32 nameOffset = ReadValue<uint32>(data, &offset);
+		uint32 materialOffset = ReadValue<uint32>(data, &offset);
+		if (meshOffset % kLMCMeshAlignment != 0 || meshOffset < kLMCHeaderSize || meshOffset > directoryOffset ||
+		    meshSize > directoryOffset - meshOffset || nameOffset >= stringsSize || materialOffset >= stringsSize) {
+			return false;
+		}
+
+		LanternModelContainerEntry &entry = (*out_entries)[i];
+		entry.Name = strings + nameOffset;
+		entry.Material = strings + materialOffset;
+		entry.Data = data + meshOffset;
+		entry.Size = meshSize;
+	}
+
+	return true;
+}
+
+LMCWriter::LMCWriter()
+		: m_file(nullptr),
+		  m_failed(false) {
+}
+
+LMCWriter::~LMCWriter() {
+	if (m_file != nullptr) {
+		fclose(m_file);
+	}
+}
+
+bool LMCWriter::Open(const char *filePath) {
+	m_file = fopen(filePath, "wb");
+	if (m_file == nullptr) {
+		return false;
+	}
+
+	// The directory offset is filled in by Close()
+	WriteUInt32(m_file, CreateMagicNumber('L', 'M', 'C', '\0'));
+	WriteUInt32(m_file, kLMCVersion);
+	WriteUInt64(m_file, 0);
+	m_failed = ferror(m_file) != 0;
+
+	return !m_failed;
+}
+
+bool LMCWriter::AddMesh(const std::string &name, const std::string &material, LanternModelFile *lmf) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_file == nullptr || m_failed) {
+		return false;
+	}
+
+	// Scene looks meshes up by name, so a second mesh with the same name would silently hide the first
+	if (!m_names.insert(name).second) {
+		printf("The container already has a mesh named [%s]\n", name.c_str());
+		return false;
+	}
+
+	// Each mesh is an LMF file on its own, so its sections are only aligned if it starts aligned
+	byte padding[kLMCMeshAlignment] = {};
+	uint64 position = Tell(m_file);
+	uint64 start = (position + kLMCMeshAlignment - 1) / kLMCMeshAlignment * kLMCMeshAlignment;
+	Write(m_file, padding, (std::size_t)(start - position));
+
+	if (!WriteLFM(m_file, lmf)) {
+		m_failed = true;
+		return false;
+	}
+
+	Entry entry;
+	entry.Name = name;
+	entry.Material = material;
+	entry.Offset = start;
+	entry.Size = Tell(m_file) - start;
+	m_entries.push_back(entry);
+
+	return true;
+}
+
+bool LMCWriter::Close() {
+	if (m_file == nullptr) {
+		return false;
+	}
+
+	// The meshes were appended in whatever order the threads finished in. Sort the directory, so it's the same every run
+	std::sort(m_entries.begin(), m_entries.end(), [](const Entry &a, const Entry &b) {
+		return a.Name < b.Name;
+	});
+
+	// Build the string table. Offset 0 is the empty string
+	std::string strings(1, '\0');
+	std::vector<uint32> nameOffsets(m_entries.size());
+	std::vector<uint32> materialOffsets(m_entries.size());
+	for (std::size_t i = 0; i < m_entries.size(); ++i) {
+		nameOffsets[i] = m_entries[i].Name.empty() ? 0 : (uint32)strings.size();
+		strings.append(m_entries[i].Name.c_str(), m_entries[i].Name.size() + (m_entries[i].Name.empty() ? 0 : 1));
+		materialOffsets[i] = m_entries[i].Material.empty() ? 0 : (uint32)strings.size();
+		strings.append(m_entries[i].Material.c_str(), m_entries[i].Material.size() + (m_entries[i].Material.empty() ? 0 : 1));
+	}
+
+	uint64 directoryOffset = Tell(m_file);
+	WriteUInt32(m_file, (uint32)m_entries.size());
+	WriteUInt32(m_file, (uint32)strings.size());
+	for (std::size_t i = 0; i < m_entries.size(); ++i) {
+		WriteUInt64(m_file, m_entries[i].Offset);
+		WriteUInt64(m_file, m_entries[i].Size);
+		WriteUInt32(m_file, nameOffsets[i]);
+		WriteUInt32(m_file, materialOffsets[i]);
+	}
+	Write(m_file, &strings[0], strings.size());
+
+	// Now the directory is written, point the header at it
+	if (!Seek(m_file, 2 * sizeof(uint32))) {
+		m_failed = true;
+	}
+	WriteUInt64(m_file, directoryOffset);
+
+	if (ferror(m_file) != 0) {
+		m_failed = true;
+	}
+	if (fclose(m_file) != 0) {
+		m_failed = true;
+	}
+	m_file = nullptr;
+
+	return !m_failed;
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,112 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "io/lantern_model_file.h"
+
+#include "math/int_types.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+
+namespace Lantern {
+
+/**
+ * The version LMCWriter writes
+ */
+const uint32 kLMCVersion = 1;
+
+/**
+ * A mesh inside a Lantern Model Container that's mapped into memory
+ *
+ * Each mesh is a whole version 2 LMF file, so Data can be handed straight to ReadLMFView()
+ */
+struct LanternModelContainerEntry {
+	// Null terminated. Both point into the container
+	const char *Name;
+	// The name of the material the mesh was made with. Empty if it didn't have one
+	const char *Material;
+
+	const byte *Data;
+	uint64 Size;
+};
+
+/**
+ * Checks if data in memory starts like a Lantern Model Container
+ */
+bool IsLMCFile(const byte *data, std::size_t size);
+/**
+ * Reads the directory of a Lantern Model Container that's in memory, and checks every mesh is inside it
+ *
+ * @param data           The start of the file. Must be at least 16-byte aligned
+ * @param size           The size of the file in bytes
+ * @param out_entries    Filled with one entry per mesh, sorted by name. The pointers are
+ *                       only valid while data is
+ * @return               False if the file isn't a valid Lantern Model Container
+ */
+bool ReadLMCView(const byte *data, std::size_t size, std::vector<LanternModelContainerEntry> *out_entries);
+
+/**
+ * Writes many meshes into one Lantern Model Container, so a scene made of thousands of parts only has to open one file
+ *
+ * Meshes are appended as they're added, from any number of threads, and the directory is written last.
+ * The directory is sorted by name, so it doesn't depend on the order the threads finish in
+ */
+class LMCWriter {
+public:
+	LMCWriter();
+	~LMCWriter();
+
+	LMCWriter(const LMCWriter &other) = delete;
+	LMCWriter &operator=(const LMCWriter &other) = delete;
+
+private:
+	struct Entry {
+		std::string Name;
+		std::string Material;
+		uint64 Offset;
+		uint64 Size;
+	};
+
+	FILE *m_file;
+	// Guards m_file, m_entries, and m_names
+	std::mutex m_lock;
+	std::vector<Entry> m_entries;
+	std::unordered_set<std::string> m_names;
+	bool m_failed;
+
+public:
+	/**
+	 * Creates the file, and writes its header
+	 *
+	 * @param filePath    The file to write
+	 * @return            False if the file couldn't be created
+	 */
+	bool Open(const char *filePath);
+	/**
+	 * Appends a mesh to the container, as a version 2 LMF file
+	 *
+	 * @param name        The name the mesh is looked up by. Must be unique in the container
+	 * @param material    The name of the material the mesh was made with. Can be empty
+	 * @param lmf         The mesh
+	 * @return            False if the container already has a mesh with the same name, or the mesh couldn't be written
+	 */
+	bool AddMesh(const std::string &name, const std::string &material, LanternModelFile *lmf);
+	/**
+	 * Writes the directory, and closes the file
+	 *
+	 * @return    False if anything failed to write
+	 */
+	bool Close();
+};
+
+} // End of namespace Lantern
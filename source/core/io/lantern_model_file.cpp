@@ -8,11 +8,46 @@
 
 #include "io/file_io.h"
 
+#include <algorithm>
+
 
 namespace Lantern {
 
 /*
 	struct LanternModelFile_FileFormat {
+		uint32 Magic;
+		uint32 Version;
+		uint32 VerticesPerPrimitive;
+		uint32 Flags;    // LMFFlags. Only HAS_EMITTER_DATA is used
+
+		struct {
+			uint64 Offset;
+			uint64 Count;
+		} Sections[HAS_EMITTER_DATA ? 5 : 4];    // Positions, Indices, Normals, TexCoords, Emitter. Empty sections have an offset of 0
+
+		// Each section starts on a 16-byte boundary, and is followed by at least 16 bytes of padding,
+		// since Embree reads the last element of a vertex buffer with a 16-byte load
+		float Positions[NumPositions][4];
+		uint32 Indices[NumIndices];
+		float Normals[NumNormals][3];
+		float TexCoords[NumTexCoords][2];
+
+		// The count of the emitter section is in floats, and includes the 12 floats before the triangle areas
+		struct {
+			float SurfaceArea;
+			float BoundsMin[3];
+			float BoundsMax[3];
+			float NormalAxis[3];
+			float NormalCosTheta;
+			float Padding;
+			float TriangleAreas[NumTriangles];
+		} Emitter;
+	};
+
+	Version 1 files have no version number. The byte after the magic is VerticesPerPrimative, which is 3 or 4,
+	so later versions can't be 3 or 4 either
+
+	struct LanternModelFile_FileFormat_V1 {
 		uint32 Magic;
 		byte VerticesPerPrimative;
 		uint32 Flags;
@@ -30,14 +65,66 @@ namespace Lantern {
 	};
 */
 
-bool ReadLMF(FILE *file, LanternModelFile *lmf) {
-	uint32 magic = ReadUInt32(file);
-	if (!VerifyMagicNumber(magic, 'L', 'M', 'F', '\0')) {
-		return false;
+static const uint kLMFMaxSections = 5;
+static const uint kLMFPositions = 0;
+static const uint kLMFIndices = 1;
+static const uint kLMFNormals = 2;
+static const uint kLMFTexCoords = 3;
+static const uint kLMFEmitter = 4;
+
+static const std::size_t kLMFSectionAlignment = 16;
+static const std::size_t kLMFSectionPadding = 16;
+// The size of a single element of each section, in bytes
+static const std::size_t kLMFElementSizes[kLMFMaxSections] = {4 * sizeof(float), sizeof(uint32), 3 * sizeof(float), 2 * sizeof(float), sizeof(float)};
+// The number of floats in the emitter section before the triangle areas
+static const std::size_t kLMFEmitterSummarySize = 12;
+
+struct LMFSection {
+	uint64 Offset;
+	uint64 Count;
+};
+
+static uint NumLMFSections(uint32 flags) {
+	return (flags & (uint32)LMFFlags::HAS_EMITTER_DATA) != 0 ? 5 : 4;
+}
+
+static std::size_t LMFHeaderSize(uint numSections) {
+	return 4 * sizeof(uint32) + numSections * 2 * sizeof(uint64);
+}
+
+/**
+ * Places each section after the header, from their counts
+ *
+ * @return    The size of the whole file
+ */
+static uint64 LayoutLMFSections(LMFSection *sections, uint numSections) {
+	uint64 end = LMFHeaderSize(numSections);
+	for (uint i = 0; i < numSections; ++i) {
+		if (sections[i].Count == 0) {
+			sections[i].Offset = 0;
+			continue;
+		}
+
+		sections[i].Offset = (end + kLMFSectionAlignment - 1) / kLMFSectionAlignment * kLMFSectionAlignment;
+		end = sections[i].Offset + sections[i].Count * kLMFElementSizes[i] + kLMFSectionPadding;
 	}
 
-	// Read the rest of the header
-	lmf->VerticesPerPrimative = ReadByte(file);
+	return (end + kLMFSectionAlignment - 1) / kLMFSectionAlignment * kLMFSectionAlignment;
+}
+
+static void WriteLMFHeader(FILE *file, uint32 verticesPerPrimitive, uint32 flags, const LMFSection *sections, uint numSections) {
+	WriteUInt32(file, CreateMagicNumber('L', 'M', 'F', '\0'));
+	WriteUInt32(file, kLMFVersion);
+	WriteUInt32(file, verticesPerPrimitive);
+	WriteUInt32(file, flags);
+	for (uint i = 0; i < numSections; ++i) {
+		WriteUInt64(file, sections[i].Offset);
+		WriteUInt64(file, sections[i].Count);
+	}
+}
+
+static bool ReadLMFVersion1(FILE *file, byte verticesPerPrimative, LanternModelFile *lmf) {
+	lmf->VerticesPerPrimative = verticesPerPrimative;
 	uint32 flags = ReadUInt32(file);
 
 	// Read the main data
@@ -64,42 +151,364 @@ bool ReadLMF(FILE *file, LanternModelFile *lmf) {
 	return true;
 }
 
+bool ReadLMF(FILE *file, LanternModelFile *lmf) {
+	uint32 magic = ReadUInt32(file);
+	if (!VerifyMagicNumber(magic, 'L', 'M', 'F', '\0')) {
+		return false;
+	}
+
+	lmf->TriangleAreas.clear();
+
+	byte versionOrVerticesPerPrimative = ReadByte(file);
+	if (versionOrVerticesPerPrimative == 3 || versionOrVerticesPerPrimative == 4) {
+		return ReadLMFVersion1(file, versionOrVerticesPerPrimative, lmf);
+	}
+
+	// Read the rest of the header
+	byte versionHighBytes[3];
+	Read(file, versionHighBytes, sizeof(versionHighBytes));
+	if (versionOrVerticesPerPrimative != kLMFVersion || versionHighBytes[0] != 0 || versionHighBytes[1] != 0 || versionHighBytes[2] != 0) {
+		printf("Unsupported LMF version. Expected [%u]\n", kLMFVersion);
+		return false;
+	}
+	lmf->VerticesPerPrimative = (byte)ReadUInt32(file);
+	uint32 flags = ReadUInt32(file);
+
+	const uint numSections = NumLMFSections(flags);
+	LMFSection sections[kLMFMaxSections];
+	for (uint i = 0; i < numSections; ++i) {
+		sections[i].Offset = ReadUInt64(file);
+		sections[i].Count = ReadUInt64(file);
+	}
+
+	// Read the sections in order, skipping the padding between them
+	uint64 position = LMFHeaderSize(numSections);
+	for (uint i = 0; i < numSections; ++i) {
+		if (sections[i].Count == 0) {
+			continue;
+		}
+		if (sections[i].Offset < position) {
+			return false;
+		}
+		byte padding[kLMFSectionAlignment + kLMFSectionPadding];
+		for (uint64 remaining = sections[i].Offset - position; remaining > 0;) {
+			std::size_t length = (std::size_t)std::min<uint64>(remaining, sizeof(padding));
+			Read(file, padding, length);
+			remaining -= length;
+		}
+		position = sections[i].Offset + sections[i].Count * kLMFElementSizes[i];
+
+		switch (i) {
+		case kLMFPositions:
+		{
+			// Drop the fourth float of each vertex, a chunk at a time
+			lmf->Positions.resize(sections[i].Count * 3);
+			float chunk[1024 * 4];
+			for (uint64 start = 0; start < sections[i].Count; start += 1024) {
+				std::size_t chunkSize = (std::size_t)std::min<uint64>(sections[i].Count - start, 1024);
+				Read(file, chunk, chunkSize * kLMFElementSizes[i]);
+				for (std::size_t j = 0; j < chunkSize; ++j) {
+					memcpy(&lmf->Positions[(start + j) * 3], &chunk[j * 4], 3 * sizeof(float));
+				}
+			}
+			break;
+		}
+		case kLMFIndices:
+			lmf->Indices.resize(sections[i].Count);
+			Read(file, &lmf->Indices[0], sections[i].Count * kLMFElementSizes[i]);
+			break;
+		case kLMFNormals:
+			lmf->Normals.resize(sections[i].Count * 3);
+			Read(file, &lmf->Normals[0], sections[i].Count * kLMFElementSizes[i]);
+			break;
+		case kLMFTexCoords:
+			lmf->TexCoords.resize(sections[i].Count * 2);
+			Read(file, &lmf->TexCoords[0], sections[i].Count * kLMFElementSizes[i]);
+			break;
+		case kLMFEmitter:
+		{
+			if (sections[i].Count <= kLMFEmitterSummarySize) {
+				return false;
+			}
+			float summary[kLMFEmitterSummarySize];
+			Read(file, summary, sizeof(summary));
+			lmf->SurfaceArea = summary[0];
+			lmf->BoundsMin = float3(summary[1], summary[2], summary[3]);
+			lmf->BoundsMax = float3(summary[4], summary[5], summary[6]);
+			lmf->NormalAxis = float3(summary[7], summary[8], summary[9]);
+			lmf->NormalCosTheta = summary[10];
+
+			lmf->TriangleAreas.resize(sections[i].Count - kLMFEmitterSummarySize);
+			Read(file, &lmf->TriangleAreas[0], lmf->TriangleAreas.size() * sizeof(float));
+			break;
+		}
+		}
+	}
+
+	return ferror(file) == 0 && feof(file) == 0;
+}
+
+uint32 ReadLMFVersion(const byte *data, std::size_t size) {
+	if (size < 2 * sizeof(uint32)) {
+		return 0;
+	}
+
+	std::size_t offset = 0;
+	uint32 magic = ReadValue<uint32>(data, &offset);
+	if (!VerifyMagicNumber(magic, 'L', 'M', 'F', '\0')) {
+		return 0;
+	}
+	if (data[offset] == 3 || data[offset] == 4) {
+		return 1;
+	}
+
+	return ReadValue<uint32>(data, &offset);
+}
+
+bool ReadLMFView(const byte *data, std::size_t size, LanternModelFileView *view) {
+	uint32 version = ReadLMFVersion(data, size);
+	if (version != kLMFVersion) {
+		printf("Unsupported LMF version [%u]. Expected [%u]\n", version, kLMFVersion);
+		return false;
+	}
+	if (size < LMFHeaderSize(0)) {
+		return false;
+	}
+
+	std::size_t offset = 2 * sizeof(uint32);
+	view->VerticesPerPrimitive = ReadValue<uint32>(data, &offset);
+	uint32 flags = ReadValue<uint32>(data, &offset);
+
+	const uint numSections = NumLMFSections(flags);
+	const std::size_t headerSize = LMFHeaderSize(numSections);
+	if (size < headerSize) {
+		return false;
+	}
+
+	const byte *sectionData[kLMFMaxSections];
+	uint64 sectionCounts[kLMFMaxSections];
+	for (uint i = 0; i < kLMFMaxSections; ++i) {
+		sectionData[i] = nullptr;
+		sectionCounts[i] = 0;
+	}
+	for (uint i = 0; i < numSections; ++i) {
+		uint64 sectionOffset = ReadValue<uint64>(data, &offset);
+		uint64 count = ReadValue<uint64>(data, &offset);
+		sectionCounts[i] = count;
+		if (count == 0) {
+			continue;
+		}
+
+		// Check the section and its padding are inside the file, without overflowing
+		if (sectionOffset % kLMFSectionAlignment != 0 || sectionOffset < headerSize || sectionOffset > size ||
+		    count > (size - sectionOffset) / kLMFElementSizes[i] || sectionOffset + count * kLMFElementSizes[i] + kLMFSectionPadding > size) {
+			return false;
+		}
+		sectionData[i] = data + sectionOffset;
+	}
+	if (sectionCounts[kLMFPositions] == 0 || sectionCounts[kLMFIndices] == 0) {
+		return false;
+	}
+
+	view->Positions = (const float *)sectionData[kLMFPositions];
+	view->NumPositions = sectionCounts[kLMFPositions];
+	view->Indices = (const uint32 *)sectionData[kLMFIndices];
+	view->NumIndices = sectionCounts[kLMFIndices];
+	view->Normals = (const float *)sectionData[kLMFNormals];
+	view->NumNormals = sectionCounts[kLMFNormals];
+	view->TexCoords = (const float *)sectionData[kLMFTexCoords];
+	view->NumTexCoords = sectionCounts[kLMFTexCoords];
+
+	view->HasEmitterData = sectionCounts[kLMFEmitter] > kLMFEmitterSummarySize;
+	if (view->HasEmitterData) {
+		const float *emitter = (const float *)sectionData[kLMFEmitter];
+		view->SurfaceArea = emitter[0];
+		view->BoundsMin = float3(emitter[1], emitter[2], emitter[3]);
+		view->BoundsMax = float3(emitter[4], emitter[5], emitter[6]);
+		view->NormalAxis = float3(emitter[7], emitter[8], emitter[9]);
+		view->NormalCosTheta = emitter[10];
+		view->TriangleAreas = emitter + kLMFEmitterSummarySize;
+		view->NumTriangles = sectionCounts[kLMFEmitter] - kLMFEmitterSummarySize;
+	} else {
+		view->TriangleAreas = nullptr;
+		view->NumTriangles = 0;
+	}
+
+	return true;
+}
+
 bool WriteLFM(FILE *file, LanternModelFile *lmf) {
-	// Write the header
-	WriteUInt32(file, CreateMagicNumber('L', 'M', 'F', '\0'));
-	WriteByte(file, lmf->VerticesPerPrimative);
-	
-	// Calculate the flags directly, rather than requiring the user to do it
-	uint32 flags = 0;
-	uint64 numNormals = lmf->Normals.size();
-	uint64 numTexCoords = lmf->TexCoords.size();
+	uint32 flags = lmf->TriangleAreas.empty() ? 0 : (uint32)LMFFlags::HAS_EMITTER_DATA;
+	const uint numSections = NumLMFSections(flags);
+
+	// Lay out the sections first, so the offsets can go in the header
+	LMFSection sections[kLMFMaxSections];
+	sections[kLMFPositions].Count = lmf->Positions.size() / 3;
+	sections[kLMFIndices].Count = lmf->Indices.size();
+	sections[kLMFNormals].Count = lmf->Normals.size() / 3;
+	sections[kLMFTexCoords].Count = lmf->TexCoords.size() / 2;
+	sections[kLMFEmitter].Count = lmf->TriangleAreas.empty() ? 0 : kLMFEmitterSummarySize + lmf->TriangleAreas.size();
+
+	uint64 end = LayoutLMFSections(sections, numSections);
+
+	WriteLMFHeader(file, lmf->VerticesPerPrimative, flags, sections, numSections);
 
-	if (numNormals > 0) {
-		flags |= (uint32)LMFFlags::HAS_NORMALS;
+	// Write the sections
+	byte padding[kLMFSectionAlignment + kLMFSectionPadding] = {};
+	uint64 position = LMFHeaderSize(numSections);
+	for (uint i = 0; i < numSections; ++i) {
+		if (sections[i].Count == 0) {
+			continue;
+		}
+		Write(file, padding, (std::size_t)(sections[i].Offset - position));
+		position = sections[i].Offset + sections[i].Count * kLMFElementSizes[i];
+
+		switch (i) {
+		case kLMFPositions:
+		{
+			// Widen the positions to match Embree's 16-byte vertices, a chunk at a time
+			float chunk[1024 * 4];
+			for (uint64 start = 0; start < sections[i].Count; start += 1024) {
+				std::size_t chunkSize = (std::size_t)std::min<uint64>(sections[i].Count - start, 1024);
+				for (std::size_t j = 0; j < chunkSize; ++j) {
+					memcpy(&chunk[j * 4], &lmf->Positions[(start + j) * 3], 3 * sizeof(float));
+					chunk[j * 4 + 3] = 1.0f;
+				}
+				Write(file, chunk, chunkSize * kLMFElementSizes[i]);
+			}
+			break;
+		}
+		case kLMFIndices:
+			Write(file, &lmf->Indices[0], lmf->Indices.size() * sizeof(uint32));
+			break;
+		case kLMFNormals:
+			Write(file, &lmf->Normals[0], (std::size_t)sections[i].Count * kLMFElementSizes[i]);
+			break;
+		case kLMFTexCoords:
+			Write(file, &lmf->TexCoords[0], (std::size_t)sections[i].Count * kLMFElementSizes[i]);
+			break;
+		case kLMFEmitter:
+		{
+			float summary[kLMFEmitterSummarySize] = {
+				lmf->SurfaceArea,
+				lmf->BoundsMin.x, lmf->BoundsMin.y, lmf->BoundsMin.z,
+				lmf->BoundsMax.x, lmf->BoundsMax.y, lmf->BoundsMax.z,
+				lmf->NormalAxis.x, lmf->NormalAxis.y, lmf->NormalAxis.z,
+				lmf->NormalCosTheta,
+				0.0f
+			};
+			Write(file, summary, sizeof(summary));
+			Write(file, &lmf->TriangleAreas[0], lmf->TriangleAreas.size() * sizeof(float));
+			break;
+		}
+		}
 	}
-	if (numTexCoords > 0) {
-		flags |= (uint32)LMFFlags::HAS_TEXCOORDS;
+	Write(file, padding, (std::size_t)(end - position));
+
+	return ferror(file) == 0;
+}
+
+LMFWriter::LMFWriter()
+		: m_file(nullptr),
+		  m_fileSize(0),
+		  m_failed(false) {
+}
+
+LMFWriter::~LMFWriter() {
+	if (m_file != nullptr) {
+		fclose(m_file);
 	}
-	Lantern::WriteUInt32(file, flags);
+}
 
-	// Write the main data
-	WriteUInt64(file, lmf->Positions.size() / 3);
-	Write(file, &lmf->Positions[0], lmf->Positions.size() * sizeof(float));
-	WriteUInt64(file, lmf->Indices.size());
-	Write(file, &lmf->Indices[0], lmf->Indices.size() * sizeof(uint32));
+bool LMFWriter::Open(const char *filePath, uint32 verticesPerPrimitive, uint64 numPositions, uint64 numIndices, uint64 numNormals, uint64 numTexCoords) {
+	m_file = fopen(filePath, "wb");
+	if (m_file == nullptr) {
+		return false;
+	}
 
-	// Write the optional data
-	if (numNormals > 0) {
-		WriteUInt64(file, numNormals);
-		Write(file, &lmf->Normals[0], numNormals * sizeof(float));
+	LMFSection sections[4];
+	sections[kLMFPositions].Count = numPositions;
+	sections[kLMFIndices].Count = numIndices;
+	sections[kLMFNormals].Count = numNormals;
+	sections[kLMFTexCoords].Count = numTexCoords;
+	m_fileSize = LayoutLMFSections(sections, 4);
+	for (uint i = 0; i < 4; ++i) {
+		m_sectionOffsets[i] = sections[i].Offset;
+		m_sectionCounts[i] = sections[i].Count;
 	}
-	if (numTexCoords > 0) {
-		WriteUInt64(file, numTexCoords);
-		Write(file, &lmf->TexCoords[0], numTexCoords * sizeof(float));
+
+	WriteLMFHeader(m_file, verticesPerPrimitive, 0, sections, 4);
+	m_failed = ferror(m_file) != 0;
+
+	return !m_failed;
+}
+
+bool LMFWriter::WritePositions(uint64 first, const float *positions, uint64 count) {
+	// Widen the positions to match Embree's 16-byte vertices, a chunk at a time
+	float chunk[1024 * 4];
+	for (uint64 start = 0; start < count; start += 1024) {
+		std::size_t chunkSize = (std::size_t)std::min<uint64>(count - start, 1024);
+		for (std::size_t j = 0; j < chunkSize; ++j) {
+			memcpy(&chunk[j * 4], &positions[(start + j) * 3], 3 * sizeof(float));
+			chunk[j * 4 + 3] = 1.0f;
+		}
+		if (!WriteSection(kLMFPositions, first + start, chunk, chunkSize)) {
+			return false;
+		}
 	}
 
 	return true;
 }
 
+bool LMFWriter::WriteIndices(uint64 first, const uint32 *indices, uint64 count) {
+	return WriteSection(kLMFIndices, first, indices, count);
+}
+
+bool LMFWriter::WriteNormals(uint64 first, const float *normals, uint64 count) {
+	return WriteSection(kLMFNormals, first, normals, count);
+}
+
+bool LMFWriter::WriteTexCoords(uint64 first, const float *texCoords, uint64 count) {
+	return WriteSection(kLMFTexCoords, first, texCoords, count);
+}
+
+bool LMFWriter::WriteSection(uint section, uint64 first, const void *data, uint64 count) {
+	if (count == 0) {
+		return true;
+	}
+	if (first > m_sectionCounts[section] || count > m_sectionCounts[section] - first) {
+		printf("LMF write out of range. Section [%u] has [%llu] elements\n", section, (unsigned long long)m_sectionCounts[section]);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	// Seeking past the end and writing fills the gap with zeros, so the padding doesn't need writing
+	if (!Seek(m_file, m_sectionOffsets[section] + first * kLMFElementSizes[section]) ||
+	    fwrite(data, kLMFElementSizes[section], (std::size_t)count, m_file) != count) {
+		m_failed = true;
+	}
+
+	return !m_failed;
+}
+
+bool LMFWriter::Close() {
+	if (m_file == nullptr) {
+		return false;
+	}
+
+	// Extend the file over the padding after the last section
+	byte zero = 0;
+	if (!Seek(m_file, m_fileSize - 1) || fwrite(&zero, 1, 1, m_file) != 1) {
+		m_failed = true;
+	}
+
+	if (fclose(m_file) != 0) {
+		m_failed = true;
+	}
+	m_file = nullptr;
+
+	return !m_failed;
+}
+
 
 } // End of namespace Lantern
@@ -7,9 +7,12 @@
 #pragma once
 
 #include "math/int_types.h"
+#include "math/vector_types.h"
 
-#include <vector>
+#include <cstddef>
 #include <cstdio>
+#include <mutex>
+#include <vector>
 
 
 namespace Lantern {
@@ -17,32 +20,170 @@ namespace Lantern {
 struct LanternModelFile {
 	byte VerticesPerPrimative;
 
+	// 3 floats per vertex
 	std::vector<float> Positions;
 	std::vector<uint32> Indices;
 	std::vector<float> Normals;
 	std::vector<float> TexCoords;
+
+	// What an emissive mesh needs to build its light, in model space, so it doesn't have to be calculated
+	// every time the mesh is loaded. Only written if TriangleAreas isn't empty
+
+	// The area of each triangle. Quads are split into (v0, v1, v3) and (v2, v3, v1), like Embree does
+	std::vector<float> TriangleAreas;
+	float SurfaceArea;
+	float3 BoundsMin;
+	float3 BoundsMax;
+	// The cone of the surface's geometric normals
+	float3 NormalAxis;
+	float NormalCosTheta;
 };
 
 enum class LMFFlags {
 	NONE = 0x00,
 	HAS_NORMALS = 0x01,
-	HAS_TEXCOORDS = 0x02
+	HAS_TEXCOORDS = 0x02,
+	// Version 2 only. Version 1 files never have emitter data
+	HAS_EMITTER_DATA = 0x04
+};
+
+/**
+ * The version WriteLFM() writes. Only files of this version can be mapped with ReadLMFView()
+ */
+const uint32 kLMFVersion = 2;
+
+/**
+ * A version 2 LMF file that's mapped into memory
+ *
+ * Each section is laid out exactly like the Embree buffer it becomes, and padded so Embree can read past
+ * its last element, so the pointers can be handed straight to rtcSetSharedGeometryBuffer(). Nothing is
+ * copied, so the pointers are only valid while the file stays mapped
+ */
+struct LanternModelFileView {
+	uint32 VerticesPerPrimitive;
+
+	// RTC_FORMAT_FLOAT3, with a 16-byte stride. The fourth float of each vertex is 1
+	const float *Positions;
+	uint64 NumPositions;
+	// RTC_FORMAT_UINT3 or RTC_FORMAT_UINT4, depending on VerticesPerPrimitive
+	const uint32 *Indices;
+	uint64 NumIndices;
+	// RTC_FORMAT_FLOAT3. nullptr if the model doesn't have any
+	const float *Normals;
+	uint64 NumNormals;
+	// RTC_FORMAT_FLOAT2. nullptr if the model doesn't have any
+	const float *TexCoords;
+	uint64 NumTexCoords;
+
+	// The emitter data from LanternModelFile. Only valid if HasEmitterData is true
+	bool HasEmitterData;
+	float SurfaceArea;
+	float3 BoundsMin;
+	float3 BoundsMax;
+	float3 NormalAxis;
+	float NormalCosTheta;
+	const float *TriangleAreas;
+	uint64 NumTriangles;
 };
 
 /**
  * Reads a LanternModelFile from a file pointer into the given struct
  *
+ * Reads both version 1 and version 2 files
+ *
  * @param file    The file to read from
  * @param lmf     The struct to read into
  */
 bool ReadLMF(FILE *file, LanternModelFile *lmf);
 /**
-* Writes the contents of a LanternModelFile to the given file
+ * Returns the version of an LMF file in memory, from its header
+ *
+ * @param data    The start of the file
+ * @param size    The size of the file in bytes
+ * @return        The version, or 0 if the data isn't an LMF file
+ */
+uint32 ReadLMFVersion(const byte *data, std::size_t size);
+/**
+ * Finds the sections of a version 2 LMF file that's in memory, and checks they're all inside it
+ *
+ * @param data    The start of the file. Must be at least 16-byte aligned
+ * @param size    The size of the file in bytes
+ * @param view    Filled with pointers into data
+ * @return        False if the file isn't a valid version 2 LMF file
+ */
+bool ReadLMFView(const byte *data, std::size_t size, LanternModelFileView *view);
+/**
+* Writes the contents of a LanternModelFile to the given file, as a version 2 LMF file
 *
 * @param file    The file to write into
 * @param lmf     The LanternModelFile to write
 */
 bool WriteLFM(FILE *file, LanternModelFile *lmf);
 
+/**
+ * Writes a version 2 LMF file a piece at a time, in any order, from any number of threads
+ *
+ * The size of each section has to be known up front, so the header can be written first. After that,
+ * the model never has to be in memory all at once, so models bigger than RAM can still be converted.
+ * The files never have emitter data, so the renderer calculates it when they're loaded
+ */
+class LMFWriter {
+public:
+	LMFWriter();
+	~LMFWriter();
+
+	LMFWriter(const LMFWriter &other) = delete;
+	LMFWriter &operator=(const LMFWriter &other) = delete;
+
+private:
+	FILE *m_file;
+	// Guards m_file, since each write has to seek first
+	std::mutex m_lock;
+	uint64 m_sectionOffsets[4];
+	uint64 m_sectionCounts[4];
+	uint64 m_fileSize;
+	bool m_failed;
+
+public:
+	/**
+	 * Creates the file, and writes its header
+	 *
+	 * @param filePath                The file to write
+	 * @param verticesPerPrimitive    3 for triangles, or 4 for quads
+	 * @param numPositions            The number of positions the model has
+	 * @param numIndices              The number of indices the model has
+	 * @param numNormals              The number of normals the model has. Either 0, or numPositions
+	 * @param numTexCoords            The number of texture coordinates the model has. Either 0, or numPositions
+	 * @return                        False if the file couldn't be created
+	 */
+	bool Open(const char *filePath, uint32 verticesPerPrimitive, uint64 numPositions, uint64 numIndices, uint64 numNormals, uint64 numTexCoords);
+	/**
+	 * Writes a range of positions
+	 *
+	 * @param first        The index of the first position in the range
+	 * @param positions    3 floats per position
+	 * @param count        The number of positions in the range
+	 */
+	bool WritePositions(uint64 first, const float *positions, uint64 count);
+	bool WriteIndices(uint64 first, const uint32 *indices, uint64 count);
+	/**
+	 * @param normals    3 floats per normal
+	 */
+	bool WriteNormals(uint64 first, const float *normals, uint64 count);
+	/**
+	 * @param texCoords    2 floats per texture coordinate
+	 */
+	bool WriteTexCoords(uint64 first, const float *texCoords, uint64 count);
+	/**
+	 * Pads the end of the file, and closes it. Every element of every section should have been written by now
+	 *
+	 * @return    False if anything failed to write
+	 */
+	bool Close();
+
+private:
+	bool WriteSection(uint section, uint64 first, const void *data, uint64 count);
+};
+
 
 } // End of namespace Lantern
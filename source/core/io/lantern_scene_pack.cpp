@@ -0,0 +1,171 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "io/lantern_scene_pack.h"
+
+#include "io/file_io.h"
+
+
+namespace Lantern {
+
+/*
+	struct LanternScenePack_FileFormat {
+		uint32 Magic;
+		uint32 Version;
+		uint64 DirectoryOffset;
+
+		// Each asset starts on a 4096-byte boundary. LTF levels are page aligned within their file,
+		// so this keeps them page aligned within the pack
+		byte Assets[];
+
+		// The directory goes last, since the scene can only be written once every asset has an index
+		struct {
+			uint64 NumAssets;
+			uint64 SceneSize;
+			struct {
+				uint64 Offset;
+				uint64 Size;
+			} Assets[NumAssets];
+			char Scene[SceneSize];
+		} Directory;
+	};
+*/
+
+static const std::size_t kLSPHeaderSize = 2 * sizeof(uint32) + sizeof(uint64);
+static const std::size_t kLSPAssetAlignment = 4096;
+
+bool IsLSPFile(const byte *data, std::size_t size) {
+	if (size < sizeof(uint32)) {
+		return false;
+	}
+
+	std::size_t offset = 0;
+	return VerifyMagicNumber(ReadValue<uint32>(data, &offset), 'L', 'S', 'P', '\0');
+}
+
+bool ReadLSPView(const byte *data, std::size_t size, LanternScenePackView *view) {
+	if (!IsLSPFile(data, size) || size < kLSPHeaderSize) {
+		return false;
+	}
+
+	std::size_t offset = sizeof(uint32);
+	uint32 version = ReadValue<uint32>(data, &offset);
+	if (version != kLSPVersion) {
+		printf("Unsupported scene pack version [%u]. Expected [%u]\n", version, kLSPVersion);
+		return false;
+	}
+	uint64 directoryOffset = ReadValue<uint64>(data, &offset);
+	if (directoryOffset < kLSPHeaderSize || directoryOffset > size || size - directoryOffset < 2 * sizeof(uint64)) {
+		return false;
+	}
+
+	offset = (std::size_t)directoryOffset;
+	uint64 numAssets = ReadValue<uint64>(data, &offset);
+	uint64 sceneSize = ReadValue<uint64>(data, &offset);
+	if (numAssets > (size - offset) / (2 * sizeof(uint64)) || sceneSize > size - offset - numAssets * 2 * sizeof(uint64)) {
+		return false;
+	}
+
+	view->Assets.resize((std::size_t)numAssets);
+	for (uint64 i = 0; i < numAssets; ++i) {
+		uint64 assetOffset = ReadValue<uint64>(data, &offset);
+		uint64 assetSize = ReadValue<uint64>(data, &offset);
+		if (assetOffset % kLSPAssetAlignment != 0 || assetOffset > directoryOffset || assetSize > directoryOffset - assetOffset) {
+			return false;
+		}
+
+		view->Assets[(std::size_t)i].Data = data + assetOffset;
+		view->Assets[(std::size_t)i].Size = assetSize;
+	}
+	view->SceneJSON = (const char *)data + offset;
+	view->SceneJSONSize = sceneSize;
+
+	return true;
+}
+
+LSPWriter::LSPWriter()
+		: m_file(nullptr),
+		  m_failed(false) {
+}
+
+LSPWriter::~LSPWriter() {
+	if (m_file != nullptr) {
+		fclose(m_file);
+	}
+}
+
+bool LSPWriter::Open(const char *filePath) {
+	m_file = fopen(filePath, "wb");
+	if (m_file == nullptr) {
+		return false;
+	}
+
+	// The directory offset is filled in by Close()
+	WriteUInt32(m_file, CreateMagicNumber('L', 'S', 'P', '\0'));
+	WriteUInt32(m_file, kLSPVersion);
+	WriteUInt64(m_file, 0);
+	m_failed = ferror(m_file) != 0;
+
+	return !m_failed;
+}
+
+FILE *LSPWriter::BeginAsset() {
+	byte padding[kLSPAssetAlignment] = {};
+	uint64 position = Tell(m_file);
+	uint64 start = (position + kLSPAssetAlignment - 1) / kLSPAssetAlignment * kLSPAssetAlignment;
+	Write(m_file, padding, (std::size_t)(start - position));
+
+	Asset asset;
+	asset.Offset = start;
+	asset.Size = 0;
+	m_assets.push_back(asset);
+
+	return m_file;
+}
+
+uint LSPWriter::EndAsset() {
+	if (ferror(m_file) != 0) {
+		m_failed = true;
+		m_assets.pop_back();
+		return (uint)-1;
+	}
+
+	m_assets.back().Size = Tell(m_file) - m_assets.back().Offset;
+	return (uint)(m_assets.size() - 1);
+}
+
+bool LSPWriter::Close(const std::string &sceneJSON) {
+	if (m_file == nullptr) {
+		return false;
+	}
+
+	uint64 directoryOffset = Tell(m_file);
+	WriteUInt64(m_file, m_assets.size());
+	WriteUInt64(m_file, sceneJSON.size());
+	for (const Asset &asset : m_assets) {
+		WriteUInt64(m_file, asset.Offset);
+		WriteUInt64(m_file, asset.Size);
+	}
+	Write(m_file, (void *)sceneJSON.data(), sceneJSON.size());
+
+	// Now the directory is written, point the header at it
+	if (!Seek(m_file, 2 * sizeof(uint32))) {
+		m_failed = true;
+	}
+	WriteUInt64(m_file, directoryOffset);
+
+	if (ferror(m_file) != 0) {
+		m_failed = true;
+	}
+	if (fclose(m_file) != 0) {
+		m_failed = true;
+	}
+	m_file = nullptr;
+
+	return !m_failed;
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,111 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+namespace Lantern {
+
+/**
+ * The version LSPWriter writes
+ */
+const uint32 kLSPVersion = 1;
+
+/**
+ * A file stored in a Lantern Scene Pack
+ */
+struct LanternScenePackAsset {
+	const byte *Data;
+	uint64 Size;
+};
+
+/**
+ * A Lantern Scene Pack that's mapped into memory
+ *
+ * Nothing is copied, so the pointers are only valid while the pack stays mapped
+ */
+struct LanternScenePackView {
+	// The scene, as JSON. Every file it uses is replaced by the index of an asset. Not null terminated
+	const char *SceneJSON;
+	uint64 SceneJSONSize;
+
+	// Each asset starts on a 4096-byte boundary, so LTF tiles stay page aligned
+	std::vector<LanternScenePackAsset> Assets;
+};
+
+/**
+ * Checks if data in memory starts like a Lantern Scene Pack
+ */
+bool IsLSPFile(const byte *data, std::size_t size);
+/**
+ * Reads the directory of a Lantern Scene Pack that's in memory, and checks every asset is inside it
+ *
+ * @param data    The start of the file. Must be at least 4096-byte aligned
+ * @param size    The size of the file in bytes
+ * @param view    Filled with pointers into data
+ * @return        False if the file isn't a valid Lantern Scene Pack
+ */
+bool ReadLSPView(const byte *data, std::size_t size, LanternScenePackView *view);
+
+/**
+ * Writes a Lantern Scene Pack. Assets are written one at a time, straight into the file, and the scene goes
+ * last, once every reference in it has been resolved to an asset
+ */
+class LSPWriter {
+public:
+	LSPWriter();
+	~LSPWriter();
+
+	LSPWriter(const LSPWriter &other) = delete;
+	LSPWriter &operator=(const LSPWriter &other) = delete;
+
+private:
+	struct Asset {
+		uint64 Offset;
+		uint64 Size;
+	};
+
+	FILE *m_file;
+	std::vector<Asset> m_assets;
+	bool m_failed;
+
+public:
+	/**
+	 * Creates the file, and writes its header
+	 *
+	 * @param filePath    The file to write
+	 * @return            False if the file couldn't be created
+	 */
+	bool Open(const char *filePath);
+	/**
+	 * Starts a new asset
+	 *
+	 * @return    The file to write the asset into, positioned at the start of the asset. Must be followed by EndAsset()
+	 */
+	FILE *BeginAsset();
+	/**
+	 * Finishes the asset started by BeginAsset()
+	 *
+	 * @return    The index of the asset, or -1 if it failed to write
+	 */
+	uint EndAsset();
+	/**
+	 * Writes the scene and the directory, and closes the file
+	 *
+	 * @param sceneJSON    The scene, with its file paths replaced by asset indices
+	 * @return             False if anything failed to write
+	 */
+	bool Close(const std::string &sceneJSON);
+};
+
+} // End of namespace Lantern
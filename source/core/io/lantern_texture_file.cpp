@@ -0,0 +1,351 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "io/lantern_texture_file.h"
+
+#include "io/block_compression.h"
+#include "io/file_io.h"
+
+#include "math/color_space.h"
+#include "math/half.h"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+namespace Lantern {
+
+/*
+	struct LanternTextureFile_FileFormat {
+		uint32 Magic;
+		uint32 Version;
+		uint32 Format;
+		uint32 XSize;
+		uint32 YSize;
+		uint32 TileSize;
+		uint32 NumLevels;
+		uint32 Reserved;
+
+		struct {
+			uint32 XSize;
+			uint32 YSize;
+			uint32 TilesX;
+			uint32 TilesY;
+			uint64 Offset;
+		} Levels[NumLevels];
+
+		// Padding up to the next 4096-byte boundary before each level
+		byte Tiles[];
+	};
+*/
+
+static const uint32 kLTFVersion = 1;
+static const std::size_t kLTFHeaderSize = 8 * sizeof(uint32);
+static const std::size_t kLTFLevelSize = 4 * sizeof(uint32) + sizeof(uint64);
+static const std::size_t kLTFLevelAlignment = 4096;
+
+void CalculateTextureLevels(uint xSize, uint ySize, std::vector<TextureLevel> *levels) {
+	levels->clear();
+
+	while (true) {
+		TextureLevel level;
+		level.XSize = xSize;
+		level.YSize = ySize;
+		level.TilesX = (xSize + kTextureTileSize - 1) / kTextureTileSize;
+		level.TilesY = (ySize + kTextureTileSize - 1) / kTextureTileSize;
+		level.Offset = 0;
+		levels->push_back(level);
+
+		if (xSize == 1 && ySize == 1) {
+			break;
+		}
+		xSize = std::max(xSize / 2, 1u);
+		ySize = std::max(ySize / 2, 1u);
+	}
+}
+
+TexelFormat DefaultTexelFormat(const char *imagePath, bool isLinear, bool compress) {
+	if (stbi_is_hdr(imagePath)) {
+		return TexelFormat::RGBA16F;
+	}
+	if (compress) {
+		return isLinear ? TexelFormat::BC1 : TexelFormat::BC1_sRGB;
+	}
+	return isLinear ? TexelFormat::RGBA8 : TexelFormat::RGBA8_sRGB;
+}
+
+/**
+ * Box filters one level of a mip chain into the next
+ *
+ * Each texel averages every texel of the previous level it overlaps, so odd sizes don't drop their last row or column
+ */
+static void Downsample(const std::vector<float> &texels, const TextureLevel &previous, const TextureLevel &level, std::vector<float> *out_texels) {
+	out_texels->assign((std::size_t)level.XSize * level.YSize * 4, 0.0f);
+
+	for (uint y = 0; y < level.YSize; ++y) {
+		uint y0 = y * previous.YSize / level.YSize;
+		uint y1 = std::max(((y + 1) * previous.YSize + level.YSize - 1) / level.YSize, y0 + 1);
+		for (uint x = 0; x < level.XSize; ++x) {
+			uint x0 = x * previous.XSize / level.XSize;
+			uint x1 = std::max(((x + 1) * previous.XSize + level.XSize - 1) / level.XSize, x0 + 1);
+
+			float *dest = &(*out_texels)[((std::size_t)y * level.XSize + x) * 4];
+			for (uint sourceY = y0; sourceY < y1; ++sourceY) {
+				for (uint sourceX = x0; sourceX < x1; ++sourceX) {
+					const float *source = &texels[((std::size_t)sourceY * previous.XSize + sourceX) * 4];
+					for (uint c = 0; c < 4; ++c) {
+						dest[c] += source[c];
+					}
+				}
+			}
+
+			float invCount = 1.0f / (float)((y1 - y0) * (x1 - x0));
+			for (uint c = 0; c < 4; ++c) {
+				dest[c] *= invCount;
+			}
+		}
+	}
+}
+
+static void EncodeTexel(const float *texel, TexelFormat format, byte *out_texel) {
+	switch (format) {
+	case TexelFormat::BC1:
+	case TexelFormat::BC1_sRGB:
+		// Encoded a block at a time, by EncodeTile()
+		break;
+	case TexelFormat::RGBA8:
+		for (uint c = 0; c < 4; ++c) {
+			out_texel[c] = (byte)(std::min(std::max(texel[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+		break;
+	case TexelFormat::RGBA8_sRGB:
+		for (uint c = 0; c < 3; ++c) {
+			out_texel[c] = (byte)(LinearToSRGB(std::min(std::max(texel[c], 0.0f), 1.0f)) * 255.0f + 0.5f);
+		}
+		out_texel[3] = (byte)(std::min(std::max(texel[3], 0.0f), 1.0f) * 255.0f + 0.5f);
+		break;
+	case TexelFormat::RGBA16F:
+	{
+		uint16 half[4];
+		for (uint c = 0; c < 4; ++c) {
+			half[c] = FloatToHalf(texel[c]);
+		}
+		memcpy(out_texel, half, sizeof(half));
+		break;
+	}
+	}
+}
+
+/**
+ * Encodes one tile of a level
+ *
+ * @param texels      The level, as linear RGBA floats
+ * @param level       The size of the level
+ * @param tileX       The x index of the tile
+ * @param tileY       The y index of the tile
+ * @param format      The format to encode the tile in
+ * @param out_tile    The encoded tile. BytesPerTile(format) bytes
+ */
+static void EncodeTile(const std::vector<float> &texels, const TextureLevel &level, uint tileX, uint tileY, TexelFormat format, byte *out_tile) {
+	if (!IsBlockCompressed(format)) {
+		// Tiles that hang off the edge repeat the edge texels
+		const std::size_t bytesPerTexel = BytesPerTexel(format);
+		for (uint y = 0; y < kTextureTileSize; ++y) {
+			uint sourceY = std::min(tileY * kTextureTileSize + y, level.YSize - 1);
+			for (uint x = 0; x < kTextureTileSize; ++x) {
+				uint sourceX = std::min(tileX * kTextureTileSize + x, level.XSize - 1);
+				EncodeTexel(&texels[((std::size_t)sourceY * level.XSize + sourceX) * 4], format, &out_tile[(y * kTextureTileSize + x) * bytesPerTexel]);
+			}
+		}
+		return;
+	}
+
+	// Gather each 4x4 block in the 8-bit encoded space, so the blocks are fit to the values they'll be decoded to
+	const uint blocksPerSide = kTextureTileSize / kBC1BlockSize;
+	for (uint blockY = 0; blockY < blocksPerSide; ++blockY) {
+		for (uint blockX = 0; blockX < blocksPerSide; ++blockX) {
+			float block[kBC1BlockSize * kBC1BlockSize * 3];
+			for (uint y = 0; y < kBC1BlockSize; ++y) {
+				uint sourceY = std::min(tileY * kTextureTileSize + blockY * kBC1BlockSize + y, level.YSize - 1);
+				for (uint x = 0; x < kBC1BlockSize; ++x) {
+					uint sourceX = std::min(tileX * kTextureTileSize + blockX * kBC1BlockSize + x, level.XSize - 1);
+					const float *texel = &texels[((std::size_t)sourceY * level.XSize + sourceX) * 4];
+					for (uint c = 0; c < 3; ++c) {
+						float value = std::min(std::max(texel[c], 0.0f), 1.0f);
+						block[(y * kBC1BlockSize + x) * 3 + c] = (format == TexelFormat::BC1_sRGB ? LinearToSRGB(value) : value) * 255.0f;
+					}
+				}
+			}
+
+			EncodeBC1Block(block, &out_tile[(blockY * blocksPerSide + blockX) * kBC1BlockBytes]);
+		}
+	}
+}
+
+bool CreateLTF(const char *imagePath, TexelFormat format, bool isLinear, LanternTextureFile *ltf) {
+	// Decode to linear RGBA floats
+	int xSize;
+	int ySize;
+	int numChannels;
+	std::vector<float> texels;
+	if (stbi_is_hdr(imagePath)) {
+		if (IsBlockCompressed(format)) {
+			printf("Unable to block compress \"%s\". BC1 can only store LDR images\n", imagePath);
+			return false;
+		}
+
+		float *data = stbi_loadf(imagePath, &xSize, &ySize, &numChannels, 4);
+		if (data == nullptr) {
+			printf("Unable to load image \"%s\": %s\n", imagePath, stbi_failure_reason());
+			return false;
+		}
+		texels.assign(data, data + (std::size_t)xSize * ySize * 4);
+		stbi_image_free(data);
+	} else {
+		byte *data = stbi_load(imagePath, &xSize, &ySize, &numChannels, 4);
+		if (data == nullptr) {
+			printf("Unable to load image \"%s\": %s\n", imagePath, stbi_failure_reason());
+			return false;
+		}
+
+		float toLinear[256];
+		for (uint i = 0; i < 256; ++i) {
+			toLinear[i] = isLinear ? (float)i / 255.0f : SRGBToLinear((float)i / 255.0f);
+		}
+
+		texels.resize((std::size_t)xSize * ySize * 4);
+		for (std::size_t i = 0; i < texels.size(); ++i) {
+			// Alpha is always linear
+			texels[i] = (i % 4) == 3 ? (float)data[i] / 255.0f : toLinear[data[i]];
+		}
+		stbi_image_free(data);
+	}
+
+	ltf->Format = format;
+	ltf->XSize = (uint32)xSize;
+	ltf->YSize = (uint32)ySize;
+	CalculateTextureLevels((uint)xSize, (uint)ySize, &ltf->Levels);
+	ltf->LevelData.resize(ltf->Levels.size());
+
+	const std::size_t bytesPerTile = BytesPerTile(format);
+	std::vector<float> nextTexels;
+	for (uint i = 0; i < (uint)ltf->Levels.size(); ++i) {
+		const TextureLevel &level = ltf->Levels[i];
+		if (i > 0) {
+			Downsample(texels, ltf->Levels[i - 1], level, &nextTexels);
+			texels.swap(nextTexels);
+		}
+
+		// Cut the level into tiles
+		std::vector<byte> &data = ltf->LevelData[i];
+		data.resize(level.TilesX * level.TilesY * bytesPerTile);
+		for (uint tileY = 0; tileY < level.TilesY; ++tileY) {
+			for (uint tileX = 0; tileX < level.TilesX; ++tileX) {
+				EncodeTile(texels, level, tileX, tileY, format, &data[(tileY * level.TilesX + tileX) * bytesPerTile]);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool ReadLTFHeader(const byte *data, std::size_t size, LanternTextureFile *ltf) {
+	if (size < kLTFHeaderSize) {
+		return false;
+	}
+
+	std::size_t offset = 0;
+	uint32 magic = ReadValue<uint32>(data, &offset);
+	if (!VerifyMagicNumber(magic, 'L', 'T', 'F', '\0')) {
+		return false;
+	}
+	uint32 version = ReadValue<uint32>(data, &offset);
+	if (version != kLTFVersion) {
+		printf("Unsupported LTF version [%u]. Expected [%u]\n", version, kLTFVersion);
+		return false;
+	}
+
+	uint32 format = ReadValue<uint32>(data, &offset);
+	ltf->XSize = ReadValue<uint32>(data, &offset);
+	ltf->YSize = ReadValue<uint32>(data, &offset);
+	uint32 tileSize = ReadValue<uint32>(data, &offset);
+	uint32 numLevels = ReadValue<uint32>(data, &offset);
+	ReadValue<uint32>(data, &offset);
+
+	if (format > (uint32)TexelFormat::BC1_sRGB || tileSize != kTextureTileSize || ltf->XSize == 0 || ltf->YSize == 0) {
+		return false;
+	}
+	ltf->Format = (TexelFormat)format;
+
+	// The level sizes are implied by the top level. Check the file agrees
+	CalculateTextureLevels(ltf->XSize, ltf->YSize, &ltf->Levels);
+	if (numLevels != ltf->Levels.size() || size < kLTFHeaderSize + numLevels * kLTFLevelSize) {
+		return false;
+	}
+
+	const std::size_t bytesPerTile = BytesPerTile(ltf->Format);
+	for (TextureLevel &level : ltf->Levels) {
+		uint32 xSize = ReadValue<uint32>(data, &offset);
+		uint32 ySize = ReadValue<uint32>(data, &offset);
+		uint32 tilesX = ReadValue<uint32>(data, &offset);
+		uint32 tilesY = ReadValue<uint32>(data, &offset);
+		level.Offset = ReadValue<uint64>(data, &offset);
+
+		if (xSize != level.XSize || ySize != level.YSize || tilesX != level.TilesX || tilesY != level.TilesY) {
+			return false;
+		}
+		if (level.Offset % kLTFLevelAlignment != 0 || level.Offset + (uint64)tilesX * tilesY * bytesPerTile > size) {
+			return false;
+		}
+	}
+
+	ltf->LevelData.clear();
+	return true;
+}
+
+bool WriteLTF(FILE *file, LanternTextureFile *ltf) {
+	// Lay out the levels first, so the offsets can go in the header
+	uint64 offset = kLTFHeaderSize + ltf->Levels.size() * kLTFLevelSize;
+	for (TextureLevel &level : ltf->Levels) {
+		offset = (offset + kLTFLevelAlignment - 1) / kLTFLevelAlignment * kLTFLevelAlignment;
+		level.Offset = offset;
+		offset += level.TilesX * level.TilesY * BytesPerTile(ltf->Format);
+	}
+
+	// Write the header
+	WriteUInt32(file, CreateMagicNumber('L', 'T', 'F', '\0'));
+	WriteUInt32(file, kLTFVersion);
+	WriteUInt32(file, (uint32)ltf->Format);
+	WriteUInt32(file, ltf->XSize);
+	WriteUInt32(file, ltf->YSize);
+	WriteUInt32(file, kTextureTileSize);
+	WriteUInt32(file, (uint32)ltf->Levels.size());
+	WriteUInt32(file, 0);
+
+	for (TextureLevel &level : ltf->Levels) {
+		WriteUInt32(file, level.XSize);
+		WriteUInt32(file, level.YSize);
+		WriteUInt32(file, level.TilesX);
+		WriteUInt32(file, level.TilesY);
+		WriteUInt64(file, level.Offset);
+	}
+
+	// Write the tiles
+	std::vector<byte> padding(kLTFLevelAlignment, 0);
+	uint64 position = kLTFHeaderSize + ltf->Levels.size() * kLTFLevelSize;
+	for (uint i = 0; i < (uint)ltf->Levels.size(); ++i) {
+		Write(file, &padding[0], (std::size_t)(ltf->Levels[i].Offset - position));
+		Write(file, &ltf->LevelData[i][0], ltf->LevelData[i].size());
+		position = ltf->Levels[i].Offset + ltf->LevelData[i].size();
+	}
+
+	return ferror(file) == 0;
+}
+
+} // End of namespace Lantern
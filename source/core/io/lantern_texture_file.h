@@ -0,0 +1,131 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+
+namespace Lantern {
+
+/**
+ * How the texels of a texture are stored. Every format has four channels
+ */
+enum class TexelFormat : uint32 {
+	// 8 bits per channel, linear
+	RGBA8 = 0,
+	// 8 bits per channel. The color channels are sRGB encoded, so the precision goes to the darks. Alpha is linear
+	RGBA8_sRGB = 1,
+	// Linear half-floats. For HDR images
+	RGBA16F = 2,
+	// BC1 blocks, with linear colors. Half a byte per texel, and no alpha
+	BC1 = 3,
+	// BC1 blocks, with sRGB encoded colors
+	BC1_sRGB = 4
+};
+
+inline bool IsBlockCompressed(TexelFormat format) {
+	return format == TexelFormat::BC1 || format == TexelFormat::BC1_sRGB;
+}
+
+/**
+ * The size of a texel, for formats that aren't block compressed
+ */
+inline std::size_t BytesPerTexel(TexelFormat format) {
+	return format == TexelFormat::RGBA16F ? 8 : 4;
+}
+
+// Textures are stored as square tiles of this many texels per side
+static const uint kTextureTileSize = 64;
+
+inline std::size_t BytesPerTile(TexelFormat format) {
+	if (IsBlockCompressed(format)) {
+		// 4x4 texel blocks of 8 bytes
+		return (kTextureTileSize / 4) * (kTextureTileSize / 4) * 8;
+	}
+	return kTextureTileSize * kTextureTileSize * BytesPerTexel(format);
+}
+
+struct TextureLevel {
+	uint32 XSize;
+	uint32 YSize;
+	uint32 TilesX;
+	uint32 TilesY;
+	// Where the level's tiles start in the file. Tiles are stored row by row
+	uint64 Offset;
+};
+
+/**
+ * A texture that has been mip-mapped and tiled
+ *
+ * Tiles that hang off the edge of a level repeat the edge texels, so every tile is full size
+ */
+struct LanternTextureFile {
+	TexelFormat Format;
+	uint32 XSize;
+	uint32 YSize;
+	std::vector<TextureLevel> Levels;
+	// The tiles of each level, one after another
+	std::vector<std::vector<byte> > LevelData;
+};
+
+/**
+ * Calculates the size of every level of a mip chain, halving down to a single texel
+ *
+ * @param xSize     The width of the top level
+ * @param ySize     The height of the top level
+ * @param levels    The levels. Their offsets are left at zero
+ */
+void CalculateTextureLevels(uint xSize, uint ySize, std::vector<TextureLevel> *levels);
+/**
+ * The format an image should be stored in, if the user doesn't choose one
+ *
+ * @param imagePath    The image
+ * @param isLinear     Whether an 8-bit image is already linear, rather than sRGB
+ * @param compress     Whether 8-bit images should be block compressed. HDR images never are
+ */
+TexelFormat DefaultTexelFormat(const char *imagePath, bool isLinear, bool compress);
+/**
+ * Decodes an image, and converts it into a mip-mapped, tiled texture
+ *
+ * The mip levels are filtered in linear space
+ *
+ * @param imagePath    The image to decode. Any format stb_image can read
+ * @param format       The format to store the texels in
+ * @param isLinear     If false, 8-bit images are treated as sRGB, and linearized before filtering.
+ *                     HDR images are always linear
+ * @param ltf          The texture
+ * @return             False if the image couldn't be decoded, or is HDR and the format is block compressed
+ */
+bool CreateLTF(const char *imagePath, TexelFormat format, bool isLinear, LanternTextureFile *ltf);
+
+/**
+ * Reads and validates the header of an LTF file that's been mapped into memory
+ *
+ * The tiles aren't read. They can be used straight from the mapping, at each level's Offset
+ *
+ * @param data    The start of the file
+ * @param size    The size of the file, in bytes
+ * @param ltf     The texture. LevelData is left empty
+ * @return        False if the file isn't a valid LTF file
+ */
+bool ReadLTFHeader(const byte *data, std::size_t size, LanternTextureFile *ltf);
+/**
+ * Writes a LanternTextureFile to the given file
+ *
+ * Each level starts on a 4096-byte boundary, so when the file is mapped into memory, every tile is aligned to its own
+ * size. Uncompressed tiles fill whole pages, but BC1 tiles are 2048 bytes, so two of them share each page
+ *
+ * @param file    The file to write into
+ * @param ltf     The LanternTextureFile to write
+ */
+bool WriteLTF(FILE *file, LanternTextureFile *ltf);
+
+} // End of namespace Lantern
@@ -0,0 +1,129 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "io/memory_mapped_file.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+
+namespace Lantern {
+
+#ifdef _WIN32
+
+MemoryMappedFile::MemoryMappedFile()
+		: m_data(nullptr),
+		  m_size(0),
+		  m_fileHandle(INVALID_HANDLE_VALUE),
+		  m_mappingHandle(nullptr) {
+}
+
+bool MemoryMappedFile::Open(const char *filePath) {
+	Close();
+
+	HANDLE file = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	m_fileHandle = file;
+	m_mappingHandle = mapping;
+	m_data = (const byte *)data;
+	m_size = (std::size_t)size.QuadPart;
+
+	return true;
+}
+
+void MemoryMappedFile::Close() {
+	if (m_data != nullptr) {
+		UnmapViewOfFile(m_data);
+		CloseHandle(m_mappingHandle);
+		CloseHandle(m_fileHandle);
+	}
+
+	m_data = nullptr;
+	m_size = 0;
+	m_fileHandle = INVALID_HANDLE_VALUE;
+	m_mappingHandle = nullptr;
+}
+
+#else
+
+MemoryMappedFile::MemoryMappedFile()
+		: m_data(nullptr),
+		  m_size(0) {
+}
+
+bool MemoryMappedFile::Open(const char *filePath) {
+	Close();
+
+	int file = open(filePath, O_RDONLY);
+	if (file < 0) {
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0) {
+		close(file);
+		return false;
+	}
+
+	void *data = mmap(nullptr, (std::size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping keeps the file alive, so we don't need the descriptor any more
+	close(file);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	m_data = (const byte *)data;
+	m_size = (std::size_t)fileStat.st_size;
+
+	return true;
+}
+
+void MemoryMappedFile::Close() {
+	if (m_data != nullptr) {
+		munmap((void *)m_data, m_size);
+	}
+
+	m_data = nullptr;
+	m_size = 0;
+}
+
+#endif
+
+MemoryMappedFile::~MemoryMappedFile() {
+	Close();
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,63 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+
+#include <cstddef>
+
+
+namespace Lantern {
+
+/**
+ * A read-only view of a whole file, mapped into memory
+ *
+ * Pages are read in by the OS as they're touched, and can be dropped again under memory pressure,
+ * so mapping a file costs almost nothing until its data is used
+ */
+class MemoryMappedFile {
+public:
+	MemoryMappedFile();
+	~MemoryMappedFile();
+
+	MemoryMappedFile(const MemoryMappedFile &other) = delete;
+	MemoryMappedFile &operator=(const MemoryMappedFile &other) = delete;
+
+private:
+	const byte *m_data;
+	std::size_t m_size;
+
+#ifdef _WIN32
+	void *m_fileHandle;
+	void *m_mappingHandle;
+#endif
+
+public:
+	/**
+	 * Maps a file. Any file that was already mapped is closed first
+	 *
+	 * @param filePath    The file to map
+	 * @return            False if the file couldn't be opened or mapped
+	 */
+	bool Open(const char *filePath);
+	void Close();
+
+	/**
+	 * The start of the file. Mappings start on a page boundary, so this is at least 4096-byte aligned
+	 */
+	const byte *Data() const {
+		return m_data;
+	}
+	std::size_t Size() const {
+		return m_size;
+	}
+	bool IsOpen() const {
+		return m_data != nullptr;
+	}
+};
+
+} // End of namespace Lantern
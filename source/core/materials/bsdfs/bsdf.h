@@ -14,7 +14,6 @@
 namespace Lantern {
 
 struct SurfaceInteraction;
-class UniformSampler;
 class Texture;
 
 class BSDF {
@@ -32,8 +31,22 @@ protected:
 	Texture *m_albedoTexture;
 
 public:
+	/**
+	 * The texture the integrator looks up into SurfaceInteraction::Albedo, before the bsdf is used
+	 */
+	Texture *GetAlbedoTexture() const {
+		return m_albedoTexture;
+	}
+
 	virtual float3 Eval(SurfaceInteraction &interaction) const = 0;
-	virtual void Sample(SurfaceInteraction &interaction, UniformSampler *sampler) const = 0;
+	/**
+	 * Samples an input direction, and the lobe it came from
+	 *
+	 * @param interaction    The interaction to sample. InputDirection and SampledLobe are written to it
+	 * @param uLobe          A uniform random number in [0, 1) for choosing the lobe
+	 * @param uDirection     A uniform random point in [0, 1)^2 for choosing the direction within the lobe
+	 */
+	virtual void Sample(SurfaceInteraction &interaction, float uLobe, float2 uDirection) const = 0;
 	virtual float Pdf(SurfaceInteraction &interaction) const = 0;
 };
 
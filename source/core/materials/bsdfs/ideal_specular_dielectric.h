@@ -7,11 +7,9 @@
 #pragma once
 
 #include "materials/bsdfs/bsdf.h"
-#include "materials/textures/texture.h"
 
 #include "integrator/surface_interaction.h"
 
-#include "math/uniform_sampler.h"
 #include <math/vector_math.h>
 
 
@@ -29,10 +27,10 @@ private:
 
 public:
 	float3 Eval(SurfaceInteraction &interaction) const override {
-		return m_albedoTexture->Sample(interaction.TexCoord);
+		return interaction.Albedo;
 	}
 
-	void Sample(SurfaceInteraction &interaction, UniformSampler *sampler) const override {
+	void Sample(SurfaceInteraction &interaction, float uLobe, float2 uDirection) const override {
 		float VdotN = dot(interaction.OutputDirection, interaction.Normal);
 		float IORo = m_ior;
 		if (VdotN < 0.0f) {
@@ -45,8 +43,7 @@ public:
 		float sinSquaredThetaT = SinSquaredThetaT(VdotN, eta);
 		float fresnel = Fresnel(interaction.IORi, IORo, VdotN, sinSquaredThetaT);
 		
-		float rand = sampler->NextFloat();
-		if (rand <= fresnel) {
+		if (uLobe <= fresnel) {
 			// Reflect
 			interaction.InputDirection = reflect(interaction.OutputDirection, interaction.Normal);
 			interaction.SampledLobe = BSDFLobe::SpecularReflection;
@@ -7,12 +7,13 @@
 #pragma once
 
 #include "materials/bsdfs/bsdf.h"
-#include "materials/textures/texture.h"
 
 #include "integrator/surface_interaction.h"
 
 #include "math/sampling.h"
 
+#include <algorithm>
+
 
 namespace Lantern {
 
@@ -23,18 +24,19 @@ public:
 	}
 
 public:
+	// Directions below the surface don't scatter. Lights can sample them, ie. the environment, so they're clamped to zero
 	float3 Eval(SurfaceInteraction &interaction) const override {
-		return m_albedoTexture->Sample(interaction.TexCoord) * (float)M_1_PI * dot(interaction.InputDirection, interaction.Normal);
+		return interaction.Albedo * (float)M_1_PI * std::max(dot(interaction.InputDirection, interaction.Normal), 0.0f);
 	}
 	
-	void Sample(SurfaceInteraction &interaction, UniformSampler *sampler) const override {
-		interaction.InputDirection = CosineSampleHemisphere(interaction.Normal, sampler);
+	void Sample(SurfaceInteraction &interaction, float uLobe, float2 uDirection) const override {
+		interaction.InputDirection = CosineSampleHemisphere(interaction.Normal, uDirection);
 		interaction.SampledLobe = BSDFLobe::Diffuse;
 
 	}
 
 	float Pdf(SurfaceInteraction &interaction) const override {
-		return dot(interaction.InputDirection, interaction.Normal) * (float)M_1_PI;
+		return std::max(dot(interaction.InputDirection, interaction.Normal), 0.0f) * (float)M_1_PI;
 	}
 };
 
@@ -7,11 +7,9 @@
 #pragma once
 
 #include "materials/bsdfs/bsdf.h"
-#include "materials/textures/texture.h"
 
 #include "integrator/surface_interaction.h"
 
-#include "math/uniform_sampler.h"
 #include "math/float_math.h"
 
 
@@ -25,10 +23,10 @@ public:
 
 public:
 	float3 Eval(SurfaceInteraction &interaction) const override {
-		return m_albedoTexture->Sample(interaction.TexCoord);
+		return interaction.Albedo;
 	}
 
-	void Sample(SurfaceInteraction &interaction, UniformSampler *sampler) const override {
+	void Sample(SurfaceInteraction &interaction, float uLobe, float2 uDirection) const override {
 		interaction.InputDirection = reflect(interaction.OutputDirection, interaction.Normal);
 		interaction.SampledLobe = BSDFLobe::SpecularReflection;
 	}
@@ -9,7 +9,6 @@
 #include "materials/media/medium.h"
 
 #include "math/int_types.h"
-#include "math/uniform_sampler.h"
 #include "math/sampling.h"
 
 #include <cmath>
@@ -28,8 +27,9 @@ private:
 	float m_scatteringCoefficient;
 
 public:
-	float SampleDistance(UniformSampler *sampler, float tFar, float *weight, float *pdf) const override {
-		float distance = -logf(sampler->NextFloat()) / m_scatteringCoefficient;
+	float SampleDistance(float u, float tFar, float *weight, float *pdf) const override {
+		// 1 - u keeps us away from log(0)
+		float distance = -logf(1.0f - u) / m_scatteringCoefficient;
 		if (distance >= tFar) {
 			*pdf = 1.0f;
 			return tFar;
@@ -38,9 +38,9 @@ public:
 		*pdf = std::exp(-m_scatteringCoefficient * distance);
 		return distance;
 	}
-	float3a SampleScatterDirection(UniformSampler *sampler, float3a &wo, float *pdf) const override {
+	float3a SampleScatterDirection(float2 u, float3a &wo, float *pdf) const override {
 		*pdf = 0.25f * (float)M_1_PI; // 1 / (4 * PI)
-		return UniformSampleSphere(sampler);
+		return UniformSampleSphere(u);
 	}
 
 	float ScatterDirectionPdf(float3a &wi, float3a &wo) const override {
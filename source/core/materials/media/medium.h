@@ -12,7 +12,6 @@
 
 
 namespace Lantern {
-class UniformSampler;
 
 class Medium {
 public:
@@ -27,9 +26,9 @@ protected:
 	const float3a m_absorptionCoefficient;
 
 public:
-	virtual float SampleDistance(UniformSampler *sampler, float tFar, float *weight, float *pdf) const = 0;
+	virtual float SampleDistance(float u, float tFar, float *weight, float *pdf) const = 0;
 
-	virtual float3a SampleScatterDirection(UniformSampler *sampler, float3a &wo, float *pdf) const = 0;
+	virtual float3a SampleScatterDirection(float2 u, float3a &wo, float *pdf) const = 0;
 	virtual float ScatterDirectionPdf(float3a &wi, float3a &wo) const = 0;
 
 	virtual float3 Transmission(float distance) const = 0;
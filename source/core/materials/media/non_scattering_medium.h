@@ -22,12 +22,12 @@ public:
 	}
 
 public:
-	float SampleDistance(UniformSampler *sampler, float tFar, float *weight, float *pdf) const override {
+	float SampleDistance(float u, float tFar, float *weight, float *pdf) const override {
 		*pdf = 1.0f;
 		return tFar;
 	}
 	
-	float3a SampleScatterDirection(UniformSampler *sampler, float3a &wo, float *pdf) const override {
+	float3a SampleScatterDirection(float2 u, float3a &wo, float *pdf) const override {
 		return wo;
 	}
 	float ScatterDirectionPdf(float3a &wi, float3a &wo) const override {
@@ -21,9 +21,14 @@ private:
 	float3 m_value;
 
 public:
-	float3 Sample(float2 texCoord) override {
+	float3 Sample(float2 texCoord, float footprint) override {
 		return m_value;
 	}
+	void SampleBatch(const float2 *texCoords, const float *footprints, uint count, float3 *out_values) override {
+		for (uint i = 0; i < count; ++i) {
+			out_values[i] = m_value;
+		}
+	}
 };
 
 } // End of namespace Lantern
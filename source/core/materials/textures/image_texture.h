@@ -12,6 +12,8 @@
 
 #include "scene/image_cache.h"
 
+#include <algorithm>
+
 
 namespace Lantern {
 
@@ -29,13 +31,26 @@ namespace Lantern {
 
 
 	public:
-		float3 Sample(float2 texCoord) override {
+		float3 Sample(float2 texCoord, float footprint) override {
 			// UV assume texCoords start in the bottom left
 			// Textures assume texCoords start in the top left
 			// So we have to invert texCoord.y to fix this discrepancy
 			texCoord.y = 1.0f - texCoord.y;
 
-			return m_imageCache->SampleImage(m_imageId, texCoord);
+			return m_imageCache->SampleImage(m_imageId, texCoord, footprint);
+		}
+		void SampleBatch(const float2 *texCoords, const float *footprints, uint count, float3 *out_values) override {
+			// Flip the texCoords a chunk at a time, so we don't need to allocate
+			const uint kChunkSize = 64;
+			float2 flipped[kChunkSize];
+			for (uint start = 0; start < count; start += kChunkSize) {
+				uint chunkSize = std::min(count - start, kChunkSize);
+				for (uint i = 0; i < chunkSize; ++i) {
+					flipped[i] = float2(texCoords[start + i].x, 1.0f - texCoords[start + i].y);
+				}
+
+				m_imageCache->SampleImage(m_imageId, flipped, footprints + start, chunkSize, out_values + start);
+			}
 		}
 	};
 
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include "math/int_types.h"
 #include "math/vector_types.h"
 
 
@@ -18,7 +19,30 @@ public:
 	virtual ~Texture() = default;
 
 public:
-	virtual float3 Sample(float2 texCoord) = 0;
+	/**
+	 * Samples the texture
+	 *
+	 * @param texCoord     Where to sample the texture
+	 * @param footprint    The width of the area being sampled, in texture coordinates. Textures with mip
+	 *                     levels use it to choose one
+	 * @return             The value of the texture
+	 */
+	virtual float3 Sample(float2 texCoord, float footprint) = 0;
+	/**
+	 * Samples the texture at many points at once. Gives the same results as calling Sample() on each point
+	 *
+	 * Textures that can share work between lookups, like image textures, override this
+	 *
+	 * @param texCoords     Where to sample the texture
+	 * @param footprints    The width of the area being sampled at each point, in texture coordinates
+	 * @param count         The number of points
+	 * @param out_values    Filled with the value of the texture at each point
+	 */
+	virtual void SampleBatch(const float2 *texCoords, const float *footprints, uint count, float3 *out_values) {
+		for (uint i = 0; i < count; ++i) {
+			out_values[i] = Sample(texCoords[i], footprints[i]);
+		}
+	}
 };
 
 } // End of namespace Lantern
@@ -13,7 +13,7 @@ namespace Lantern {
 
 	class UVTexture : public Texture {
 	public:
-		float3 Sample(float2 texCoord) override {
+		float3 Sample(float2 texCoord, float footprint) override {
 			return float3(texCoord.x, texCoord.y, 0.0f);
 		}
 	};
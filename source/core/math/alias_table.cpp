@@ -0,0 +1,90 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "math/alias_table.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace Lantern {
+
+void AliasTable::Build(const std::vector<float> &weights) {
+	const std::size_t n = weights.size();
+	m_buckets.resize(n);
+	if (n == 0) {
+		return;
+	}
+
+	// NaNs and infinities from a bad image would poison the sum, so they're dropped along with negative weights
+	std::vector<double> clamped(n);
+	double sum = 0.0;
+	for (std::size_t i = 0; i < n; ++i) {
+		clamped[i] = std::isfinite(weights[i]) ? std::max(weights[i], 0.0f) : 0.0;
+		sum += clamped[i];
+	}
+
+	// Scale the weights so the average bucket holds exactly 1
+	std::vector<double> scaled(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		double probability = sum > 0.0 ? clamped[i] / sum : 1.0 / n;
+		m_buckets[i].Pdf = (float)probability;
+		scaled[i] = probability * n;
+	}
+
+	std::vector<uint> small;
+	std::vector<uint> large;
+	for (uint i = 0; i < (uint)n; ++i) {
+		if (scaled[i] < 1.0) {
+			small.push_back(i);
+		} else {
+			large.push_back(i);
+		}
+	}
+
+	// Fill each under-full bucket with probability from an over-full one
+	while (!small.empty() && !large.empty()) {
+		uint s = small.back();
+		small.pop_back();
+		uint l = large.back();
+
+		m_buckets[s].Threshold = (float)scaled[s];
+		m_buckets[s].Alias = l;
+
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+
+	// Anything left is full, give or take rounding error
+	for (uint i : small) {
+		m_buckets[i].Threshold = 1.0f;
+		m_buckets[i].Alias = i;
+	}
+	for (uint i : large) {
+		m_buckets[i].Threshold = 1.0f;
+		m_buckets[i].Alias = i;
+	}
+}
+
+uint AliasTable::Sample(float u, float *pdf) const {
+	// The integer part of u * n picks the bucket. The fractional part picks between the bucket and its alias
+	const uint n = (uint)m_buckets.size();
+	// In double, so big tables still have bits left over to pick between the bucket and its alias
+	double scaled = (double)u * n;
+	uint bucket = std::min((uint)scaled, n - 1);
+	double remainder = scaled - bucket;
+
+	double threshold = m_buckets[bucket].Threshold;
+	uint index = remainder < threshold ? bucket : m_buckets[bucket].Alias;
+	*pdf = m_buckets[index].Pdf;
+
+	return index;
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,63 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+
+#include <vector>
+
+
+namespace Lantern {
+
+/**
+ * Samples an index in proportion to a set of weights in constant time
+ *
+ * Uses Vose's alias method. Every index gets a bucket of equal probability. A bucket keeps its own index
+ * with probability Threshold, and otherwise gives the sample to its Alias
+ */
+class AliasTable {
+public:
+	AliasTable() {}
+
+private:
+	struct Bucket {
+		float Threshold;
+		uint Alias;
+		// The probability of sampling this bucket's own index
+		float Pdf;
+	};
+	std::vector<Bucket> m_buckets;
+
+public:
+	/**
+	 * Builds the table. Negative, NaN and infinite weights are treated as zero
+	 *
+	 * If every weight is zero, the indices are sampled uniformly
+	 *
+	 * @param weights    The relative probability of sampling each index
+	 */
+	void Build(const std::vector<float> &weights);
+	/**
+	 * Samples an index
+	 *
+	 * @param u      A uniform random number in [0, 1)
+	 * @param pdf    The probability of the sampled index
+	 * @return       The sampled index
+	 */
+	uint Sample(float u, float *pdf) const;
+	/**
+	 * The probability that Sample() returns an index
+	 */
+	float Pdf(uint index) const {
+		return m_buckets[index].Pdf;
+	}
+	std::size_t Size() const {
+		return m_buckets.size();
+	}
+};
+
+} // End of namespace Lantern
@@ -0,0 +1,34 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include <cmath>
+
+
+namespace Lantern {
+
+/**
+ * Converts an sRGB encoded value in [0, 1] to linear
+ */
+inline float SRGBToLinear(float value) {
+	if (value <= 0.04045f) {
+		return value / 12.92f;
+	}
+	return powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+/**
+ * Converts a linear value in [0, 1] to sRGB encoding
+ */
+inline float LinearToSRGB(float value) {
+	if (value <= 0.0031308f) {
+		return value * 12.92f;
+	}
+	return 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+} // End of namespace Lantern
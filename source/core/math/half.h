@@ -0,0 +1,124 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+
+#include <cstring>
+#include <emmintrin.h>
+
+
+namespace Lantern {
+
+/**
+ * Converts a float to an IEEE 754 half-float, rounding to the nearest even
+ *
+ * Values too large for a half become infinity. NaNs stay NaN
+ */
+inline uint16 FloatToHalf(float value) {
+	uint32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32 sign = (bits >> 16) & 0x8000u;
+	uint32 exponent = (bits >> 23) & 0xFFu;
+	uint32 mantissa = bits & 0x7FFFFFu;
+
+	// Infinity and NaN
+	if (exponent == 0xFFu) {
+		return (uint16)(sign | 0x7C00u | (mantissa != 0 ? 0x200u : 0u));
+	}
+
+	int halfExponent = (int)exponent - 127 + 15;
+	if (halfExponent >= 31) {
+		return (uint16)(sign | 0x7C00u);
+	}
+
+	if (halfExponent <= 0) {
+		// Too small for a normal half. Shift the implicit 1 into the mantissa and make a subnormal
+		if (halfExponent < -10) {
+			return (uint16)sign;
+		}
+		mantissa |= 0x800000u;
+		uint32 shift = (uint32)(14 - halfExponent);
+		uint32 half = mantissa >> shift;
+		uint32 remainder = mantissa & ((1u << shift) - 1u);
+		uint32 halfway = 1u << (shift - 1u);
+		if (remainder > halfway || (remainder == halfway && (half & 1u) != 0)) {
+			++half;
+		}
+		return (uint16)(sign | half);
+	}
+
+	// Rounding up can carry into the exponent, which is still the correct result
+	uint32 half = ((uint32)halfExponent << 10) | (mantissa >> 13);
+	uint32 remainder = mantissa & 0x1FFFu;
+	if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u) != 0)) {
+		++half;
+	}
+	return (uint16)(sign | half);
+}
+
+/**
+ * Converts an IEEE 754 half-float to a float. Every half is exactly representable as a float
+ */
+inline float HalfToFloat(uint16 value) {
+	uint32 sign = (uint32)(value & 0x8000u) << 16;
+	uint32 exponent = (value >> 10) & 0x1Fu;
+	uint32 mantissa = value & 0x3FFu;
+
+	uint32 bits;
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			bits = sign;
+		} else {
+			// Subnormal. Shift the mantissa up until it has an implicit 1
+			exponent = 127 - 15 + 1;
+			while ((mantissa & 0x400u) == 0) {
+				mantissa <<= 1;
+				--exponent;
+			}
+			mantissa &= 0x3FFu;
+			bits = sign | (exponent << 23) | (mantissa << 13);
+		}
+	} else if (exponent == 0x1Fu) {
+		bits = sign | 0x7F800000u | (mantissa << 13);
+	} else {
+		bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+/**
+ * Converts four half-floats to floats at once. Gives exactly the same results as HalfToFloat()
+ *
+ * @param halves    The halves, zero-extended into the low 16 bits of each 32-bit lane
+ * @return          The floats
+ */
+inline __m128 HalfToFloat4(__m128i halves) {
+	__m128i sign = _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x8000)), 16);
+	__m128i exponentAndMantissa = _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x7FFF)), 13);
+
+	// Shifting a half's exponent and mantissa into place leaves the exponent biased by 15 instead of 127
+	__m128i rebiased = _mm_add_epi32(exponentAndMantissa, _mm_set1_epi32(112 << 23));
+
+	// Infinity and NaN have the largest exponent, which has to stay the largest
+	__m128i infOrNaN = _mm_cmpgt_epi32(exponentAndMantissa, _mm_set1_epi32(0x0F7FFFFF));
+	rebiased = _mm_add_epi32(rebiased, _mm_and_si128(infOrNaN, _mm_set1_epi32(112 << 23)));
+
+	// Subnormal halves get an implicit 1 added, and then subtracted back off as a float. Unlike the
+	// usual multiply by 2^112, this never makes a float subnormal, so it still works when denormals are flushed
+	__m128i subnormal = _mm_cmplt_epi32(exponentAndMantissa, _mm_set1_epi32(0x00800000));
+	__m128 subnormalValue = _mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(rebiased, _mm_set1_epi32(1 << 23))), _mm_castsi128_ps(_mm_set1_epi32(113 << 23)));
+	__m128 magnitude = _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(subnormal), subnormalValue), _mm_andnot_ps(_mm_castsi128_ps(subnormal), _mm_castsi128_ps(rebiased)));
+
+	return _mm_or_ps(magnitude, _mm_castsi128_ps(sign));
+}
+
+} // End of namespace Lantern
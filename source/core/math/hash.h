@@ -0,0 +1,44 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+
+
+namespace Lantern {
+
+// MurmurHash3
+inline uint HashMix(uint hash, uint k) {
+	const uint c1 = 0xcc9e2d51;
+	const uint c2 = 0x1b873593;
+	const uint r1 = 15;
+	const uint r2 = 13;
+	const uint m = 5;
+	const uint n = 0xe6546b64;
+
+	k *= c1;
+	k = (k << r1) | (k >> (32 - r1));
+	k *= c2;
+
+	hash ^= k;
+	hash = ((hash << r2) | (hash >> (32 - r2))) * m + n;
+
+	return hash;
+}
+
+// MurmurHash3
+inline uint HashFinalize(uint hash) {
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,240 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "math/pmj02_sampler.h"
+
+#include "math/uniform_sampler.h"
+#include "math/hash.h"
+
+#include <vector>
+
+
+namespace Lantern {
+
+// Enough for the finest strata of kSequenceLength points, which have sqrt(2 * kSequenceLength) per subquadrant at most
+static const uint kMaxStrataPerSubquadrant = 64;
+
+// Returns the top 'bits' bits of a fixed point value
+inline uint32 TopBits(uint32 value, uint bits) {
+	return bits == 0 ? 0u : value >> (32 - bits);
+}
+
+/**
+ * Tracks which elementary intervals of a set of 2^log2NumStrata points are occupied
+ */
+class ElementaryIntervals {
+public:
+	ElementaryIntervals(uint log2NumStrata)
+		: m_log2NumStrata(log2NumStrata),
+		  m_occupied((log2NumStrata + 1) << log2NumStrata, 0) {
+	}
+
+private:
+	uint m_log2NumStrata;
+	// For each shape, 2^k x 2^(log2NumStrata - k), a flag for each interval
+	std::vector<byte> m_occupied;
+
+public:
+	bool IsOccupied(uint32 x, uint32 y) const {
+		for (uint k = 0; k <= m_log2NumStrata; ++k) {
+			if (m_occupied[Index(k, x, y)] != 0) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+	void Occupy(uint32 x, uint32 y) {
+		for (uint k = 0; k <= m_log2NumStrata; ++k) {
+			m_occupied[Index(k, x, y)] = 1;
+		}
+	}
+
+	bool IsXStratumOccupied(uint stratum) const {
+		return m_occupied[(m_log2NumStrata << m_log2NumStrata) + stratum] != 0;
+	}
+	bool IsYStratumOccupied(uint stratum) const {
+		return m_occupied[stratum] != 0;
+	}
+
+private:
+	std::size_t Index(uint k, uint32 x, uint32 y) const {
+		uint32 cell = (TopBits(y, m_log2NumStrata - k) << k) | TopBits(x, k);
+		return ((std::size_t)k << m_log2NumStrata) + cell;
+	}
+};
+
+/**
+ * Places a new point in the given subquadrant of a grid cell, without landing in an occupied elementary interval
+ *
+ * @return    False if we couldn't find a free spot
+ */
+static bool GenerateSamplePoint(uint i, uint j, uint xHalf, uint yHalf, uint log2GridSize, uint log2NumStrata, ElementaryIntervals *intervals, UniformSampler *random, uint32 *point) {
+	// Only try the finest 1D strata that are still free
+	// This is much faster than blind rejection sampling
+	const uint stridePerSubquadrant = 1u << (log2NumStrata - log2GridSize - 1);
+	const uint xStart = ((i << 1) | xHalf) * stridePerSubquadrant;
+	const uint yStart = ((j << 1) | yHalf) * stridePerSubquadrant;
+
+	uint freeX[kMaxStrataPerSubquadrant];
+	uint freeY[kMaxStrataPerSubquadrant];
+	uint numFreeX = 0;
+	uint numFreeY = 0;
+	for (uint k = 0; k < stridePerSubquadrant; ++k) {
+		if (!intervals->IsXStratumOccupied(xStart + k)) {
+			freeX[numFreeX++] = xStart + k;
+		}
+		if (!intervals->IsYStratumOccupied(yStart + k)) {
+			freeY[numFreeY++] = yStart + k;
+		}
+	}
+	if (numFreeX == 0 || numFreeY == 0) {
+		return false;
+	}
+
+	for (uint attempt = 0; attempt < 10000; ++attempt) {
+		uint32 x = (freeX[random->NextDiscrete(numFreeX)] << (32 - log2NumStrata)) | (random->NextUInt() >> log2NumStrata);
+		uint32 y = (freeY[random->NextDiscrete(numFreeY)] << (32 - log2NumStrata)) | (random->NextUInt() >> log2NumStrata);
+
+		if (!intervals->IsOccupied(x, y)) {
+			intervals->Occupy(x, y);
+			point[0] = x;
+			point[1] = y;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Generates one pmj02 sequence, by repeatedly doubling it
+ *
+ * Going from N to 2N points, each new point goes in a subquadrant of the grid cell of one of the existing points,
+ * chosen so the first 2N points are still stratified
+ *
+ * @return    False if the generation got stuck. Trying again with different random numbers will fix it
+ */
+static bool GenerateSequence(UniformSampler *random, uint32 *points) {
+	points[0] = random->NextUInt();
+	points[1] = random->NextUInt();
+
+	uint log2N = 0;
+	for (uint n = 1; n < PMJ02Sampler::kSequenceLength; n *= 2, ++log2N) {
+		const uint log2NumStrata = log2N + 1;
+		ElementaryIntervals intervals(log2NumStrata);
+		for (uint s = 0; s < n; ++s) {
+			intervals.Occupy(points[s * 2], points[s * 2 + 1]);
+		}
+
+		if ((log2N & 1) == 0) {
+			// n is a power of 4. The existing points sit in a sqrt(n) x sqrt(n) grid
+			// Each new point goes in the diagonally opposite subquadrant of its "parent"
+			const uint log2GridSize = log2N / 2;
+			for (uint s = 0; s < n; ++s) {
+				uint i = TopBits(points[s * 2], log2GridSize);
+				uint j = TopBits(points[s * 2 + 1], log2GridSize);
+				uint xHalf = TopBits(points[s * 2], log2GridSize + 1) & 1;
+				uint yHalf = TopBits(points[s * 2 + 1], log2GridSize + 1) & 1;
+
+				if (!GenerateSamplePoint(i, j, 1 - xHalf, 1 - yHalf, log2GridSize, log2NumStrata, &intervals, random, &points[(n + s) * 2])) {
+					return false;
+				}
+			}
+		} else {
+			// The existing points fill two of the subquadrants of each cell of a sqrt(n / 2) x sqrt(n / 2) grid
+			// The new points fill the other two. We alternate between them, so every prefix stays balanced
+			const uint log2GridSize = (log2N - 1) / 2;
+			const uint half = n / 2;
+			for (uint s = 0; s < half; ++s) {
+				uint i = TopBits(points[s * 2], log2GridSize);
+				uint j = TopBits(points[s * 2 + 1], log2GridSize);
+				uint xHalf = TopBits(points[s * 2], log2GridSize + 1) & 1;
+				uint yHalf = TopBits(points[s * 2 + 1], log2GridSize + 1) & 1;
+
+				// Randomly pick the horizontally or vertically opposite subquadrant
+				if (random->NextFloat() < 0.5f) {
+					xHalf = 1 - xHalf;
+				} else {
+					yHalf = 1 - yHalf;
+				}
+				if (!GenerateSamplePoint(i, j, xHalf, yHalf, log2GridSize, log2NumStrata, &intervals, random, &points[(n + s) * 2])) {
+					return false;
+				}
+
+				// And the last one goes in the remaining subquadrant
+				if (!GenerateSamplePoint(i, j, 1 - xHalf, 1 - yHalf, log2GridSize, log2NumStrata, &intervals, random, &points[(n + half + s) * 2])) {
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+static std::vector<uint32> GenerateSequences() {
+	std::vector<uint32> sequences(PMJ02Sampler::kNumSequences * PMJ02Sampler::kSequenceLength * 2);
+
+	for (uint i = 0; i < PMJ02Sampler::kNumSequences; ++i) {
+		uint32 *points = &sequences[i * PMJ02Sampler::kSequenceLength * 2];
+
+		// Generation only rarely gets stuck. When it does, start over with a new stream
+		for (uint64 attempt = 0; ; ++attempt) {
+			UniformSampler random(i, attempt);
+			if (GenerateSequence(&random, points)) {
+				break;
+			}
+		}
+	}
+
+	return sequences;
+}
+
+PMJ02Sampler::PMJ02Sampler(uint seed)
+		: m_seed(seed),
+		  m_pixelHash(0u),
+		  m_sampleIndex(0u) {
+	// C++11 guarantees this is only initialized once, even if multiple threads get here at the same time
+	static const std::vector<uint32> sequences = GenerateSequences();
+	m_sequences = &sequences[0];
+}
+
+void PMJ02Sampler::StartPixelSample(uint x, uint y, uint sampleIndex) {
+	m_pixelHash = HashFinalize(HashMix(HashMix(m_seed, x), y));
+	m_sampleIndex = sampleIndex;
+}
+
+const uint32 *PMJ02Sampler::GetPoint(uint dimension, uint32 *scrambleX, uint32 *scrambleY) const {
+	uint hash = HashFinalize(HashMix(m_pixelHash, dimension));
+
+	// Past the end of a sequence, switch to another one
+	uint round = m_sampleIndex / kSequenceLength;
+	uint sequence = HashFinalize(HashMix(hash, round)) % kNumSequences;
+
+	// XOR scrambling flips the same bits of every point, so it keeps the stratification
+	*scrambleX = HashFinalize(HashMix(hash, 1u));
+	*scrambleY = HashFinalize(HashMix(hash, 2u));
+
+	return &m_sequences[(sequence * kSequenceLength + m_sampleIndex % kSequenceLength) * 2];
+}
+
+float PMJ02Sampler::Get1D(uint dimension) {
+	uint32 scrambleX, scrambleY;
+	const uint32 *point = GetPoint(dimension, &scrambleX, &scrambleY);
+
+	// The 1D projections of a pmj02 sequence are stratified too
+	return FixedPointToFloat(point[0] ^ scrambleX);
+}
+
+float2 PMJ02Sampler::Get2D(uint dimension) {
+	uint32 scrambleX, scrambleY;
+	const uint32 *point = GetPoint(dimension, &scrambleX, &scrambleY);
+
+	return float2(FixedPointToFloat(point[0] ^ scrambleX), FixedPointToFloat(point[1] ^ scrambleY));
+}
+
+} // End of namespace Lantern
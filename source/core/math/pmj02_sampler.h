@@ -0,0 +1,52 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+#include "math/vector_types.h"
+#include "math/sampler.h"
+
+
+namespace Lantern {
+
+/**
+ * Progressive multi-jittered (0,2) sequences
+ *
+ * Every power of two prefix of a pmj02 sequence is stratified in every elementary interval,
+ * so the samples of a pixel stay well distributed no matter when rendering stops.
+ * The sequences are generated once, the first time a PMJ02Sampler is created. Each pixel and
+ * dimension picks one of the sequences, and decorrelates it with random digit scrambling
+ *
+ * Based on Per Christensen, Andrew Kensler, and Charlie Kilpatrick's "Progressive Multi-Jittered Sample Sequences", EGSR 2018
+ * https://graphics.pixar.com/library/ProgressiveMultiJitteredSampling/
+ */
+class PMJ02Sampler : public Sampler {
+public:
+	PMJ02Sampler(uint seed = 0u);
+
+public:
+	static const uint kNumSequences = 32;
+	static const uint kSequenceLength = 1024;
+
+private:
+	// kNumSequences * kSequenceLength points, as x, y pairs of 32 bit fixed point values
+	const uint32 *m_sequences;
+
+	uint m_seed;
+	uint m_pixelHash;
+	uint m_sampleIndex;
+
+public:
+	void StartPixelSample(uint x, uint y, uint sampleIndex) override;
+	float Get1D(uint dimension) override;
+	float2 Get2D(uint dimension) override;
+
+private:
+	const uint32 *GetPoint(uint dimension, uint32 *scrambleX, uint32 *scrambleY) const;
+};
+
+} // End of namespace Lantern
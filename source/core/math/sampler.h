@@ -0,0 +1,86 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+#include "math/vector_types.h"
+
+
+namespace Lantern {
+
+/**
+ * The interface for generating the random numbers of a path
+ *
+ * Every sample of a pixel is a point in a high-dimensional space. Each decision the
+ * integrator makes (the filter offset, which light to sample, the bsdf direction, etc.)
+ * reads its own dimension of that point, as laid out in SampleDimension. This lets the
+ * low-discrepancy samplers stratify each decision across the samples of a pixel
+ */
+class Sampler {
+public:
+	virtual ~Sampler() = default;
+
+public:
+	/**
+	 * Starts a new sample for a pixel
+	 *
+	 * @param x              The x coordinate of the pixel
+	 * @param y              The y coordinate of the pixel
+	 * @param sampleIndex    The index of this sample within the pixel. The low-discrepancy samplers work best
+	 *                       when the indices of a pixel are consecutive, starting from zero
+	 */
+	virtual void StartPixelSample(uint x, uint y, uint sampleIndex) = 0;
+	/**
+	 * @return    The value of the current sample in the given dimension, in [0, 1)
+	 */
+	virtual float Get1D(uint dimension) = 0;
+	/**
+	 * @return    The values of the current sample in the dimensions [dimension, dimension + 1], in [0, 1)^2
+	 */
+	virtual float2 Get2D(uint dimension) = 0;
+};
+
+enum class SamplerType {
+	Uniform,
+	Sobol,
+	PMJ02
+};
+
+/**
+ * The dimensions each decision of a path reads from the Sampler
+ */
+namespace SampleDimension {
+enum Type {
+	CameraFilter = 0,      // 2D
+
+	// Each bounce gets its own block of PerBounce dimensions, starting at FirstBounce
+	// The values below are offsets into that block
+	FirstBounce = 2,
+	MediumDistance = 0,    // 1D
+	MediumDirection = 1,   // 2D
+	LightSelection = 3,    // 1D
+	LightPosition = 4,     // 2D
+	BSDFLobe = 6,          // 1D
+	BSDFDirection = 7,     // 2D
+	RussianRoulette = 9,   // 1D
+	LightElement = 10,     // 1D
+	PerBounce = 11
+};
+}
+
+inline uint BounceDimension(uint bounce, SampleDimension::Type offset) {
+	return SampleDimension::FirstBounce + bounce * SampleDimension::PerBounce + offset;
+}
+
+// Converts 32 bits of fixed point to a float in [0, 1)
+// Only the top 24 bits fit in a float's mantissa. Dropping the rest, rather than rounding,
+// means the result can never round up to 1, or into the next stratum
+inline float FixedPointToFloat(uint32 value) {
+	return (value >> 8) * 5.9604644775390625e-8f; // 1 / 2^24
+}
+
+} // End of namespace Lantern
@@ -7,7 +7,6 @@
 #pragma once
 
 #include "math/vector_types.h"
-#include "math/uniform_sampler.h"
 #include "math/vector_math.h"
 
 
@@ -28,10 +27,9 @@ inline float PowerHeuristic(uint numf, float fPdf, uint numg, float gPdf, uint n
 	return (f * f) / (f * f + g * g + h * h);
 }
 
-inline void UniformSampleDisc(UniformSampler *sampler, float radius, float *x, float *y) {
-	float rand = sampler->NextFloat();
-	float r = sqrtf(rand) * radius;
-	float theta = sampler->NextFloat() * 2.0f * (float)M_PI;
+inline void UniformSampleDisc(float2 u, float radius, float *x, float *y) {
+	float r = sqrtf(u.x) * radius;
+	float theta = u.y * 2.0f * (float)M_PI;
 
 	*x = r * cosf(theta);
 	*y = r * sinf(theta);
@@ -43,15 +41,14 @@ inline void UniformSampleDisc(UniformSampler *sampler, float radius, float *x, f
 * Based on http://www.rorydriscoll.com/2009/01/07/better-sampling/
 *
 * @param normal     The normal that defines the hemisphere
-*
-* @param sampler    The sampler to use for internal random number generation
+* @param u          A uniform random point in [0, 1)^2
 * @return           A cosine weighted random direction in the hemisphere
 */
-inline float3a CosineSampleHemisphere(float3a &normal, UniformSampler *sampler) {
+inline float3a CosineSampleHemisphere(float3a &normal, float2 u) {
 	// Create coordinates in the local coordinate system
 	float x;
 	float y;
-	UniformSampleDisc(sampler, 1.0f, &x, &y);
+	UniformSampleDisc(u, 1.0f, &x, &y);
 
 	// Project z up to the unit hemisphere
 	float z = sqrtf(1.0f - x * x - y * y);
@@ -59,10 +56,10 @@ inline float3a CosineSampleHemisphere(float3a &normal, UniformSampler *sampler)
 	return normalize(RotateToWorld(x, y, z, normal));
 }
 
-inline float3a UniformSampleHemisphere(float3a &normal, UniformSampler *sampler) {
-	float cosPhi = sampler->NextFloat();
+inline float3a UniformSampleHemisphere(float3a &normal, float2 u) {
+	float cosPhi = u.x;
 	float sinPhi = sqrt(1.0f - cosPhi * cosPhi);
-	float theta = 2 * (float)M_PI * sampler->NextFloat();
+	float theta = 2 * (float)M_PI * u.y;
 
 	float x = sinPhi * sinf(theta);
 	float y = cosPhi;
@@ -71,10 +68,10 @@ inline float3a UniformSampleHemisphere(float3a &normal, UniformSampler *sampler)
 	return normalize(RotateToWorld(x, y, z, normal));
 }
 
-inline float3a UniformSampleSphere(UniformSampler *sampler) {
-	float cosPhi = 2.0f * sampler->NextFloat() - 1.0f;
+inline float3a UniformSampleSphere(float2 u) {
+	float cosPhi = 2.0f * u.x - 1.0f;
 	float sinPhi = std::sqrt(1.0f - cosPhi * cosPhi);
-	float theta = 2 * (float)M_PI * sampler->NextFloat();
+	float theta = 2 * (float)M_PI * u.y;
 
 	float x = sinPhi * sinf(theta);
 	float y = cosPhi;
@@ -83,4 +80,18 @@ inline float3a UniformSampleSphere(UniformSampler *sampler) {
 	return float3a(x, y, z);
 }
 
+/**
+ * Creates a uniform random point on a triangle
+ *
+ * @param u     A uniform random point in [0, 1)^2
+ * @param b0    The barycentric coordinate of the first vertex
+ * @param b1    The barycentric coordinate of the second vertex. The third is 1 - b0 - b1
+ */
+inline void UniformSampleTriangle(float2 u, float *b0, float *b1) {
+	float su0 = sqrtf(u.x);
+
+	*b0 = 1.0f - su0;
+	*b1 = u.y * su0;
+}
+
 } // End of namespace Lantern
@@ -0,0 +1,103 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+#include "math/vector_types.h"
+#include "math/sampler.h"
+#include "math/hash.h"
+
+
+namespace Lantern {
+
+/**
+ * An Owen-scrambled Sobol sequence
+ *
+ * Every pair of dimensions is the 2D Sobol sequence, with its own hashed Owen scrambling and
+ * sample order. This "padding" keeps the 2D projections well stratified, without needing a table
+ * of direction numbers for thousands of dimensions
+ *
+ * Based on Brent Burley's "Practical Hash-based Owen Scrambling", JCGT 2020
+ * http://www.jcgt.org/published/0009/04/01/
+ */
+class SobolSampler : public Sampler {
+public:
+	SobolSampler(uint seed = 0u)
+		: m_seed(seed),
+		  m_pixelHash(0u),
+		  m_sampleIndex(0u) {
+	}
+
+private:
+	uint m_seed;
+	uint m_pixelHash;
+	uint m_sampleIndex;
+
+public:
+	void StartPixelSample(uint x, uint y, uint sampleIndex) override {
+		m_pixelHash = HashFinalize(HashMix(HashMix(m_seed, x), y));
+		m_sampleIndex = sampleIndex;
+	}
+
+	float Get1D(uint dimension) override {
+		uint32 seed = HashFinalize(HashMix(m_pixelHash, dimension));
+		uint32 index = NestedUniformScramble(m_sampleIndex, HashFinalize(HashMix(seed, 0u)));
+
+		return FixedPointToFloat(NestedUniformScramble(ReverseBits(index), HashFinalize(HashMix(seed, 1u))));
+	}
+
+	float2 Get2D(uint dimension) override {
+		uint32 seed = HashFinalize(HashMix(m_pixelHash, dimension));
+		uint32 index = NestedUniformScramble(m_sampleIndex, HashFinalize(HashMix(seed, 0u)));
+
+		uint32 x = NestedUniformScramble(ReverseBits(index), HashFinalize(HashMix(seed, 1u)));
+		uint32 y = NestedUniformScramble(SobolDimension1(index), HashFinalize(HashMix(seed, 2u)));
+
+		return float2(FixedPointToFloat(x), FixedPointToFloat(y));
+	}
+
+private:
+	static uint32 ReverseBits(uint32 value) {
+		value = (value << 16) | (value >> 16);
+		value = ((value & 0x00FF00FFu) << 8) | ((value & 0xFF00FF00u) >> 8);
+		value = ((value & 0x0F0F0F0Fu) << 4) | ((value & 0xF0F0F0F0u) >> 4);
+		value = ((value & 0x33333333u) << 2) | ((value & 0xCCCCCCCCu) >> 2);
+		value = ((value & 0x55555555u) << 1) | ((value & 0xAAAAAAAAu) >> 1);
+
+		return value;
+	}
+
+	// The second dimension of the Sobol sequence. The first is just ReverseBits()
+	static uint32 SobolDimension1(uint32 index) {
+		uint32 result = 0u;
+		for (uint32 v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+			if ((index & 1u) != 0) {
+				result ^= v;
+			}
+		}
+
+		return result;
+	}
+
+	// Samuli Laine and Tero Karras' hash, with Burley's improved constants
+	// It only ever flips a bit based on the bits below it, so it's an Owen scramble of the reversed bits
+	static uint32 LaineKarrasPermutation(uint32 value, uint32 seed) {
+		value += seed;
+		value ^= value * 0x6c50b47cu;
+		value ^= value * 0xb82f1e52u;
+		value ^= value * 0xc7afe638u;
+		value ^= value * 0x8d22f6e6u;
+
+		return value;
+	}
+
+	static uint32 NestedUniformScramble(uint32 value, uint32 seed) {
+		return ReverseBits(LaineKarrasPermutation(ReverseBits(value), seed));
+	}
+};
+
+} // End of namespace Lantern
@@ -8,11 +8,17 @@
 
 #include "math/int_types.h"
 #include "math/vector_types.h"
+#include "math/sampler.h"
 
 
 namespace Lantern {
 
-class UniformSampler {
+/**
+ * A plain stream of pseudo-random numbers
+ *
+ * As a Sampler, it ignores the pixel and the dimension, and just returns the next numbers of the stream
+ */
+class UniformSampler : public Sampler {
 public:
 	UniformSampler(uint64 seed, uint64 sequence = 0)
 		: m_state(seed),
@@ -56,6 +62,15 @@ public:
 		return (uint)(range * NextFloat());
 	}
 
+	void StartPixelSample(uint x, uint y, uint sampleIndex) override {
+	}
+	float Get1D(uint dimension) override {
+		return NextFloat();
+	}
+	float2 Get2D(uint dimension) override {
+		return NextFloat2();
+	}
+
 private:
 	// Note: Could replace this with memcpy, which gcc optimizes to the same assembly
 	// as the code below. I'm not sure how other compiler treat it though, since it's
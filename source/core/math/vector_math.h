@@ -30,6 +30,13 @@ inline bool any(float3a &a) {
 
 float3a RotateToWorld(float x, float y, float z, float3a &normal);
 
+/**
+ * The perceived brightness of a linear RGB color, using the Rec. 709 weights
+ */
+inline float Luminance(const float3 &color) {
+	return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+}
+
 inline float3a reflect(const float3a &V, const float3a &N) {
 	return 2.0f * dot(V, N) * N - V;
 }
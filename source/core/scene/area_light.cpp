@@ -15,98 +15,114 @@
 
 namespace Lantern {
 
-float3 AreaLight::SampleLi(UniformSampler *sampler, Scene *scene, SurfaceInteraction &interaction, float *pdf) const {
-	// Generate a random point on the great circle of the bounding sphere that is oriented towards the origin
-	float x, y;
-	UniformSampleDisc(sampler, m_boundingSphere.w, &x, &y);
-	
-	// Calculate the paramaters of the great circle
-	float3a circleDirection = (float3a)m_boundingSphere.xyz() - interaction.Position;
-	float distance = length(circleDirection);
-	float3a circleNormal = normalize(circleDirection);
-
-	float3a point = RotateToWorld(x, y, distance - m_boundingSphere.w, circleNormal);
-	float3a direction = normalize(point);
-	interaction.InputDirection = direction;
-
-	// Check that the point on the circle is above the horizon
-	if (dot(direction, interaction.Normal) <= 0.0f) {
-		*pdf = 0.0f;
-		return float3(0.0f);
+AreaLight::AreaLight(float3 color, float radiantPower, float area, const float3a *vertices, const uint *indices, uint verticesPerPrimitive, const std::vector<float> &triangleAreas)
+	: Light(color * radiantPower * (float)M_1_PI / area),
+	  m_area(area),
+	  m_vertices(vertices),
+	  m_indices(indices),
+	  m_verticesPerPrimitive(verticesPerPrimitive),
+	  m_boundsMin(embree::inf),
+	  m_boundsMax(embree::neg_inf) {
+	m_triangleDistribution.Build(triangleAreas);
+
+	bool firstNormal = true;
+	for (uint i = 0; i < (uint)triangleAreas.size(); ++i) {
+		float3a v0, v1, v2;
+		GetTriangle(i, &v0, &v1, &v2);
+
+		m_boundsMin = min(m_boundsMin, min(float3(v0.x, v0.y, v0.z), min(float3(v1.x, v1.y, v1.z), float3(v2.x, v2.y, v2.z))));
+		m_boundsMax = max(m_boundsMax, max(float3(v0.x, v0.y, v0.z), max(float3(v1.x, v1.y, v1.z), float3(v2.x, v2.y, v2.z))));
+
+		float3a n = cross(v1 - v0, v2 - v0);
+		float nLength = length(n);
+		if (nLength == 0.0f) {
+			continue;
+		}
+
+		DirectionCone cone(float3(n.x, n.y, n.z) / nLength, 1.0f);
+		m_normals = firstNormal ? cone : DirectionCone::Union(m_normals, cone);
+		firstNormal = false;
 	}
 
-	// Make sure there's nothing occluding us
-	RTC_ALIGN(16) RTCRayHit rayHit;
-	memset(&rayHit, 0, sizeof(rayHit));
-
-	rayHit.ray.org_x = interaction.Position.x;
-	rayHit.ray.org_y = interaction.Position.y;
-	rayHit.ray.org_z = interaction.Position.z;
-
-	rayHit.ray.dir_x = direction.x;
-	rayHit.ray.dir_y = direction.y;
-	rayHit.ray.dir_z = direction.z;
-
-	rayHit.ray.tnear = 0.001f;
-	rayHit.ray.tfar = embree::inf;
-	rayHit.ray.mask = 0xFFFFFFFF;
-
-	rayHit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
-	rayHit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
-	rayHit.hit.primID = RTC_INVALID_GEOMETRY_ID;
-
-	scene->Intersect(rayHit);
-	if (rayHit.hit.geomID != m_geomId) {
-		*pdf = 0.0f;
-		return float3(0.0f);
+	if (firstNormal) {
+		m_normals = DirectionCone::EntireSphere();
 	}
+}
 
-	// Calculate the pdf
-	float3a intersectionPoint = float3a(rayHit.ray.org_x, rayHit.ray.org_y, rayHit.ray.org_z) + normalize(float3a(rayHit.ray.dir_x, rayHit.ray.dir_y, rayHit.ray.dir_z)) * rayHit.ray.tfar;
-	float distanceSquared = sqr_length(intersectionPoint - interaction.Position);
-	*pdf = distanceSquared / (std::abs(dot(normalize(scene->InterpolateNormal(rayHit.hit.geomID, rayHit.hit.primID, rayHit.hit.u, rayHit.hit.v)), -direction)) * m_area);
+AreaLight::AreaLight(float3 color, float radiantPower, float area, const float3a *vertices, const uint *indices, uint verticesPerPrimitive, const std::vector<float> &triangleAreas,
+                     float3 boundsMin, float3 boundsMax, DirectionCone normals)
+	: Light(color * radiantPower * (float)M_1_PI / area),
+	  m_area(area),
+	  m_vertices(vertices),
+	  m_indices(indices),
+	  m_verticesPerPrimitive(verticesPerPrimitive),
+	  m_boundsMin(boundsMin),
+	  m_boundsMax(boundsMax),
+	  m_normals(normals) {
+	m_triangleDistribution.Build(triangleAreas);
+}
 
-	// Return the full radiance value
-	// The value will be attenuated by the BRDF
-	return m_radiance;
+void AreaLight::GetTriangle(uint triangle, float3a *v0, float3a *v1, float3a *v2) const {
+	if (m_verticesPerPrimitive == 4) {
+		const uint *quad = &m_indices[(triangle / 2) * 4];
+		if ((triangle & 1) == 0) {
+			*v0 = m_vertices[quad[0]];
+			*v1 = m_vertices[quad[1]];
+			*v2 = m_vertices[quad[3]];
+		} else {
+			*v0 = m_vertices[quad[2]];
+			*v1 = m_vertices[quad[3]];
+			*v2 = m_vertices[quad[1]];
+		}
+	} else {
+		*v0 = m_vertices[m_indices[triangle * 3]];
+		*v1 = m_vertices[m_indices[triangle * 3 + 1]];
+		*v2 = m_vertices[m_indices[triangle * 3 + 2]];
+	}
 }
 
-float AreaLight::PdfLi(Scene *scene, SurfaceInteraction &interaction) const {
-	// Check that wi is above the horizon
-	if (dot(interaction.InputDirection, interaction.Normal) <= 0.0f) {
-		return 0.0f;
+float3 AreaLight::SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const {
+	if (m_triangleDistribution.Size() == 0) {
+		*pdf = 0.0f;
+		return float3(0.0f);
 	}
 
-	// Make sure there's nothing occluding us
-	RTC_ALIGN(16) RTCRayHit rayHit;
-	memset(&rayHit, 0, sizeof(rayHit));
+	// Pick a triangle in proportion to its area, then a uniform point on it
+	// Together, that's a uniform point on the whole surface
+	float trianglePdf;
+	uint triangle = m_triangleDistribution.Sample(uElement, &trianglePdf);
 
-	rayHit.ray.org_x = interaction.Position.x;
-	rayHit.ray.org_y = interaction.Position.y;
-	rayHit.ray.org_z = interaction.Position.z;
+	float3a v0, v1, v2;
+	GetTriangle(triangle, &v0, &v1, &v2);
 
-	rayHit.ray.dir_x = interaction.InputDirection.x;
-	rayHit.ray.dir_y = interaction.InputDirection.y;
-	rayHit.ray.dir_z = interaction.InputDirection.z;
+	float b0, b1;
+	UniformSampleTriangle(u, &b0, &b1);
+	float3a point = b0 * v0 + b1 * v1 + (1.0f - b0 - b1) * v2;
 
-	rayHit.ray.tnear = 0.001f;
-	rayHit.ray.tfar = embree::inf;
-	rayHit.ray.mask = 0xFFFFFFFF;
+	return ConnectUniformAreaSample(point, cross(v1 - v0, v2 - v0), m_area, interaction, pdf, shadowRay);
+}
 
-	rayHit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
-	rayHit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
-	rayHit.hit.primID = RTC_INVALID_GEOMETRY_ID;
+float AreaLight::PdfLi(Scene *scene, const RTCRayHit &rayHit) const {
+	return UniformAreaPdfLi(rayHit, m_area);
+}
 
-	scene->Intersect(rayHit);
-	if (rayHit.hit.geomID != m_geomId) {
-		return 0.0f;
-	}
+float AreaLight::Power() const {
+	// Every point of the surface emits m_radiance over the hemisphere
+	return Luminance(m_radiance) * m_area * (float)M_PI;
+}
 
-	// Calculate the pdf
-	float3a intersectionPoint = float3a(rayHit.ray.org_x, rayHit.ray.org_y, rayHit.ray.org_z) + normalize(float3a(rayHit.ray.dir_x, rayHit.ray.dir_y, rayHit.ray.dir_z)) * rayHit.ray.tfar;
-	float distanceSquared = sqr_length(intersectionPoint - interaction.Position);
-	
-	return distanceSquared / (std::abs(dot(normalize(scene->InterpolateNormal(rayHit.hit.geomID, rayHit.hit.primID, rayHit.hit.u, rayHit.hit.v)), interaction.InputDirection)) * m_area);
+bool AreaLight::Bounds(LightBounds *bounds) const {
+	bounds->Min = m_boundsMin;
+	bounds->Max = m_boundsMax;
+	bounds->W = m_normals.W;
+	bounds->Phi = Power();
+	bounds->CosThetaO = m_normals.CosTheta;
+	// Diffuse emission reaches all the way to the horizon
+	bounds->CosThetaE = 0.0f;
+	// SampleLi and PdfLi treat both sides of the surface as emissive
+	bounds->TwoSided = true;
+
+	return true;
 }
 
 } // End of namespace Lantern
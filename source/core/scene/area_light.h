@@ -8,26 +8,61 @@
 
 #include "scene/light.h"
 
+#include "math/alias_table.h"
+
+#include <vector>
+
 
 namespace Lantern {
 
 class AreaLight : public Light {
 public:
-	AreaLight(float3 color, float radiantPower, float area, uint geomId, float4 boundingSphere)
-		: Light(color * radiantPower * (float)M_1_PI / area),
-		  m_area(area),
-		  m_geomId(geomId),
-		  m_boundingSphere(boundingSphere) {
-	}
+	/**
+	 * Creates a light that emits uniformly from every point of a mesh
+	 *
+	 * The vertex and index buffers aren't copied, so they must outlive the light
+	 *
+	 * @param color                   The color of the emitted light
+	 * @param radiantPower            The total power of the emitted light
+	 * @param area                    The surface area of the mesh
+	 * @param vertices                The mesh's vertex buffer
+	 * @param indices                 The mesh's index buffer
+	 * @param verticesPerPrimitive    3 for triangles, or 4 for quads
+	 * @param triangleAreas           The area of each triangle. Quads are split into (v0, v1, v3) and (v2, v3, v1), like Embree does
+	 */
+	AreaLight(float3 color, float radiantPower, float area, const float3a *vertices, const uint *indices, uint verticesPerPrimitive, const std::vector<float> &triangleAreas);
+	/**
+	 * Creates a light that emits uniformly from every point of a mesh, whose bounds were calculated ahead of time
+	 *
+	 * Skips looping over every triangle to find them, which adds up for big emissive meshes
+	 *
+	 * @param boundsMin    The minimum corner of the mesh's bounding box
+	 * @param boundsMax    The maximum corner of the mesh's bounding box
+	 * @param normals      The cone of the mesh's geometric normals
+	 */
+	AreaLight(float3 color, float radiantPower, float area, const float3a *vertices, const uint *indices, uint verticesPerPrimitive, const std::vector<float> &triangleAreas,
+	          float3 boundsMin, float3 boundsMax, DirectionCone normals);
 
 private:
 	float m_area;
-	uint m_geomId;
-	float4 m_boundingSphere;
+	const float3a *m_vertices;
+	const uint *m_indices;
+	uint m_verticesPerPrimitive;
+	// Picks triangles in proportion to their area, so points are spread uniformly over the surface
+	AliasTable m_triangleDistribution;
+	float3 m_boundsMin;
+	float3 m_boundsMax;
+	// The cone of the surface's geometric normals
+	DirectionCone m_normals;
 
 public:
-	float3 SampleLi(UniformSampler *sampler, Scene *scene, SurfaceInteraction &interaction, float *pdf) const override;
-	float PdfLi(Scene *scene, SurfaceInteraction &interaction) const override;
+	float3 SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const override;
+	float PdfLi(Scene *scene, const RTCRayHit &rayHit) const override;
+	float Power() const override;
+	bool Bounds(LightBounds *bounds) const override;
+
+private:
+	void GetTriangle(uint triangle, float3a *v0, float3a *v1, float3a *v2) const;
 };
 
 } // End of namespace Lantern
@@ -0,0 +1,55 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "scene/disk_light.h"
+
+#include "math/sampling.h"
+
+#include "integrator/surface_interaction.h"
+
+#include <algorithm>
+
+
+namespace Lantern {
+
+float3 DiskLight::SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const {
+	float x, y;
+	UniformSampleDisc(u, m_radius, &x, &y);
+
+	float3a normal = m_normal;
+	float3a point = m_center + RotateToWorld(x, y, 0.0f, normal);
+
+	return ConnectUniformAreaSample(point, m_normal, Area(), interaction, pdf, shadowRay);
+}
+
+float DiskLight::PdfLi(Scene *scene, const RTCRayHit &rayHit) const {
+	return UniformAreaPdfLi(rayHit, Area());
+}
+
+float DiskLight::Power() const {
+	// Every point of the surface emits m_radiance over the hemisphere
+	return Luminance(m_radiance) * Area() * (float)M_PI;
+}
+
+bool DiskLight::Bounds(LightBounds *bounds) const {
+	// The extent of the disk along each axis is radius * sin(angle between the axis and the normal)
+	float3 center(m_center.x, m_center.y, m_center.z);
+	float3 extent(m_radius * sqrtf(std::max(1.0f - m_normal.x * m_normal.x, 0.0f)),
+	              m_radius * sqrtf(std::max(1.0f - m_normal.y * m_normal.y, 0.0f)),
+	              m_radius * sqrtf(std::max(1.0f - m_normal.z * m_normal.z, 0.0f)));
+	bounds->Min = center - extent;
+	bounds->Max = center + extent;
+	bounds->W = float3(m_normal.x, m_normal.y, m_normal.z);
+	bounds->Phi = Power();
+	bounds->CosThetaO = 1.0f;
+	// Diffuse emission reaches all the way to the horizon
+	bounds->CosThetaE = 0.0f;
+	bounds->TwoSided = true;
+
+	return true;
+}
+
+} // End of namespace Lantern
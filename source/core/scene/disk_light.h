@@ -0,0 +1,43 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "scene/light.h"
+
+
+namespace Lantern {
+
+/**
+ * An emissive analytic disk. Both sides emit, like AreaLight
+ */
+class DiskLight : public Light {
+public:
+	DiskLight(float3 color, float radiantPower, float3a center, float3a normal, float radius)
+		: Light(color * radiantPower * (float)M_1_PI / ((float)M_PI * radius * radius)),
+		  m_center(center),
+		  m_normal(normal),
+		  m_radius(radius) {
+	}
+
+private:
+	float3a m_center;
+	float3a m_normal;
+	float m_radius;
+
+public:
+	float3 SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const override;
+	float PdfLi(Scene *scene, const RTCRayHit &rayHit) const override;
+	float Power() const override;
+	bool Bounds(LightBounds *bounds) const override;
+
+private:
+	float Area() const {
+		return (float)M_PI * m_radius * m_radius;
+	}
+};
+
+} // End of namespace Lantern
@@ -0,0 +1,123 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "scene/environment_light.h"
+
+#include "math/vector_math.h"
+
+#include "integrator/surface_interaction.h"
+
+#include <algorithm>
+
+
+namespace Lantern {
+
+EnvironmentLight::EnvironmentLight(const float *pixels, uint width, uint height, float3 scale)
+	: Light(float3(0.0f)),
+	  m_pixels(width * height),
+	  m_width(width),
+	  m_height(height),
+	  m_averageRadiance(0.0f),
+	  m_hasRadiance(false),
+	  m_sceneRadius(1.0f) {
+	// Weight each pixel by the solid angle it covers, so the rows near the poles aren't over-sampled
+	std::vector<float> weights(width * height);
+	float totalWeight = 0.0f;
+	float totalSolidAngle = 0.0f;
+	for (uint y = 0; y < height; ++y) {
+		float sinTheta = sinf((float)M_PI * (y + 0.5f) / height);
+		for (uint x = 0; x < width; ++x) {
+			uint i = y * width + x;
+			m_pixels[i] = float3(pixels[i * 3], pixels[i * 3 + 1], pixels[i * 3 + 2]) * scale;
+			weights[i] = Luminance(m_pixels[i]) * sinTheta;
+			totalWeight += std::max(weights[i], 0.0f);
+
+			m_averageRadiance += m_pixels[i] * sinTheta;
+			totalSolidAngle += sinTheta;
+		}
+	}
+
+	if (totalSolidAngle > 0.0f) {
+		m_averageRadiance = m_averageRadiance / totalSolidAngle;
+	}
+	// An all-black map has nothing to sample. SampleLi() and PdfLi() return a pdf of zero, rather than a uniform one
+	m_hasRadiance = totalWeight > 0.0f;
+	m_distribution.Build(weights);
+}
+
+uint EnvironmentLight::PixelIndex(const float3a &direction, float *sinTheta) const {
+	float phi = atan2f(direction.x, direction.z);
+	if (phi < 0.0f) {
+		phi += 2.0f * (float)M_PI;
+	}
+	float cosTheta = std::min(std::max(direction.y, -1.0f), 1.0f);
+	*sinTheta = sqrtf(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+
+	uint x = std::min((uint)(phi / (2.0f * (float)M_PI) * m_width), m_width - 1);
+	uint y = std::min((uint)(acosf(cosTheta) / (float)M_PI * m_height), m_height - 1);
+
+	return y * m_width + x;
+}
+
+float3 EnvironmentLight::SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const {
+	if (!m_hasRadiance) {
+		*pdf = 0.0f;
+		return float3(0.0f);
+	}
+
+	// Pick a pixel, then a uniform point in it
+	float pixelPdf;
+	uint index = m_distribution.Sample(uElement, &pixelPdf);
+	uint x = index % m_width;
+	uint y = index / m_width;
+
+	float phi = 2.0f * (float)M_PI * (x + u.x) / m_width;
+	float theta = (float)M_PI * (y + u.y) / m_height;
+	float sinTheta = sinf(theta);
+	if (sinTheta == 0.0f) {
+		*pdf = 0.0f;
+		return float3(0.0f);
+	}
+
+	float3a direction(sinTheta * sinf(phi), cosf(theta), sinTheta * cosf(phi));
+	interaction.InputDirection = direction;
+
+	// Convert from the pdf over the image to solid angle
+	// The image covers 2pi x pi radians, and each row covers sinTheta as much solid angle as the equator
+	*pdf = pixelPdf * m_width * m_height / (2.0f * (float)M_PI * (float)M_PI * sinTheta);
+
+	InitShadowRay(interaction.Position, direction, embree::inf, shadowRay);
+
+	return m_pixels[index];
+}
+
+float EnvironmentLight::PdfLi(Scene *scene, const RTCRayHit &rayHit) const {
+	if (!m_hasRadiance) {
+		return 0.0f;
+	}
+
+	float3a direction = normalize(float3a(rayHit.ray.dir_x, rayHit.ray.dir_y, rayHit.ray.dir_z));
+
+	float sinTheta;
+	uint index = PixelIndex(direction, &sinTheta);
+	if (sinTheta == 0.0f) {
+		return 0.0f;
+	}
+
+	return m_distribution.Pdf(index) * m_width * m_height / (2.0f * (float)M_PI * (float)M_PI * sinTheta);
+}
+
+float3 EnvironmentLight::Le(const float3a &direction) const {
+	float sinTheta;
+	return m_pixels[PixelIndex(normalize(direction), &sinTheta)];
+}
+
+float EnvironmentLight::Power() const {
+	// The light that would fall on a disc the size of the scene
+	return Luminance(m_averageRadiance) * (float)M_PI * m_sceneRadius * m_sceneRadius;
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,75 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "scene/light.h"
+
+#include "math/alias_table.h"
+
+#include <vector>
+
+
+namespace Lantern {
+
+/**
+ * Light arriving from infinitely far away, in every direction, from a lat-long image
+ *
+ * The image uses the same mapping as CreateSphere(): +y is the top row, and u wraps around y, starting at +z
+ *
+ * SampleLi picks pixels in proportion to their luminance times the solid angle they cover, so a small, bright
+ * sun gets most of the samples. Within a pixel, the direction is uniform in (u, v)
+ */
+class EnvironmentLight : public Light {
+public:
+	/**
+	 * @param pixels    The image, as linear RGB, row by row, starting at the top
+	 * @param width     The width of the image
+	 * @param height    The height of the image
+	 * @param scale     Multiplies the radiance of every pixel
+	 */
+	EnvironmentLight(const float *pixels, uint width, uint height, float3 scale);
+
+private:
+	std::vector<float3> m_pixels;
+	uint m_width;
+	uint m_height;
+	// Picks pixels in proportion to their contribution
+	AliasTable m_distribution;
+	// The radiance, averaged over the sphere of directions
+	float3 m_averageRadiance;
+	// False if every pixel is black
+	bool m_hasRadiance;
+	// The radius of a sphere around the scene. Used to estimate the light's power
+	float m_sceneRadius;
+
+public:
+	float3 SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const override;
+	float PdfLi(Scene *scene, const RTCRayHit &rayHit) const override;
+	float3 Le(const float3a &direction) const override;
+	float Power() const override;
+
+	/**
+	 * Sets the size of the scene, which Power() depends on. Call before building the light distribution
+	 *
+	 * @param sceneRadius    The radius of a sphere that contains the whole scene
+	 */
+	void SetSceneRadius(float sceneRadius) {
+		m_sceneRadius = sceneRadius;
+	}
+
+private:
+	/**
+	 * Finds the pixel a direction falls in
+	 *
+	 * @param direction    A normalized direction
+	 * @param sinTheta     The sine of the direction's angle from +y
+	 * @return             The index of the pixel
+	 */
+	uint PixelIndex(const float3a &direction, float *sinTheta) const;
+};
+
+} // End of namespace Lantern
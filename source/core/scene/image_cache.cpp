@@ -1,72 +1,507 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2017
+*/
+
 #include "scene/image_cache.h"
 
+#include "math/color_space.h"
+#include "math/half.h"
+
+#include "io/block_compression.h"
+
 #include "stb_image.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 
 
 namespace Lantern {
 
+const std::size_t ImageCache::kDefaultMemoryBudget;
+
+// Decodes the color channels of RGBA8_sRGB texels
+static const struct SRGBTable {
+	SRGBTable() {
+		for (uint i = 0; i < 256; ++i) {
+			Values[i] = SRGBToLinear((float)i / 255.0f);
+		}
+	}
+
+	float Values[256];
+} s_sRGBToLinear;
+
+// Texel fetches for each format
+// They all return the linear color of texel (x, y) of a tile
+
+static __m128 FetchRGBA8(const byte *tile, uint x, uint y) {
+	int texel;
+	memcpy(&texel, &tile[(y * kTextureTileSize + x) * 4], sizeof(texel));
+
+	// Widen each byte to its own 32-bit lane
+	__m128i zero = _mm_setzero_si128();
+	__m128i channels = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(texel), zero), zero);
+	return _mm_mul_ps(_mm_cvtepi32_ps(channels), _mm_set1_ps(1.0f / 255.0f));
+}
+
+static __m128 FetchRGBA8_sRGB(const byte *tile, uint x, uint y) {
+	const byte *texel = &tile[(y * kTextureTileSize + x) * 4];
+	return _mm_setr_ps(s_sRGBToLinear.Values[texel[0]], s_sRGBToLinear.Values[texel[1]], s_sRGBToLinear.Values[texel[2]], 0.0f);
+}
+
+static __m128 FetchRGBA16F(const byte *tile, uint x, uint y) {
+	__m128i halves = _mm_loadl_epi64((const __m128i *)&tile[(y * kTextureTileSize + x) * 8]);
+	return HalfToFloat4(_mm_unpacklo_epi16(halves, _mm_setzero_si128()));
+}
+
+static const byte *BC1Block(const byte *tile, uint x, uint y) {
+	const uint blocksPerSide = kTextureTileSize / kBC1BlockSize;
+	return &tile[((y / kBC1BlockSize) * blocksPerSide + x / kBC1BlockSize) * kBC1BlockBytes];
+}
+
+static __m128 FetchBC1(const byte *tile, uint x, uint y) {
+	__m128 color = DecodeBC1Texel(BC1Block(tile, x, y), x % kBC1BlockSize, y % kBC1BlockSize);
+	return _mm_mul_ps(color, _mm_set1_ps(1.0f / 255.0f));
+}
+
+static __m128 FetchBC1_sRGB(const byte *tile, uint x, uint y) {
+	__m128 color = DecodeBC1Texel(BC1Block(tile, x, y), x % kBC1BlockSize, y % kBC1BlockSize);
+
+	// Round to 8 bits, so sRGB can go through the same table as RGBA8_sRGB
+	int channels[4];
+	_mm_storeu_si128((__m128i *)channels, _mm_cvtps_epi32(color));
+	return _mm_setr_ps(s_sRGBToLinear.Values[channels[0]], s_sRGBToLinear.Values[channels[1]], s_sRGBToLinear.Values[channels[2]], 0.0f);
+}
+
+static TexelFetchFunction ChooseTexelFetch(TexelFormat format) {
+	switch (format) {
+	case TexelFormat::RGBA8:
+		return FetchRGBA8;
+	case TexelFormat::RGBA8_sRGB:
+		return FetchRGBA8_sRGB;
+	case TexelFormat::RGBA16F:
+		return FetchRGBA16F;
+	case TexelFormat::BC1:
+		return FetchBC1;
+	case TexelFormat::BC1_sRGB:
+	default:
+		return FetchBC1_sRGB;
+	}
+}
+
+static inline __m128 Lerp(__m128 a, __m128 b, __m128 t) {
+	return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+// Every cache gets a new generation when it's created or cleared, so a thread can tell that the tiles in its
+// micro-cache are stale, even if a new cache was created at the address of an old one
+static std::atomic<uint> s_nextGeneration(1u);
+
+// Copies one tile out of a decoded texture, so it can be evicted on its own
+static std::shared_ptr<ImageTile> CopyTile(const LanternTextureFile &ltf, uint level, uint tileIndex, std::size_t bytesPerTile) {
+	std::shared_ptr<ImageTile> tile = std::make_shared<ImageTile>();
+	tile->Texels.assign(ltf.LevelData[level].begin() + tileIndex * bytesPerTile, ltf.LevelData[level].begin() + (tileIndex + 1) * bytesPerTile);
+
+	return tile;
+}
+
+/**
+ * The last few tiles a thread used, so most lookups don't need to lock the shared cache
+ *
+ * Direct-mapped, since the lookup has to be cheaper than the lock it saves
+ */
+struct MicroCache {
+	static const uint kNumEntries = 16;
+	// No tile can have this key, since image ids are well under 2^24
+	static const uint64 kInvalidKey = ~0ull;
+
+	MicroCache() {
+		Reset(0u);
+	}
+
+	uint Generation;
+	uint64 Keys[kNumEntries];
+	std::shared_ptr<const ImageTile> Tiles[kNumEntries];
+
+	static uint Slot(uint64 key) {
+		// Fibonacci hashing. The top 4 bits pick one of the 16 entries
+		return (uint)((key * 0x9E3779B97F4A7C15ull) >> 60);
+	}
+
+	void Reset(uint generation) {
+		Generation = generation;
+		for (uint i = 0; i < kNumEntries; ++i) {
+			Keys[i] = kInvalidKey;
+			Tiles[i].reset();
+		}
+	}
+};
+
+const uint MicroCache::kNumEntries;
+const uint64 MicroCache::kInvalidKey;
+
+static thread_local MicroCache t_microCache;
+
+ImageCache::ImageCache()
+		: m_memoryUsed(0),
+		  m_memoryBudget(kDefaultMemoryBudget),
+		  m_compressTextures(false),
+		  m_filter(TextureFilter::Trilinear),
+		  m_generation(s_nextGeneration++) {
+}
+
 ImageCache::~ImageCache() {
 	Clear();
 }
 
-uint ImageCache::AddImage(const char *filepath) {
-	Image image;
-	image.Data = stbi_load(filepath, &image.XSize, &image.YSize, &image.NumChannels, 0);
-	
-	m_images.push_back(std::move(image));
-
-	return (uint)m_images.size() - 1;
-}
-
-float3 ImageCache::SampleImage(uint imageId, float2 texCoord) {
-	Image *image = &m_images[imageId];
-
-	// Wrap texCoord to [0, 1]
-	// We can't use frac() because that will exclude 1, which is a valid value
-	//while (texCoord.x > 1.0f) {
-	//	texCoord.x -= 1.0f;
-	//}
-	//while (texCoord.x < 0.0f) {
-	//	texCoord.x += 1.0f;
-	//}
-	//while (texCoord.y > 1.0f) {
-	//	texCoord.y -= 1.0f;
-	//}
-	//while (texCoord.y < 1.0f) {
-	//	texCoord.y += 1.0f;
-	//}
-
-	// Closest sampling for now because it's simple
-	std::size_t x = (uint)std::round(texCoord.x * (float)image->XSize);
-	std::size_t y = (uint)std::round(texCoord.y * (float)image->YSize);
-
-	std::size_t index = (y * image->XSize + x) * image->NumChannels;
-	switch (image->NumChannels) {
-	case 1:
+uint ImageCache::AddImage(const char *filepath, bool isLinear) {
+	// The same image decoded in both color spaces is two different images
+	std::size_t length = strlen(filepath);
+	bool isLTF = length > 4 && strcmp(filepath + length - 4, ".ltf") == 0;
+	std::string key = isLTF || isLinear ? filepath : std::string(filepath) + " (sRGB)";
+
+	auto iter = m_imageIds.find(key);
+	if (iter != m_imageIds.end()) {
+		return iter->second;
+	}
+
+	Image *image = new Image();
+	image->FilePath = filepath;
+
+	if (isLTF) {
+		// Preprocessed textures are used straight from the file
+		image->Mapping = new MemoryMappedFile();
+		LanternTextureFile ltf;
+		if (!image->Mapping->Open(filepath) || !ReadLTFHeader(image->Mapping->Data(), image->Mapping->Size(), &ltf)) {
+			printf("Unable to load texture file \"%s\"\n", filepath);
+			delete image;
+			return (uint)-1;
+		}
+
+		image->XSize = ltf.XSize;
+		image->YSize = ltf.YSize;
+		image->Format = ltf.Format;
+		image->Levels = ltf.Levels;
+		image->LTFData = image->Mapping->Data();
+	} else {
+		// Only read the header for now. The pixels are decoded the first time the image is sampled
+		int xSize;
+		int ySize;
+		int numChannels;
+		if (stbi_info(filepath, &xSize, &ySize, &numChannels) == 0) {
+			printf("Unable to load image \"%s\": %s\n", filepath, stbi_failure_reason());
+			delete image;
+			return (uint)-1;
+		}
+
+		image->XSize = (uint)xSize;
+		image->YSize = (uint)ySize;
+		image->IsLinear = isLinear;
+		image->Format = DefaultTexelFormat(filepath, isLinear, m_compressTextures);
+		CalculateTextureLevels(image->XSize, image->YSize, &image->Levels);
+	}
+
+	image->FetchTexel = ChooseTexelFetch(image->Format);
+
+	uint imageId = (uint)m_images.size();
+	m_images.push_back(image);
+	m_imageIds[key] = imageId;
+
+	return imageId;
+}
+
+uint ImageCache::AddImage(const char *name, const byte *data, std::size_t size) {
+	auto iter = m_imageIds.find(name);
+	if (iter != m_imageIds.end()) {
+		return iter->second;
+	}
+
+	LanternTextureFile ltf;
+	if (!ReadLTFHeader(data, size, &ltf)) {
+		printf("Unable to load texture file \"%s\"\n", name);
+		return (uint)-1;
+	}
+
+	Image *image = new Image();
+	image->FilePath = name;
+	image->XSize = ltf.XSize;
+	image->YSize = ltf.YSize;
+	image->Format = ltf.Format;
+	image->Levels = ltf.Levels;
+	image->LTFData = data;
+	image->FetchTexel = ChooseTexelFetch(image->Format);
+
+	uint imageId = (uint)m_images.size();
+	m_images.push_back(image);
+	m_imageIds[name] = imageId;
+
+	return imageId;
+}
+
+float3 ImageCache::SampleImage(uint imageId, float2 texCoord, float footprint) {
+	float color[4];
+	_mm_storeu_ps(color, Sample(imageId, m_images[imageId], texCoord, footprint));
+
+	return float3(color[0], color[1], color[2]);
+}
+
+void ImageCache::SampleImage(uint imageId, const float2 *texCoords, const float *footprints, uint count, float3 *out_colors) {
+	const Image *image = m_images[imageId];
+
+	for (uint i = 0; i < count; ++i) {
+		float color[4];
+		_mm_storeu_ps(color, Sample(imageId, image, texCoords[i], footprints[i]));
+		out_colors[i] = float3(color[0], color[1], color[2]);
+	}
+}
+
+void ImageCache::SetMemoryBudget(std::size_t bytes) {
+	std::lock_guard<std::mutex> lock(m_tileLock);
+	m_memoryBudget = bytes;
+	EvictTiles();
+}
+
+void ImageCache::Clear() {
 	{
-		float value = (float)image->Data[index] / 256.0f;
-		return float3(value);
-	}
-	case 2:
-		return float3((float)image->Data[index] / 256.0f, (float)image->Data[index + 1] / 256.0f, 0.0f);
-	case 3:
-	case 4:
-		return float3((float)image->Data[index] / 256.0f, (float)image->Data[index + 1] / 256.0f, (float)image->Data[index + 2] / 256.0f);
+		std::lock_guard<std::mutex> lock(m_tileLock);
+		m_tiles.clear();
+		m_lru.clear();
+		m_memoryUsed = 0;
+	}
+
+	for (Image *image : m_images) {
+		delete image;
+	}
+	m_images.clear();
+	m_imageIds.clear();
+
+	m_generation = s_nextGeneration++;
+}
+
+__m128 ImageCache::Sample(uint imageId, const Image *image, float2 texCoord, float footprint) {
+	// Wrap texCoord to [0, 1)
+	float u = texCoord.x - floorf(texCoord.x);
+	float v = texCoord.y - floorf(texCoord.y);
+
+	// Find the level where a texel is about as wide as the footprint. Each level is half the size of the one before it
+	float lod = 0.0f;
+	float footprintInTexels = footprint * (float)std::max(image->XSize, image->YSize);
+	if (footprintInTexels > 1.0f) {
+		lod = std::min(log2f(footprintInTexels), (float)(image->Levels.size() - 1));
+	}
+
+	switch (m_filter) {
+	case TextureFilter::Nearest:
+		return SampleNearest(imageId, image, (uint)(lod + 0.5f), u, v);
+	case TextureFilter::Bilinear:
+		return SampleBilinear(imageId, image, (uint)(lod + 0.5f), u, v);
+	case TextureFilter::Trilinear:
 	default:
+	{
+		uint level = (uint)lod;
+		float levelWeight = lod - (float)level;
+		__m128 color = SampleBilinear(imageId, image, level, u, v);
+		if (levelWeight == 0.0f) {
+			return color;
+		}
+
+		return Lerp(color, SampleBilinear(imageId, image, level + 1, u, v), _mm_set1_ps(levelWeight));
+	}
+	}
+}
+
+__m128 ImageCache::SampleNearest(uint imageId, const Image *image, uint level, float u, float v) {
+	const TextureLevel &mip = image->Levels[level];
+	uint x = std::min((uint)(u * (float)mip.XSize), mip.XSize - 1);
+	uint y = std::min((uint)(v * (float)mip.YSize), mip.YSize - 1);
+
+	return FetchTexel(imageId, image, level, x, y);
+}
+
+__m128 ImageCache::SampleBilinear(uint imageId, const Image *image, uint level, float u, float v) {
+	const TextureLevel &mip = image->Levels[level];
+
+	// Texel centers are at half-integer coordinates
+	// u and v are in [0, 1), so the texels on either side are at most one past an edge
+	// The clamps just keep a NaN texCoord from indexing out of bounds
+	float s = u * (float)mip.XSize - 0.5f;
+	float t = v * (float)mip.YSize - 0.5f;
+	float sFloor = std::max(-1.0f, std::min(floorf(s), (float)(mip.XSize - 1)));
+	float tFloor = std::max(-1.0f, std::min(floorf(t), (float)(mip.YSize - 1)));
+	__m128 sWeight = _mm_set1_ps(s - sFloor);
+	__m128 tWeight = _mm_set1_ps(t - tFloor);
+
+	int xFloor = (int)sFloor;
+	int yFloor = (int)tFloor;
+	uint x0 = xFloor < 0 ? mip.XSize - 1 : (uint)xFloor;
+	uint y0 = yFloor < 0 ? mip.YSize - 1 : (uint)yFloor;
+	uint x1 = (uint)(xFloor + 1) == mip.XSize ? 0 : (uint)(xFloor + 1);
+	uint y1 = (uint)(yFloor + 1) == mip.YSize ? 0 : (uint)(yFloor + 1);
+
+	__m128 texel00;
+	__m128 texel10;
+	__m128 texel01;
+	__m128 texel11;
+	uint tileX = x0 / kTextureTileSize;
+	uint tileY = y0 / kTextureTileSize;
+	if (tileX == x1 / kTextureTileSize && tileY == y1 / kTextureTileSize) {
+		// The common case. All four texels are in the same tile, so we only have to find it once
+		const byte *tile = GetTileTexels(imageId, image, level, tileY * mip.TilesX + tileX);
+		if (tile == nullptr) {
+			return _mm_set1_ps(std::nanf(""));
+		}
+
+		uint tileX0 = x0 % kTextureTileSize;
+		uint tileY0 = y0 % kTextureTileSize;
+		uint tileX1 = x1 % kTextureTileSize;
+		uint tileY1 = y1 % kTextureTileSize;
+		texel00 = image->FetchTexel(tile, tileX0, tileY0);
+		texel10 = image->FetchTexel(tile, tileX1, tileY0);
+		texel01 = image->FetchTexel(tile, tileX0, tileY1);
+		texel11 = image->FetchTexel(tile, tileX1, tileY1);
+	} else {
+		texel00 = FetchTexel(imageId, image, level, x0, y0);
+		texel10 = FetchTexel(imageId, image, level, x1, y0);
+		texel01 = FetchTexel(imageId, image, level, x0, y1);
+		texel11 = FetchTexel(imageId, image, level, x1, y1);
+	}
+
+	return Lerp(Lerp(texel00, texel10, sWeight), Lerp(texel01, texel11, sWeight), tWeight);
+}
+
+__m128 ImageCache::FetchTexel(uint imageId, const Image *image, uint level, uint x, uint y) {
+	const TextureLevel &mip = image->Levels[level];
+	const byte *tile = GetTileTexels(imageId, image, level, (y / kTextureTileSize) * mip.TilesX + x / kTextureTileSize);
+	if (tile == nullptr) {
 		// Error. Return NaN
-		return float3((float)std::nan(nullptr), (float)std::nan(nullptr), (float)std::nan(nullptr));
-		break;
+		return _mm_set1_ps(std::nanf(""));
+	}
+
+	return image->FetchTexel(tile, x % kTextureTileSize, y % kTextureTileSize);
+}
+
+const byte *ImageCache::GetTileTexels(uint imageId, const Image *image, uint level, uint tileIndex) {
+	if (image->LTFData != nullptr) {
+		return image->LTFData + image->Levels[level].Offset + tileIndex * BytesPerTile(image->Format);
 	}
+
+	const ImageTile *tile = GetTile(imageId, level, tileIndex);
+	return tile == nullptr ? nullptr : &tile->Texels[0];
 }
 
-void ImageCache::Clear() {
-	for (Image &image : m_images) {
-		stbi_image_free(image.Data);
+const ImageTile *ImageCache::GetTile(uint imageId, uint level, uint tileIndex) {
+	MicroCache &microCache = t_microCache;
+	if (microCache.Generation != m_generation) {
+		microCache.Reset(m_generation);
 	}
 
-	m_images.clear();
+	uint64 key = TileKey(imageId, level, tileIndex);
+	uint slot = MicroCache::Slot(key);
+	if (microCache.Keys[slot] == key) {
+		return microCache.Tiles[slot].get();
+	}
+
+	std::shared_ptr<const ImageTile> tile = FindTile(key);
+	if (!tile) {
+		tile = LoadTile(imageId, level, tileIndex);
+		if (!tile) {
+			return nullptr;
+		}
+	}
+
+	// The micro-cache holds a reference, so the tile stays alive even if the shared cache evicts it
+	microCache.Keys[slot] = key;
+	microCache.Tiles[slot] = std::move(tile);
+	return microCache.Tiles[slot].get();
+}
+
+std::shared_ptr<const ImageTile> ImageCache::FindTile(uint64 key) {
+	std::lock_guard<std::mutex> lock(m_tileLock);
+
+	auto iter = m_tiles.find(key);
+	if (iter == m_tiles.end()) {
+		return nullptr;
+	}
+
+	m_lru.splice(m_lru.begin(), m_lru, iter->second.LRUPosition);
+	return iter->second.Tile;
+}
+
+std::shared_ptr<const ImageTile> ImageCache::LoadTile(uint imageId, uint level, uint tileIndex) {
+	Image *image = m_images[imageId];
+	std::lock_guard<std::mutex> loadLock(image->LoadLock);
+
+	// Another thread may have loaded the image while we waited
+	uint64 key = TileKey(imageId, level, tileIndex);
+	std::shared_ptr<const ImageTile> tile = FindTile(key);
+	if (tile || image->LoadFailed) {
+		return tile;
+	}
+
+	LanternTextureFile ltf;
+	if (!CreateLTF(image->FilePath.c_str(), image->Format, image->IsLinear, &ltf)) {
+		image->LoadFailed = true;
+		return nullptr;
+	}
+	if (ltf.XSize != image->XSize || ltf.YSize != image->YSize) {
+		printf("Image \"%s\" changed size since it was added to the scene\n", image->FilePath.c_str());
+		image->LoadFailed = true;
+		return nullptr;
+	}
+
+	// The requested tile goes in first, and can push older tiles out
+	const std::size_t bytesPerTile = BytesPerTile(image->Format);
+	std::lock_guard<std::mutex> lock(m_tileLock);
+	tile = CopyTile(ltf, level, tileIndex, bytesPerTile);
+	InsertTile(key, tile, bytesPerTile, true);
+	EvictTiles();
+
+	// Keep as many of the other tiles as fit in what's left of the budget, so they don't need another decode.
+	// The rest of the requested level goes first, then the coarser levels trilinear filtering blends in, then the finer ones.
+	// Whatever doesn't fit is dropped, rather than pushing out tiles that are in use
+	const uint numLevels = (uint)ltf.Levels.size();
+	for (uint n = 0; n < numLevels; ++n) {
+		uint i = level + n < numLevels ? level + n : numLevels - 1 - n;
+		for (uint j = 0; j < ltf.Levels[i].TilesX * ltf.Levels[i].TilesY; ++j) {
+			if (i == level && j == tileIndex) {
+				continue;
+			}
+			if (m_memoryUsed + bytesPerTile > m_memoryBudget) {
+				return tile;
+			}
+
+			InsertTile(TileKey(imageId, i, j), CopyTile(ltf, i, j, bytesPerTile), bytesPerTile, false);
+		}
+	}
+
+	return tile;
+}
+
+void ImageCache::InsertTile(uint64 key, const std::shared_ptr<const ImageTile> &tile, std::size_t memorySize, bool mostRecent) {
+	if (m_tiles.count(key) != 0) {
+		return;
+	}
+
+	CacheEntry entry;
+	entry.Tile = tile;
+	entry.LRUPosition = m_lru.insert(mostRecent ? m_lru.begin() : m_lru.end(), key);
+	entry.MemorySize = memorySize;
+	m_tiles[key] = entry;
+
+	m_memoryUsed += memorySize;
 }
 
+void ImageCache::EvictTiles() {
+	while (m_memoryUsed > m_memoryBudget && !m_lru.empty()) {
+		auto iter = m_tiles.find(m_lru.back());
+		m_memoryUsed -= iter->second.MemorySize;
+		m_tiles.erase(iter);
+		m_lru.pop_back();
+	}
 }
+
+} // End of namespace Lantern
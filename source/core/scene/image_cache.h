@@ -6,34 +6,264 @@
 
 #pragma once
 
+#include "io/lantern_texture_file.h"
+#include "io/memory_mapped_file.h"
+
 #include "math/int_types.h"
 #include "math/vector_types.h"
 
+#include <cstddef>
+#include <emmintrin.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 
 namespace Lantern {
 
+/**
+ * A square block of kTextureTileSize x kTextureTileSize texels from one mip level of an image, in the image's format
+ */
+struct ImageTile {
+	std::vector<byte> Texels;
+};
+
+/**
+ * Decodes a single texel of a tile
+ *
+ * @param tile    The texels of the tile
+ * @param x       The column of the texel, within the tile
+ * @param y       The row of the texel, within the tile
+ * @return        The linear color of the texel in the first three lanes. The last lane is undefined
+ */
+typedef __m128 (*TexelFetchFunction)(const byte *tile, uint x, uint y);
+
+/**
+ * How images are filtered when they're sampled
+ */
+enum class TextureFilter {
+	// The closest texel of the closest mip level
+	Nearest,
+	// A blend of the four closest texels of the closest mip level
+	Bilinear,
+	// A bilinear blend in the two closest mip levels, blended by where the footprint falls between them
+	Trilinear
+};
+
 struct Image {
-	byte *Data;
-	int XSize;
-	int YSize;
-	int NumChannels;
+	Image()
+		: Format(TexelFormat::RGBA8_sRGB),
+		  IsLinear(true),
+		  FetchTexel(nullptr),
+		  LTFData(nullptr),
+		  Mapping(nullptr),
+		  LoadFailed(false) {
+	}
+	~Image() {
+		delete Mapping;
+	}
+
+	std::string FilePath;
+	uint XSize;
+	uint YSize;
+	TexelFormat Format;
+	std::vector<TextureLevel> Levels;
+	// Whether the source image is linear, rather than sRGB. Only used when it's decoded
+	bool IsLinear;
+	// Chosen by Format when the image is added, so sampling doesn't have to switch on it for every texel
+	TexelFetchFunction FetchTexel;
+
+	// Preprocessed .ltf files are sampled in place. Their tiles never go through the cache
+	// nullptr for images that are decoded
+	const byte *LTFData;
+	// The mapping LTFData points into, for .ltf files that are used on their own. nullptr for .ltf files
+	// that are in a scene pack, since the scene keeps the pack mapped
+	MemoryMappedFile *Mapping;
+
+	// Held while the image is being decoded, so two threads that miss on it don't both decode it
+	std::mutex LoadLock;
+	bool LoadFailed;
 };
 
+/**
+ * Holds the tiles of every image the scene uses, up to a memory budget
+ *
+ * Images are only decoded when one of their tiles is first sampled, and the least recently used tiles
+ * are evicted when the cache is over budget. Each thread also keeps a few of the tiles it used last, so
+ * most lookups don't touch the shared cache, or its lock, at all
+ *
+ * Images that were preprocessed into .ltf files skip all of this. They're mapped into memory, and the OS
+ * pages their tiles in and out
+ */
 class ImageCache {
 public:
-	ImageCache() { }
+	ImageCache();
 	~ImageCache();
 
+	static const std::size_t kDefaultMemoryBudget = 1024ull * 1024ull * 1024ull;
+
 private:
-	std::vector<Image> m_images;
+	std::vector<Image *> m_images;
+	std::unordered_map<std::string, uint> m_imageIds;
+
+	typedef std::list<uint64> LRUList;
+	struct CacheEntry {
+		std::shared_ptr<const ImageTile> Tile;
+		LRUList::iterator LRUPosition;
+		std::size_t MemorySize;
+	};
+
+	// Guards m_tiles, m_lru, and m_memoryUsed
+	std::mutex m_tileLock;
+	std::unordered_map<uint64, CacheEntry> m_tiles;
+	// The most recently used tile is at the front
+	LRUList m_lru;
+	std::size_t m_memoryUsed;
+	std::size_t m_memoryBudget;
+	// Whether images that are decoded at load are block compressed in the cache
+	bool m_compressTextures;
+	TextureFilter m_filter;
+
+	// Bumped by Clear(), so the per-thread caches know to drop their tiles
+	uint m_generation;
 
 public:
-	uint AddImage(const char *filepath);
-	float3 SampleImage(uint imageId, float2 texCoord);
+	/**
+	 * Registers an image with the cache. Nothing is decoded until the image is sampled
+	 *
+	 * Adding the same file path, with the same color space, more than once returns the same id
+	 *
+	 * @param filepath    The path to the image. Either a .ltf file, or any image stb_image can read
+	 * @param isLinear    Whether an 8-bit image is linear, rather than sRGB. Ignored for HDR images, and .ltf files,
+	 *                    which store their own format
+	 * @return            The id of the image, or -1 if it couldn't be read
+	 */
+	uint AddImage(const char *filepath, bool isLinear);
+	/**
+	 * Registers a .ltf file that's already in memory. It's sampled in place, so it has to outlive the cache, or the next Clear()
+	 *
+	 * Adding the same name more than once returns the same id
+	 *
+	 * @param name    A unique name for the image, for error messages
+	 * @param data    The start of the .ltf file
+	 * @param size    The size of the .ltf file in bytes
+	 * @return        The id of the image, or -1 if it isn't a valid .ltf file
+	 */
+	uint AddImage(const char *name, const byte *data, std::size_t size);
+	/**
+	 * Samples an image with the cache's filter, using the mip levels whose texels best match the footprint
+	 *
+	 * Texture coordinates outside [0, 1) wrap around
+	 *
+	 * @param imageId      The id returned by AddImage()
+	 * @param texCoord     Where to sample the image
+	 * @param footprint    The width of the area being sampled, in texture coordinates
+	 * @return             The color of the image
+	 */
+	float3 SampleImage(uint imageId, float2 texCoord, float footprint);
+	/**
+	 * Samples an image at many points at once. Gives the same results as calling SampleImage() on each point,
+	 * but only looks the image up once, and the tiles it touches stay hot from one lookup to the next
+	 *
+	 * @param imageId       The id returned by AddImage()
+	 * @param texCoords     Where to sample the image
+	 * @param footprints    The width of the area being sampled at each point, in texture coordinates
+	 * @param count         The number of points
+	 * @param out_colors    Filled with the color of the image at each point
+	 */
+	void SampleImage(uint imageId, const float2 *texCoords, const float *footprints, uint count, float3 *out_colors);
+
+	/**
+	 * Sets how many bytes of tiles the cache can hold. Tiles are evicted as soon as they're over the budget
+	 */
+	void SetMemoryBudget(std::size_t bytes);
+	/**
+	 * Sets whether 8-bit images are block compressed when they're decoded. BC1 tiles use an eighth of the
+	 * memory of RGBA8 tiles, at some loss of quality. Only affects images added after this is called
+	 *
+	 * Preprocessed .ltf files keep the format they were compiled with
+	 */
+	void SetCompression(bool compress) {
+		m_compressTextures = compress;
+	}
+	/**
+	 * Sets how images are filtered. Defaults to TextureFilter::Trilinear
+	 */
+	void SetFilter(TextureFilter filter) {
+		m_filter = filter;
+	}
 
 	void Clear();
+
+private:
+	static uint64 TileKey(uint imageId, uint level, uint tileIndex) {
+		return ((uint64)imageId << 40) | ((uint64)level << 32) | (uint64)tileIndex;
+	}
+	/**
+	 * Samples an image with the cache's filter
+	 *
+	 * @return    The color of the image in the first three lanes
+	 */
+	__m128 Sample(uint imageId, const Image *image, float2 texCoord, float footprint);
+	/**
+	 * Returns the closest texel to (u, v) in a mip level. u and v must already be wrapped to [0, 1)
+	 */
+	__m128 SampleNearest(uint imageId, const Image *image, uint level, float u, float v);
+	/**
+	 * Blends the four closest texels to (u, v) in a mip level. u and v must already be wrapped to [0, 1)
+	 *
+	 * Texels on the far side of an edge wrap around, just like the texture coordinates do
+	 */
+	__m128 SampleBilinear(uint imageId, const Image *image, uint level, float u, float v);
+	/**
+	 * Decodes a single texel of a mip level
+	 *
+	 * @return    The color of the texel, or NaN if its image couldn't be decoded
+	 */
+	__m128 FetchTexel(uint imageId, const Image *image, uint level, uint x, uint y);
+	/**
+	 * Returns the texels of a tile. Mapped images are read in place. Otherwise, this is GetTile()
+	 *
+	 * @return    The texels of the tile, or nullptr if its image couldn't be decoded
+	 */
+	const byte *GetTileTexels(uint imageId, const Image *image, uint level, uint tileIndex);
+	/**
+	 * Returns a tile, loading its image if it isn't in the cache
+	 *
+	 * The tile is kept alive by the calling thread's micro-cache, so it's only valid until the thread's next call
+	 *
+	 * @return    The tile, or nullptr if its image couldn't be decoded
+	 */
+	const ImageTile *GetTile(uint imageId, uint level, uint tileIndex);
+	/**
+	 * Looks a tile up in the shared cache, and marks it as the most recently used
+	 *
+	 * @return    The tile, or nullptr if it isn't in the cache
+	 */
+	std::shared_ptr<const ImageTile> FindTile(uint64 key);
+	/**
+	 * Decodes the tile's image and adds all of its tiles to the cache
+	 *
+	 * The image is converted exactly as the texture compiler would, so preprocessing an image doesn't change how it looks
+	 *
+	 * The requested tile becomes the most recently used. The rest are added as the least recently used, but only while
+	 * they fit in the budget. The others are dropped, rather than evicting tiles that are in use, and are decoded again
+	 * if they're needed. Images that are much bigger than the budget should be preprocessed into .ltf files
+	 */
+	std::shared_ptr<const ImageTile> LoadTile(uint imageId, uint level, uint tileIndex);
+	/**
+	 * Adds a tile to the LRU list, if it isn't already in the cache. m_tileLock must be held
+	 *
+	 * @param mostRecent    If true, the tile goes to the front of the list. Otherwise it goes to the back
+	 */
+	void InsertTile(uint64 key, const std::shared_ptr<const ImageTile> &tile, std::size_t memorySize, bool mostRecent);
+	/**
+	 * Evicts tiles from the back of the LRU list until the cache is within budget. m_tileLock must be held
+	 */
+	void EvictTiles();
 };
 
-}
+} // End of namespace Lantern
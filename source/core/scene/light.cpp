@@ -0,0 +1,80 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "scene/light.h"
+
+#include "math/vector_math.h"
+
+#include "integrator/surface_interaction.h"
+
+#include <cstring>
+
+
+namespace Lantern {
+
+float3 Light::ConnectUniformAreaSample(const float3a &point, const float3a &normal, float area, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const {
+	float3a toLight = point - interaction.Position;
+	float distanceSquared = dot(toLight, toLight);
+	float distance = sqrtf(distanceSquared);
+	if (distance == 0.0f) {
+		*pdf = 0.0f;
+		return float3(0.0f);
+	}
+	float3a direction = toLight / distance;
+	interaction.InputDirection = direction;
+
+	// Check that the point is above the horizon
+	if (dot(direction, interaction.Normal) <= 0.0f) {
+		*pdf = 0.0f;
+		return float3(0.0f);
+	}
+
+	// Convert the area pdf to solid angle
+	float cosTheta = std::abs(dot(normalize(normal), direction));
+	if (cosTheta == 0.0f) {
+		*pdf = 0.0f;
+		return float3(0.0f);
+	}
+	*pdf = distanceSquared / (cosTheta * area);
+
+	InitShadowRay(interaction.Position, direction, distance, shadowRay);
+
+	// Return the full radiance value
+	// The value will be attenuated by the BRDF
+	return m_radiance;
+}
+
+float Light::UniformAreaPdfLi(const RTCRayHit &rayHit, float area) const {
+	float3a direction(rayHit.ray.dir_x, rayHit.ray.dir_y, rayHit.ray.dir_z);
+	float directionLength = length(direction);
+
+	// Convert the area pdf to solid angle, just like ConnectUniformAreaSample
+	// It uses the geometric normal, so we have to as well
+	float3a geometricNormal(rayHit.hit.Ng_x, rayHit.hit.Ng_y, rayHit.hit.Ng_z);
+	float distance = rayHit.ray.tfar * directionLength;
+	float cosTheta = std::abs(dot(normalize(geometricNormal), direction / directionLength));
+
+	return distance * distance / (cosTheta * area);
+}
+
+void Light::InitShadowRay(const float3a &origin, const float3a &direction, float distance, RTCRay *shadowRay) {
+	// Only test visibility up to the light, so the shadow ray can terminate on any hit
+	memset(shadowRay, 0, sizeof(RTCRay));
+
+	shadowRay->org_x = origin.x;
+	shadowRay->org_y = origin.y;
+	shadowRay->org_z = origin.z;
+
+	shadowRay->dir_x = direction.x;
+	shadowRay->dir_y = direction.y;
+	shadowRay->dir_z = direction.z;
+
+	shadowRay->tnear = 0.001f;
+	shadowRay->tfar = distance - 0.001f;
+	shadowRay->mask = 0xFFFFFFFF;
+}
+
+} // End of namespace Lantern
@@ -6,7 +6,13 @@
 
 #pragma once
 
-#include "math/uniform_sampler.h"
+#include "math/int_types.h"
+#include "math/vector_types.h"
+
+#include "scene/light_bounds.h"
+
+#define EMBREE_STATIC_LIB
+#include "embree3/rtcore.h"
 
 
 namespace Lantern {
@@ -17,17 +23,88 @@ class Scene;
 class Light {
 public:
 	Light(float3 radiance) 
-		: m_radiance(radiance) {
+		: m_radiance(radiance),
+		  m_index(0u) {
 	}
 	virtual ~Light() = default;
 
 public:
 	float3 m_radiance;
+	// The light's index in the scene. Set by the scene when the light is added
+	uint m_index;
 
 public:
-	virtual float3 SampleLi(UniformSampler *sampler, Scene *scene, SurfaceInteraction &interaction, float *pdf) const = 0;
-	virtual float PdfLi(Scene *scene, SurfaceInteraction &interaction) const = 0;
-	virtual float3 Le() const { return m_radiance; }
+	/**
+	 * Samples a direction towards the light, ignoring occlusion
+	 *
+	 * The caller is responsible for tracing shadowRay. The sample only contributes if it is unoccluded
+	 *
+	 * @param uElement       A uniform random number in [0, 1). Lights made of many parts, like meshes and environment maps,
+	 *                       use it to pick a part, so all of u is left for the point within the part
+	 * @param u              A uniform random point in [0, 1)^2, used to pick the point on the light
+	 * @param scene          The scene the light belongs to
+	 * @param interaction    The surface being lit. InputDirection is set to the sampled direction
+	 * @param pdf            The solid angle pdf of the sample. Zero if the sample is invalid
+	 * @param shadowRay      A ray from the surface to the sampled point on the light, with tfar bounded to just short of the light
+	 * @return               The radiance arriving from the light, if unoccluded
+	 */
+	virtual float3 SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const = 0;
+	/**
+	 * Calculates the pdf that SampleLi would have sampled the direction of a ray that hit this light
+	 *
+	 * @param scene     The scene the light belongs to
+	 * @param rayHit    A ray whose closest hit is this light
+	 * @return          The solid angle pdf of the ray's direction
+	 */
+	virtual float PdfLi(Scene *scene, const RTCRayHit &rayHit) const = 0;
+	/**
+	 * The radiance the light emits towards a ray that hit it
+	 *
+	 * @param direction    The direction of the ray
+	 */
+	virtual float3 Le(const float3a &direction) const { return m_radiance; }
+	/**
+	 * The total power the light emits, used to decide how often to sample it
+	 *
+	 * Only relative values matter, so lights can use any estimate that is consistent between them
+	 */
+	virtual float Power() const = 0;
+	/**
+	 * Bounds where the light is, and which way it emits, for the LightBVH
+	 *
+	 * @param bounds    The bounds. Only valid if this returns true
+	 * @return          False if the light can't be bounded, ie. it's infinitely far away
+	 */
+	virtual bool Bounds(LightBounds *bounds) const { return false; }
+
+protected:
+	/**
+	 * Finishes SampleLi for lights that pick a uniform point on their surface
+	 *
+	 * Converts the area pdf to solid angle, and sets up the shadow ray
+	 *
+	 * @param point          The sampled point on the light
+	 * @param normal         The geometric normal of the light at point. It doesn't need to be normalized
+	 * @param area           The surface area of the light
+	 * @param interaction    The surface being lit. InputDirection is set to the direction of point
+	 * @param pdf            The solid angle pdf of the sample. Zero if the sample is invalid
+	 * @param shadowRay      A ray from the surface to point
+	 * @return               The radiance arriving from the light, if unoccluded
+	 */
+	float3 ConnectUniformAreaSample(const float3a &point, const float3a &normal, float area, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const;
+	/**
+	 * The solid angle pdf that ConnectUniformAreaSample would have given the direction of a ray that hit this light
+	 */
+	float UniformAreaPdfLi(const RTCRayHit &rayHit, float area) const;
+	/**
+	 * Sets up a shadow ray that tests visibility up to, but not including, a point on the light
+	 *
+	 * @param origin       The surface being lit
+	 * @param direction    The normalized direction from origin to the light
+	 * @param distance     The distance from origin to the light
+	 * @param shadowRay    The ray to set up
+	 */
+	static void InitShadowRay(const float3a &origin, const float3a &direction, float distance, RTCRay *shadowRay);
 };
 
 } // End of namespace Lantern
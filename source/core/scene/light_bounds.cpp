@@ -0,0 +1,147 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "scene/light_bounds.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace Lantern {
+
+static inline float SafeSqrt(float x) {
+	return sqrtf(std::max(x, 0.0f));
+}
+
+static inline float SafeACos(float x) {
+	return acosf(std::min(std::max(x, -1.0f), 1.0f));
+}
+
+/**
+ * cos(max(0, thetaA - thetaB)), from the sines and cosines of the angles
+ */
+static inline float CosSubClamped(float sinThetaA, float cosThetaA, float sinThetaB, float cosThetaB) {
+	if (cosThetaA > cosThetaB) {
+		return 1.0f;
+	}
+	return cosThetaA * cosThetaB + sinThetaA * sinThetaB;
+}
+
+/**
+ * sin(max(0, thetaA - thetaB)), from the sines and cosines of the angles
+ */
+static inline float SinSubClamped(float sinThetaA, float cosThetaA, float sinThetaB, float cosThetaB) {
+	if (cosThetaA > cosThetaB) {
+		return 0.0f;
+	}
+	return sinThetaA * cosThetaB - cosThetaA * sinThetaB;
+}
+
+/**
+ * Rotates v around a unit axis by theta radians
+ */
+static inline float3 Rotate(const float3 &v, const float3 &axis, float theta) {
+	float cosTheta = cosf(theta);
+	float sinTheta = sinf(theta);
+
+	return v * cosTheta + cross(axis, v) * sinTheta + axis * dot(axis, v) * (1.0f - cosTheta);
+}
+
+DirectionCone DirectionCone::Union(const DirectionCone &a, const DirectionCone &b) {
+	float thetaA = SafeACos(a.CosTheta);
+	float thetaB = SafeACos(b.CosTheta);
+	float thetaD = SafeACos(dot(a.W, b.W));
+
+	// If one cone already contains the other, we're done
+	if (std::min(thetaD + thetaB, (float)M_PI) <= thetaA) {
+		return a;
+	}
+	if (std::min(thetaD + thetaA, (float)M_PI) <= thetaB) {
+		return b;
+	}
+
+	float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+	if (thetaO >= (float)M_PI) {
+		return EntireSphere();
+	}
+
+	// Rotate a's axis towards b's, until the cone touches the far edges of both
+	float3 axis = cross(a.W, b.W);
+	float axisLength = length(axis);
+	if (axisLength == 0.0f) {
+		return EntireSphere();
+	}
+	float3 w = Rotate(a.W, axis / axisLength, thetaO - thetaA);
+
+	return DirectionCone(normalize(w), cosf(thetaO));
+}
+
+float LightBounds::Importance(const float3 &position, const float3 &normal) const {
+	// Clamp the distance to the size of the bounds, so points close to, or inside, the bounds don't blow up
+	float3 centroid = Centroid();
+	float3 toPoint = position - centroid;
+	float distanceSquared = dot(toPoint, toPoint);
+	distanceSquared = std::max(distanceSquared, length(Max - Min) * 0.5f);
+	float3 wi = distanceSquared > 0.0f ? normalize(toPoint) : float3(0.0f, 0.0f, 1.0f);
+
+	// The angle between the light's axis and the direction to the point
+	float cosThetaW = dot(W, wi);
+	if (TwoSided) {
+		cosThetaW = std::abs(cosThetaW);
+	}
+	float sinThetaW = SafeSqrt(1.0f - cosThetaW * cosThetaW);
+
+	// The angle the bounds subtend, as seen from the point
+	float3 extent = (Max - Min) * 0.5f;
+	float radiusSquared = dot(extent, extent);
+	float centroidDistanceSquared = dot(toPoint, toPoint);
+	float cosThetaB = centroidDistanceSquared < radiusSquared ? -1.0f : SafeSqrt(1.0f - radiusSquared / centroidDistanceSquared);
+	float sinThetaB = SafeSqrt(1.0f - cosThetaB * cosThetaB);
+
+	// The smallest angle between any emitted direction and any direction to the point
+	float sinThetaO = SafeSqrt(1.0f - CosThetaO * CosThetaO);
+	float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, CosThetaO);
+	float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, CosThetaO);
+	float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if (cosThetaP <= CosThetaE) {
+		return 0.0f;
+	}
+
+	float importance = Phi * cosThetaP / distanceSquared;
+
+	// The smallest angle of incidence at the point
+	if (normal.x != 0.0f || normal.y != 0.0f || normal.z != 0.0f) {
+		float cosThetaI = std::abs(dot(wi, normal));
+		float sinThetaI = SafeSqrt(1.0f - cosThetaI * cosThetaI);
+		importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	}
+
+	return std::max(importance, 0.0f);
+}
+
+LightBounds LightBounds::Union(const LightBounds &a, const LightBounds &b) {
+	if (a.Phi == 0.0f) {
+		return b;
+	}
+	if (b.Phi == 0.0f) {
+		return a;
+	}
+
+	DirectionCone cone = DirectionCone::Union(DirectionCone(a.W, a.CosThetaO), DirectionCone(b.W, b.CosThetaO));
+
+	LightBounds result;
+	result.Min = min(a.Min, b.Min);
+	result.Max = max(a.Max, b.Max);
+	result.W = cone.W;
+	result.Phi = a.Phi + b.Phi;
+	result.CosThetaO = cone.CosTheta;
+	result.CosThetaE = std::min(a.CosThetaE, b.CosThetaE);
+	result.TwoSided = a.TwoSided || b.TwoSided;
+
+	return result;
+}
+
+} // End of namespace Lantern
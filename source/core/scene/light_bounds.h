@@ -0,0 +1,86 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/vector_types.h"
+
+
+namespace Lantern {
+
+/**
+ * A cone of directions around an axis
+ */
+struct DirectionCone {
+	DirectionCone()
+		: W(0.0f, 0.0f, 1.0f),
+		  CosTheta(1.0f) {
+	}
+	DirectionCone(float3 w, float cosTheta)
+		: W(w),
+		  CosTheta(cosTheta) {
+	}
+
+	float3 W;
+	// The cosine of the cone's half angle
+	float CosTheta;
+
+	static DirectionCone EntireSphere() {
+		return DirectionCone(float3(0.0f, 0.0f, 1.0f), -1.0f);
+	}
+	/**
+	 * The smallest cone that contains both a and b
+	 */
+	static DirectionCone Union(const DirectionCone &a, const DirectionCone &b);
+};
+
+/**
+ * A conservative description of where a light is, which way it points, and how much it emits
+ *
+ * Used by the LightBVH to estimate how much a light, or a whole cluster of lights, could contribute to a point
+ */
+struct LightBounds {
+	LightBounds()
+		: Min(0.0f),
+		  Max(0.0f),
+		  W(0.0f, 0.0f, 1.0f),
+		  Phi(0.0f),
+		  CosThetaO(1.0f),
+		  CosThetaE(1.0f),
+		  TwoSided(false) {
+	}
+
+	float3 Min;
+	float3 Max;
+	// The axis of the cone of surface normals
+	float3 W;
+	// The emitted power
+	float Phi;
+	// The cosine of the half angle of the cone of surface normals
+	float CosThetaO;
+	// The cosine of the angle past the normals that light is still emitted at. cos(pi / 2) for diffuse emitters
+	float CosThetaE;
+	bool TwoSided;
+
+	float3 Centroid() const {
+		return (Min + Max) * 0.5f;
+	}
+	/**
+	 * Estimates the light's contribution to a point
+	 *
+	 * The estimate is an upper bound over every point and orientation within the bounds, but it
+	 * only needs to be good relative to other LightBounds. So it's only used to pick between lights
+	 *
+	 * @param position    The point being lit
+	 * @param normal      The normal of the point being lit, or zero for points in a medium
+	 * @return            The estimated contribution
+	 */
+	float Importance(const float3 &position, const float3 &normal) const;
+
+	static LightBounds Union(const LightBounds &a, const LightBounds &b);
+};
+
+} // End of namespace Lantern
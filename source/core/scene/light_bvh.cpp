@@ -0,0 +1,254 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "scene/light_bvh.h"
+
+#include "scene/light.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace Lantern {
+
+const uint64 LightBVH::kNotSampled;
+const uint64 LightBVH::kUnbounded;
+const uint LightBVH::kMaxSAHDepth;
+
+// The largest float below 1
+static const float kOneMinusEpsilon = 0.99999994f;
+
+/**
+ * The surface area orientation heuristic cost of a cluster of lights
+ *
+ * Like the surface area heuristic, but it also penalizes clusters whose lights point in many different directions,
+ * and clusters that are thin along the split axis
+ */
+static float EvaluateCost(const LightBounds &bounds, const LightBounds &parentBounds, uint dim) {
+	float thetaO = acosf(std::min(std::max(bounds.CosThetaO, -1.0f), 1.0f));
+	float thetaE = acosf(std::min(std::max(bounds.CosThetaE, -1.0f), 1.0f));
+	float thetaW = std::min(thetaO + thetaE, (float)M_PI);
+	float sinThetaO = sqrtf(std::max(1.0f - bounds.CosThetaO * bounds.CosThetaO, 0.0f));
+
+	// The solid angle of the cone of emitted directions, weighted by cosine
+	float mOmega = 2.0f * (float)M_PI * (1.0f - bounds.CosThetaO) +
+	               (float)M_PI / 2.0f * (2.0f * thetaW * sinThetaO - cosf(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + bounds.CosThetaO);
+
+	float3 parentDiagonal = parentBounds.Max - parentBounds.Min;
+	float maxExtent = std::max(parentDiagonal.x, std::max(parentDiagonal.y, parentDiagonal.z));
+	float kr = parentDiagonal[dim] > 0.0f ? maxExtent / parentDiagonal[dim] : 0.0f;
+
+	float3 d = bounds.Max - bounds.Min;
+	float surfaceArea = 2.0f * (d.x * d.y + d.x * d.z + d.y * d.z);
+
+	return bounds.Phi * mOmega * kr * surfaceArea;
+}
+
+void LightBVH::Build(const std::vector<Light *> &lights) {
+	m_nodes.clear();
+	m_lights = lights;
+	m_unboundedLights.clear();
+	m_lightPaths.assign(lights.size(), kNotSampled);
+
+	std::vector<std::pair<LightBounds, uint> > bounds;
+	for (uint i = 0; i < (uint)lights.size(); ++i) {
+		LightBounds lightBounds;
+		if (!lights[i]->Bounds(&lightBounds)) {
+			m_unboundedLights.push_back(lights[i]);
+			m_lightPaths[i] = kUnbounded;
+		} else if (lightBounds.Phi > 0.0f) {
+			bounds.push_back(std::make_pair(lightBounds, i));
+		}
+	}
+
+	if (!bounds.empty()) {
+		m_nodes.reserve(2 * bounds.size() - 1);
+		BuildNode(bounds, 0, bounds.size(), 0ull, 0u);
+	}
+}
+
+uint LightBVH::BuildNode(std::vector<std::pair<LightBounds, uint> > &bounds, std::size_t begin, std::size_t end, uint64 path, uint depth) {
+	uint nodeIndex = (uint)m_nodes.size();
+	m_nodes.push_back(Node());
+
+	if (end - begin == 1) {
+		Node &node = m_nodes[nodeIndex];
+		node.Bounds = bounds[begin].first;
+		node.ChildOrLightIndex = bounds[begin].second;
+		node.IsLeaf = true;
+
+		m_lightPaths[bounds[begin].second] = path;
+		return nodeIndex;
+	}
+
+	LightBounds totalBounds;
+	float3 centroidMin(embree::inf);
+	float3 centroidMax(embree::neg_inf);
+	for (std::size_t i = begin; i < end; ++i) {
+		totalBounds = LightBounds::Union(totalBounds, bounds[i].first);
+		centroidMin = min(centroidMin, bounds[i].first.Centroid());
+		centroidMax = max(centroidMax, bounds[i].first.Centroid());
+	}
+
+	// Find the cheapest split, by binning the lights along each axis
+	static const uint kNumBuckets = 12;
+	bool foundSplit = false;
+	float bestCost = 0.0f;
+	uint bestDim = 0;
+	uint bestBucket = 0;
+	if (depth < kMaxSAHDepth) {
+		for (uint dim = 0; dim < 3; ++dim) {
+			if (centroidMax[dim] == centroidMin[dim]) {
+				continue;
+			}
+
+			LightBounds buckets[kNumBuckets];
+			for (std::size_t i = begin; i < end; ++i) {
+				float offset = (bounds[i].first.Centroid()[dim] - centroidMin[dim]) / (centroidMax[dim] - centroidMin[dim]);
+				uint b = std::min((uint)(offset * kNumBuckets), kNumBuckets - 1);
+				buckets[b] = LightBounds::Union(buckets[b], bounds[i].first);
+			}
+
+			for (uint split = 0; split < kNumBuckets - 1; ++split) {
+				LightBounds below;
+				LightBounds above;
+				for (uint b = 0; b <= split; ++b) {
+					below = LightBounds::Union(below, buckets[b]);
+				}
+				for (uint b = split + 1; b < kNumBuckets; ++b) {
+					above = LightBounds::Union(above, buckets[b]);
+				}
+
+				float cost = EvaluateCost(below, totalBounds, dim) + EvaluateCost(above, totalBounds, dim);
+				if (cost > 0.0f && (!foundSplit || cost < bestCost)) {
+					foundSplit = true;
+					bestCost = cost;
+					bestDim = dim;
+					bestBucket = split;
+				}
+			}
+		}
+	}
+
+	std::size_t mid = begin;
+	if (foundSplit) {
+		auto pivot = std::partition(bounds.begin() + begin, bounds.begin() + end, [&](const std::pair<LightBounds, uint> &entry) {
+			float offset = (entry.first.Centroid()[bestDim] - centroidMin[bestDim]) / (centroidMax[bestDim] - centroidMin[bestDim]);
+			uint b = std::min((uint)(offset * kNumBuckets), kNumBuckets - 1);
+			return b <= bestBucket;
+		});
+		mid = pivot - bounds.begin();
+	}
+
+	// Fall back to a median split along the widest axis if there's no useful split
+	if (mid == begin || mid == end) {
+		float3 extent = centroidMax - centroidMin;
+		uint dim = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		mid = (begin + end) / 2;
+		std::nth_element(bounds.begin() + begin, bounds.begin() + mid, bounds.begin() + end, [dim](const std::pair<LightBounds, uint> &a, const std::pair<LightBounds, uint> &b) {
+			return a.first.Centroid()[dim] < b.first.Centroid()[dim];
+		});
+	}
+
+	BuildNode(bounds, begin, mid, path, depth + 1);
+	uint secondChild = BuildNode(bounds, mid, end, path | (1ull << depth), depth + 1);
+
+	Node &node = m_nodes[nodeIndex];
+	node.Bounds = LightBounds::Union(m_nodes[nodeIndex + 1].Bounds, m_nodes[secondChild].Bounds);
+	node.ChildOrLightIndex = secondChild;
+	node.IsLeaf = false;
+
+	return nodeIndex;
+}
+
+Light *LightBVH::Sample(float u, const float3 &position, const float3 &normal, float *pdf) const {
+	// Unbounded lights get the same chance as the whole tree
+	float pUnbounded = float(m_unboundedLights.size()) / float(m_unboundedLights.size() + (m_nodes.empty() ? 0 : 1));
+	if (u < pUnbounded) {
+		uint index = std::min((uint)(u / pUnbounded * m_unboundedLights.size()), (uint)m_unboundedLights.size() - 1);
+		*pdf = pUnbounded / m_unboundedLights.size();
+		return m_unboundedLights[index];
+	}
+	if (m_nodes.empty()) {
+		return nullptr;
+	}
+
+	// Reuse u for every decision on the way down, by rescaling the part that's left
+	u = std::min((u - pUnbounded) / (1.0f - pUnbounded), kOneMinusEpsilon);
+	float pmf = 1.0f - pUnbounded;
+
+	uint nodeIndex = 0;
+	while (true) {
+		const Node &node = m_nodes[nodeIndex];
+		if (node.IsLeaf) {
+			// Interior nodes already checked their children's importance. Only a lone root needs checking
+			if (nodeIndex > 0 || node.Bounds.Importance(position, normal) > 0.0f) {
+				*pdf = pmf;
+				return m_lights[node.ChildOrLightIndex];
+			}
+			return nullptr;
+		}
+
+		float importance0 = m_nodes[nodeIndex + 1].Bounds.Importance(position, normal);
+		float importance1 = m_nodes[node.ChildOrLightIndex].Bounds.Importance(position, normal);
+		if (importance0 == 0.0f && importance1 == 0.0f) {
+			return nullptr;
+		}
+
+		float p0 = importance0 / (importance0 + importance1);
+		if (u < p0) {
+			nodeIndex = nodeIndex + 1;
+			u = std::min(u / p0, kOneMinusEpsilon);
+			pmf *= p0;
+		} else {
+			nodeIndex = node.ChildOrLightIndex;
+			u = std::min((u - p0) / (1.0f - p0), kOneMinusEpsilon);
+			pmf *= 1.0f - p0;
+		}
+	}
+}
+
+float LightBVH::Pdf(const float3 &position, const float3 &normal, const Light *light) const {
+	uint64 path = m_lightPaths[light->m_index];
+	if (path == kNotSampled) {
+		return 0.0f;
+	}
+
+	float pUnbounded = float(m_unboundedLights.size()) / float(m_unboundedLights.size() + (m_nodes.empty() ? 0 : 1));
+	if (path == kUnbounded) {
+		return pUnbounded / m_unboundedLights.size();
+	}
+
+	// Match Sample(), which won't pick a lone root that can't contribute
+	if (m_nodes.size() == 1 && m_nodes[0].Bounds.Importance(position, normal) == 0.0f) {
+		return 0.0f;
+	}
+
+	// Follow the light's path down the tree, multiplying the probabilities of each choice
+	float pmf = 1.0f - pUnbounded;
+	uint nodeIndex = 0;
+	while (!m_nodes[nodeIndex].IsLeaf) {
+		const Node &node = m_nodes[nodeIndex];
+		float importance0 = m_nodes[nodeIndex + 1].Bounds.Importance(position, normal);
+		float importance1 = m_nodes[node.ChildOrLightIndex].Bounds.Importance(position, normal);
+		if (importance0 == 0.0f && importance1 == 0.0f) {
+			return 0.0f;
+		}
+
+		if ((path & 1ull) == 0) {
+			pmf *= importance0 / (importance0 + importance1);
+			nodeIndex = nodeIndex + 1;
+		} else {
+			pmf *= importance1 / (importance0 + importance1);
+			nodeIndex = node.ChildOrLightIndex;
+		}
+		path >>= 1;
+	}
+
+	return pmf;
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,89 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "math/int_types.h"
+#include "math/vector_types.h"
+
+#include "scene/light_bounds.h"
+
+#include <vector>
+
+
+namespace Lantern {
+
+class Light;
+
+/**
+ * A bounding volume hierarchy over the lights, for picking lights in proportion to their estimated contribution to a point
+ *
+ * Sampling walks from the root to a leaf, choosing between the two children of each node in proportion to
+ * their LightBounds::Importance(). So lights that are far away, small, dim, or facing away are rarely picked,
+ * and picking a light is O(log n), no matter how many lights there are
+ *
+ * Lights without bounds, like environment lights, can't be placed in the tree. They're picked separately,
+ * with the same probability as the tree as a whole. Lights that don't emit anything are never picked
+ */
+class LightBVH {
+public:
+	LightBVH() {}
+
+private:
+	struct Node {
+		LightBounds Bounds;
+		// For interior nodes, the index of the second child. The first child always follows its parent
+		// For leaves, the index of the light
+		uint ChildOrLightIndex;
+		bool IsLeaf;
+	};
+	std::vector<Node> m_nodes;
+
+	std::vector<Light *> m_lights;
+	std::vector<Light *> m_unboundedLights;
+	// The path from the root to each light's leaf, indexed by Light::m_index
+	// Bit n is set if the path takes the second child at depth n. Lights that aren't in the tree use the sentinels below
+	std::vector<uint64> m_lightPaths;
+	static const uint64 kNotSampled = ~0ull;
+	static const uint64 kUnbounded = ~0ull - 1ull;
+	// Subtrees deeper than this are split at the median, which keeps every path within 64 bits
+	static const uint kMaxSAHDepth = 40;
+
+public:
+	/**
+	 * Builds the tree
+	 *
+	 * @param lights    Every light in the scene. Each light's m_index must be its index in lights
+	 */
+	void Build(const std::vector<Light *> &lights);
+	/**
+	 * Picks a light for a point
+	 *
+	 * @param u           A uniform random number in [0, 1)
+	 * @param position    The point being lit
+	 * @param normal      The normal of the point being lit, or zero for points in a medium
+	 * @param pdf         The probability of picking the returned light
+	 * @return            The light, or nullptr if no light can contribute to the point
+	 */
+	Light *Sample(float u, const float3 &position, const float3 &normal, float *pdf) const;
+	/**
+	 * The probability that Sample() picks a light for a point
+	 */
+	float Pdf(const float3 &position, const float3 &normal, const Light *light) const;
+
+private:
+	/**
+	 * Recursively builds the subtree over bounds[begin, end)
+	 *
+	 * @param bounds    The bounds of each light, paired with the light's index
+	 * @param path      The path from the root to the new node, in the format of m_lightPaths
+	 * @param depth     The depth of the new node
+	 * @return          The index of the new node
+	 */
+	uint BuildNode(std::vector<std::pair<LightBounds, uint> > &bounds, std::size_t begin, std::size_t end, uint64 path, uint depth);
+};
+
+} // End of namespace Lantern
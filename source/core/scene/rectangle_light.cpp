@@ -0,0 +1,159 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "scene/rectangle_light.h"
+
+#include "math/vector_math.h"
+
+#include "integrator/surface_interaction.h"
+
+#include <algorithm>
+
+
+namespace Lantern {
+
+// Below this solid angle, the spherical rectangle loses too much precision, so we sample by area instead
+static const float kMinSolidAngle = 1e-4f;
+
+RectangleLight::RectangleLight(float3 color, float radiantPower, float3a corner, float3a edgeX, float3a edgeY)
+	: Light(color * radiantPower * (float)M_1_PI / (length(edgeX) * length(edgeY))),
+	  m_corner(corner),
+	  m_x(normalize(edgeX)),
+	  m_y(normalize(edgeY)),
+	  m_z(normalize(cross(edgeX, edgeY))),
+	  m_width(length(edgeX)),
+	  m_height(length(edgeY)) {
+}
+
+bool RectangleLight::Project(const float3a &origin, SphericalRectangle *rect) const {
+	float3a d = m_corner - origin;
+	rect->X0 = dot(d, m_x);
+	rect->Y0 = dot(d, m_y);
+	rect->Z0 = dot(d, m_z);
+	rect->Z = m_z;
+
+	// Work in the frame where the rectangle is below the point
+	if (rect->Z0 > 0.0f) {
+		rect->Z0 = -rect->Z0;
+		rect->Z = -rect->Z;
+	}
+	if (rect->Z0 == 0.0f) {
+		rect->S = 0.0f;
+		return false;
+	}
+
+	rect->X1 = rect->X0 + m_width;
+	rect->Y1 = rect->Y0 + m_height;
+
+	// The corners of the rectangle, and the normals of the planes through the point and each edge
+	float3a v00(rect->X0, rect->Y0, rect->Z0);
+	float3a v01(rect->X0, rect->Y1, rect->Z0);
+	float3a v10(rect->X1, rect->Y0, rect->Z0);
+	float3a v11(rect->X1, rect->Y1, rect->Z0);
+	float3a n0 = normalize(cross(v00, v10));
+	float3a n1 = normalize(cross(v10, v11));
+	float3a n2 = normalize(cross(v11, v01));
+	float3a n3 = normalize(cross(v01, v00));
+
+	// The internal angles of the spherical rectangle
+	float g0 = acosf(std::min(std::max(-dot(n0, n1), -1.0f), 1.0f));
+	float g1 = acosf(std::min(std::max(-dot(n1, n2), -1.0f), 1.0f));
+	float g2 = acosf(std::min(std::max(-dot(n2, n3), -1.0f), 1.0f));
+	float g3 = acosf(std::min(std::max(-dot(n3, n0), -1.0f), 1.0f));
+
+	rect->B0 = n0.z;
+	rect->B1 = n2.z;
+	rect->K = 2.0f * (float)M_PI - g2 - g3;
+	rect->S = g0 + g1 - rect->K;
+
+	return rect->S >= kMinSolidAngle;
+}
+
+float3 RectangleLight::SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const {
+	SphericalRectangle rect;
+	if (!Project(interaction.Position, &rect)) {
+		// The rectangle is tiny, or very far away, so sampling by area is just as good
+		float3a point = m_corner + m_x * (u.x * m_width) + m_y * (u.y * m_height);
+		return ConnectUniformAreaSample(point, m_z, Area(), interaction, pdf, shadowRay);
+	}
+
+	// Pick x, so the area to the left of x is proportional to u.x
+	float au = u.x * rect.S + rect.K;
+	float fu = (cosf(au) * rect.B0 - rect.B1) / sinf(au);
+	float cu = 1.0f / sqrtf(fu * fu + rect.B0 * rect.B0) * (fu > 0.0f ? 1.0f : -1.0f);
+	cu = std::min(std::max(cu, -1.0f), 1.0f);
+	float xu = -(cu * rect.Z0) / sqrtf(std::max(1.0f - cu * cu, 0.0f));
+	xu = std::min(std::max(xu, rect.X0), rect.X1);
+
+	// Then pick y, uniformly in the solid angle of the line at x
+	float d = sqrtf(xu * xu + rect.Z0 * rect.Z0);
+	float h0 = rect.Y0 / sqrtf(d * d + rect.Y0 * rect.Y0);
+	float h1 = rect.Y1 / sqrtf(d * d + rect.Y1 * rect.Y1);
+	float hv = h0 + u.y * (h1 - h0);
+	float hvSquared = hv * hv;
+	float yv = hvSquared < 1.0f - 1e-6f ? (hv * d) / sqrtf(1.0f - hvSquared) : rect.Y1;
+
+	float3a toLight = m_x * xu + m_y * yv + rect.Z * rect.Z0;
+	float distance = length(toLight);
+	float3a direction = toLight / distance;
+	interaction.InputDirection = direction;
+
+	// Check that the point is above the horizon
+	if (dot(direction, interaction.Normal) <= 0.0f) {
+		*pdf = 0.0f;
+		return float3(0.0f);
+	}
+
+	*pdf = 1.0f / rect.S;
+
+	InitShadowRay(interaction.Position, direction, distance, shadowRay);
+
+	// Return the full radiance value
+	// The value will be attenuated by the BRDF
+	return m_radiance;
+}
+
+float RectangleLight::PdfLi(Scene *scene, const RTCRayHit &rayHit) const {
+	float3a origin(rayHit.ray.org_x, rayHit.ray.org_y, rayHit.ray.org_z);
+
+	SphericalRectangle rect;
+	if (!Project(origin, &rect)) {
+		return UniformAreaPdfLi(rayHit, Area());
+	}
+
+	return 1.0f / rect.S;
+}
+
+float RectangleLight::Power() const {
+	// Every point of the surface emits m_radiance over the hemisphere
+	return Luminance(m_radiance) * Area() * (float)M_PI;
+}
+
+bool RectangleLight::Bounds(LightBounds *bounds) const {
+	float3a corners[4] = {
+		m_corner,
+		m_corner + m_x * m_width,
+		m_corner + m_y * m_height,
+		m_corner + m_x * m_width + m_y * m_height
+	};
+
+	bounds->Min = float3(embree::inf);
+	bounds->Max = float3(embree::neg_inf);
+	for (const float3a &corner : corners) {
+		bounds->Min = min(bounds->Min, float3(corner.x, corner.y, corner.z));
+		bounds->Max = max(bounds->Max, float3(corner.x, corner.y, corner.z));
+	}
+	bounds->W = float3(m_z.x, m_z.y, m_z.z);
+	bounds->Phi = Power();
+	bounds->CosThetaO = 1.0f;
+	// Diffuse emission reaches all the way to the horizon
+	bounds->CosThetaE = 0.0f;
+	bounds->TwoSided = true;
+
+	return true;
+}
+
+} // End of namespace Lantern
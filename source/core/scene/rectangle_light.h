@@ -0,0 +1,74 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "scene/light.h"
+
+
+namespace Lantern {
+
+/**
+ * An emissive rectangle. Both sides emit, like AreaLight
+ *
+ * SampleLi samples the solid angle the rectangle subtends, so every sample lands on the light, and the pdf
+ * is the same for every direction. See "An Area-Preserving Parametrization for Spherical Rectangles" by
+ * Ureña, Fajardo, and King: https://www.arnoldrenderer.com/research/egsr2013_spherical_rectangle.pdf
+ */
+class RectangleLight : public Light {
+public:
+	/**
+	 * @param color           The color of the emitted light
+	 * @param radiantPower    The total power of the emitted light
+	 * @param corner          A corner of the rectangle
+	 * @param edgeX           The edge from corner to the next corner
+	 * @param edgeY           The other edge from corner. It must be perpendicular to edgeX
+	 */
+	RectangleLight(float3 color, float radiantPower, float3a corner, float3a edgeX, float3a edgeY);
+
+private:
+	float3a m_corner;
+	// The unit vectors along the edges, and the normal
+	float3a m_x;
+	float3a m_y;
+	float3a m_z;
+	float m_width;
+	float m_height;
+
+	/**
+	 * The rectangle, as seen from a point, in the rectangle's local frame
+	 */
+	struct SphericalRectangle {
+		// The rectangle's extents, relative to the point
+		float X0, Y0, Z0;
+		float X1, Y1;
+		// The normal, flipped to face away from the point
+		float3a Z;
+		float B0, B1;
+		float K;
+		// The solid angle
+		float S;
+	};
+
+public:
+	float3 SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const override;
+	float PdfLi(Scene *scene, const RTCRayHit &rayHit) const override;
+	float Power() const override;
+	bool Bounds(LightBounds *bounds) const override;
+
+private:
+	float Area() const {
+		return m_width * m_height;
+	}
+	/**
+	 * Projects the rectangle onto the unit sphere around a point
+	 *
+	 * @return    False if the solid angle is too small to sample accurately. The caller should sample by area instead
+	 */
+	bool Project(const float3a &origin, SphericalRectangle *rect) const;
+};
+
+} // End of namespace Lantern
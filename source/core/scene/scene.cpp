@@ -8,7 +8,12 @@
 
 #include "scene/mesh_elements.h"
 #include "scene/area_light.h"
+#include "scene/sphere_light.h"
+#include "scene/disk_light.h"
+#include "scene/rectangle_light.h"
+#include "scene/environment_light.h"
 #include "scene/geometry_generator.h"
+#include "scene/scene_json.h"
 
 #include "math/vector_math.h"
 
@@ -23,12 +28,16 @@
 #include "materials/textures/uv_texture.h"
 
 #include "io/lantern_model_file.h"
+#include "io/lantern_model_container.h"
+#include "io/lantern_scene_pack.h"
 
 #include "json.hpp"
-#include "json_schema_validator.hpp"
+
+#include "stb_image.h"
 
 
 #include <stdlib.h>
+#include <algorithm>
 
 
 namespace Lantern {
@@ -36,8 +45,11 @@ namespace Lantern {
 Scene::Scene()
 	: Camera(nullptr),
 	  BackgroundColor(0.0f),
+	  m_lightSamplerType(LightSamplerType::BVH),
+	  m_environmentLight(nullptr),
 	  m_device(rtcNewDevice(nullptr)),
-	  m_scene(nullptr) {
+	  m_scene(nullptr),
+	  m_scenePack(nullptr) {
 }
 
 Scene::~Scene() {
@@ -46,71 +58,131 @@ Scene::~Scene() {
 	rtcReleaseDevice(m_device);
 }
 
-float4 CalculateBoundingSphere(float3a *positions, std::size_t len) {
-	float3a center = positions[0];
-	float radius = 0.0001f;
-	float3a pos, diff;
-	float length, alpha, alphaSq;
-
-	for (std::size_t i = 0; i < 2; i++) {
-		for (std::size_t j = 0; j < len; ++j) {
-			pos = positions[j];
-			diff = pos - center;
-			length = embree::length(diff);
-			if (length > radius) {
-				alpha = length / radius;
-				alphaSq = alpha * alpha;
-				radius = 0.5f * (alpha + 1 / alpha) * radius;
-				center = 0.5f * ((1 + 1 / alphaSq) * center + (1 - 1 / alphaSq) * pos);
-			}
-		}
+/**
+ * The area of a triangle, using the half cross product: https://math.stackexchange.com/a/128999
+ */
+static inline float TriangleArea(const float3a &v0, const float3a &v1, const float3a &v2) {
+	return 0.5f * length(cross(v1 - v0, v2 - v0));
+}
+
+/**
+ * Points a view at the arrays of a version 1 LMF file
+ *
+ * Version 1 files pack their positions, so they're widened into positions, to match the view
+ */
+static void CreateLMFView(const LanternModelFile &lmf, std::vector<float> *positions, LanternModelFileView *view) {
+	positions->resize(lmf.Positions.size() / 3 * 4);
+	for (std::size_t i = 0, j = 0; i + 2 < lmf.Positions.size(); i += 3, j += 4) {
+		(*positions)[j] = lmf.Positions[i];
+		(*positions)[j + 1] = lmf.Positions[i + 1];
+		(*positions)[j + 2] = lmf.Positions[i + 2];
+		(*positions)[j + 3] = 1.0f;
 	}
 
-	for (std::size_t j = 0; j < len; ++j) {
-		pos = positions[j];
-		diff = pos - center;
-		length = embree::length(diff);
-		if (length > radius) {
-			radius = (radius + length) / 2.0f;
-			center = center + ((length - radius) / length * diff);
-		}
+	view->VerticesPerPrimitive = lmf.VerticesPerPrimative;
+	view->Positions = positions->data();
+	view->NumPositions = lmf.Positions.size() / 3;
+	view->Indices = lmf.Indices.data();
+	view->NumIndices = lmf.Indices.size();
+	view->Normals = lmf.Normals.empty() ? nullptr : lmf.Normals.data();
+	view->NumNormals = lmf.Normals.size() / 3;
+	view->TexCoords = lmf.TexCoords.empty() ? nullptr : lmf.TexCoords.data();
+	view->NumTexCoords = lmf.TexCoords.size() / 2;
+	view->HasEmitterData = false;
+	view->TriangleAreas = nullptr;
+	view->NumTriangles = 0;
+}
+
+/**
+ * Whether the emitter data stored in an LMF file can be used as is
+ *
+ * It's calculated in model space, so it only applies if the model isn't transformed
+ */
+static bool CanUseEmitterData(const LanternModelFileView &lmf, const float4x4 &transform) {
+	uint64 numTriangles = lmf.VerticesPerPrimitive == 4 ? lmf.NumIndices / 2 : lmf.NumIndices / 3;
+	return lmf.HasEmitterData && lmf.NumTriangles == numTriangles && transform == float4x4(embree::one);
+}
+
+/**
+ * A Lantern Model Container that's been mapped, and the index of each mesh in it by name
+ */
+struct LoadedLMC {
+	std::vector<LanternModelContainerEntry> Entries;
+	std::unordered_map<std::string, std::size_t> EntryMap;
+};
+
+/**
+ * The scale of a transform that only translates, rotates, and scales uniformly
+ *
+ * If the scale isn't uniform, this warns, and returns the average scale of the three axes
+ */
+static float UniformScale(const float4x4 &transform) {
+	float3a x(transform * float3a(1.0f, 0.0f, 0.0f, 0.0f));
+	float3a y(transform * float3a(0.0f, 1.0f, 0.0f, 0.0f));
+	float3a z(transform * float3a(0.0f, 0.0f, 1.0f, 0.0f));
+	float scaleX = length(x);
+	float scaleY = length(y);
+	float scaleZ = length(z);
+
+	float scale = (scaleX + scaleY + scaleZ) / 3.0f;
+	if (std::abs(scaleX - scale) > 1e-4f * scale || std::abs(scaleY - scale) > 1e-4f * scale || std::abs(scaleZ - scale) > 1e-4f * scale) {
+		printf("Spheres and disks can only be scaled uniformly. Using the average scale [%f]\n", scale);
 	}
 
-	return float4(center, radius);
+	return scale;
 }
 
 bool Scene::LoadSceneFromJSON(const char *filePath) {
 	m_jsonPath = canonical(fs::path(filePath));
 
-	if (ParseJSON()) {
-		rtcCommitScene(m_scene);
-		return true;
-	}
-
-	return false;
+	return ParseJSON();
 }
 
 bool Scene::ReloadSceneFromJSON() {
 	// Cleanup from the old scene
 	CleanupScene();
 
-	if (ParseJSON()) {
-		rtcCommitScene(m_scene);
-		return true;
+	return ParseJSON();
+}
+
+Light *Scene::RandomOneLight(float u, const float3a &position, const float3a &normal, Light *exclude, float *pdf) {
+	if (m_lights.empty()) {
+		return nullptr;
+	}
+
+	Light *light;
+	if (m_lightSamplerType == LightSamplerType::BVH) {
+		light = m_lightBVH.Sample(u, float3(position.x, position.y, position.z), float3(normal.x, normal.y, normal.z), pdf);
+	} else {
+		light = m_lights[m_lightDistribution.Sample(u, pdf)];
 	}
 
-	return false;
+	// Renormalizing around the excluded light would need a second distribution
+	// Excluded lights are only the ones we're standing on, so wasting the odd sample is cheaper
+	return light != exclude ? light : nullptr;
 }
 
-Light *Scene::RandomOneLight(UniformSampler *sampler) {
-	// FIXME: Update to a full size_t if we ever get lots and lots of lights
-	uint numLights = (uint)m_lights.size();
-	if (numLights == 0) {
-		return nullptr;
+Light *Scene::GetEnvironmentLight() const {
+	return m_environmentLight;
+}
+
+float Scene::LightSelectionPdf(const float3a &position, const float3a &normal, const Light *light) const {
+	if (m_lightSamplerType == LightSamplerType::BVH) {
+		return m_lightBVH.Pdf(float3(position.x, position.y, position.z), float3(normal.x, normal.y, normal.z), light);
 	}
 
-	uint lightIndex = sampler->NextDiscrete(numLights);
-	return m_lights[lightIndex];
+	return m_lightDistribution.Pdf(light->m_index);
+}
+
+void Scene::BuildLightDistribution() {
+	std::vector<float> power(m_lights.size());
+	for (std::size_t i = 0; i < m_lights.size(); ++i) {
+		m_lights[i]->m_index = (uint)i;
+		power[i] = m_lights[i]->Power();
+	}
+
+	m_lightDistribution.Build(power);
+	m_lightBVH.Build(m_lights);
 }
 
 void Scene::Intersect(RTCRayHit &ray) const {
@@ -120,6 +192,87 @@ void Scene::Intersect(RTCRayHit &ray) const {
 	rtcIntersect1(m_scene, &context, &ray);
 }
 
+void Scene::Intersect(const int *valid, RTCRayHit16 &rays) const {
+	RTCIntersectContext context;
+	rtcInitIntersectContext(&context);
+	context.flags = RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+	rtcIntersect16(valid, m_scene, &context, &rays);
+}
+
+bool Scene::Occluded(RTCRay &ray) const {
+	RTCIntersectContext context;
+	rtcInitIntersectContext(&context);
+	context.flags = RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+	rtcOccluded1(m_scene, &context, &ray);
+
+	return ray.tfar < 0.0f;
+}
+
+void Scene::Occluded(const int *valid, RTCRay16 &rays) const {
+	RTCIntersectContext context;
+	rtcInitIntersectContext(&context);
+	context.flags = RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+	rtcOccluded16(valid, m_scene, &context, &rays);
+}
+
+void Scene::GetSurfaceAttributes(const RTCRayHit &rayHit, const float3a &position, float3a *normal, float2 *texCoord, float *texCoordScale) const {
+	const Model &model = m_models.at(rayHit.hit.geomID);
+	float3a geometricNormal(rayHit.hit.Ng_x, rayHit.hit.Ng_y, rayHit.hit.Ng_z);
+
+	if (model.shape == ShapeType::Sphere) {
+		// Embree's geometric normal is exact for spheres
+		*normal = normalize(geometricNormal);
+
+		// Use the same mapping as CreateSphere()
+		float3a local(model.worldToObject * float3a(position.x, position.y, position.z, 1.0f));
+		local = normalize(local);
+		float theta = atan2f(local.x, local.z);
+		if (theta < 0.0f) {
+			theta += 2.0f * (float)M_PI;
+		}
+		float phi = acosf(std::min(std::max(local.y, -1.0f), 1.0f));
+
+		*texCoord = float2(theta / (2.0f * (float)M_PI), phi / (float)M_PI);
+
+		// Lines of latitude shrink towards the poles, so u moves faster there. Take the geometric mean of u and v
+		float sinPhi = std::max(sqrtf(std::max(1.0f - local.y * local.y, 0.0f)), 1e-4f);
+		*texCoordScale = model.texCoordScale / sqrtf(sinPhi);
+	} else if (model.shape == ShapeType::Disk) {
+		*normal = normalize(geometricNormal);
+
+		// Project the disk's bounding square onto [0, 1]^2, like CreateGrid()
+		float3a local(model.worldToObject * float3a(position.x, position.y, position.z, 1.0f));
+		*texCoord = float2(0.5f + 0.5f * local.x / model.radius, 0.5f + 0.5f * local.z / model.radius);
+		*texCoordScale = model.texCoordScale;
+	} else {
+		if (model.hasNormals) {
+			*normal = normalize(InterpolateNormal(rayHit.hit.geomID, rayHit.hit.primID, rayHit.hit.u, rayHit.hit.v));
+		} else {
+			*normal = normalize(geometricNormal);
+		}
+
+		if (model.hasTexCoords) {
+			*texCoord = InterpolateTexCoord(rayHit.hit.geomID, rayHit.hit.primID, rayHit.hit.u, rayHit.hit.v);
+
+			// Compare the area the texture coordinates cover to the area of the surface, around the hit
+			RTCGeometry geometry = rtcGetGeometry(m_scene, rayHit.hit.geomID);
+			float3 dPdu;
+			float3 dPdv;
+			rtcInterpolate1(geometry, rayHit.hit.primID, rayHit.hit.u, rayHit.hit.v, RTC_BUFFER_TYPE_VERTEX, 0, nullptr, &dPdu.x, &dPdv.x, 3);
+			float2 dTdu;
+			float2 dTdv;
+			rtcInterpolate1(geometry, rayHit.hit.primID, rayHit.hit.u, rayHit.hit.v, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, nullptr, &dTdu.x, &dTdv.x, 2);
+
+			float surfaceArea = length(cross(dPdu, dPdv));
+			float texCoordArea = std::abs(dTdu.x * dTdv.y - dTdu.y * dTdv.x);
+			*texCoordScale = surfaceArea > 0.0f ? sqrtf(texCoordArea / surfaceArea) : 0.0f;
+		} else {
+			*texCoord = float2(0.0f, 0.0f);
+			*texCoordScale = 0.0f;
+		}
+	}
+}
+
 float3 Scene::InterpolateNormal(uint meshId, uint primId, float u, float v) const {
 	float3 normal;
 	rtcInterpolate1(rtcGetGeometry(m_scene, meshId), primId, u, v, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, &normal.x, nullptr, nullptr, 3);
@@ -142,74 +295,66 @@ float2 Scene::InterpolateTexCoord(uint meshId, uint primId, float u, float v) co
 	return texCoord;
 }
 
-void loader(const nlohmann::json_uri &uri, nlohmann::json &schema) {
-	std::fstream lf("." + uri.path());
-	if (!lf.good()) {
-		throw std::invalid_argument("could not open " + uri.url() + " tried with " + uri.path());
+uint Scene::AddImage(const std::string &filePath, bool isLinear) {
+	fs::path imagePath(filePath);
+	if (imagePath.is_relative()) {
+		imagePath = m_jsonPath.parent_path() / imagePath;
 	}
 
-	lf >> schema;
+	return m_imageCache.AddImage(imagePath.u8string().c_str(), isLinear);
 }
 
-bool Scene::ParseJSON() {
-	// Load the schema
-	nlohmann::json schema;
-
-	// First, assume we're running from the 'build/...' directory, and try to load the schema from the scenes directory
-	std::fstream lf("../../../../scenes/scene.schema.json");
-	if (lf.good()) {
-		try {
-			lf >> schema;
-		} catch (std::exception &e) {
-			printf("%s at %zu - while parsing the schema\n", e.what(), lf.tellp());
-			return false;
-		}
-	} else {
-		lf.close();
-		// Next, try to find the schema in the working directory
-		lf.open("scene.schema.json");
-		if (lf.good()) {
-			try {
-				lf >> schema;
-			} catch (std::exception &e) {
-				printf("%s at %zu - while parsing the schema\n", e.what(), lf.tellp());
-				return false;
-			}
-		} else {
-			// Barf
-			printf("Failed to find scene.schema.json");
-			return false;
-		}
+uint Scene::AddPackedImage(uint asset) {
+	const byte *data;
+	std::size_t size;
+	if (!GetPackedAsset(asset, &data, &size)) {
+		return (uint)-1;
 	}
 
-	// Set up the validator
-	nlohmann::json_schema_draft4::json_validator validator(loader);
+	// Images are compiled to .ltf files when they're packed, so they can be sampled straight from the pack
+	std::string name = m_jsonPath.u8string() + ":" + std::to_string(asset);
+	return m_imageCache.AddImage(name.c_str(), data, size);
+}
 
-	try {
-		validator.set_root_schema(schema);
-	} catch (const std::exception &e) {
-		printf("Setting root schema failed: %s", e.what());
+bool Scene::GetPackedAsset(uint asset, const byte **out_data, std::size_t *out_size) const {
+	if (m_scenePack == nullptr || asset >= m_scenePackView.Assets.size()) {
+		printf("Asset [%u] isn't in the scene pack\n", asset);
 		return false;
 	}
 
+	*out_data = m_scenePackView.Assets[asset].Data;
+	*out_size = (std::size_t)m_scenePackView.Assets[asset].Size;
+	return true;
+}
 
+bool Scene::ParseJSON() {
 	m_scene = rtcNewScene(m_device);
 	rtcSetSceneFlags(m_scene, RTC_SCENE_FLAG_NONE);
 	rtcSetSceneBuildQuality(m_scene, RTC_BUILD_QUALITY_HIGH);
 
-	std::ifstream ifs(m_jsonPath);
-	if (!ifs.good()) {
-		printf("Could not open %ls\n", m_jsonPath.c_str());
-		return false;
-	}
 	nlohmann::json j;
+	m_scenePack = new MemoryMappedFile();
+	if (m_scenePack->Open(m_jsonPath.u8string().c_str()) && IsLSPFile(m_scenePack->Data(), m_scenePack->Size())) {
+		// Packs were validated when they were made, and their assets are used straight from the mapping,
+		// so it stays open until the scene is cleaned up
+		if (!ReadLSPView(m_scenePack->Data(), m_scenePack->Size(), &m_scenePackView)) {
+			printf("Unable to load scene pack \"%s\"\n", m_jsonPath.u8string().c_str());
+			return false;
+		}
 
-	try {
-		ifs >> j;
-		validator.validate(j);
-	} catch (std::exception &e) {
-		printf("Schema validation failed: %s at offset %zu\n", e.what(), ifs.tellg());
-		return false;
+		try {
+			j = nlohmann::json::parse(std::string(m_scenePackView.SceneJSON, (std::size_t)m_scenePackView.SceneJSONSize));
+		} catch (std::exception &e) {
+			printf("%s - while parsing the scene pack\n", e.what());
+			return false;
+		}
+	} else {
+		delete m_scenePack;
+		m_scenePack = nullptr;
+
+		if (!ReadSceneJSON(m_jsonPath, &j)) {
+			return false;
+		}
 	}
 
 	if (j.count("background_color") == 1) {
@@ -218,6 +363,45 @@ bool Scene::ParseJSON() {
 		BackgroundColor.z = j["background_color"][2].get<float>();
 	}
 
+	if (j.count("environment") == 1) {
+		nlohmann::json environment = j["environment"];
+
+		float3 scale(1.0f);
+		if (environment.count("scale") == 1) {
+			scale = float3(environment["scale"][0].get<float>(), environment["scale"][1].get<float>(), environment["scale"][2].get<float>());
+		}
+
+		// stb converts LDR images to linear float, so any format works, but HDR is the only one that makes sense
+		int width, height, numChannels;
+		float *pixels = nullptr;
+		std::string imageName;
+		if (environment.count("asset") == 1) {
+			// Scene packs keep the image as it was, so it's decoded from the pack
+			uint asset = environment["asset"].get<uint>();
+			imageName = "asset " + std::to_string(asset);
+			const byte *data;
+			std::size_t size;
+			if (GetPackedAsset(asset, &data, &size)) {
+				pixels = stbi_loadf_from_memory(data, (int)size, &width, &height, &numChannels, 3);
+			}
+		} else {
+			fs::path imagePath(environment["file_path"].get<std::string>());
+			if (imagePath.is_relative()) {
+				imagePath = m_jsonPath.parent_path() / imagePath;
+			}
+
+			imageName = imagePath.u8string();
+			pixels = stbi_loadf(imageName.c_str(), &width, &height, &numChannels, 3);
+		}
+		if (pixels == nullptr) {
+			printf("Unable to load environment image \"%s\": %s\n", imageName.c_str(), stbi_failure_reason());
+		} else {
+			m_environmentLight = new EnvironmentLight(pixels, (uint)width, (uint)height, scale);
+			m_lights.push_back(m_environmentLight);
+			stbi_image_free(pixels);
+		}
+	}
+
 	if (j.count("camera") != 1) {
 		printf("JSON parse error: \"camera\" is required\n");
 		return false;
@@ -256,6 +440,8 @@ bool Scene::ParseJSON() {
 	std::unordered_map<std::string, Medium *> mediaMap;
 	std::unordered_map<std::string, Material *> materialMap;
 	std::unordered_map<std::string, uint> primitiveMap;
+	// Containers are only mapped once, however many primitives use them
+	std::unordered_map<std::string, LoadedLMC> containerMap;
 
 
 	if (j.count("bsdfs") == 1) {
@@ -269,8 +455,13 @@ bool Scene::ParseJSON() {
 					                                        bsdf["albedo"]["value"][1].get<float>(),
 					                                        bsdf["albedo"]["value"][2].get<float>()));
 				} else if (bsdf["albedo"]["type"] == "image") {
-					uint imageId = m_imageCache.AddImage(bsdf["albedo"]["file_path"].get<std::string>().c_str());
-					newTexture = new ImageTexture(&m_imageCache, imageId);
+					uint imageId = bsdf["albedo"].count("asset") == 1 ? AddPackedImage(bsdf["albedo"]["asset"].get<uint>()) : AddImage(bsdf["albedo"]["file_path"].get<std::string>(), IsLinearImage(bsdf["albedo"]));
+					if (imageId != (uint)-1) {
+						newTexture = new ImageTexture(&m_imageCache, imageId);
+					} else {
+						// Make missing textures stand out
+						newTexture = new ConstantTexture(float3(1.0f, 0.0f, 1.0f));
+					}
 				} else if (bsdf["albedo"]["type"] == "uv") {
 					newTexture = new UVTexture();
 				}
@@ -286,8 +477,13 @@ bool Scene::ParseJSON() {
 					                                        bsdf["albedo"]["value"][1].get<float>(),
 					                                        bsdf["albedo"]["value"][2].get<float>()));
 				} else if (bsdf["albedo"]["type"] == "image") {
-					uint imageId = m_imageCache.AddImage(bsdf["albedo"]["file_path"].get<std::string>().c_str());
-					newTexture = new ImageTexture(&m_imageCache, imageId);
+					uint imageId = bsdf["albedo"].count("asset") == 1 ? AddPackedImage(bsdf["albedo"]["asset"].get<uint>()) : AddImage(bsdf["albedo"]["file_path"].get<std::string>(), IsLinearImage(bsdf["albedo"]));
+					if (imageId != (uint)-1) {
+						newTexture = new ImageTexture(&m_imageCache, imageId);
+					} else {
+						// Make missing textures stand out
+						newTexture = new ConstantTexture(float3(1.0f, 0.0f, 1.0f));
+					}
 				} else if (bsdf["albedo"]["type"] == "uv") {
 					newTexture = new UVTexture();
 				}
@@ -302,8 +498,13 @@ bool Scene::ParseJSON() {
 					                                        bsdf["albedo"]["value"][1].get<float>(),
 					                                        bsdf["albedo"]["value"][2].get<float>()));
 				} else if (bsdf["albedo"]["type"] == "image") {
-					uint imageId = m_imageCache.AddImage(bsdf["albedo"]["file_path"].get<std::string>().c_str());
-					newTexture = new ImageTexture(&m_imageCache, imageId);
+					uint imageId = bsdf["albedo"].count("asset") == 1 ? AddPackedImage(bsdf["albedo"]["asset"].get<uint>()) : AddImage(bsdf["albedo"]["file_path"].get<std::string>(), IsLinearImage(bsdf["albedo"]));
+					if (imageId != (uint)-1) {
+						newTexture = new ImageTexture(&m_imageCache, imageId);
+					} else {
+						// Make missing textures stand out
+						newTexture = new ConstantTexture(float3(1.0f, 0.0f, 1.0f));
+					}
 				} else if (bsdf["albedo"]["type"] == "uv") {
 					newTexture = new UVTexture();
 				}
@@ -381,31 +582,158 @@ bool Scene::ParseJSON() {
 			std::string type = primitive["type"].get<std::string>();
 			uint meshId;
 			float surfaceArea;
-			float4 boundingSphere;
+			std::vector<float> triangleAreas;
 			bool hasNormals;
 			bool hasTexCoords;
+			uint verticesPerPrimitive = 3;
+			// Only used by spheres and disks
+			float3a center;
+			float3a normal;
+			float radius;
+			// Only used by LMF files with emitter data
+			bool precomputedBounds = false;
+			float3 boundsMin;
+			float3 boundsMax;
+			DirectionCone normalCone;
 			if (type == "lmf") {
-				std::string lmfFilePathString = primitive["file_path"].get<std::string>();
-				fs::path lmfFilePath(lmfFilePathString);
-				if (lmfFilePath.is_relative()) {
-					lmfFilePath = m_jsonPath.parent_path() / lmfFilePath;
+				// Where the model is, for messages, and for finding containers that are already loaded
+				std::string lmfName;
+				const byte *lmfData = nullptr;
+				std::size_t lmfSize = 0;
+				MemoryMappedFile *mapping = nullptr;
+				if (primitive.count("asset") == 1) {
+					// Packed models were converted to version 2 when they were packed, and are used straight from the pack
+					uint asset = primitive["asset"].get<uint>();
+					if (!GetPackedAsset(asset, &lmfData, &lmfSize)) {
+						continue;
+					}
+					lmfName = "asset " + std::to_string(asset);
+				} else {
+					std::string lmfFilePathString = primitive["file_path"].get<std::string>();
+					fs::path lmfFilePath(lmfFilePathString);
+					if (lmfFilePath.is_relative()) {
+						lmfFilePath = m_jsonPath.parent_path() / lmfFilePath;
+					}
+					lmfName = lmfFilePath.u8string();
 				}
 
-				FILE *file = fopen(lmfFilePath.u8string().c_str(), "rb");
-				if (!file) {
-					perror("Error");
-					printf("Unable to open \"%s\" for reading\n", lmfFilePath.u8string().c_str());
-					continue;
+				auto container = containerMap.find(lmfName);
+				if (container == containerMap.end()) {
+					if (lmfData == nullptr) {
+						mapping = new MemoryMappedFile();
+						if (!mapping->Open(lmfName.c_str())) {
+							printf("Unable to open \"%s\" for reading\n", lmfName.c_str());
+							delete mapping;
+							continue;
+						}
+						lmfData = mapping->Data();
+						lmfSize = mapping->Size();
+					}
+
+					if (IsLMCFile(lmfData, lmfSize)) {
+						LoadedLMC lmc;
+						if (!ReadLMCView(lmfData, lmfSize, &lmc.Entries)) {
+							printf("Unable to load \"%s\"\n", lmfName.c_str());
+							delete mapping;
+							continue;
+						}
+						for (std::size_t i = 0; i < lmc.Entries.size(); ++i) {
+							lmc.EntryMap[lmc.Entries[i].Name] = i;
+						}
+
+						// Embree reads straight from the mapping, so it has to outlive the Embree scene
+						if (mapping != nullptr) {
+							m_modelFiles.push_back(mapping);
+							mapping = nullptr;
+						}
+						container = containerMap.emplace(lmfName, std::move(lmc)).first;
+					}
 				}
 
-				LanternModelFile lmf;
-				if (!ReadLMF(file, &lmf)) {
+				LanternModelFileView view;
+				if (container != containerMap.end() && primitive.count("mesh") == 0) {
+					// Without a mesh name, the primitive is every mesh in the container, each with the material it was made with
+					if (primitive.count("emission") == 1) {
+						printf("Primitive [%s] uses every mesh in \"%s\", so it can't be emissive. Give it a mesh to make it a light\n", name.c_str(), lmfName.c_str());
+					}
+
+					std::string defaultMaterial = primitive["material"].get<std::string>();
+					for (auto &entry : container->second.Entries) {
+						if (!ReadLMFView(entry.Data, (std::size_t)entry.Size, &view)) {
+							printf("Unable to load mesh [%s] from \"%s\"\n", entry.Name, lmfName.c_str());
+							continue;
+						}
+
+						meshId = AddLMF(view, true, transform, &surfaceArea, &triangleAreas, &hasNormals, &hasTexCoords);
+						if (meshId == (uint)-1) {
+							continue;
+						}
+						primitiveMap[name + "/" + entry.Name] = meshId;
+
+						auto material = materialMap.find(entry.Material);
+						m_models[meshId].material = material != materialMap.end() ? material->second : materialMap[defaultMaterial];
+						m_models[meshId].hasNormals = hasNormals;
+						m_models[meshId].hasTexCoords = hasTexCoords;
+					}
+					continue;
+				} else if (container != containerMap.end()) {
+					std::string meshName = primitive["mesh"].get<std::string>();
+					auto entry = container->second.EntryMap.find(meshName);
+					if (entry == container->second.EntryMap.end()) {
+						printf("Mesh [%s] could not be found in \"%s\"\n", meshName.c_str(), lmfName.c_str());
+						continue;
+					}
+
+					const LanternModelContainerEntry &mesh = container->second.Entries[entry->second];
+					if (!ReadLMFView(mesh.Data, (std::size_t)mesh.Size, &view)) {
+						printf("Unable to load mesh [%s] from \"%s\"\n", meshName.c_str(), lmfName.c_str());
+						continue;
+					}
+
+					meshId = AddLMF(view, true, transform, &surfaceArea, &triangleAreas, &hasNormals, &hasTexCoords);
+				} else if (mapping != nullptr && ReadLMFVersion(lmfData, lmfSize) == 1) {
+					// Version 1 files aren't laid out for Embree, so they're read and copied the old way
+					delete mapping;
+
+					FILE *file = fopen(lmfName.c_str(), "rb");
+					LanternModelFile lmf;
+					bool success = file != nullptr && ReadLMF(file, &lmf);
+					if (file != nullptr) {
+						fclose(file);
+					}
+					if (!success) {
+						printf("Unable to load \"%s\"\n", lmfName.c_str());
+						continue;
+					}
+
+					std::vector<float> positions;
+					CreateLMFView(lmf, &positions, &view);
+					meshId = AddLMF(view, false, transform, &surfaceArea, &triangleAreas, &hasNormals, &hasTexCoords);
+				} else {
+					if (!ReadLMFView(lmfData, lmfSize, &view)) {
+						printf("Unable to load \"%s\"\n", lmfName.c_str());
+						delete mapping;
+						continue;
+					}
+
+					// Embree reads straight from the mapping, so it has to outlive the Embree scene
+					if (mapping != nullptr) {
+						m_modelFiles.push_back(mapping);
+					}
+					meshId = AddLMF(view, true, transform, &surfaceArea, &triangleAreas, &hasNormals, &hasTexCoords);
+				}
+				if (meshId == (uint)-1) {
 					continue;
 				}
-				fclose(file);
-
-				meshId = AddLMF(&lmf, transform, &surfaceArea, &boundingSphere, &hasNormals, &hasTexCoords);
 				primitiveMap[name] = meshId;
+
+				verticesPerPrimitive = view.VerticesPerPrimitive;
+				if (CanUseEmitterData(view, transform)) {
+					precomputedBounds = true;
+					boundsMin = view.BoundsMin;
+					boundsMax = view.BoundsMax;
+					normalCone = DirectionCone(view.NormalAxis, view.NormalCosTheta);
+				}
 			} else if (type == "grid") {
 				float width = primitive["width"].get<float>();
 				float depth = primitive["depth"].get<float>();
@@ -414,7 +742,7 @@ bool Scene::ParseJSON() {
 
 				Mesh mesh;
 				CreateGrid(width, depth, m, n, &mesh);
-				meshId = AddMesh(&mesh, transform, &surfaceArea, &boundingSphere, &hasNormals, &hasTexCoords);
+				meshId = AddMesh(&mesh, transform, &surfaceArea, &triangleAreas, &hasNormals, &hasTexCoords);
 				primitiveMap[name] = meshId;
 			} else if (type == "geosphere") {
 				float radius = primitive["radius"].get<float>();
@@ -422,8 +750,27 @@ bool Scene::ParseJSON() {
 
 				Mesh mesh;
 				CreateGeosphere(radius, n, &mesh);
-				meshId = AddMesh(&mesh, transform, &surfaceArea, &boundingSphere, &hasNormals, &hasTexCoords);
+				meshId = AddMesh(&mesh, transform, &surfaceArea, &triangleAreas, &hasNormals, &hasTexCoords);
+				primitiveMap[name] = meshId;
+			} else if (type == "sphere") {
+				meshId = AddSphere(primitive["radius"].get<float>(), transform, &center, &radius);
+				primitiveMap[name] = meshId;
+
+				hasNormals = true;
+				hasTexCoords = true;
+			} else if (type == "disk") {
+				meshId = AddDisk(primitive["radius"].get<float>(), transform, &center, &normal, &radius);
+				primitiveMap[name] = meshId;
+
+				hasNormals = true;
+				hasTexCoords = true;
+			} else if (type == "rectangle") {
+				meshId = AddRectangle(primitive["width"].get<float>(), primitive["depth"].get<float>(), transform, &surfaceArea, &triangleAreas);
 				primitiveMap[name] = meshId;
+
+				verticesPerPrimitive = 4;
+				hasNormals = true;
+				hasTexCoords = true;
 			} else {
 				printf("Unknown primitive type: [%s]\n", type.c_str());
 				continue;
@@ -438,17 +785,48 @@ bool Scene::ParseJSON() {
 				float3 color(primitive["emission"]["color"][0].get<float>(), primitive["emission"]["color"][1].get<float>(), primitive["emission"]["color"][2].get<float>());
 				float radiantPower = primitive["emission"]["radiant_power"].get<float>();
 
-				AreaLight *light = new AreaLight(color, radiantPower, surfaceArea, meshId, boundingSphere);
+				Light *light;
+				if (type == "sphere") {
+					light = new SphereLight(color, radiantPower, center, radius);
+				} else if (type == "disk") {
+					light = new DiskLight(color, radiantPower, center, normal, radius);
+				} else {
+					// The light samples straight from the buffers in the main scene, rather than copying them
+					RTCGeometry geometry = rtcGetGeometry(m_scene, meshId);
+					const float3a *vertices = (const float3a *)rtcGetGeometryBufferData(geometry, RTC_BUFFER_TYPE_VERTEX, 0);
+					const uint *indices = (const uint *)rtcGetGeometryBufferData(geometry, RTC_BUFFER_TYPE_INDEX, 0);
+
+					// A sheared transform turns the rectangle into a parallelogram, which RectangleLight can't sample
+					if (type == "rectangle" && std::abs(dot(normalize(vertices[1] - vertices[0]), normalize(vertices[3] - vertices[0]))) < 1e-4f) {
+						light = new RectangleLight(color, radiantPower, vertices[0], vertices[1] - vertices[0], vertices[3] - vertices[0]);
+					} else if (precomputedBounds) {
+						light = new AreaLight(color, radiantPower, surfaceArea, vertices, indices, verticesPerPrimitive, triangleAreas, boundsMin, boundsMax, normalCone);
+					} else {
+						light = new AreaLight(color, radiantPower, surfaceArea, vertices, indices, verticesPerPrimitive, triangleAreas);
+					}
+				}
 				m_lights.push_back(light);
 				m_models[meshId].light = light;
 			}
 		}
 	}
 
+	rtcCommitScene(m_scene);
+
+	// The environment's power depends on the size of the scene, so the scene has to be built first
+	if (m_environmentLight != nullptr) {
+		RTCBounds bounds;
+		rtcGetSceneBounds(m_scene, &bounds);
+		float3 extent(bounds.upper_x - bounds.lower_x, bounds.upper_y - bounds.lower_y, bounds.upper_z - bounds.lower_z);
+		m_environmentLight->SetSceneRadius(m_models.empty() ? 1.0f : 0.5f * length(extent));
+	}
+
+	BuildLightDistribution();
+
 	return true;
 }
 
-uint Scene::AddMesh(Mesh *mesh, float4x4 &transform, float *out_surfaceArea, float4 *out_boundingSphere, bool *out_hasNormals, bool *out_hasTexCoords) {
+uint Scene::AddMesh(Mesh *mesh, float4x4 &transform, float *out_surfaceArea, std::vector<float> *out_triangleAreas, bool *out_hasNormals, bool *out_hasTexCoords) {
 	RTCGeometry geometry = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_TRIANGLE);
 	rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_HIGH);
 	rtcSetGeometryTimeStepCount(geometry, 1);
@@ -462,17 +840,17 @@ uint Scene::AddMesh(Mesh *mesh, float4x4 &transform, float *out_surfaceArea, flo
 
 	// Calculate the surface area
 	*out_surfaceArea = 0.0f;
+	out_triangleAreas->resize(mesh->Indices.size() / 3);
 	for (std::size_t i = 0; i < mesh->Indices.size(); i += 3) {
 		float3a v0 = vertices[mesh->Indices[i]];
 		float3a v1 = vertices[mesh->Indices[i + 1]];
 		float3a v2 = vertices[mesh->Indices[i + 2]];
 
-		*out_surfaceArea += 0.5f * length(cross(v0 - v1, v0 - v2));
+		float area = TriangleArea(v0, v1, v2);
+		(*out_triangleAreas)[i / 3] = area;
+		*out_surfaceArea += area;
 	}
 
-	*out_boundingSphere = CalculateBoundingSphere(vertices, mesh->Positions.size());
-
-
 	uint *indices = (uint *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, 3 * sizeof(uint), mesh->Indices.size() / 3);
 	memcpy(indices, &mesh->Indices[0], mesh->Indices.size() * sizeof(uint));
 
@@ -499,75 +877,112 @@ uint Scene::AddMesh(Mesh *mesh, float4x4 &transform, float *out_surfaceArea, flo
 	return meshId;
 }
 
-uint Scene::AddLMF(LanternModelFile *lmf, float4x4 &transform, float *out_surfaceArea, float4 *out_boundingSphere, bool *out_hasNormals, bool *out_hasTexCoords) {
+uint Scene::AddLMF(const LanternModelFileView &lmf, bool shareBuffers, float4x4 &transform, float *out_surfaceArea, std::vector<float> *out_triangleAreas, bool *out_hasNormals, bool *out_hasTexCoords) {
 	RTCGeometry geometry;
-	if (lmf->VerticesPerPrimative == 3) {
+	if (lmf.VerticesPerPrimitive == 3) {
 		geometry = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_TRIANGLE);
 		rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_HIGH);
 		rtcSetGeometryTimeStepCount(geometry, 1);
-	} else if (lmf->VerticesPerPrimative == 4) {
+	} else if (lmf.VerticesPerPrimitive == 4) {
 		geometry = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_QUAD);
 		rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_HIGH);
 		rtcSetGeometryTimeStepCount(geometry, 1);
 	} else {
-		printf("Lantern only supports 3 or 4 vertices per primitive. Given [%hhu]\n", lmf->VerticesPerPrimative);
+		printf("Lantern only supports 3 or 4 vertices per primitive. Given [%u]\n", lmf.VerticesPerPrimitive);
 		return -1;
 	}
 
-	float3a *vertices = (float3a *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, sizeof(float3a), lmf->Positions.size() / 3);
-	for (uint i = 0, j = 0; j < lmf->Positions.size() / 3; i += 3, ++j) {
-		float3a vertex(lmf->Positions[i], lmf->Positions[i + 1], lmf->Positions[i + 2], 1.0f);
+	const float3a *vertices;
+	if (shareBuffers && transform == float4x4(embree::one)) {
+		rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, lmf.Positions, 0, sizeof(float3a), lmf.NumPositions);
+		vertices = (const float3a *)lmf.Positions;
+	} else {
+		float3a *transformed = (float3a *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, sizeof(float3a), lmf.NumPositions);
+		for (uint64 i = 0; i < lmf.NumPositions; ++i) {
+			float3a vertex(lmf.Positions[i * 4], lmf.Positions[i * 4 + 1], lmf.Positions[i * 4 + 2], 1.0f);
 
-		vertices[j] = transform * vertex;
+			transformed[i] = transform * vertex;
+		}
+		vertices = transformed;
 	}
 
-	// Calculate the surface area
-	*out_surfaceArea = 0.0f;
-	if (lmf->VerticesPerPrimative == 3) {
-		for (std::size_t i = 0; i < lmf->Indices.size(); i += 3) {
-			float3a v0 = vertices[lmf->Indices[i]];
-			float3a v1 = vertices[lmf->Indices[i + 1]];
-			float3a v2 = vertices[lmf->Indices[i + 2]];
-
-			// Calculate the area of a triangle using the half cross product: https://math.stackexchange.com/a/128999
-			*out_surfaceArea += 0.5f * length(cross(v0 - v1, v0 - v2));
+	// Calculate the surface area, unless the LMF compiler already did
+	bool precomputedAreas = CanUseEmitterData(lmf, transform);
+	if (precomputedAreas) {
+		*out_surfaceArea = lmf.SurfaceArea;
+		out_triangleAreas->assign(lmf.TriangleAreas, lmf.TriangleAreas + lmf.NumTriangles);
+	} else {
+		*out_surfaceArea = 0.0f;
+		out_triangleAreas->clear();
+	}
+	if (lmf.VerticesPerPrimitive == 3) {
+		if (!precomputedAreas) {
+			out_triangleAreas->reserve(lmf.NumIndices / 3);
+			for (std::size_t i = 0; i < lmf.NumIndices; i += 3) {
+				float3a v0 = vertices[lmf.Indices[i]];
+				float3a v1 = vertices[lmf.Indices[i + 1]];
+				float3a v2 = vertices[lmf.Indices[i + 2]];
+
+				float area = TriangleArea(v0, v1, v2);
+				out_triangleAreas->push_back(area);
+				*out_surfaceArea += area;
+			}
 		}
 
-		*out_boundingSphere = CalculateBoundingSphere(vertices, lmf->Positions.size() / 3);
-
-		uint *indices = (uint *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, 3 * sizeof(uint), lmf->Indices.size() / 3);
-		memcpy(indices, &lmf->Indices[0], lmf->Indices.size() * sizeof(uint));
-	} else if (lmf->VerticesPerPrimative == 4) {
-		for (std::size_t i = 0; i < lmf->Indices.size(); i += 4) {
-			float3a v0 = vertices[lmf->Indices[i]];
-			float3a v1 = vertices[lmf->Indices[i + 1]];
-			float3a v2 = vertices[lmf->Indices[i + 2]];
-			float3a v3 = vertices[lmf->Indices[i + 2]];
-
-			// Shoelace formula: https://en.wikipedia.org/wiki/Shoelace_formula
-			*out_surfaceArea += 0.5f * length(cross(v0 - v1, v0 - v2)) + 0.5f * length(cross(v0 - v2, v0 - v3));
+		if (shareBuffers) {
+			rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, lmf.Indices, 0, 3 * sizeof(uint), lmf.NumIndices / 3);
+		} else {
+			uint *indices = (uint *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, 3 * sizeof(uint), lmf.NumIndices / 3);
+			memcpy(indices, lmf.Indices, lmf.NumIndices * sizeof(uint));
+		}
+	} else if (lmf.VerticesPerPrimitive == 4) {
+		if (!precomputedAreas) {
+			out_triangleAreas->reserve(lmf.NumIndices / 2);
+			for (std::size_t i = 0; i < lmf.NumIndices; i += 4) {
+				float3a v0 = vertices[lmf.Indices[i]];
+				float3a v1 = vertices[lmf.Indices[i + 1]];
+				float3a v2 = vertices[lmf.Indices[i + 2]];
+				float3a v3 = vertices[lmf.Indices[i + 3]];
+
+				// Split the quad the same way Embree does, so the light can sample the same triangles
+				float area0 = TriangleArea(v0, v1, v3);
+				float area1 = TriangleArea(v2, v3, v1);
+				out_triangleAreas->push_back(area0);
+				out_triangleAreas->push_back(area1);
+				*out_surfaceArea += area0 + area1;
+			}
 		}
 
-		*out_boundingSphere = CalculateBoundingSphere(vertices, lmf->Positions.size());
-
-		uint *indices = (uint *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT4, 4 * sizeof(uint), lmf->Indices.size() / 4);
-		memcpy(indices, &lmf->Indices[0], lmf->Indices.size() * sizeof(uint));
+		if (shareBuffers) {
+			rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT4, lmf.Indices, 0, 4 * sizeof(uint), lmf.NumIndices / 4);
+		} else {
+			uint *indices = (uint *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT4, 4 * sizeof(uint), lmf.NumIndices / 4);
+			memcpy(indices, lmf.Indices, lmf.NumIndices * sizeof(uint));
+		}
 	}
 
-	rtcSetGeometryVertexAttributeCount(geometry, (lmf->Normals.size() > 0 ? 1 : 0) + (lmf->TexCoords.size() > 0 ? 1 : 0));
+	rtcSetGeometryVertexAttributeCount(geometry, (lmf.NumNormals > 0 ? 1 : 0) + (lmf.NumTexCoords > 0 ? 1 : 0));
 
-	if (lmf->Normals.size() > 0) {
-		float3 *normals = (float3 *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, sizeof(float3), lmf->Normals.size() / 3);
-		memcpy(normals, &lmf->Normals[0], lmf->Normals.size() * sizeof(float));
+	if (lmf.NumNormals > 0) {
+		if (shareBuffers) {
+			rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, lmf.Normals, 0, sizeof(float3), lmf.NumNormals);
+		} else {
+			float3 *normals = (float3 *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, sizeof(float3), lmf.NumNormals);
+			memcpy(normals, lmf.Normals, lmf.NumNormals * sizeof(float3));
+		}
 
 		*out_hasNormals = true;
 	} else {
 		*out_hasNormals = false;
 	}
 
-	if (lmf->TexCoords.size() > 0) {
-		float2 *texCoords = (float2 *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2, sizeof(float2), lmf->TexCoords.size() / 2);
-		memcpy(texCoords, &lmf->TexCoords[0], lmf->TexCoords.size() * sizeof(float));
+	if (lmf.NumTexCoords > 0) {
+		if (shareBuffers) {
+			rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2, lmf.TexCoords, 0, sizeof(float2), lmf.NumTexCoords);
+		} else {
+			float2 *texCoords = (float2 *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2, sizeof(float2), lmf.NumTexCoords);
+			memcpy(texCoords, lmf.TexCoords, lmf.NumTexCoords * sizeof(float2));
+		}
 
 		*out_hasTexCoords = true;
 	} else {
@@ -581,6 +996,110 @@ uint Scene::AddLMF(LanternModelFile *lmf, float4x4 &transform, float *out_surfac
 	return meshId;
 }
 
+uint Scene::AddSphere(float radius, float4x4 &transform, float3a *out_center, float *out_radius) {
+	*out_center = transform * float3a(0.0f, 0.0f, 0.0f, 1.0f);
+	*out_radius = radius * UniformScale(transform);
+
+	RTCGeometry geometry = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_SPHERE_POINT);
+	rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_HIGH);
+	rtcSetGeometryTimeStepCount(geometry, 1);
+
+	float4 *point = (float4 *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT4, sizeof(float4), 1);
+	*point = float4(out_center->x, out_center->y, out_center->z, *out_radius);
+
+	rtcCommitGeometry(geometry);
+	uint meshId = rtcAttachGeometry(m_scene, geometry);
+	rtcReleaseGeometry(geometry);
+
+	Model &model = m_models[meshId];
+	model.shape = ShapeType::Sphere;
+	model.radius = radius;
+	model.worldToObject = transform.inverse();
+	// u wraps once around the equator, and v runs from pole to pole
+	model.texCoordScale = 1.0f / ((float)M_PI * *out_radius * sqrtf(2.0f));
+
+	return meshId;
+}
+
+uint Scene::AddDisk(float radius, float4x4 &transform, float3a *out_center, float3a *out_normal, float *out_radius) {
+	*out_center = transform * float3a(0.0f, 0.0f, 0.0f, 1.0f);
+	*out_normal = transform * float3a(0.0f, 1.0f, 0.0f, 0.0f);
+	*out_normal = normalize(*out_normal);
+	*out_radius = radius * UniformScale(transform);
+
+	RTCGeometry geometry = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_ORIENTED_DISC_POINT);
+	rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_HIGH);
+	rtcSetGeometryTimeStepCount(geometry, 1);
+
+	float4 *point = (float4 *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT4, sizeof(float4), 1);
+	*point = float4(out_center->x, out_center->y, out_center->z, *out_radius);
+
+	float3 *normal = (float3 *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_NORMAL, 0, RTC_FORMAT_FLOAT3, sizeof(float3), 1);
+	*normal = float3(out_normal->x, out_normal->y, out_normal->z);
+
+	rtcCommitGeometry(geometry);
+	uint meshId = rtcAttachGeometry(m_scene, geometry);
+	rtcReleaseGeometry(geometry);
+
+	Model &model = m_models[meshId];
+	model.shape = ShapeType::Disk;
+	model.radius = radius;
+	model.worldToObject = transform.inverse();
+	// The disk's diameter spans [0, 1]
+	model.texCoordScale = 0.5f / *out_radius;
+
+	return meshId;
+}
+
+uint Scene::AddRectangle(float width, float depth, float4x4 &transform, float *out_surfaceArea, std::vector<float> *out_triangleAreas) {
+	RTCGeometry geometry = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_QUAD);
+	rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_HIGH);
+	rtcSetGeometryTimeStepCount(geometry, 1);
+
+	float halfWidth = 0.5f * width;
+	float halfDepth = 0.5f * depth;
+	float3a *vertices = (float3a *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, sizeof(float3a), 4);
+	vertices[0] = transform * float3a(-halfWidth, 0.0f, -halfDepth, 1.0f);
+	vertices[1] = transform * float3a(+halfWidth, 0.0f, -halfDepth, 1.0f);
+	vertices[2] = transform * float3a(+halfWidth, 0.0f, +halfDepth, 1.0f);
+	vertices[3] = transform * float3a(-halfWidth, 0.0f, +halfDepth, 1.0f);
+
+	uint *indices = (uint *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT4, 4 * sizeof(uint), 1);
+	indices[0] = 0;
+	indices[1] = 1;
+	indices[2] = 2;
+	indices[3] = 3;
+
+	// Split the quad the same way Embree does, so the light can sample the same triangles
+	out_triangleAreas->resize(2);
+	(*out_triangleAreas)[0] = TriangleArea(vertices[0], vertices[1], vertices[3]);
+	(*out_triangleAreas)[1] = TriangleArea(vertices[2], vertices[3], vertices[1]);
+	*out_surfaceArea = (*out_triangleAreas)[0] + (*out_triangleAreas)[1];
+
+	rtcSetGeometryVertexAttributeCount(geometry, 2);
+
+	// Normals are transformed by the inverse transpose, so they stay perpendicular to the surface
+	float3a transformedNormal(transpose(transform.inverse()) * float3a(0.0f, 1.0f, 0.0f, 0.0f));
+	transformedNormal = normalize(transformedNormal);
+	float3 *normals = (float3 *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, sizeof(float3), 4);
+	for (uint i = 0; i < 4; ++i) {
+		normals[i] = float3(transformedNormal.x, transformedNormal.y, transformedNormal.z);
+	}
+
+	// Embree's u and v already run along the edges of the quad, so these match CreateGrid()
+	float2 *texCoords = (float2 *)rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2, sizeof(float2), 4);
+	texCoords[0] = float2(0.0f, 0.0f);
+	texCoords[1] = float2(1.0f, 0.0f);
+	texCoords[2] = float2(1.0f, 1.0f);
+	texCoords[3] = float2(0.0f, 1.0f);
+
+	rtcCommitGeometry(geometry);
+	uint meshId = rtcAttachGeometry(m_scene, geometry);
+	rtcReleaseGeometry(geometry);
+
+	return meshId;
+}
+
 void Scene::CleanupScene() {
 	delete Camera;
 
@@ -596,6 +1115,7 @@ void Scene::CleanupScene() {
 		delete light;
 	}
 	m_lights.clear();
+	m_environmentLight = nullptr;
 
 	m_materials.clear();
 	m_models.clear();
@@ -603,6 +1123,16 @@ void Scene::CleanupScene() {
 	m_imageCache.Clear();
 
 	rtcReleaseScene(m_scene);
+
+	// Embree is done with the buffers now
+	for (MemoryMappedFile *modelFile : m_modelFiles) {
+		delete modelFile;
+	}
+	m_modelFiles.clear();
+
+	// Embree and the image cache are done with the pack now
+	delete m_scenePack;
+	m_scenePack = nullptr;
 }
 
 } // End of namespace Lantern
@@ -12,6 +12,11 @@
 
 #include "scene/light.h"
 #include "scene/image_cache.h"
+#include "scene/light_bvh.h"
+
+#include "io/lantern_scene_pack.h"
+
+#include "math/alias_table.h"
 
 #define EMBREE_STATIC_LIB
 #include "embree3/rtcore.h"
@@ -27,8 +32,16 @@ class BSDF;
 class Medium;
 struct Material;
 struct Mesh;
-struct LanternModelFile;
+struct LanternModelFileView;
 class Texture;
+class EnvironmentLight;
+
+enum class LightSamplerType {
+	// Proportional to each light's power
+	Power,
+	// Proportional to each light's estimated contribution to the shading point
+	BVH
+};
 
 class Scene {
 public:
@@ -47,27 +60,65 @@ private:
 	std::vector<Material *> m_materials;
 	std::vector<Texture *> m_textures;
 	std::vector<Light *> m_lights;
+	LightSamplerType m_lightSamplerType;
+	// Picks lights in proportion to their power
+	AliasTable m_lightDistribution;
+	// Picks lights in proportion to their estimated contribution
+	LightBVH m_lightBVH;
+	// Lights any ray that misses the scene. Also in m_lights. nullptr if the scene doesn't have one
+	EnvironmentLight *m_environmentLight;
 
 	ImageCache m_imageCache;
 
+	enum class ShapeType {
+		// A triangle or quad mesh, with optional normals and texture coordinates
+		Mesh,
+		// Embree's native sphere, centered on the origin of the model
+		Sphere,
+		// Embree's native oriented disk, centered on the origin of the model, facing +y
+		Disk
+	};
+
 	struct Model {
-		Model() : material(nullptr), light(nullptr) { }
+		Model() : material(nullptr), light(nullptr), shape(ShapeType::Mesh), radius(0.0f), texCoordScale(0.0f) { }
 		Model(Material *material, Light *light = nullptr)
 			: material(material),
-			  light(light) {
+			  light(light),
+			  shape(ShapeType::Mesh),
+			  radius(0.0f),
+			  texCoordScale(0.0f) {
 		}
 
 		Material *material;
 		Light *light;
 		bool hasNormals;
 		bool hasTexCoords;
+
+		ShapeType shape;
+		// For spheres and disks, the radius and the transform from world space back to the model, for calculating texture coordinates
+		float radius;
+		float4x4 worldToObject;
+		// For spheres and disks, how far the texture coordinates move per world unit. Spheres are measured at the equator
+		float texCoordScale;
 	};
 	std::unordered_map<uint, Model> m_models;
 
 	RTCDevice m_device;
 	RTCScene m_scene;
+	// LMF files that Embree reads the buffers of in place. They stay mapped until the Embree scene is released
+	std::vector<MemoryMappedFile *> m_modelFiles;
+	// The scene pack the scene was loaded from, or nullptr if it was loaded from JSON. Models and images
+	// are used straight from it, so it stays mapped until the scene is cleaned up
+	MemoryMappedFile *m_scenePack;
+	LanternScenePackView m_scenePackView;
 
 public:
+	/**
+	 * Loads a scene
+	 *
+	 * @param filePath    Either a scene JSON file, or a scene pack made by 'lantern pack'. Packs skip the schema validation
+	 * @return            False if the scene couldn't be loaded
+	 */
 	bool LoadSceneFromJSON(const char *filePath);
 	bool ReloadSceneFromJSON();
 
@@ -78,9 +129,85 @@ public:
 		return m_models[modelId].light;
 	}
 	std::size_t NumLights() const { return m_lights.size(); }
-	Light *RandomOneLight(UniformSampler *sampler);
+	/**
+	 * The light for rays that miss the scene, or nullptr if misses should return BackgroundColor
+	 */
+	Light *GetEnvironmentLight() const;
+	void SetLightSamplerType(LightSamplerType lightSamplerType) {
+		m_lightSamplerType = lightSamplerType;
+	}
+	/**
+	 * Sets how much memory the texture cache can use. Textures are loaded lazily, in tiles, so scenes can
+	 * reference more texture data than this
+	 *
+	 * @param bytes    The budget, in bytes
+	 */
+	void SetTextureMemoryBudget(std::size_t bytes) {
+		m_imageCache.SetMemoryBudget(bytes);
+	}
+	/**
+	 * Sets whether textures are block compressed when they're loaded. Must be set before the scene is loaded
+	 */
+	void SetTextureCompression(bool compress) {
+		m_imageCache.SetCompression(compress);
+	}
+	void SetTextureFilter(TextureFilter filter) {
+		m_imageCache.SetFilter(filter);
+	}
+	/**
+	 * Picks a light to sample for a shading point
+	 *
+	 * The excluded light isn't removed from the distribution. If it gets picked, nothing is returned,
+	 * so pdf stays the same whether or not a light is excluded
+	 *
+	 * @param u           A uniform random number in [0, 1)
+	 * @param position    The shading point
+	 * @param normal      The normal of the shading point
+	 * @param exclude     A light that shouldn't be picked, or nullptr
+	 * @param pdf         The probability of picking the returned light
+	 * @return            The light, or nullptr if there's nothing to pick from
+	 */
+	Light *RandomOneLight(float u, const float3a &position, const float3a &normal, Light *exclude, float *pdf);
+	/**
+	 * The probability that RandomOneLight picks a light for a shading point
+	 */
+	float LightSelectionPdf(const float3a &position, const float3a &normal, const Light *light) const;
 
 	void Intersect(RTCRayHit &ray) const;
+	/**
+	 * Intersects a packet of 16 rays with the scene
+	 *
+	 * @param valid    Per-ray masks. -1 means the ray is active, 0 means it is ignored
+	 * @param rays     The packet to intersect. Results are written into rays.hit
+	 */
+	void Intersect(const int *valid, RTCRayHit16 &rays) const;
+	/**
+	 * Tests if anything in the scene lies between ray.tnear and ray.tfar
+	 *
+	 * This stops at the first hit it finds, so it's much cheaper than Intersect()
+	 *
+	 * @param ray    The ray to test. If occluded, ray.tfar is set to -inf
+	 * @return       Whether the ray is occluded
+	 */
+	bool Occluded(RTCRay &ray) const;
+	/**
+	 * Tests a packet of 16 rays for occlusion
+	 *
+	 * @param valid    Per-ray masks. -1 means the ray is active, 0 means it is ignored
+	 * @param rays     The packet to test. The tfar of each occluded ray is set to -inf
+	 */
+	void Occluded(const int *valid, RTCRay16 &rays) const;
+	/**
+	 * Calculates the shading normal and texture coordinate of a hit
+	 *
+	 * @param rayHit      The ray and its closest hit
+	 * @param position    The position of the hit
+	 * @param normal           The normalized shading normal
+	 * @param texCoord         The texture coordinate. Zero if the model doesn't have any
+	 * @param texCoordScale    How far the texture coordinate moves per world unit around the hit. Used to turn
+	 *                         a ray cone's width into a texture footprint
+	 */
+	void GetSurfaceAttributes(const RTCRayHit &rayHit, const float3a &position, float3a *normal, float2 *texCoord, float *texCoordScale) const;
 	bool HasNormals(uint meshId) {
 		return m_models[meshId].hasNormals;
 	}
@@ -92,8 +219,74 @@ public:
 
 private:
 	bool ParseJSON();
-	uint AddMesh(Mesh *mesh, float4x4 &transform, float *out_surfaceArea, float4 *out_boundingSphere, bool *out_hasNormals, bool *out_hasTexCoords);
-	uint AddLMF(LanternModelFile *lmf, float4x4 &transform, float *out_surfaceArea, float4 *out_boundingSphere, bool *out_hasNormals, bool *out_hasTexCoords);
+	/**
+	 * Adds an image to the image cache. Relative paths are relative to the scene file
+	 *
+	 * @param filePath    The path to the image, or to a .ltf file
+	 * @param isLinear    Whether an 8-bit image is linear, rather than sRGB
+	 * @return            The id of the image, or -1 if it couldn't be read
+	 */
+	uint AddImage(const std::string &filePath, bool isLinear);
+	/**
+	 * Adds an image from the scene pack to the image cache
+	 *
+	 * @param asset    The index of the image in the pack. It's sampled in place
+	 * @return         The id of the image, or -1 if it couldn't be read
+	 */
+	uint AddPackedImage(uint asset);
+	/**
+	 * Finds an asset in the scene pack
+	 *
+	 * @return    False if the scene wasn't loaded from a pack, or the pack doesn't have the asset
+	 */
+	bool GetPackedAsset(uint asset, const byte **out_data, std::size_t *out_size) const;
+	/**
+	 * Adds a triangle mesh to the scene
+	 *
+	 * @param out_triangleAreas    The area of each triangle, for emitters to sample from
+	 * @return                     The id of the new model
+	 */
+	uint AddMesh(Mesh *mesh, float4x4 &transform, float *out_surfaceArea, std::vector<float> *out_triangleAreas, bool *out_hasNormals, bool *out_hasTexCoords);
+	/**
+	 * Adds a triangle or quad mesh to the scene
+	 *
+	 * @param shareBuffers         If true, Embree uses the buffers of lmf in place, so they must outlive the scene.
+	 *                             The positions are still copied if they need to be transformed. Otherwise, everything is copied
+	 * @param out_triangleAreas    The area of each triangle, for emitters to sample from. Quads are split into two triangles, like Embree does
+	 * @return                     The id of the new model
+	 */
+	uint AddLMF(const LanternModelFileView &lmf, bool shareBuffers, float4x4 &transform, float *out_surfaceArea, std::vector<float> *out_triangleAreas, bool *out_hasNormals, bool *out_hasTexCoords);
+	/**
+	 * Adds an analytic sphere, centered on the origin of the transform
+	 *
+	 * Embree spheres can't be stretched, so the transform should only translate, rotate, and scale uniformly
+	 *
+	 * @param out_center    The center of the sphere in world space
+	 * @param out_radius    The radius of the sphere in world space
+	 * @return              The id of the new model
+	 */
+	uint AddSphere(float radius, float4x4 &transform, float3a *out_center, float *out_radius);
+	/**
+	 * Adds an analytic disk, centered on the origin of the transform, and facing +y
+	 *
+	 * Embree disks can't be stretched, so the transform should only translate, rotate, and scale uniformly
+	 *
+	 * @param out_center    The center of the disk in world space
+	 * @param out_normal    The normal of the disk in world space
+	 * @param out_radius    The radius of the disk in world space
+	 * @return              The id of the new model
+	 */
+	uint AddDisk(float radius, float4x4 &transform, float3a *out_center, float3a *out_normal, float *out_radius);
+	/**
+	 * Adds a rectangle in the xz plane, centered on the origin of the transform, and facing +y
+	 *
+	 * The rectangle is a single Embree quad, so it's exact, no matter the size
+	 *
+	 * @param out_triangleAreas    The area of the two triangles Embree splits the quad into, for emitters to sample from
+	 * @return                     The id of the new model
+	 */
+	uint AddRectangle(float width, float depth, float4x4 &transform, float *out_surfaceArea, std::vector<float> *out_triangleAreas);
+	void BuildLightDistribution();
 	void CleanupScene();
 };
 
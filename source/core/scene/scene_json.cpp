@@ -0,0 +1,87 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "scene/scene_json.h"
+
+#include "json_schema_validator.hpp"
+
+#include <fstream>
+
+
+namespace Lantern {
+
+static void loader(const nlohmann::json_uri &uri, nlohmann::json &schema) {
+	std::fstream lf("." + uri.path());
+	if (!lf.good()) {
+		throw std::invalid_argument("could not open " + uri.url() + " tried with " + uri.path());
+	}
+
+	lf >> schema;
+}
+
+bool ReadSceneJSON(const fs::path &jsonPath, nlohmann::json *out_json) {
+	// Load the schema
+	nlohmann::json schema;
+
+	// First, assume we're running from the 'build/...' directory, and try to load the schema from the scenes directory
+	std::fstream lf("../../../../scenes/scene.schema.json");
+	if (lf.good()) {
+		try {
+			lf >> schema;
+		} catch (std::exception &e) {
+			printf("%s at %zu - while parsing the schema\n", e.what(), lf.tellp());
+			return false;
+		}
+	} else {
+		lf.close();
+		// Next, try to find the schema in the working directory
+		lf.open("scene.schema.json");
+		if (lf.good()) {
+			try {
+				lf >> schema;
+			} catch (std::exception &e) {
+				printf("%s at %zu - while parsing the schema\n", e.what(), lf.tellp());
+				return false;
+			}
+		} else {
+			// Barf
+			printf("Failed to find scene.schema.json");
+			return false;
+		}
+	}
+
+	// Set up the validator
+	nlohmann::json_schema_draft4::json_validator validator(loader);
+
+	try {
+		validator.set_root_schema(schema);
+	} catch (const std::exception &e) {
+		printf("Setting root schema failed: %s", e.what());
+		return false;
+	}
+
+	std::ifstream ifs(jsonPath);
+	if (!ifs.good()) {
+		printf("Could not open %ls\n", jsonPath.c_str());
+		return false;
+	}
+	try {
+		ifs >> *out_json;
+		validator.validate(*out_json);
+	} catch (std::exception &e) {
+		printf("Schema validation failed: %s at offset %zu\n", e.what(), ifs.tellg());
+		return false;
+	}
+
+	return true;
+}
+
+bool IsLinearImage(const nlohmann::json &texture) {
+	auto iter = texture.find("color_space");
+	return iter == texture.end() || *iter != "srgb";
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,37 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "json.hpp"
+
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+
+namespace Lantern {
+
+/**
+ * Reads a scene file, and validates it against scene.schema.json
+ *
+ * The schema is looked for in the scenes directory of the source tree, relative to the build directory, and then in the working directory
+ *
+ * @param jsonPath    The scene file
+ * @param out_json    The parsed scene
+ * @return            False if the schema or the scene couldn't be read, or the scene isn't valid
+ */
+bool ReadSceneJSON(const fs::path &jsonPath, nlohmann::json *out_json);
+/**
+ * Whether the 8-bit texels of an image texture are linear, rather than sRGB encoded
+ *
+ * Images are linear unless the texture's "color_space" is "srgb", which keeps scenes written before the field
+ * existed rendering as they did. HDR images and .ltf files ignore it
+ *
+ * @param texture    An "image" texture from the scene
+ */
+bool IsLinearImage(const nlohmann::json &texture);
+
+} // End of namespace Lantern
@@ -0,0 +1,241 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "scene/scene_pack.h"
+
+#include "scene/scene_json.h"
+
+#include "io/file_io.h"
+#include "io/lantern_model_container.h"
+#include "io/lantern_model_file.h"
+#include "io/lantern_scene_pack.h"
+#include "io/lantern_texture_file.h"
+#include "io/memory_mapped_file.h"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+
+namespace Lantern {
+
+/**
+ * Packs files, making sure each file is only packed once
+ */
+class ScenePacker {
+public:
+	ScenePacker(const fs::path &jsonPath, LSPWriter *writer, bool compressTextures)
+		: m_jsonPath(jsonPath),
+		  m_writer(writer),
+		  m_compressTextures(compressTextures) {
+	}
+
+private:
+	fs::path m_jsonPath;
+	LSPWriter *m_writer;
+	bool m_compressTextures;
+	// The asset each file was packed as, by its full path, and its color space for images
+	std::unordered_map<std::string, uint> m_assets;
+
+public:
+	enum class FileKind {
+		// Packed as is
+		Raw,
+		// Compiled to a .ltf file
+		Image,
+		// Converted to a version 2 LMF file, if it isn't one already
+		Model
+	};
+
+	/**
+	 * Packs the file an object of the scene refers to, and replaces its "file_path" with the "asset" it became
+	 *
+	 * @param object    A part of the scene with a "file_path"
+	 * @param kind      What sort of file it is
+	 * @return          False if the file couldn't be packed
+	 */
+	bool PackFileOf(nlohmann::json *object, FileKind kind) {
+		fs::path filePath((*object)["file_path"].get<std::string>());
+		if (filePath.is_relative()) {
+			filePath = m_jsonPath.parent_path() / filePath;
+		}
+		std::string path = filePath.u8string();
+		// Images are compiled in their color space, so an image used in both is packed twice
+		bool isLinear = kind != FileKind::Image || IsLinearImage(*object);
+		std::string key = isLinear ? path : path + " (sRGB)";
+
+		uint asset;
+		auto iter = m_assets.find(key);
+		if (iter != m_assets.end()) {
+			asset = iter->second;
+		} else {
+			switch (kind) {
+			case FileKind::Image:
+				asset = PackImage(path, isLinear);
+				break;
+			case FileKind::Model:
+				asset = PackModel(path);
+				break;
+			case FileKind::Raw:
+			default:
+				asset = PackRaw(path);
+				break;
+			}
+			if (asset == (uint)-1) {
+				return false;
+			}
+			m_assets[key] = asset;
+		}
+
+		object->erase("file_path");
+		(*object)["asset"] = asset;
+		return true;
+	}
+
+private:
+	uint PackRaw(const std::string &path) {
+		MemoryMappedFile file;
+		if (!file.Open(path.c_str())) {
+			printf("Unable to open \"%s\" for reading\n", path.c_str());
+			return (uint)-1;
+		}
+
+		return PackData(file.Data(), file.Size());
+	}
+
+	uint PackData(const byte *data, std::size_t size) {
+		Write(m_writer->BeginAsset(), (void *)data, size);
+		return m_writer->EndAsset();
+	}
+
+	uint PackImage(const std::string &path, bool isLinear) {
+		if (path.size() > 4 && strcmp(path.c_str() + path.size() - 4, ".ltf") == 0) {
+			return PackRaw(path);
+		}
+
+		// Compile the image, just like texture_compiler does, so it can be sampled in place
+		LanternTextureFile ltf;
+		if (!CreateLTF(path.c_str(), DefaultTexelFormat(path.c_str(), isLinear, m_compressTextures), isLinear, &ltf)) {
+			printf("Unable to compile image \"%s\"\n", path.c_str());
+			return (uint)-1;
+		}
+
+		WriteLTF(m_writer->BeginAsset(), &ltf);
+		return m_writer->EndAsset();
+	}
+
+	uint PackModel(const std::string &path) {
+		MemoryMappedFile file;
+		if (!file.Open(path.c_str())) {
+			printf("Unable to open \"%s\" for reading\n", path.c_str());
+			return (uint)-1;
+		}
+
+		// Containers and version 2 files are already laid out for Embree
+		if (IsLMCFile(file.Data(), file.Size()) || ReadLMFVersion(file.Data(), file.Size()) == kLMFVersion) {
+			return PackData(file.Data(), file.Size());
+		}
+		if (ReadLMFVersion(file.Data(), file.Size()) != 1) {
+			printf("\"%s\" isn't an LMF file\n", path.c_str());
+			return (uint)-1;
+		}
+
+		// Version 1 files are rewritten as version 2
+		FILE *lmfFile = fopen(path.c_str(), "rb");
+		LanternModelFile lmf;
+		bool success = lmfFile != nullptr && ReadLMF(lmfFile, &lmf);
+		if (lmfFile != nullptr) {
+			fclose(lmfFile);
+		}
+		if (!success) {
+			printf("Unable to load \"%s\"\n", path.c_str());
+			return (uint)-1;
+		}
+
+		WriteLFM(m_writer->BeginAsset(), &lmf);
+		return m_writer->EndAsset();
+	}
+};
+
+/**
+ * Packs every file a scene uses, and then the scene itself
+ *
+ * @param jsonPath    The scene file
+ * @param scene       The scene. Its file paths are replaced with the assets they became
+ * @param packPath    The file to write the pack to
+ * @return            False if anything couldn't be packed. The file is left incomplete
+ */
+static bool WritePack(const fs::path &jsonPath, nlohmann::json *scene, const char *packPath, bool compressTextures) {
+	nlohmann::json &j = *scene;
+
+	LSPWriter writer;
+	if (!writer.Open(packPath)) {
+		printf("Unable to open \"%s\" for writing\n", packPath);
+		return false;
+	}
+	ScenePacker packer(jsonPath, &writer, compressTextures);
+
+	// Resolve every file the scene uses to an asset. These are the same files Scene::ParseJSON() loads
+	if (j.count("environment") == 1) {
+		if (!packer.PackFileOf(&j["environment"], ScenePacker::FileKind::Raw)) {
+			return false;
+		}
+	}
+	if (j.count("bsdfs") == 1) {
+		for (auto &bsdf : j["bsdfs"]) {
+			if (bsdf.count("albedo") == 1 && bsdf["albedo"]["type"] == "image") {
+				if (!packer.PackFileOf(&bsdf["albedo"], ScenePacker::FileKind::Image)) {
+					return false;
+				}
+			}
+		}
+	}
+	if (j.count("primitives") == 1) {
+		for (auto &primitive : j["primitives"]) {
+			if (primitive["type"] == "lmf") {
+				if (!packer.PackFileOf(&primitive, ScenePacker::FileKind::Model)) {
+					return false;
+				}
+			}
+		}
+	}
+
+	if (!writer.Close(j.dump())) {
+		printf("Unable to write \"%s\"\n", packPath);
+		return false;
+	}
+
+	return true;
+}
+
+bool PackScene(const char *scenePath, const char *packPath, bool compressTextures) {
+	fs::path jsonPath = canonical(fs::path(scenePath));
+
+	nlohmann::json j;
+	if (!ReadSceneJSON(jsonPath, &j)) {
+		return false;
+	}
+
+	// Write the pack next to where it goes, and only move it into place once it's complete, so a failure
+	// doesn't leave a truncated pack behind, or clobber a good one
+	fs::path tempPath = fs::path(packPath).concat(".tmp");
+	std::error_code error;
+	if (!WritePack(jsonPath, &j, tempPath.u8string().c_str(), compressTextures)) {
+		fs::remove(tempPath, error);
+		return false;
+	}
+
+	fs::rename(tempPath, fs::path(packPath), error);
+	if (error) {
+		printf("Unable to move \"%s\" to \"%s\": %s\n", tempPath.u8string().c_str(), packPath, error.message().c_str());
+		fs::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+} // End of namespace Lantern
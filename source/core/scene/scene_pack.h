@@ -0,0 +1,29 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+
+namespace Lantern {
+
+/**
+ * Compiles a scene, and every file it uses, into one Lantern Scene Pack
+ *
+ * The scene is validated once, here, so loading the pack can skip the schema. Files are resolved to assets
+ * in the pack, and converted to the layout the renderer uses in place:
+ *  - Images are compiled to .ltf files, so they're sampled straight from the pack. The environment image is kept as is
+ *  - Version 1 LMF files are converted to version 2, so Embree can use their buffers straight from the pack
+ *
+ * A file used more than once is only packed once
+ *
+ * @param scenePath           The scene JSON file
+ * @param packPath            The pack to write
+ * @param compressTextures    Whether 8-bit images are block compressed when they're compiled
+ * @return                    False if the scene, or any of its files, couldn't be packed. packPath is left as it was
+ */
+bool PackScene(const char *scenePath, const char *packPath, bool compressTextures);
+
+} // End of namespace Lantern
@@ -0,0 +1,123 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "scene/sphere_light.h"
+
+#include "math/sampling.h"
+
+#include "integrator/surface_interaction.h"
+
+#include <algorithm>
+
+
+namespace Lantern {
+
+// sin^2 of 1.5 degrees. Below this, 1 - cos(thetaMax) loses too much precision to compute directly
+static const float kSinSquaredThetaMaxEpsilon = 0.00068523f;
+
+float SphereLight::OneMinusCosThetaMax(float distanceSquared) const {
+	float radiusSquared = m_radius * m_radius;
+	if (distanceSquared <= radiusSquared) {
+		return 0.0f;
+	}
+
+	float sinSquaredThetaMax = radiusSquared / distanceSquared;
+	if (sinSquaredThetaMax < kSinSquaredThetaMaxEpsilon) {
+		// Taylor expansion of 1 - sqrt(1 - x)
+		return sinSquaredThetaMax / 2.0f;
+	}
+
+	return 1.0f - sqrtf(1.0f - sinSquaredThetaMax);
+}
+
+float3 SphereLight::SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const {
+	float3a toCenter = m_center - interaction.Position;
+	float distanceSquared = dot(toCenter, toCenter);
+	float oneMinusCosThetaMax = OneMinusCosThetaMax(distanceSquared);
+
+	// Inside the sphere, every direction hits it, so sample the surface uniformly
+	if (oneMinusCosThetaMax == 0.0f) {
+		float3a normal = UniformSampleSphere(u);
+		float3a point = m_center + normal * m_radius;
+
+		return ConnectUniformAreaSample(point, normal, Area(), interaction, pdf, shadowRay);
+	}
+
+	// Uniformly sample a direction in the cone the sphere subtends
+	float sinSquaredThetaMax = m_radius * m_radius / distanceSquared;
+	float cosTheta, sinSquaredTheta;
+	if (sinSquaredThetaMax < kSinSquaredThetaMaxEpsilon) {
+		sinSquaredTheta = sinSquaredThetaMax * u.x;
+		cosTheta = sqrtf(1.0f - sinSquaredTheta);
+	} else {
+		cosTheta = 1.0f - u.x * oneMinusCosThetaMax;
+		sinSquaredTheta = 1.0f - cosTheta * cosTheta;
+	}
+
+	// Find where the direction first hits the sphere, as an angle alpha from the center, measured from the shading point
+	float distanceToCenter = sqrtf(distanceSquared);
+	float cosAlpha = sinSquaredTheta / (m_radius / distanceToCenter) +
+	                 cosTheta * sqrtf(std::max(1.0f - sinSquaredTheta / sinSquaredThetaMax, 0.0f));
+	float sinAlpha = sqrtf(std::max(1.0f - cosAlpha * cosAlpha, 0.0f));
+	float phi = u.y * 2.0f * (float)M_PI;
+
+	float3a fromCenter = -toCenter / distanceToCenter;
+	float3a normal = RotateToWorld(sinAlpha * cosf(phi), sinAlpha * sinf(phi), cosAlpha, fromCenter);
+	float3a point = m_center + normal * m_radius;
+
+	float3a toLight = point - interaction.Position;
+	float distance = length(toLight);
+	float3a direction = toLight / distance;
+	interaction.InputDirection = direction;
+
+	// Check that the point is above the horizon
+	if (dot(direction, interaction.Normal) <= 0.0f) {
+		*pdf = 0.0f;
+		return float3(0.0f);
+	}
+
+	*pdf = 1.0f / (2.0f * (float)M_PI * oneMinusCosThetaMax);
+
+	InitShadowRay(interaction.Position, direction, distance, shadowRay);
+
+	// Return the full radiance value
+	// The value will be attenuated by the BRDF
+	return m_radiance;
+}
+
+float SphereLight::PdfLi(Scene *scene, const RTCRayHit &rayHit) const {
+	float3a origin(rayHit.ray.org_x, rayHit.ray.org_y, rayHit.ray.org_z);
+	float3a toCenter = m_center - origin;
+	float oneMinusCosThetaMax = OneMinusCosThetaMax(dot(toCenter, toCenter));
+
+	// Match SampleLi, which samples the surface uniformly from inside the sphere
+	if (oneMinusCosThetaMax == 0.0f) {
+		return UniformAreaPdfLi(rayHit, Area());
+	}
+
+	return 1.0f / (2.0f * (float)M_PI * oneMinusCosThetaMax);
+}
+
+float SphereLight::Power() const {
+	// Every point of the surface emits m_radiance over the hemisphere
+	return Luminance(m_radiance) * Area() * (float)M_PI;
+}
+
+bool SphereLight::Bounds(LightBounds *bounds) const {
+	float3 center(m_center.x, m_center.y, m_center.z);
+	bounds->Min = center - float3(m_radius);
+	bounds->Max = center + float3(m_radius);
+	// The sphere emits in every direction
+	bounds->W = float3(0.0f, 1.0f, 0.0f);
+	bounds->Phi = Power();
+	bounds->CosThetaO = -1.0f;
+	bounds->CosThetaE = 0.0f;
+	bounds->TwoSided = false;
+
+	return true;
+}
+
+} // End of namespace Lantern
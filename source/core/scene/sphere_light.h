@@ -0,0 +1,51 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "scene/light.h"
+
+
+namespace Lantern {
+
+/**
+ * An emissive analytic sphere
+ *
+ * From outside the sphere, SampleLi samples the cone of directions the sphere subtends, so every sample
+ * lands on the visible side of the sphere. From inside, it falls back to sampling the surface uniformly
+ */
+class SphereLight : public Light {
+public:
+	SphereLight(float3 color, float radiantPower, float3a center, float radius)
+		: Light(color * radiantPower * (float)M_1_PI / (4.0f * (float)M_PI * radius * radius)),
+		  m_center(center),
+		  m_radius(radius) {
+	}
+
+private:
+	float3a m_center;
+	float m_radius;
+
+public:
+	float3 SampleLi(float uElement, float2 u, Scene *scene, SurfaceInteraction &interaction, float *pdf, RTCRay *shadowRay) const override;
+	float PdfLi(Scene *scene, const RTCRayHit &rayHit) const override;
+	float Power() const override;
+	bool Bounds(LightBounds *bounds) const override;
+
+private:
+	float Area() const {
+		return 4.0f * (float)M_PI * m_radius * m_radius;
+	}
+	/**
+	 * Calculates 1 - cos(thetaMax), where thetaMax is the half angle of the cone the sphere subtends from a point
+	 *
+	 * @param distanceSquared    The squared distance from the point to the center of the sphere
+	 * @return                   Zero if the point is inside the sphere
+	 */
+	float OneMinusCosThetaMax(float distanceSquared) const;
+};
+
+} // End of namespace Lantern
@@ -8,6 +8,9 @@
 
 #include "scene/scene.h"
 
+#include "tbb/parallel_reduce.h"
+#include "tbb/blocked_range.h"
+
 #include "visualizer/shaders/fullscreen_triangle_vs.spv.h"
 #include "visualizer/shaders/final_resolve_ps.spv.h"
 
@@ -21,6 +24,8 @@
 #include <random>
 #include <algorithm>
 
+#include <emmintrin.h>
+
 
 namespace Lantern {
 
@@ -56,11 +61,15 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
 // Needed for message pump callbacks
 Visualizer *g_visualizer;
 
-Visualizer::Visualizer(Scene *scene, FrameBuffer *currentFrameBuffer, std::atomic<FrameBuffer *> *swapFrameBuffer)
+Visualizer::Visualizer(Scene *scene, TileTransferBuffer *transferBuffer)
 		: m_scene(scene),
-          m_currentFrameBuffer(currentFrameBuffer),
-          m_swapFrameBuffer(swapFrameBuffer),
+          m_transferBuffer(transferBuffer),
           m_accumulationFrameBuffer(scene->Camera->FrameBufferWidth, scene->Camera->FrameBufferHeight),
+		  // Start above the initial stagingVersion, so the first frame always resolves
+		  m_accumulationVersion(1u),
+		  m_minSPP(0u),
+		  m_maxSPP(0u),
+		  m_avgSPP(0.0f),
 		  m_window(nullptr) {
 	g_visualizer = this;
 }
@@ -299,20 +308,9 @@ bool Visualizer::RenderFrame() {
 
 	// Rendering
 
-	// Accumulate pixels generated by the Renderer
-	m_currentFrameBuffer = std::atomic_exchange(m_swapFrameBuffer, m_currentFrameBuffer);
-
-	if (!m_currentFrameBuffer->Empty) {
-		for (uint y = 0; y < m_currentFrameBuffer->Height; ++y) {
-			const size_t offset = y * m_currentFrameBuffer->Width;
-			for (uint x = 0; x < m_currentFrameBuffer->Width; ++x) {
-				const size_t index = offset + x;
-				m_accumulationFrameBuffer.ColorData[index] += m_currentFrameBuffer->ColorData[index];
-				m_accumulationFrameBuffer.Bounces[index] += m_currentFrameBuffer->Bounces[index];
-				m_accumulationFrameBuffer.ColorSampleCount[index] += m_currentFrameBuffer->ColorSampleCount[index];
-			}
-		}
-		m_currentFrameBuffer->Reset();
+	// Accumulate the tiles the Renderer has finished since the last frame
+	if (m_transferBuffer->Consume(&m_accumulationFrameBuffer) > 0) {
+		++m_accumulationVersion;
 	}
 
 	// Acquire the next image to render to
@@ -346,31 +344,12 @@ bool Visualizer::RenderFrame() {
 		return false;
 	}
 
-	uint minSPP = 0xFFFFFFFF;
-	uint maxSPP = 0;
-	float sumSPP = 0.0f;
-
 	// Copy Renderer data to the GPU
-	float *mappedData = (float *)frame->stagingBufferAllocInfo.pMappedData;
-	for (uint j = 0; j < m_accumulationFrameBuffer.Height; ++j) {
-		const size_t offset = j * m_accumulationFrameBuffer.Width;
-		for (uint i = 0; i < m_accumulationFrameBuffer.Width; ++i) {
-			const size_t frameBufferIndex = offset + i;
-			const size_t mappedDataIndex = frameBufferIndex * 3;
-
-			float3 &color = m_accumulationFrameBuffer.ColorData[frameBufferIndex];
-			uint sampleCount = m_accumulationFrameBuffer.ColorSampleCount[frameBufferIndex];
-			mappedData[mappedDataIndex + 0] = color.x / float(sampleCount); // Red
-			mappedData[mappedDataIndex + 1] = color.y / float(sampleCount); // Green
-			mappedData[mappedDataIndex + 2] = color.z / float(sampleCount); // Blue
-
-			minSPP = std::min(minSPP, sampleCount);
-			maxSPP = std::max(maxSPP, sampleCount);
-			sumSPP += sampleCount;
-		}
-	}
+	// Each frame has its own staging image, so it only needs updating if samples arrived since it was last written
+	if (frame->stagingVersion != m_accumulationVersion) {
+		ResolveAccumulation((float *)frame->stagingBufferAllocInfo.pMappedData);
+		frame->stagingVersion = m_accumulationVersion;
 
-	{
 		// Flush to GPU
 		vk::MappedMemoryRange flushRange;
 		flushRange.memory = (vk::DeviceMemory)frame->stagingBufferAllocInfo.deviceMemory;
@@ -386,9 +365,9 @@ bool Visualizer::RenderFrame() {
 	ImGui::SetNextWindowPos(ImVec2(0, 50));
 	ImGui::Begin("Integrator Stats", nullptr, ImVec2(0, 0), -1, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoCollapse);
 	{
-		ImGui::Text("%u Min Samples Per Pixel", minSPP);
-		ImGui::Text("%u Max Samples Per Pixel", maxSPP);
-		ImGui::Text("%u Avg Samples Per Pixel", (uint)(sumSPP / (m_accumulationFrameBuffer.Width * m_accumulationFrameBuffer.Height)));
+		ImGui::Text("%u Min Samples Per Pixel", m_minSPP);
+		ImGui::Text("%u Max Samples Per Pixel", m_maxSPP);
+		ImGui::Text("%u Avg Samples Per Pixel", (uint)m_avgSPP);
 	}
 	ImGui::End();
 
@@ -1004,6 +983,7 @@ bool Visualizer::InitVulkanWindow(int width, int height) {
 				printf("Vulkan: Failed to create staging image");
 				return false;
 			}
+			frame->stagingVersion = 0u;
 
 			// Transition image to Shader Read Only Optimal
 			{
@@ -1283,6 +1263,104 @@ bool Visualizer::CreateSwapChain(int width, int height) {
 	return true;
 }
 
+struct SampleStats {
+	uint Min;
+	uint Max;
+	uint64 Sum;
+};
+
+/**
+ * Resolves one row of pixels. Four pixels at a time, since four float3s are exactly three SSE registers
+ */
+static void ResolveRow(const float3 *color, const uint *sampleCount, uint width, float *out, SampleStats *stats) {
+	const float *colorData = (const float *)color;
+
+	// The largest float that still fits in a uint
+	__m128 minCount = _mm_set1_ps(4294967040.0f);
+	__m128 maxCount = _mm_setzero_ps();
+	__m128i sum = _mm_setzero_si128();
+
+	uint x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i counts = _mm_loadu_si128((const __m128i *)&sampleCount[x]);
+		__m128 countsF = _mm_cvtepi32_ps(counts);
+
+		minCount = _mm_min_ps(minCount, countsF);
+		maxCount = _mm_max_ps(maxCount, countsF);
+		sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(counts, _mm_setzero_si128()));
+		sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(counts, _mm_setzero_si128()));
+
+		// Pixels without any samples resolve to black, instead of 0 / 0
+		__m128 rcp = _mm_div_ps(_mm_set1_ps(1.0f), countsF);
+		rcp = _mm_and_ps(rcp, _mm_cmpgt_ps(countsF, _mm_setzero_ps()));
+
+		// Spread the reciprocals to match the RGBRGBRGBRGB layout
+		__m128 rcp0 = _mm_shuffle_ps(rcp, rcp, _MM_SHUFFLE(1, 0, 0, 0));
+		__m128 rcp1 = _mm_shuffle_ps(rcp, rcp, _MM_SHUFFLE(2, 2, 1, 1));
+		__m128 rcp2 = _mm_shuffle_ps(rcp, rcp, _MM_SHUFFLE(3, 3, 3, 2));
+
+		const float *src = colorData + x * 3;
+		float *dst = out + x * 3;
+		_mm_storeu_ps(dst + 0, _mm_mul_ps(_mm_loadu_ps(src + 0), rcp0));
+		_mm_storeu_ps(dst + 4, _mm_mul_ps(_mm_loadu_ps(src + 4), rcp1));
+		_mm_storeu_ps(dst + 8, _mm_mul_ps(_mm_loadu_ps(src + 8), rcp2));
+	}
+
+	// Sample counts are exact in a float up to 2^24, which is plenty for display
+	float minLanes[4];
+	float maxLanes[4];
+	uint64 sumLanes[2];
+	_mm_storeu_ps(minLanes, minCount);
+	_mm_storeu_ps(maxLanes, maxCount);
+	_mm_storeu_si128((__m128i *)sumLanes, sum);
+
+	uint minSPP = (uint)std::min(std::min(minLanes[0], minLanes[1]), std::min(minLanes[2], minLanes[3]));
+	uint maxSPP = (uint)std::max(std::max(maxLanes[0], maxLanes[1]), std::max(maxLanes[2], maxLanes[3]));
+	uint64 sumSPP = sumLanes[0] + sumLanes[1];
+
+	for (; x < width; ++x) {
+		uint count = sampleCount[x];
+		float rcp = count > 0 ? 1.0f / float(count) : 0.0f;
+		out[x * 3 + 0] = color[x].x * rcp; // Red
+		out[x * 3 + 1] = color[x].y * rcp; // Green
+		out[x * 3 + 2] = color[x].z * rcp; // Blue
+
+		minSPP = std::min(minSPP, count);
+		maxSPP = std::max(maxSPP, count);
+		sumSPP += count;
+	}
+
+	stats->Min = std::min(stats->Min, minSPP);
+	stats->Max = std::max(stats->Max, maxSPP);
+	stats->Sum += sumSPP;
+}
+
+void Visualizer::ResolveAccumulation(float *mappedData) {
+	const uint width = m_accumulationFrameBuffer.Width;
+	const uint height = m_accumulationFrameBuffer.Height;
+	const float3 *colorData = m_accumulationFrameBuffer.ColorData;
+	const uint *sampleCountData = m_accumulationFrameBuffer.ColorSampleCount;
+
+	SampleStats identity = {0xFFFFFFFF, 0u, 0u};
+	SampleStats stats = tbb::parallel_reduce(tbb::blocked_range<uint>(0, height), identity,
+		[=](const tbb::blocked_range<uint> &rows, SampleStats partial) {
+			for (uint y = rows.begin(); y < rows.end(); ++y) {
+				const std::size_t offset = (std::size_t)y * width;
+				ResolveRow(colorData + offset, sampleCountData + offset, width, mappedData + offset * 3, &partial);
+			}
+			return partial;
+		},
+		[](SampleStats a, SampleStats b) {
+			SampleStats result = {std::min(a.Min, b.Min), std::max(a.Max, b.Max), a.Sum + b.Sum};
+			return result;
+		}
+	);
+
+	m_minSPP = stats.Min;
+	m_maxSPP = stats.Max;
+	m_avgSPP = float(double(stats.Sum) / (double(width) * height));
+}
+
 bool Visualizer::RenderImage(FrameData *frame) {
 	{
 		vk::RenderPassBeginInfo beginInfo;
@@ -9,6 +9,7 @@
 #include "math/int_types.h"
 
 #include "camera/frame_buffer.h"
+#include "camera/tile_transfer_buffer.h"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -19,8 +20,6 @@
 
 #include "vk_mem_alloc.h"
 
-#include <atomic>
-
 
 struct GLFWwindow;
 
@@ -30,16 +29,22 @@ class Scene;
 
 class Visualizer {
 public:
-	Visualizer(Scene *scene, FrameBuffer *currentFrameBuffer, std::atomic<FrameBuffer *> *swapFrameBuffer);
+	Visualizer(Scene *scene, TileTransferBuffer *transferBuffer);
 	~Visualizer();
 
 private:
 	Scene *m_scene;
 
-	FrameBuffer *m_currentFrameBuffer;
-	std::atomic<FrameBuffer *> *m_swapFrameBuffer;
+	TileTransferBuffer *m_transferBuffer;
 
 	FrameBuffer m_accumulationFrameBuffer;
+	// Incremented every time new samples are merged into m_accumulationFrameBuffer
+	uint64 m_accumulationVersion;
+
+	// Sample statistics from the last resolve
+	uint m_minSPP;
+	uint m_maxSPP;
+	float m_avgSPP;
 
 	GLFWwindow *m_window;
 
@@ -81,6 +86,8 @@ private:
 		vk::ImageView stagingImageView;
 		VmaAllocation stagingBufferAllocation;
 		VmaAllocationInfo stagingBufferAllocInfo;
+		// The m_accumulationVersion the staging image was last resolved from
+		uint64 stagingVersion;
 
 		vk::DescriptorSet descriptorSet;
 	};
@@ -122,6 +129,15 @@ public:
 private:
 	bool RenderFrame();
 
+	/**
+	 * Divides the accumulated color of every pixel by its sample count, and writes the result to a staging image
+	 *
+	 * Also updates the sample statistics
+	 *
+	 * @param mappedData    The mapped staging image. Tightly packed RGB floats
+	 */
+	void ResolveAccumulation(float *mappedData);
+
 	bool RenderImage(FrameData *frame);
 	bool RenderImGui(FrameData *frame);
 
@@ -5,10 +5,17 @@
 */
 
 #include "scene/scene.h"
+#include "scene/scene_pack.h"
+
+#include "camera/frame_buffer.h"
+#include "camera/tile_transfer_buffer.h"
 
 #include "visualizer/visualizer.h"
 
 #include "integrator/integrator.h"
+#include "integrator/wavefront_integrator.h"
+
+#include "io/image_writer.h"
 
 #include "argparse.h"
 
@@ -16,29 +23,80 @@
 #include <pmmintrin.h>
 
 #include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+
+struct LanternOpts {
+	const char *ScenePath = "scene.json";
+	const char *IntegratorName = "path";
+	const char *SamplerName = "sobol";
+	const char *LightSamplerName = "bvh";
+	int TextureMemoryBudget = 1024;
+	bool CompressTextures = false;
+	const char *TextureFilterName = "trilinear";
+	bool Verbose = false;
+
+	bool Headless = false;
+	const char *OutputPath = "output";
+	int SamplesPerPixel = 0;
+	int SamplesPerPass = 1;
+	float NoiseThreshold = 0.0f;
+	float TimeLimit = 0.0f;
+	float CheckpointInterval = 0.0f;
+	int ToneMapper = (int)Lantern::ToneMapper::Filmic;
+	float Exposure = 0.0f;
+};
 
+Lantern::Integrator *CreateIntegrator(const char *name, Lantern::Scene *scene, Lantern::TileTransferBuffer *transferBuffer);
+int RunHeadless(Lantern::Scene *scene, Lantern::Integrator *integrator, Lantern::TileTransferBuffer *transferBuffer, LanternOpts *options);
+int RunPack(int argc, const char *argv[]);
 
 int main(int argc, const char *argv[]) {
 	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
 	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
 
-	struct LanternOpts {
-		const char *ScenePath = "scene.json";
-		bool Verbose = false;
-	} options;
+	// 'lantern pack' compiles a scene into a scene pack, rather than rendering it
+	if (argc > 1 && strcmp(argv[1], "pack") == 0) {
+		return RunPack(argc - 1, argv + 1);
+	}
+
+	LanternOpts options;
 
 	const char *const usage[] = {
 		"lantern [options] [[--] args]",
 		"lantern [options]",
+		"lantern pack [options] [--] <scene.json>",
 		NULL,
 	};
-	
+
 	struct argparse_option parseOptions[] = {
 		OPT_HELP(),
 		OPT_GROUP("Root options"),
 		OPT_BOOLEAN('v', "verbose", &options.Verbose, "Use verbose logging"),
 		OPT_GROUP("Basic Options"),
-		OPT_STRING('s', "scene", &options.ScenePath, "Path to the scene.json file. If ommited, Lantern will search for 'scene.json' in the working directory"),
+		OPT_STRING('s', "scene", &options.ScenePath, "Path to the scene.json file, or to a scene pack made with 'lantern pack'. If ommited, Lantern will search for 'scene.json' in the working directory"),
+		OPT_STRING('i', "integrator", &options.IntegratorName, "The integrator to render with. Either 'path' (default) or 'wavefront'"),
+		OPT_GROUP("Sampling Options"),
+		OPT_STRING(0, "sampler", &options.SamplerName, "The sampler to generate samples with. Either 'sobol' (default), 'pmj02', or 'uniform'"),
+		OPT_STRING(0, "light-sampler", &options.LightSamplerName, "How lights are picked for direct lighting. Either 'bvh' (default), which favors lights close to and facing the shading point, or 'power'"),
+		OPT_INTEGER(0, "samples-per-pass", &options.SamplesPerPass, "How many samples each pixel gets before the frame is published. Higher values have less overhead, but update the image less often"),
+		OPT_INTEGER(0, "spp", &options.SamplesPerPixel, "Stop each pixel after this many samples"),
+		OPT_FLOAT(0, "noise", &options.NoiseThreshold, "Stop each pixel once its estimated relative error falls below this. Noisy pixels get more samples per pass"),
+		OPT_GROUP("Memory Options"),
+		OPT_INTEGER(0, "texture-memory", &options.TextureMemoryBudget, "How many MB of texture tiles to keep in memory. Textures are loaded lazily, so scenes can use more than this"),
+		OPT_BOOLEAN(0, "compress-textures", &options.CompressTextures, "Block compress textures as they're loaded. Uses an eighth of the memory, at some loss of quality"),
+		OPT_STRING(0, "texture-filter", &options.TextureFilterName, "How textures are filtered. Either 'trilinear' (default), 'bilinear', or 'nearest'"),
+		OPT_GROUP("Headless Options"),
+		OPT_BOOLEAN(0, "headless", &options.Headless, "Render without a window, and write the result to disk"),
+		OPT_STRING('o', "output", &options.OutputPath, "Output path, without an extension. Lantern writes <output>.pfm and <output>.png"),
+		OPT_FLOAT(0, "time", &options.TimeLimit, "Stop after this many seconds of rendering"),
+		OPT_FLOAT(0, "checkpoint", &options.CheckpointInterval, "Write the in-progress image every N seconds"),
+		OPT_INTEGER(0, "tonemapper", &options.ToneMapper, "Tonemapper for the PNG output. 0 = Clamp, 1 = Filmic"),
+		OPT_FLOAT(0, "exposure", &options.Exposure, "Exposure, in stops, for the PNG output"),
 		OPT_END(),
 	};
 
@@ -48,37 +106,213 @@ int main(int argc, const char *argv[]) {
 
 	argc = argparse_parse(&argparse, argc, argv);
 
+	if (options.Headless && options.SamplesPerPixel <= 0 && options.NoiseThreshold <= 0.0f && options.TimeLimit <= 0.0f) {
+		printf("Headless rendering requires --spp, --noise, and/or --time\n\n");
+		argparse_usage(&argparse);
+		return 1;
+	}
+
 	// Load the scene
 	Lantern::Scene scene;
+	if (strcmp(options.LightSamplerName, "bvh") == 0) {
+		scene.SetLightSamplerType(Lantern::LightSamplerType::BVH);
+	} else if (strcmp(options.LightSamplerName, "power") == 0) {
+		scene.SetLightSamplerType(Lantern::LightSamplerType::Power);
+	} else {
+		printf("Unknown light sampler [%s]\n", options.LightSamplerName);
+		return 1;
+	}
+	if (options.TextureMemoryBudget <= 0) {
+		printf("--texture-memory must be positive\n");
+		return 1;
+	}
+	scene.SetTextureMemoryBudget((std::size_t)options.TextureMemoryBudget * 1024 * 1024);
+	scene.SetTextureCompression(options.CompressTextures);
+	if (strcmp(options.TextureFilterName, "trilinear") == 0) {
+		scene.SetTextureFilter(Lantern::TextureFilter::Trilinear);
+	} else if (strcmp(options.TextureFilterName, "bilinear") == 0) {
+		scene.SetTextureFilter(Lantern::TextureFilter::Bilinear);
+	} else if (strcmp(options.TextureFilterName, "nearest") == 0) {
+		scene.SetTextureFilter(Lantern::TextureFilter::Nearest);
+	} else {
+		printf("Unknown texture filter [%s]\n", options.TextureFilterName);
+		return 1;
+	}
 	if (!scene.LoadSceneFromJSON(options.ScenePath)) {
 		printf("Could not load scene.json\n");
 		return 1;
 	}
 
-	Lantern::FrameBuffer transferFrames[3] = {
-		Lantern::FrameBuffer(scene.Camera->FrameBufferWidth, scene.Camera->FrameBufferHeight),
-		Lantern::FrameBuffer(scene.Camera->FrameBufferWidth, scene.Camera->FrameBufferHeight),
-		Lantern::FrameBuffer(scene.Camera->FrameBufferWidth, scene.Camera->FrameBufferHeight)
-	};
-	std::atomic<Lantern::FrameBuffer *> swapBuffer(&transferFrames[1]);
+	Lantern::TileTransferBuffer transferBuffer(scene.Camera->FrameBufferWidth, scene.Camera->FrameBufferHeight, Lantern::Integrator::kTileSize);
+
+	Lantern::Integrator *integrator = CreateIntegrator(options.IntegratorName, &scene, &transferBuffer);
+	if (integrator == nullptr) {
+		printf("Unknown integrator [%s]\n", options.IntegratorName);
+		return 1;
+	}
+	if (strcmp(options.SamplerName, "sobol") == 0) {
+		integrator->SetSamplerType(Lantern::SamplerType::Sobol);
+	} else if (strcmp(options.SamplerName, "pmj02") == 0) {
+		integrator->SetSamplerType(Lantern::SamplerType::PMJ02);
+	} else if (strcmp(options.SamplerName, "uniform") == 0) {
+		integrator->SetSamplerType(Lantern::SamplerType::Uniform);
+	} else {
+		printf("Unknown sampler [%s]\n", options.SamplerName);
+		delete integrator;
+		return 1;
+	}
+	integrator->SetSamplesPerPass((uint)std::max(options.SamplesPerPass, 1));
+	integrator->SetConvergenceCriteria(std::max(options.NoiseThreshold, 0.0f), (uint)std::max(options.SamplesPerPixel, 0));
+
+	if (options.Headless) {
+		int result = RunHeadless(&scene, integrator, &transferBuffer, &options);
+		delete integrator;
+
+		return result;
+	}
 
-	Lantern::Integrator integrator(&scene, &transferFrames[0], &swapBuffer);
-	Lantern::Visualizer visualizer(&scene, &transferFrames[2], &swapBuffer);
+	Lantern::Visualizer visualizer(&scene, &transferBuffer);
 	if (!visualizer.Init(scene.Camera->FrameBufferWidth, scene.Camera->FrameBufferHeight)) {
+		delete integrator;
 		return 1;
 	}
-	
+
 	std::atomic_bool quit(false);
 	std::thread rendererThread(
 		[](Lantern::Integrator *_integrator, std::atomic_bool *_quit) {
-			while (!_quit->load(std::memory_order_relaxed)) {
-				_integrator->RenderFrame();
-			}
-	}, &integrator, &quit);
+			// Run() returns early if every pixel converges. The visualizer keeps showing the result
+			_integrator->Run(_quit);
+	}, integrator, &quit);
 
 	visualizer.Run();
 	visualizer.Shutdown();
 
 	quit.store(true);
 	rendererThread.join();
+
+	delete integrator;
+}
+
+Lantern::Integrator *CreateIntegrator(const char *name, Lantern::Scene *scene, Lantern::TileTransferBuffer *transferBuffer) {
+	if (strcmp(name, "path") == 0) {
+		return new Lantern::Integrator(scene, transferBuffer);
+	}
+	if (strcmp(name, "wavefront") == 0) {
+		return new Lantern::WavefrontIntegrator(scene, transferBuffer);
+	}
+
+	return nullptr;
+}
+
+int RunHeadless(Lantern::Scene *scene, Lantern::Integrator *integrator, Lantern::TileTransferBuffer *transferBuffer, LanternOpts *options) {
+	const uint width = scene->Camera->FrameBufferWidth;
+	const uint height = scene->Camera->FrameBufferHeight;
+
+	Lantern::FrameBuffer accumulationFrameBuffer(width, height);
+	Lantern::ImageWriter imageWriter((Lantern::ToneMapper)options->ToneMapper, options->Exposure);
+
+	std::atomic_bool quit(false);
+	std::atomic_bool finished(false);
+	std::thread rendererThread(
+		[](Lantern::Integrator *_integrator, std::atomic_bool *_quit, std::atomic_bool *_finished) {
+			// Run() returns once every pixel has reached --spp or --noise
+			_integrator->Run(_quit);
+			_finished->store(true);
+	}, integrator, &quit, &finished);
+
+	typedef std::chrono::steady_clock Clock;
+	auto start = Clock::now();
+	auto lastCheckpoint = start;
+
+	while (!finished.load()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		// Merge the tiles the integrator has finished, just like the Visualizer does
+		transferBuffer->Consume(&accumulationFrameBuffer);
+
+		auto now = Clock::now();
+		float elapsed = std::chrono::duration<float>(now - start).count();
+		if (options->TimeLimit > 0.0f && elapsed >= options->TimeLimit) {
+			quit.store(true);
+		}
+
+		if (options->CheckpointInterval > 0.0f && std::chrono::duration<float>(now - lastCheckpoint).count() >= options->CheckpointInterval) {
+			lastCheckpoint = now;
+
+			std::vector<float3> resolved;
+			Lantern::ResolveFrameBuffer(&accumulationFrameBuffer, &resolved);
+			imageWriter.Write(options->OutputPath, width, height, std::move(resolved));
+
+			if (options->Verbose) {
+				printf("Checkpoint: %.1f seconds elapsed\n", elapsed);
+			}
+		}
+	}
+	rendererThread.join();
+
+	// Pick up the final tiles. A single Consume() might stop early if tiles were re-queued while it ran
+	while (transferBuffer->Consume(&accumulationFrameBuffer) > 0) {
+	}
+
+	float elapsed = std::chrono::duration<float>(Clock::now() - start).count();
+	uint64 sampleSum = 0;
+	for (std::size_t i = 0; i < (std::size_t)width * height; ++i) {
+		sampleSum += accumulationFrameBuffer.ColorSampleCount[i];
+	}
+	printf("Rendered %.1f samples per pixel on average in %.2f seconds\n", double(sampleSum) / (double(width) * height), elapsed);
+
+	std::vector<float3> resolved;
+	Lantern::ResolveFrameBuffer(&accumulationFrameBuffer, &resolved);
+	imageWriter.Write(options->OutputPath, width, height, std::move(resolved));
+	imageWriter.Flush();
+
+	return 0;
+}
+
+int RunPack(int argc, const char *argv[]) {
+	const char *outputPath = nullptr;
+	bool compressTextures = false;
+
+	const char *const usage[] = {
+		"lantern pack [options] [--] <scene.json>",
+		NULL,
+	};
+
+	struct argparse_option parseOptions[] = {
+		OPT_HELP(),
+		OPT_STRING('o', "output", &outputPath, "Output path for the scene pack. Defaults to the scene path, with a .lsp extension"),
+		OPT_BOOLEAN(0, "compress-textures", &compressTextures, "Block compress 8-bit images as they're compiled into the pack"),
+		OPT_END(),
+	};
+
+	argparse argparse;
+	argparse_init(&argparse, parseOptions, usage, 0);
+	argparse_describe(&argparse, "Compiles a scene, and every file it uses, into one scene pack. Packs load without validating the scene, and their models and textures are used in place, so render processes on the same machine share them", "Example:\nlantern pack -o sponza.lsp sponza.json\nlantern -s sponza.lsp");
+
+	argc = argparse_parse(&argparse, argc, argv);
+	if (argc != 1) {
+		printf("ERROR: Got an unexpected number of arguments.\n\n");
+		argparse_usage(&argparse);
+		return 1;
+	}
+
+	std::string packPath;
+	if (outputPath != nullptr) {
+		packPath = outputPath;
+	} else {
+		packPath = argv[0];
+		std::size_t extension = packPath.find_last_of('.');
+		if (extension != std::string::npos && packPath.find_first_of("/\\", extension) == std::string::npos) {
+			packPath.resize(extension);
+		}
+		packPath += ".lsp";
+	}
+
+	if (!Lantern::PackScene(argv[0], packPath.c_str(), compressTextures)) {
+		printf("Unable to pack \"%s\"\n", argv[0]);
+		return 1;
+	}
+
+	printf("Packed \"%s\" into \"%s\"\n", argv[0], packPath.c_str());
+	return 0;
 }
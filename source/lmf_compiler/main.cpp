@@ -4,34 +4,104 @@
 * Copyright Adrian Astley 2015 - 2016
 */
 
+#include "mesh_processing.h"
+#include "mesh_sink.h"
+#include "obj_reader.h"
+#include "ply_reader.h"
+
 #include "io/lantern_model_file.h"
+#include "io/lantern_model_container.h"
+#include "io/memory_mapped_file.h"
 
 #include "argparse.h"
 
 #include "tiny_obj_loader/tiny_obj_loader.h"
 
+#include "tbb/parallel_for.h"
+
 #include <stdio.h>
+#include <string.h>
 #include <stdexcept>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
 
 struct LMFCompilerOpts {
-	const char *InputPath = nullptr;
+	std::vector<const char *> InputPaths;
 	const char *OutputPath = nullptr;
+	const char *ContainerPath = nullptr;
+	bool Weld = false;
+	const char *ReorderName = nullptr;
+	Lantern::PrimitiveOrder Reorder = Lantern::PrimitiveOrder::None;
+	int MemoryLimit = 4096;
+
+	// Opened from ContainerPath. If it's set, every mesh goes into it, rather than its own .lmf file
+	Lantern::LMCWriter *Container = nullptr;
+
+	// Containers need every model in memory. Inputs whose model is bigger than MemoryLimit are set aside while
+	// the inputs are converted in parallel, and converted one at a time afterwards, with ConvertingDeferred set
+	std::mutex DeferredLock;
+	std::vector<const char *> DeferredInputs;
+	bool ConvertingDeferred = false;
 };
 
 void ParseCommandLine(int argc, const char *argv[], LMFCompilerOpts *opts);
-void ConvertObjToLMF(LMFCompilerOpts *opts);
+bool ConvertToLMF(LMFCompilerOpts *opts, const char *inputPath);
+bool ConvertObjToLMF(LMFCompilerOpts *opts, const char *inputPath, Lantern::MemoryMappedFile *file, const std::string &outputBase);
+bool ConvertPlyToLMF(LMFCompilerOpts *opts, const char *inputPath, Lantern::MemoryMappedFile *file, const std::string &outputBase);
+bool ConvertObjWithTinyObj(LMFCompilerOpts *opts, const char *inputPath, const std::string &outputBase);
 
 int main(int argc, const char *argv[]) {
 	LMFCompilerOpts options;
 
 	ParseCommandLine(argc, argv, &options);
-	ConvertObjToLMF(&options);
+
+	if (options.ContainerPath != nullptr) {
+		options.Container = new Lantern::LMCWriter();
+		if (!options.Container->Open(options.ContainerPath)) {
+			printf("Unable to open \"%s\" for writing\n", options.ContainerPath);
+			delete options.Container;
+			return 1;
+		}
+	}
+
+	// The inputs don't depend on each other, so they're converted in parallel. The readers split each
+	// input into chunks on the same thread pool, so one big input still uses every core
+	std::atomic<uint> numFailed(0);
+	tbb::parallel_for(std::size_t(0), options.InputPaths.size(), [&](std::size_t i) {
+		if (!ConvertToLMF(&options, options.InputPaths[i])) {
+			++numFailed;
+		}
+	});
+
+	// Only one oversized model is in memory at a time
+	options.ConvertingDeferred = true;
+	for (const char *inputPath : options.DeferredInputs) {
+		if (!ConvertToLMF(&options, inputPath)) {
+			++numFailed;
+		}
+	}
+
+	if (options.Container != nullptr) {
+		if (!options.Container->Close()) {
+			printf("Unable to write \"%s\"\n", options.ContainerPath);
+			++numFailed;
+		}
+		delete options.Container;
+	}
+
+	if (numFailed > 0 && options.InputPaths.size() > 1) {
+		printf("[%u] of [%zu] inputs failed to convert\n", numFailed.load(), options.InputPaths.size());
+	}
+
+	return numFailed == 0 ? 0 : 1;
 }
 
 void ParseCommandLine(int argc, const char *argv[], LMFCompilerOpts *opts) {
 	const char *const usage[] = {
-		"lmf_compiler [options] [--] <input_file>",
+		"lmf_compiler [options] [--] <input_file>...",
 		NULL,
 	};
 
@@ -39,12 +109,18 @@ void ParseCommandLine(int argc, const char *argv[], LMFCompilerOpts *opts) {
 		OPT_HELP(),
 		OPT_GROUP("Basic options"),
 		OPT_STRING('o', "output", &opts->OutputPath, "Output Path for the .lmf file"),
+		OPT_STRING(0, "container", &opts->ContainerPath, "Write every mesh of every input into this one .lmc container, rather than one .lmf file each. Meshes are named <input>/<object>, where <input> is the file name without its directory or extension, and keep the name of their material. Two meshes with the same name fail the conversion. Meshes have to be converted in memory to go into a container, so ones bigger than --memory-limit are converted one at a time, after the rest"),
+		OPT_GROUP("Optimization options"),
+		OPT_BOOLEAN(0, "weld", &opts->Weld, "Merge vertices whose position, normal, and texture coordinate are identical"),
+		OPT_STRING(0, "reorder", &opts->ReorderName, "Sort the primitives along a space filling curve, so neighbours are close in memory. Either 'morton' or 'hilbert'"),
+		OPT_GROUP("Memory options"),
+		OPT_INTEGER(0, "memory-limit", &opts->MemoryLimit, "Models bigger than this many MB are streamed straight to disk, rather than loaded into memory. Streamed models skip --weld, --reorder, and precomputing their emitter data. With --container, they're converted in memory one at a time instead. Defaults to 4096"),
 		OPT_END(),
 	};
 
 	argparse argparse;
 	argparse_init(&argparse, parseOptions, usage, 0);
-	argparse_describe(&argparse, "Converts OBJ files to Lantern Model Files", "Example:\nlmf_compiler -o dragon.lmf dragon.obj");
+	argparse_describe(&argparse, "Converts OBJ and binary PLY files to Lantern Model Files", "Example:\nlmf_compiler -o dragon.lmf dragon.obj\nlmf_compiler --container engine.lmc parts/*.obj");
 
 	argc = argparse_parse(&argparse, argc, argv);
 
@@ -60,34 +136,241 @@ void ParseCommandLine(int argc, const char *argv[], LMFCompilerOpts *opts) {
 	//argparse.flags
 
 	// Check that we have the correct number of arguments
-	if (argc != 1) {
+	if (argc < 1) {
 		printf("ERROR: Got an unexpected number of arguments.\n\n");
 		argparse_usage(&argparse);
 		exit(1);
 	}
 
-	opts->InputPath = argv[0];
+	opts->InputPaths.assign(argv, argv + argc);
+
+	if (opts->ReorderName != nullptr) {
+		if (strcmp(opts->ReorderName, "morton") == 0) {
+			opts->Reorder = Lantern::PrimitiveOrder::Morton;
+		} else if (strcmp(opts->ReorderName, "hilbert") == 0) {
+			opts->Reorder = Lantern::PrimitiveOrder::Hilbert;
+		} else {
+			printf("ERROR: Unknown primitive order [%s]. Expected 'morton' or 'hilbert'\n\n", opts->ReorderName);
+			argparse_usage(&argparse);
+			exit(1);
+		}
+	}
+}
+
+/**
+ * Makes the path of the .lmf file for a model. Characters that aren't allowed in file names are replaced with '-'
+ */
+static std::string MakeOutputPath(const std::string &outputBase, const std::string &name) {
+	std::string sanitizedName = name;
+	for (auto iter = sanitizedName.begin(); iter != sanitizedName.end(); ++iter) {
+		if (*iter == ':' || *iter == '\\' || *iter == '/' || *iter == '*' || *iter == '?' || *iter == '<' || *iter == '>' || *iter == '|' || *iter == '"') {
+			*iter = '-';
+		}
+	}
+
+	return outputBase + sanitizedName + ".lmf";
+}
+
+/**
+ * Moves a finished .lmf file from its temporary path into place, or deletes it if it failed. Models are written to a
+ * temporary path, so a failure doesn't leave a truncated file behind, or clobber a good one from an earlier run
+ *
+ * @param success    Whether the file was written successfully
+ * @return           Whether the file is in place
+ */
+static bool FinishOutputFile(const std::string &tempPath, const std::string &outputPath, bool success) {
+	if (success) {
+		// rename() doesn't replace an existing file on Windows
+		remove(outputPath.c_str());
+		if (rename(tempPath.c_str(), outputPath.c_str()) != 0) {
+			printf("Unable to move \"%s\" to \"%s\"\n", tempPath.c_str(), outputPath.c_str());
+			success = false;
+		}
+	}
+	if (!success) {
+		remove(tempPath.c_str());
+	}
+
+	return success;
+}
+
+/**
+ * Makes the name of a model in a container, and in the log. Models are named after their input file, so models from
+ * different inputs don't clash
+ */
+static std::string MakeMeshName(const std::string &outputBase, const std::string &name) {
+	std::size_t separator = outputBase.find_last_of("/\\");
+	std::string meshName = separator == std::string::npos ? outputBase : outputBase.substr(separator + 1);
+	if (!name.empty()) {
+		meshName += "/" + name;
+	}
+
+	return meshName;
+}
+
+/**
+ * Runs the optional passes over a model that's in memory, precomputes its emitter data, and writes it, either
+ * to its own file, or into the container
+ */
+static bool ProcessAndWriteLMF(LMFCompilerOpts *opts, const std::string &outputBase, const std::string &name, const std::string &material, Lantern::LanternModelFile *lmf) {
+	std::string meshName = MakeMeshName(outputBase, name);
+
+	// Optimize
+	if (opts->Weld) {
+		uint removed = Lantern::WeldVertices(lmf);
+		printf("[%s] Welded %u of %zu vertices\n", meshName.c_str(), removed, lmf->Positions.size() / 3 + removed);
+	}
+	Lantern::ReorderPrimitives(lmf, opts->Reorder);
+
+	// Precompute what the mesh needs if it's used as an emitter, so the renderer doesn't have to
+	Lantern::CalculateEmitterData(lmf);
+
+	if (opts->Container != nullptr) {
+		if (!opts->Container->AddMesh(meshName, material, lmf)) {
+			printf("Unable to add [%s] to \"%s\"\n", meshName.c_str(), opts->ContainerPath);
+			return false;
+		}
+
+		return true;
+	}
+
+	// Write the file
+	std::string outputPath = MakeOutputPath(outputBase, name);
+	std::string tempPath = outputPath + ".tmp";
+	FILE *file = fopen(tempPath.c_str(), "wb");
+	if (!file) {
+		printf("Unable to open \"%s\" for writing\n", tempPath.c_str());
+		return false;
+	}
+
+	bool success = Lantern::WriteLFM(file, lmf);
+	if (!success) {
+		printf("LMF write failed");
+	}
+
+	// Cleanup
+	if (fclose(file) != 0) {
+		success = false;
+	}
+	return FinishOutputFile(tempPath, outputPath, success);
 }
 
-void ConvertObjToLMF(LMFCompilerOpts *opts) {
+/**
+ * Converts a model with one of the parallel readers. Models that fit in the memory limit are collected in memory,
+ * so they can be processed. Bigger ones are streamed straight into their own .lmf file. If they're going into a container,
+ * they're deferred instead, and converted in memory once the other inputs are done
+ *
+ * @param inputPath       The file the model is read from
+ * @param numPositions    The number of positions in the model, for estimating its size
+ * @param numIndices      The number of indices in the model, for estimating its size
+ * @param convert         Reads the model into the sink it's given. Returns false if it fails
+ */
+template <typename ConvertFunction>
+static bool ConvertModel(LMFCompilerOpts *opts, const char *inputPath, const std::string &outputBase, const std::string &name, const std::string &material, uint64 numPositions, uint64 numIndices, ConvertFunction convert) {
+	// Assume the model has normals and texture coordinates. It's only an estimate
+	uint64 modelSize = numPositions * (4 + 3 + 2) * sizeof(float) + numIndices * sizeof(uint32);
+	bool fitsInMemory = modelSize <= (uint64)opts->MemoryLimit * 1024 * 1024;
+	if (!fitsInMemory && opts->Container != nullptr && !opts->ConvertingDeferred) {
+		printf("[%s] is bigger than the memory limit. It will go into the container once the other inputs are done\n", MakeMeshName(outputBase, name).c_str());
+		std::lock_guard<std::mutex> lock(opts->DeferredLock);
+		opts->DeferredInputs.push_back(inputPath);
+		return true;
+	}
+
+	if (fitsInMemory || opts->Container != nullptr) {
+		Lantern::LanternModelFile lmf;
+		Lantern::MemoryMeshSink sink(&lmf);
+		if (!convert(&sink)) {
+			return false;
+		}
+
+		return ProcessAndWriteLMF(opts, outputBase, name, material, &lmf);
+	}
+
+	printf("[%s] is bigger than the memory limit, so it will be streamed to disk. Skipping --weld, --reorder, and emitter data\n", MakeMeshName(outputBase, name).c_str());
+	std::string outputPath = MakeOutputPath(outputBase, name);
+	std::string tempPath = outputPath + ".tmp";
+	Lantern::FileMeshSink sink(tempPath.c_str());
+	bool success = convert(&sink);
+	success = sink.End() && success;
+	return FinishOutputFile(tempPath, outputPath, success);
+}
+
+bool ConvertToLMF(LMFCompilerOpts *opts, const char *inputPath) {
+	// Outputs go next to the input, named after the input
+	std::string outputBase = inputPath;
+	char const *pos = strrchr(inputPath, '.');
+	if (pos != nullptr) {
+		outputBase.resize(pos - inputPath);
+	}
+
+	Lantern::MemoryMappedFile file;
+	if (!file.Open(inputPath)) {
+		printf("Unable to open \"%s\" for reading\n", inputPath);
+		return false;
+	}
+
+	if (pos != nullptr && (strcmp(pos, ".ply") == 0 || strcmp(pos, ".PLY") == 0)) {
+		return ConvertPlyToLMF(opts, inputPath, &file, outputBase);
+	} else {
+		return ConvertObjToLMF(opts, inputPath, &file, outputBase);
+	}
+}
+
+bool ConvertObjToLMF(LMFCompilerOpts *opts, const char *inputPath, Lantern::MemoryMappedFile *file, const std::string &outputBase) {
+	Lantern::ObjScan scan;
+	if (!Lantern::ScanObj((const char *)file->Data(), file->Size(), &scan)) {
+		return false;
+	}
+
+	if (!scan.Streamable) {
+		printf("\"%s\" has more than one object or material, or its normals or texture coordinates don't line up with its positions. Converting it with tinyobj\n", inputPath);
+		file->Close();
+		return ConvertObjWithTinyObj(opts, inputPath, outputBase);
+	}
+
+	bool needsReindexing = false;
+	bool success = ConvertModel(opts, inputPath, outputBase, scan.Name, scan.Material, scan.NumPositions, scan.NumTriangles * 3, [&](Lantern::MeshSink *sink) {
+		return Lantern::ConvertObj((const char *)file->Data(), scan, sink, &needsReindexing);
+	});
+
+	if (!success && needsReindexing) {
+		printf("\"%s\" indexes its normals or texture coordinates separately from its positions. Converting it with tinyobj\n", inputPath);
+		file->Close();
+		return ConvertObjWithTinyObj(opts, inputPath, outputBase);
+	} else if (!success) {
+		printf("Unable to convert \"%s\"\n", inputPath);
+	}
+
+	return success;
+}
+
+bool ConvertPlyToLMF(LMFCompilerOpts *opts, const char *inputPath, Lantern::MemoryMappedFile *file, const std::string &outputBase) {
+	Lantern::PlyScan scan;
+	if (!Lantern::ScanPly(file->Data(), file->Size(), &scan)) {
+		return false;
+	}
+
+	bool success = ConvertModel(opts, inputPath, outputBase, "", "", scan.NumVertices, scan.NumTriangles * 3, [&](Lantern::MeshSink *sink) {
+		return Lantern::ConvertPly(file->Data(), scan, sink);
+	});
+
+	if (!success) {
+		printf("Unable to convert \"%s\"\n", inputPath);
+	}
+
+	return success;
+}
+
+bool ConvertObjWithTinyObj(LMFCompilerOpts *opts, const char *inputPath, const std::string &outputBase) {
 	std::vector<tinyobj::shape_t> tinyObjShapes;
 	std::vector<tinyobj::material_t> tinyObjMaterials;
 	std::string err;
 
-	if (!tinyobj::LoadObj(tinyObjShapes, tinyObjMaterials, err, opts->InputPath)) {
+	if (!tinyobj::LoadObj(tinyObjShapes, tinyObjMaterials, err, inputPath)) {
 		printf("Unable to parse obj file\n");
 		printf("%s\n", err.c_str());
-		return;
-	}
-
-	char outputPath[260];
-	char const *pos = strrchr(opts->InputPath, '.');
-	if (pos != nullptr) {
-		size_t strLen = pos - opts->InputPath;
-		memcpy(outputPath, opts->InputPath, strLen);
-		outputPath[strLen] = '\0';
-	} else {
-		strncpy(outputPath, opts->InputPath, sizeof(outputPath));
+		return false;
 	}
 
 	// Write out one lmf file per shape
@@ -95,28 +378,9 @@ void ConvertObjToLMF(LMFCompilerOpts *opts) {
 		// Check that the mesh is valid
 		if (shape.mesh.positions.size() == 0 || shape.mesh.indices.size() == 0) {
 			printf("Mesh [%s] does not have positions or indices\n", shape.name.c_str());
-			return;
-		}
-
-		std::string sanitizedName = shape.name;
-		for (auto iter = sanitizedName.begin(); iter != sanitizedName.end(); ++iter) {
-			if (*iter == ':' || *iter == '\\' || *iter == '/' || *iter == '*' || *iter == '?' || *iter == '<' || *iter == '>' || *iter == '|' || *iter == '"') {
-				*iter = '-';
-			}
+			return false;
 		}
 
-		// Create a unique name
-		char uniqueName[260];
-		snprintf(uniqueName, sizeof(uniqueName), "%s%s.lmf", outputPath, sanitizedName.c_str());
-
-		// Create the file
-		FILE *file = fopen(uniqueName, "wb");
-		if (!file) {
-			printf("Unable to open \"%s\" for writing\n",uniqueName);
-			return;
-		}
-
-
 		// Convert to LMF data
 		Lantern::LanternModelFile lmf;
 		
@@ -124,7 +388,7 @@ void ConvertObjToLMF(LMFCompilerOpts *opts) {
 		for (std::size_t i = 1; i < shape.mesh.num_vertices.size(); ++i) {
 			if (shape.mesh.num_vertices[i] != verticesPerPrimative) {
 				printf("The number of vertices per primitive is not consistent across [%s]\nThe first face has %u vertices. Found %u vertices for face #%zu\n", shape.name.c_str(), verticesPerPrimative, shape.mesh.num_vertices[i], i / verticesPerPrimative);
-				return;
+				return false;
 			}
 		}
 		lmf.VerticesPerPrimative = verticesPerPrimative;
@@ -134,12 +398,16 @@ void ConvertObjToLMF(LMFCompilerOpts *opts) {
 		lmf.Normals = std::move(shape.mesh.normals);
 		lmf.TexCoords = std::move(shape.mesh.texcoords);
 
-		// Write the file
-		if (!Lantern::WriteLFM(file, &lmf)) {
-			printf("LMF write failed");
+		// An LMF mesh only has one material, so the shape keeps the material of its first face
+		std::string material;
+		if (!shape.mesh.material_ids.empty() && shape.mesh.material_ids[0] >= 0 && (std::size_t)shape.mesh.material_ids[0] < tinyObjMaterials.size()) {
+			material = tinyObjMaterials[shape.mesh.material_ids[0]].name;
 		}
 
-		// Cleanup
-		fclose(file);
+		if (!ProcessAndWriteLMF(opts, outputBase, shape.name, material, &lmf)) {
+			return false;
+		}
 	}
+
+	return true;
 }
@@ -0,0 +1,274 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "mesh_processing.h"
+
+#include "scene/light_bounds.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+
+namespace Lantern {
+
+/**
+ * The bits of a vertex's position, normal, and texture coordinate, so vertices can be compared exactly
+ */
+struct VertexKey {
+	uint32 Bits[8];
+
+	bool operator==(const VertexKey &other) const {
+		return memcmp(Bits, other.Bits, sizeof(Bits)) == 0;
+	}
+};
+
+struct VertexKeyHash {
+	std::size_t operator()(const VertexKey &key) const {
+		// FNV-1a
+		uint64 hash = 14695981039346656037ull;
+		for (uint32 bits : key.Bits) {
+			hash = (hash ^ bits) * 1099511628211ull;
+		}
+		return (std::size_t)hash;
+	}
+};
+
+/**
+ * Moves the vertex attributes into their new order
+ *
+ * @param remap          The new index of each vertex, or -1 if the vertex should be dropped
+ * @param numVertices    The number of vertices after remapping
+ */
+static void RemapVertices(LanternModelFile *lmf, const std::vector<uint32> &remap, uint32 numVertices) {
+	std::vector<float> positions(numVertices * 3);
+	std::vector<float> normals(lmf->Normals.empty() ? 0 : numVertices * 3);
+	std::vector<float> texCoords(lmf->TexCoords.empty() ? 0 : numVertices * 2);
+	for (std::size_t i = 0; i < remap.size(); ++i) {
+		uint32 j = remap[i];
+		if (j == (uint32)-1) {
+			continue;
+		}
+
+		memcpy(&positions[j * 3], &lmf->Positions[i * 3], 3 * sizeof(float));
+		if (!normals.empty()) {
+			memcpy(&normals[j * 3], &lmf->Normals[i * 3], 3 * sizeof(float));
+		}
+		if (!texCoords.empty()) {
+			memcpy(&texCoords[j * 2], &lmf->TexCoords[i * 2], 2 * sizeof(float));
+		}
+	}
+
+	lmf->Positions = std::move(positions);
+	lmf->Normals = std::move(normals);
+	lmf->TexCoords = std::move(texCoords);
+
+	for (uint32 &index : lmf->Indices) {
+		index = remap[index];
+	}
+}
+
+uint WeldVertices(LanternModelFile *lmf) {
+	std::size_t numVertices = lmf->Positions.size() / 3;
+	if ((!lmf->Normals.empty() && lmf->Normals.size() / 3 != numVertices) || (!lmf->TexCoords.empty() && lmf->TexCoords.size() / 2 != numVertices)) {
+		printf("Can't weld a mesh that doesn't have the same number of positions, normals, and texture coordinates\n");
+		return 0;
+	}
+
+	std::unordered_map<VertexKey, uint32, VertexKeyHash> uniqueVertices;
+	uniqueVertices.reserve(numVertices);
+
+	std::vector<uint32> remap(numVertices);
+	uint32 numUnique = 0;
+	for (std::size_t i = 0; i < numVertices; ++i) {
+		VertexKey key = {};
+		memcpy(&key.Bits[0], &lmf->Positions[i * 3], 3 * sizeof(float));
+		if (!lmf->Normals.empty()) {
+			memcpy(&key.Bits[3], &lmf->Normals[i * 3], 3 * sizeof(float));
+		}
+		if (!lmf->TexCoords.empty()) {
+			memcpy(&key.Bits[6], &lmf->TexCoords[i * 2], 2 * sizeof(float));
+		}
+
+		auto result = uniqueVertices.insert(std::make_pair(key, numUnique));
+		remap[i] = result.first->second;
+		if (result.second) {
+			++numUnique;
+		}
+	}
+
+	RemapVertices(lmf, remap, numUnique);
+
+	return (uint)(numVertices - numUnique);
+}
+
+/**
+ * Spreads the low 10 bits of x out, so there are two zero bits between each of them
+ */
+static uint32 SpreadBits(uint32 x) {
+	x &= 0x3FF;
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+static uint32 MortonCode(uint32 x, uint32 y, uint32 z) {
+	return (SpreadBits(x) << 2) | (SpreadBits(y) << 1) | SpreadBits(z);
+}
+
+/**
+ * The distance along a 3D Hilbert curve of a point on a 1024^3 grid
+ *
+ * John Skilling, "Programming the Hilbert curve", 2004. The coordinates are transformed in place,
+ * so that interleaving their bits, like a Morton code, gives the distance along the curve
+ */
+static uint32 HilbertCode(uint32 x, uint32 y, uint32 z) {
+	uint32 axes[3] = {x, y, z};
+	const uint32 highBit = 1u << 9;
+
+	// Undo the rotations and reflections of each level
+	for (uint32 q = highBit; q > 1; q >>= 1) {
+		uint32 p = q - 1;
+		for (uint i = 0; i < 3; ++i) {
+			if ((axes[i] & q) != 0) {
+				axes[0] ^= p;
+			} else {
+				uint32 t = (axes[0] ^ axes[i]) & p;
+				axes[0] ^= t;
+				axes[i] ^= t;
+			}
+		}
+	}
+
+	// Gray encode
+	axes[1] ^= axes[0];
+	axes[2] ^= axes[1];
+	uint32 t = 0;
+	for (uint32 q = highBit; q > 1; q >>= 1) {
+		if ((axes[2] & q) != 0) {
+			t ^= q - 1;
+		}
+	}
+	for (uint32 &axis : axes) {
+		axis ^= t;
+	}
+
+	return MortonCode(axes[0], axes[1], axes[2]);
+}
+
+void ReorderPrimitives(LanternModelFile *lmf, PrimitiveOrder order) {
+	if (order == PrimitiveOrder::None || lmf->Indices.empty()) {
+		return;
+	}
+
+	const uint verticesPerPrimitive = lmf->VerticesPerPrimative;
+	const std::size_t numPrimitives = lmf->Indices.size() / verticesPerPrimitive;
+
+	// Sum the vertices instead of averaging them, since only the relative positions matter
+	std::vector<float3> centroids(numPrimitives);
+	float3 centroidMin(embree::inf);
+	float3 centroidMax(embree::neg_inf);
+	for (std::size_t i = 0; i < numPrimitives; ++i) {
+		float3 centroid(0.0f);
+		for (uint j = 0; j < verticesPerPrimitive; ++j) {
+			const float *position = &lmf->Positions[lmf->Indices[i * verticesPerPrimitive + j] * 3];
+			centroid += float3(position[0], position[1], position[2]);
+		}
+
+		centroids[i] = centroid;
+		centroidMin = min(centroidMin, centroid);
+		centroidMax = max(centroidMax, centroid);
+	}
+
+	// Quantize each centroid to 10 bits per axis, across the bounds of all of them
+	float3 extent = centroidMax - centroidMin;
+	float3 scale(extent.x > 0.0f ? 1023.0f / extent.x : 0.0f, extent.y > 0.0f ? 1023.0f / extent.y : 0.0f, extent.z > 0.0f ? 1023.0f / extent.z : 0.0f);
+	std::vector<std::pair<uint32, uint32> > codes(numPrimitives);
+	for (std::size_t i = 0; i < numPrimitives; ++i) {
+		float3 cell = (centroids[i] - centroidMin) * scale;
+		uint32 x = std::min((uint32)cell.x, 1023u);
+		uint32 y = std::min((uint32)cell.y, 1023u);
+		uint32 z = std::min((uint32)cell.z, 1023u);
+
+		uint32 code = order == PrimitiveOrder::Morton ? MortonCode(x, y, z) : HilbertCode(x, y, z);
+		codes[i] = std::make_pair(code, (uint32)i);
+	}
+	// Ties keep their original order, so the output is deterministic
+	std::sort(codes.begin(), codes.end());
+
+	std::vector<uint32> indices(lmf->Indices.size());
+	for (std::size_t i = 0; i < numPrimitives; ++i) {
+		memcpy(&indices[i * verticesPerPrimitive], &lmf->Indices[codes[i].second * verticesPerPrimitive], verticesPerPrimitive * sizeof(uint32));
+	}
+	lmf->Indices = std::move(indices);
+
+	// Renumber the vertices in the order they're first used
+	std::vector<uint32> remap(lmf->Positions.size() / 3, (uint32)-1);
+	uint32 numVertices = 0;
+	for (uint32 index : lmf->Indices) {
+		if (remap[index] == (uint32)-1) {
+			remap[index] = numVertices++;
+		}
+	}
+
+	RemapVertices(lmf, remap, numVertices);
+}
+
+void CalculateEmitterData(LanternModelFile *lmf) {
+	const std::size_t numPrimitives = lmf->Indices.size() / lmf->VerticesPerPrimative;
+	lmf->TriangleAreas.clear();
+	lmf->TriangleAreas.reserve(lmf->VerticesPerPrimative == 4 ? numPrimitives * 2 : numPrimitives);
+	lmf->SurfaceArea = 0.0f;
+	lmf->BoundsMin = float3(embree::inf);
+	lmf->BoundsMax = float3(embree::neg_inf);
+
+	DirectionCone normals;
+	bool firstNormal = true;
+	auto addTriangle = [&](uint32 i0, uint32 i1, uint32 i2) {
+		float3a v0(lmf->Positions[i0 * 3], lmf->Positions[i0 * 3 + 1], lmf->Positions[i0 * 3 + 2]);
+		float3a v1(lmf->Positions[i1 * 3], lmf->Positions[i1 * 3 + 1], lmf->Positions[i1 * 3 + 2]);
+		float3a v2(lmf->Positions[i2 * 3], lmf->Positions[i2 * 3 + 1], lmf->Positions[i2 * 3 + 2]);
+
+		float3a n = cross(v1 - v0, v2 - v0);
+		float nLength = length(n);
+		float area = 0.5f * nLength;
+		lmf->TriangleAreas.push_back(area);
+		lmf->SurfaceArea += area;
+
+		lmf->BoundsMin = min(lmf->BoundsMin, min(float3(v0.x, v0.y, v0.z), min(float3(v1.x, v1.y, v1.z), float3(v2.x, v2.y, v2.z))));
+		lmf->BoundsMax = max(lmf->BoundsMax, max(float3(v0.x, v0.y, v0.z), max(float3(v1.x, v1.y, v1.z), float3(v2.x, v2.y, v2.z))));
+
+		if (nLength == 0.0f) {
+			return;
+		}
+		DirectionCone cone(float3(n.x, n.y, n.z) / nLength, 1.0f);
+		normals = firstNormal ? cone : DirectionCone::Union(normals, cone);
+		firstNormal = false;
+	};
+
+	for (std::size_t i = 0; i < numPrimitives; ++i) {
+		if (lmf->VerticesPerPrimative == 4) {
+			// Split the quad the same way Embree does
+			const uint32 *quad = &lmf->Indices[i * 4];
+			addTriangle(quad[0], quad[1], quad[3]);
+			addTriangle(quad[2], quad[3], quad[1]);
+		} else {
+			const uint32 *triangle = &lmf->Indices[i * 3];
+			addTriangle(triangle[0], triangle[1], triangle[2]);
+		}
+	}
+
+	if (firstNormal) {
+		normals = DirectionCone::EntireSphere();
+	}
+	lmf->NormalAxis = normals.W;
+	lmf->NormalCosTheta = normals.CosTheta;
+}
+
+} // End of namespace Lantern
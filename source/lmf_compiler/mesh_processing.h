@@ -0,0 +1,58 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "io/lantern_model_file.h"
+
+
+namespace Lantern {
+
+/**
+ * The space filling curves primitives can be sorted along
+ */
+enum class PrimitiveOrder {
+	// Keep the order of the source file
+	None,
+	// Z-order. Cheap, but jumps across the mesh at the end of each block
+	Morton,
+	// Never jumps, so neighbouring primitives are always close together
+	Hilbert
+};
+
+/**
+ * Merges vertices whose position, normal, and texture coordinate are exactly the same
+ *
+ * OBJ files index each attribute separately, so converting them leaves a lot of duplicate vertices.
+ * The first copy of each vertex is kept, and the indices are remapped to it
+ *
+ * @param lmf    The model to weld. Normals and texture coordinates must be empty, or have one per position
+ * @return       The number of vertices that were removed
+ */
+uint WeldVertices(LanternModelFile *lmf);
+
+/**
+ * Sorts the primitives along a space filling curve through their centroids, then renumbers the vertices
+ * in the order the primitives first use them
+ *
+ * Primitives that are close in space end up close in memory, so Embree's builder, and the traversal of
+ * the finished BVH, touch fewer cache lines. Vertices that no primitive uses are dropped
+ *
+ * @param lmf      The model to reorder
+ * @param order    The curve to sort along
+ */
+void ReorderPrimitives(LanternModelFile *lmf, PrimitiveOrder order);
+
+/**
+ * Calculates the emitter data of a model, so the renderer doesn't have to when the model is an area light
+ *
+ * The triangle areas are calculated exactly like Scene::AddLMF() does
+ *
+ * @param lmf    The model. Its TriangleAreas, SurfaceArea, bounds, and normal cone are filled in
+ */
+void CalculateEmitterData(LanternModelFile *lmf);
+
+} // End of namespace Lantern
@@ -0,0 +1,145 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "io/lantern_model_file.h"
+
+#include <cstdio>
+#include <cstring>
+
+
+namespace Lantern {
+
+/**
+ * Where a model reader puts the model it reads
+ *
+ * Readers convert chunks of a file in parallel, so the ranges are written in any order, from any thread.
+ * Each element is written exactly once
+ */
+class MeshSink {
+public:
+	virtual ~MeshSink() {}
+
+	/**
+	 * Called once, before anything is written, with the size of each array
+	 *
+	 * @param verticesPerPrimitive    3 for triangles, or 4 for quads
+	 * @param numNormals              Either 0, or numPositions
+	 * @param numTexCoords            Either 0, or numPositions
+	 */
+	virtual bool Begin(uint verticesPerPrimitive, uint64 numPositions, uint64 numIndices, uint64 numNormals, uint64 numTexCoords) = 0;
+	/**
+	 * @param positions    3 floats per position
+	 */
+	virtual bool WritePositions(uint64 first, const float *positions, uint64 count) = 0;
+	virtual bool WriteIndices(uint64 first, const uint32 *indices, uint64 count) = 0;
+	/**
+	 * @param normals    3 floats per normal
+	 */
+	virtual bool WriteNormals(uint64 first, const float *normals, uint64 count) = 0;
+	/**
+	 * @param texCoords    2 floats per texture coordinate
+	 */
+	virtual bool WriteTexCoords(uint64 first, const float *texCoords, uint64 count) = 0;
+};
+
+/**
+ * Collects the model into a LanternModelFile, so it can be processed before it's written
+ */
+class MemoryMeshSink : public MeshSink {
+public:
+	explicit MemoryMeshSink(LanternModelFile *lmf)
+		: m_lmf(lmf) {
+	}
+
+private:
+	LanternModelFile *m_lmf;
+
+public:
+	bool Begin(uint verticesPerPrimitive, uint64 numPositions, uint64 numIndices, uint64 numNormals, uint64 numTexCoords) override {
+		m_lmf->VerticesPerPrimative = (byte)verticesPerPrimitive;
+		m_lmf->Positions.resize(numPositions * 3);
+		m_lmf->Indices.resize(numIndices);
+		m_lmf->Normals.resize(numNormals * 3);
+		m_lmf->TexCoords.resize(numTexCoords * 2);
+
+		return true;
+	}
+	// The vectors are sized up front, so writes to different ranges don't need a lock
+	bool WritePositions(uint64 first, const float *positions, uint64 count) override {
+		if (count == 0) {
+			return true;
+		}
+		memcpy(&m_lmf->Positions[first * 3], positions, count * 3 * sizeof(float));
+		return true;
+	}
+	bool WriteIndices(uint64 first, const uint32 *indices, uint64 count) override {
+		if (count == 0) {
+			return true;
+		}
+		memcpy(&m_lmf->Indices[first], indices, count * sizeof(uint32));
+		return true;
+	}
+	bool WriteNormals(uint64 first, const float *normals, uint64 count) override {
+		if (count == 0) {
+			return true;
+		}
+		memcpy(&m_lmf->Normals[first * 3], normals, count * 3 * sizeof(float));
+		return true;
+	}
+	bool WriteTexCoords(uint64 first, const float *texCoords, uint64 count) override {
+		if (count == 0) {
+			return true;
+		}
+		memcpy(&m_lmf->TexCoords[first * 2], texCoords, count * 2 * sizeof(float));
+		return true;
+	}
+};
+
+/**
+ * Streams the model straight into an LMF file, so it never has to be in memory all at once
+ */
+class FileMeshSink : public MeshSink {
+public:
+	explicit FileMeshSink(const char *filePath)
+		: m_filePath(filePath) {
+	}
+
+private:
+	const char *m_filePath;
+	LMFWriter m_writer;
+
+public:
+	bool Begin(uint verticesPerPrimitive, uint64 numPositions, uint64 numIndices, uint64 numNormals, uint64 numTexCoords) override {
+		if (!m_writer.Open(m_filePath, verticesPerPrimitive, numPositions, numIndices, numNormals, numTexCoords)) {
+			printf("Unable to open \"%s\" for writing\n", m_filePath);
+			return false;
+		}
+
+		return true;
+	}
+	bool WritePositions(uint64 first, const float *positions, uint64 count) override {
+		return m_writer.WritePositions(first, positions, count);
+	}
+	bool WriteIndices(uint64 first, const uint32 *indices, uint64 count) override {
+		return m_writer.WriteIndices(first, indices, count);
+	}
+	bool WriteNormals(uint64 first, const float *normals, uint64 count) override {
+		return m_writer.WriteNormals(first, normals, count);
+	}
+	bool WriteTexCoords(uint64 first, const float *texCoords, uint64 count) override {
+		return m_writer.WriteTexCoords(first, texCoords, count);
+	}
+	/**
+	 * Finishes the file. Must be called once everything has been written
+	 */
+	bool End() {
+		return m_writer.Close();
+	}
+};
+
+} // End of namespace Lantern
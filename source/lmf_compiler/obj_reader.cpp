@@ -0,0 +1,496 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "obj_reader.h"
+
+#include "tbb/parallel_for.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace Lantern {
+
+// Big enough that each chunk is worth a task, small enough that a few chunks per thread fit in memory
+static const std::size_t kObjChunkSize = 32 * 1024 * 1024;
+
+enum class ObjLineType {
+	Other,
+	// v
+	Position,
+	// vn
+	Normal,
+	// vt
+	TexCoord,
+	// f
+	Face,
+	// o or g
+	Group,
+	// usemtl
+	Material
+};
+
+struct ObjFaceVertex {
+	int64 Position;
+	int64 TexCoord;
+	int64 Normal;
+	bool HasTexCoord;
+	bool HasNormal;
+};
+
+static inline bool IsSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *SkipSpaces(const char *p, const char *end) {
+	while (p < end && IsSpace(*p)) {
+		++p;
+	}
+	return p;
+}
+
+/**
+ * Reads the keyword at the start of a line, and skips past it
+ */
+static ObjLineType ReadLineType(const char **p, const char *end) {
+	const char *start = SkipSpaces(*p, end);
+	const char *keywordEnd = start;
+	while (keywordEnd < end && !IsSpace(*keywordEnd)) {
+		++keywordEnd;
+	}
+	*p = keywordEnd;
+
+	std::size_t length = keywordEnd - start;
+	if (length == 1) {
+		switch (start[0]) {
+		case 'v':
+			return ObjLineType::Position;
+		case 'f':
+			return ObjLineType::Face;
+		case 'o':
+		case 'g':
+			return ObjLineType::Group;
+		}
+	} else if (length == 2 && start[0] == 'v') {
+		if (start[1] == 'n') {
+			return ObjLineType::Normal;
+		}
+		if (start[1] == 't') {
+			return ObjLineType::TexCoord;
+		}
+	} else if (length == 6 && memcmp(start, "usemtl", 6) == 0) {
+		return ObjLineType::Material;
+	}
+
+	return ObjLineType::Other;
+}
+
+/**
+ * Parses the next float on a line. Missing values are 0, like tinyobj
+ */
+static float ParseFloat(const char **p, const char *end) {
+	const char *start = SkipSpaces(*p, end);
+	const char *numberEnd = start;
+	while (numberEnd < end && !IsSpace(*numberEnd)) {
+		++numberEnd;
+	}
+	*p = numberEnd;
+
+	// The file isn't null terminated, so the number is copied out for strtof()
+	char buffer[64];
+	std::size_t length = std::min<std::size_t>(numberEnd - start, sizeof(buffer) - 1);
+	memcpy(buffer, start, length);
+	buffer[length] = '\0';
+
+	return strtof(buffer, nullptr);
+}
+
+/**
+ * Parses a signed integer
+ *
+ * @return    False if there are no digits
+ */
+static bool ParseIndex(const char **p, const char *end, int64 *value) {
+	const char *c = *p;
+	bool negative = false;
+	if (c < end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+		++c;
+	}
+	if (c == end || *c < '0' || *c > '9') {
+		return false;
+	}
+
+	int64 result = 0;
+	while (c < end && *c >= '0' && *c <= '9') {
+		result = result * 10 + (*c - '0');
+		++c;
+	}
+
+	*value = negative ? -result : result;
+	*p = c;
+	return true;
+}
+
+/**
+ * Parses the next vertex of a face. Either v, v/vt, v//vn, or v/vt/vn
+ *
+ * @return    False if there are no more vertices on the line
+ */
+static bool ParseFaceVertex(const char **p, const char *end, ObjFaceVertex *vertex) {
+	*p = SkipSpaces(*p, end);
+	if (!ParseIndex(p, end, &vertex->Position)) {
+		return false;
+	}
+
+	vertex->HasTexCoord = false;
+	vertex->HasNormal = false;
+	if (*p < end && **p == '/') {
+		++*p;
+		vertex->HasTexCoord = ParseIndex(p, end, &vertex->TexCoord);
+		if (*p < end && **p == '/') {
+			++*p;
+			vertex->HasNormal = ParseIndex(p, end, &vertex->Normal);
+		}
+	}
+
+	// Skip anything else that's stuck to the vertex
+	while (*p < end && !IsSpace(**p)) {
+		++*p;
+	}
+
+	return true;
+}
+
+/**
+ * Turns an OBJ index into an index from 0. Positive indices count from 1, and negative ones count back from the current element
+ *
+ * @param count    How many elements of the type come before the line
+ * @return         The index, or -1 if it's invalid
+ */
+static inline int64 ResolveIndex(int64 index, uint64 count) {
+	if (index > 0) {
+		return index - 1;
+	}
+	if (index < 0 && (uint64)-index <= count) {
+		return (int64)count + index;
+	}
+	return -1;
+}
+
+/**
+ * Reads the first name on the rest of a line. Any other names are ignored, like tinyobj
+ */
+static std::string ReadName(const char *p, const char *lineEnd) {
+	const char *nameStart = SkipSpaces(p, lineEnd);
+	const char *nameEnd = nameStart;
+	while (nameEnd < lineEnd && !IsSpace(*nameEnd)) {
+		++nameEnd;
+	}
+	return std::string(nameStart, nameEnd);
+}
+
+static void CountChunk(const char *data, ObjChunk *chunk) {
+	const char *p = data + chunk->Start;
+	const char *end = data + chunk->End;
+
+	int64 numGroups = 0;
+	int64 numMaterials = 0;
+	while (p < end) {
+		const char *lineEnd = (const char *)memchr(p, '\n', end - p);
+		if (lineEnd == nullptr) {
+			lineEnd = end;
+		}
+
+		switch (ReadLineType(&p, lineEnd)) {
+		case ObjLineType::Position:
+			++chunk->NumPositions;
+			break;
+		case ObjLineType::Normal:
+			++chunk->NumNormals;
+			break;
+		case ObjLineType::TexCoord:
+			++chunk->NumTexCoords;
+			break;
+		case ObjLineType::Face:
+		{
+			uint64 numVertices = 0;
+			uint64 numNormals = 0;
+			uint64 numTexCoords = 0;
+			ObjFaceVertex vertex;
+			while (ParseFaceVertex(&p, lineEnd, &vertex)) {
+				++numVertices;
+				numNormals += vertex.HasNormal ? 1 : 0;
+				numTexCoords += vertex.HasTexCoord ? 1 : 0;
+			}
+
+			// Faces with less than three vertices don't make any triangles, so they're ignored completely
+			if (numVertices >= 3) {
+				chunk->NumTriangles += numVertices - 2;
+				chunk->NumFaceVertices += numVertices;
+				chunk->NumFaceNormals += numNormals;
+				chunk->NumFaceTexCoords += numTexCoords;
+
+				if (chunk->FirstFaceGroup < 0) {
+					chunk->FirstFaceGroup = numGroups;
+					chunk->FirstFaceMaterial = numMaterials;
+				}
+				chunk->LastFaceGroup = numGroups;
+				chunk->LastFaceMaterial = numMaterials;
+			}
+			break;
+		}
+		case ObjLineType::Group:
+			chunk->GroupNames.push_back(ReadName(p, lineEnd));
+			++numGroups;
+			break;
+		case ObjLineType::Material:
+			chunk->MaterialNames.push_back(ReadName(p, lineEnd));
+			++numMaterials;
+			break;
+		case ObjLineType::Other:
+			break;
+		}
+
+		p = lineEnd < end ? lineEnd + 1 : end;
+	}
+}
+
+bool ScanObj(const char *data, std::size_t size, ObjScan *scan) {
+	// Split the file into chunks of whole lines
+	scan->Chunks.clear();
+	for (std::size_t start = 0; start < size;) {
+		std::size_t end = std::min(start + kObjChunkSize, size);
+		if (end < size) {
+			const char *newLine = (const char *)memchr(data + end, '\n', size - end);
+			end = newLine == nullptr ? size : (std::size_t)(newLine - data) + 1;
+		}
+
+		ObjChunk chunk = {};
+		chunk.Start = start;
+		chunk.End = end;
+		chunk.FirstFaceGroup = -1;
+		chunk.LastFaceGroup = -1;
+		chunk.FirstFaceMaterial = -1;
+		chunk.LastFaceMaterial = -1;
+		scan->Chunks.push_back(chunk);
+
+		start = end;
+	}
+
+	tbb::parallel_for(std::size_t(0), scan->Chunks.size(), [&](std::size_t i) {
+		CountChunk(data, &scan->Chunks[i]);
+	});
+
+	// Work out where each chunk's elements go, and which groups have faces
+	scan->NumPositions = 0;
+	scan->NumNormals = 0;
+	scan->NumTexCoords = 0;
+	scan->NumTriangles = 0;
+	uint64 numFaceVertices = 0;
+	uint64 numFaceNormals = 0;
+	uint64 numFaceTexCoords = 0;
+	std::vector<std::string> groupNames;
+	int64 firstFaceGroup = -1;
+	bool oneGroup = true;
+	// Faces before the first usemtl don't have a material
+	std::vector<std::string> materialNames(1);
+	int64 firstFaceMaterial = -1;
+	bool oneMaterial = true;
+	for (ObjChunk &chunk : scan->Chunks) {
+		chunk.FirstPosition = scan->NumPositions;
+		chunk.FirstNormal = scan->NumNormals;
+		chunk.FirstTexCoord = scan->NumTexCoords;
+		chunk.FirstTriangle = scan->NumTriangles;
+		scan->NumPositions += chunk.NumPositions;
+		scan->NumNormals += chunk.NumNormals;
+		scan->NumTexCoords += chunk.NumTexCoords;
+		scan->NumTriangles += chunk.NumTriangles;
+		numFaceVertices += chunk.NumFaceVertices;
+		numFaceNormals += chunk.NumFaceNormals;
+		numFaceTexCoords += chunk.NumFaceTexCoords;
+
+		if (chunk.FirstFaceGroup >= 0) {
+			int64 first = (int64)groupNames.size() + chunk.FirstFaceGroup;
+			int64 last = (int64)groupNames.size() + chunk.LastFaceGroup;
+			if (firstFaceGroup < 0) {
+				firstFaceGroup = first;
+			}
+			oneGroup = oneGroup && first == firstFaceGroup && last == firstFaceGroup;
+		}
+		groupNames.insert(groupNames.end(), chunk.GroupNames.begin(), chunk.GroupNames.end());
+
+		// Files often repeat the same usemtl, so materials are compared by name
+		std::size_t numMaterialsBefore = materialNames.size() - 1;
+		materialNames.insert(materialNames.end(), chunk.MaterialNames.begin(), chunk.MaterialNames.end());
+		if (chunk.FirstFaceMaterial >= 0) {
+			int64 first = (int64)numMaterialsBefore + chunk.FirstFaceMaterial;
+			int64 last = (int64)numMaterialsBefore + chunk.LastFaceMaterial;
+			if (firstFaceMaterial < 0) {
+				firstFaceMaterial = first;
+			}
+			for (int64 i = first; i <= last; ++i) {
+				oneMaterial = oneMaterial && materialNames[i] == materialNames[firstFaceMaterial];
+			}
+		}
+	}
+
+	if (scan->NumTriangles == 0) {
+		printf("The OBJ file doesn't have any faces\n");
+		return false;
+	}
+	if (scan->NumPositions > (uint64)UINT32_MAX) {
+		printf("The OBJ file has [%llu] positions. LMF files can only index [%u]\n", (unsigned long long)scan->NumPositions, UINT32_MAX);
+		return false;
+	}
+
+	scan->Name = firstFaceGroup > 0 ? groupNames[firstFaceGroup - 1] : "";
+	scan->Material = materialNames[firstFaceMaterial];
+	scan->HasNormals = numFaceNormals == numFaceVertices;
+	scan->HasTexCoords = numFaceTexCoords == numFaceVertices;
+
+	scan->Streamable = oneGroup && oneMaterial &&
+	                   (numFaceNormals == 0 || (scan->HasNormals && scan->NumNormals == scan->NumPositions)) &&
+	                   (numFaceTexCoords == 0 || (scan->HasTexCoords && scan->NumTexCoords == scan->NumPositions));
+
+	return true;
+}
+
+/**
+ * Parses a chunk, and writes it into the sink
+ */
+static bool ConvertChunk(const char *data, const ObjScan &scan, const ObjChunk &chunk, MeshSink *sink, bool *out_needsReindexing) {
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<float> texCoords;
+	std::vector<uint32> indices;
+	positions.reserve(chunk.NumPositions * 3);
+	normals.reserve(scan.HasNormals ? chunk.NumNormals * 3 : 0);
+	texCoords.reserve(scan.HasTexCoords ? chunk.NumTexCoords * 2 : 0);
+	indices.reserve(chunk.NumTriangles * 3);
+
+	const char *p = data + chunk.Start;
+	const char *end = data + chunk.End;
+
+	// How many of each element come before the current line, for relative indices
+	uint64 numPositions = chunk.FirstPosition;
+	uint64 numNormals = chunk.FirstNormal;
+	uint64 numTexCoords = chunk.FirstTexCoord;
+
+	std::vector<ObjFaceVertex> faceVertices;
+	std::vector<uint32> face;
+	while (p < end) {
+		const char *lineEnd = (const char *)memchr(p, '\n', end - p);
+		if (lineEnd == nullptr) {
+			lineEnd = end;
+		}
+
+		switch (ReadLineType(&p, lineEnd)) {
+		case ObjLineType::Position:
+			positions.push_back(ParseFloat(&p, lineEnd));
+			positions.push_back(ParseFloat(&p, lineEnd));
+			positions.push_back(ParseFloat(&p, lineEnd));
+			++numPositions;
+			break;
+		case ObjLineType::Normal:
+			if (scan.HasNormals) {
+				normals.push_back(ParseFloat(&p, lineEnd));
+				normals.push_back(ParseFloat(&p, lineEnd));
+				normals.push_back(ParseFloat(&p, lineEnd));
+			}
+			++numNormals;
+			break;
+		case ObjLineType::TexCoord:
+			if (scan.HasTexCoords) {
+				texCoords.push_back(ParseFloat(&p, lineEnd));
+				texCoords.push_back(ParseFloat(&p, lineEnd));
+			}
+			++numTexCoords;
+			break;
+		case ObjLineType::Face:
+		{
+			faceVertices.clear();
+			ObjFaceVertex vertex;
+			while (ParseFaceVertex(&p, lineEnd, &vertex)) {
+				faceVertices.push_back(vertex);
+			}
+			// Faces with less than three vertices were ignored by ScanObj()
+			if (faceVertices.size() < 3) {
+				break;
+			}
+
+			face.clear();
+			for (const ObjFaceVertex &faceVertex : faceVertices) {
+				int64 position = ResolveIndex(faceVertex.Position, numPositions);
+				if (position < 0 || (uint64)position >= scan.NumPositions) {
+					printf("Face vertex [%lld] is out of range. The OBJ file has [%llu] positions\n", (long long)faceVertex.Position, (unsigned long long)scan.NumPositions);
+					return false;
+				}
+
+				// Each vertex has to use the same index for everything, since that's all an LMF file can store
+				if ((scan.HasNormals && ResolveIndex(faceVertex.Normal, numNormals) != position) ||
+				    (scan.HasTexCoords && ResolveIndex(faceVertex.TexCoord, numTexCoords) != position)) {
+					*out_needsReindexing = true;
+					return false;
+				}
+
+				face.push_back((uint32)position);
+			}
+
+			// Split the polygon into a fan of triangles
+			for (std::size_t i = 2; i < face.size(); ++i) {
+				indices.push_back(face[0]);
+				indices.push_back(face[i - 1]);
+				indices.push_back(face[i]);
+			}
+			break;
+		}
+		// The first pass already found the names. Streamable files only have one of each
+		case ObjLineType::Group:
+		case ObjLineType::Material:
+		case ObjLineType::Other:
+			break;
+		}
+
+		p = lineEnd < end ? lineEnd + 1 : end;
+	}
+
+	return sink->WritePositions(chunk.FirstPosition, positions.data(), positions.size() / 3) &&
+	       sink->WriteNormals(chunk.FirstNormal, normals.data(), normals.size() / 3) &&
+	       sink->WriteTexCoords(chunk.FirstTexCoord, texCoords.data(), texCoords.size() / 2) &&
+	       sink->WriteIndices(chunk.FirstTriangle * 3, indices.data(), indices.size());
+}
+
+bool ConvertObj(const char *data, const ObjScan &scan, MeshSink *sink, bool *out_needsReindexing) {
+	*out_needsReindexing = false;
+	if (!sink->Begin(3, scan.NumPositions, scan.NumTriangles * 3, scan.HasNormals ? scan.NumNormals : 0, scan.HasTexCoords ? scan.NumTexCoords : 0)) {
+		return false;
+	}
+
+	std::atomic<bool> failed(false);
+	std::atomic<bool> needsReindexing(false);
+	tbb::parallel_for(std::size_t(0), scan.Chunks.size(), [&](std::size_t i) {
+		if (failed.load(std::memory_order_relaxed)) {
+			return;
+		}
+
+		bool chunkNeedsReindexing = false;
+		if (!ConvertChunk(data, scan, scan.Chunks[i], sink, &chunkNeedsReindexing)) {
+			failed.store(true, std::memory_order_relaxed);
+			if (chunkNeedsReindexing) {
+				needsReindexing.store(true, std::memory_order_relaxed);
+			}
+		}
+	});
+
+	*out_needsReindexing = needsReindexing.load();
+	return !failed.load();
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,100 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "mesh_sink.h"
+
+#include "math/int_types.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+namespace Lantern {
+
+/**
+ * A range of whole lines of an OBJ file, and what the first pass found in them
+ */
+struct ObjChunk {
+	std::size_t Start;
+	std::size_t End;
+
+	uint64 NumPositions;
+	uint64 NumNormals;
+	uint64 NumTexCoords;
+	// Polygons are split into fans of triangles, like tinyobj does
+	uint64 NumTriangles;
+	uint64 NumFaceVertices;
+	uint64 NumFaceNormals;
+	uint64 NumFaceTexCoords;
+
+	// The names of the 'o' and 'g' lines in the chunk
+	std::vector<std::string> GroupNames;
+	// How many 'o' and 'g' lines came before the chunk's first and last faces, counted from the start of the chunk. -1 if it has no faces
+	int64 FirstFaceGroup;
+	int64 LastFaceGroup;
+	// The same, for the 'usemtl' lines in the chunk
+	std::vector<std::string> MaterialNames;
+	int64 FirstFaceMaterial;
+	int64 LastFaceMaterial;
+
+	// Where the chunk's elements go in the whole model. Filled in once every chunk has been counted
+	uint64 FirstPosition;
+	uint64 FirstNormal;
+	uint64 FirstTexCoord;
+	uint64 FirstTriangle;
+};
+
+/**
+ * What the first pass over an OBJ file found
+ */
+struct ObjScan {
+	std::vector<ObjChunk> Chunks;
+
+	uint64 NumPositions;
+	uint64 NumNormals;
+	uint64 NumTexCoords;
+	uint64 NumTriangles;
+	// Whether every face vertex has a normal, or a texture coordinate. Otherwise they're dropped
+	bool HasNormals;
+	bool HasTexCoords;
+	// The name of the object or group the faces are in
+	std::string Name;
+	// The name of the material the faces use. Empty if they don't have a usemtl
+	std::string Material;
+
+	// The streaming reader can only convert files whose faces are all in one object, with one material, and whose
+	// normals and texture coordinates line up with the positions. Anything else has to go through tinyobj
+	bool Streamable;
+};
+
+/**
+ * The first pass over an OBJ file. Splits it into chunks of whole lines, and counts what's in each of them, in parallel
+ *
+ * @param data    The file
+ * @param size    The size of the file in bytes
+ * @param scan    Filled with the chunks and their counts
+ * @return        False if the file has no faces
+ */
+bool ScanObj(const char *data, std::size_t size, ObjScan *scan);
+
+/**
+ * The second pass over an OBJ file. Parses each chunk in parallel, and writes it straight into the sink,
+ * so only a few chunks are ever in memory at once
+ *
+ * @param data                    The file
+ * @param scan                    The result of ScanObj(). Must be Streamable
+ * @param sink                    Where to write the model
+ * @param out_needsReindexing     Set to true if a face indexes its normals or texture coordinates differently than its
+ *                                positions, which the streaming reader can't handle. ScanObj() can't always tell, since
+ *                                relative indices depend on the chunks before them
+ * @return                        False if the file couldn't be converted
+ */
+bool ConvertObj(const char *data, const ObjScan &scan, MeshSink *sink, bool *out_needsReindexing);
+
+} // End of namespace Lantern
@@ -0,0 +1,576 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "ply_reader.h"
+
+#include "tbb/parallel_for.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+
+namespace Lantern {
+
+static const uint64 kPlyVertexChunkSize = 1024 * 1024;
+static const uint64 kPlyFaceChunkSize = 1024 * 1024;
+
+struct PlyHeaderProperty {
+	std::string Name;
+	PlyType Type;
+	bool IsList;
+	PlyType CountType;
+};
+
+struct PlyElement {
+	std::string Name;
+	uint64 Count;
+	std::vector<PlyHeaderProperty> Properties;
+};
+
+static PlyType ParsePlyType(const std::string &name) {
+	if (name == "char" || name == "int8") {
+		return PlyType::Int8;
+	}
+	if (name == "uchar" || name == "uint8") {
+		return PlyType::UInt8;
+	}
+	if (name == "short" || name == "int16") {
+		return PlyType::Int16;
+	}
+	if (name == "ushort" || name == "uint16") {
+		return PlyType::UInt16;
+	}
+	if (name == "int" || name == "int32") {
+		return PlyType::Int32;
+	}
+	if (name == "uint" || name == "uint32") {
+		return PlyType::UInt32;
+	}
+	if (name == "float" || name == "float32") {
+		return PlyType::Float32;
+	}
+	if (name == "double" || name == "float64") {
+		return PlyType::Float64;
+	}
+	return PlyType::None;
+}
+
+static uint PlyTypeSize(PlyType type) {
+	switch (type) {
+	case PlyType::Int8:
+	case PlyType::UInt8:
+		return 1;
+	case PlyType::Int16:
+	case PlyType::UInt16:
+		return 2;
+	case PlyType::Int32:
+	case PlyType::UInt32:
+	case PlyType::Float32:
+		return 4;
+	case PlyType::Float64:
+		return 8;
+	case PlyType::None:
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Loads an unaligned value. Assumes the machine is little endian, like the rest of Lantern
+ */
+template <typename T>
+static inline T LoadPlyValue(const byte *p, bool bigEndian) {
+	T value;
+	if (bigEndian) {
+		byte swapped[sizeof(T)];
+		for (std::size_t i = 0; i < sizeof(T); ++i) {
+			swapped[i] = p[sizeof(T) - 1 - i];
+		}
+		memcpy(&value, swapped, sizeof(T));
+	} else {
+		memcpy(&value, p, sizeof(T));
+	}
+
+	return value;
+}
+
+static double ReadPlyValue(const byte *p, PlyType type, bool bigEndian) {
+	switch (type) {
+	case PlyType::Int8:
+		return (double)LoadPlyValue<int8>(p, bigEndian);
+	case PlyType::UInt8:
+		return (double)LoadPlyValue<uint8>(p, bigEndian);
+	case PlyType::Int16:
+		return (double)LoadPlyValue<int16>(p, bigEndian);
+	case PlyType::UInt16:
+		return (double)LoadPlyValue<uint16>(p, bigEndian);
+	case PlyType::Int32:
+		return (double)LoadPlyValue<int32>(p, bigEndian);
+	case PlyType::UInt32:
+		return (double)LoadPlyValue<uint32>(p, bigEndian);
+	case PlyType::Float32:
+		return (double)LoadPlyValue<float>(p, bigEndian);
+	case PlyType::Float64:
+		return LoadPlyValue<double>(p, bigEndian);
+	case PlyType::None:
+	default:
+		return 0.0;
+	}
+}
+
+/**
+ * Reads the count of a list property
+ *
+ * @return    The count, or -1 if it's negative
+ */
+static inline int64 ReadPlyCount(const byte *p, PlyType type, bool bigEndian) {
+	double count = ReadPlyValue(p, type, bigEndian);
+	return count < 0.0 ? -1 : (int64)count;
+}
+
+/**
+ * Parses the text header, up to and including the end_header line
+ *
+ * @param out_dataOffset    Where the binary data starts
+ */
+static bool ParsePlyHeader(const byte *data, std::size_t size, std::vector<PlyElement> *out_elements, bool *out_bigEndian, std::size_t *out_dataOffset) {
+	const char *text = (const char *)data;
+	if (size < 4 || memcmp(text, "ply", 3) != 0 || (text[3] != '\n' && text[3] != '\r')) {
+		printf("Not a PLY file\n");
+		return false;
+	}
+
+	bool hasFormat = false;
+	std::size_t lineStart = 0;
+	while (lineStart < size) {
+		const char *newLine = (const char *)memchr(text + lineStart, '\n', size - lineStart);
+		if (newLine == nullptr) {
+			break;
+		}
+		std::size_t lineEnd = newLine - text;
+
+		std::istringstream line(std::string(text + lineStart, text + lineEnd));
+		lineStart = lineEnd + 1;
+
+		std::string keyword;
+		line >> keyword;
+		if (keyword == "end_header") {
+			if (!hasFormat) {
+				printf("The PLY file doesn't have a format line\n");
+				return false;
+			}
+			*out_dataOffset = lineStart;
+			return true;
+		}
+
+		if (keyword == "format") {
+			std::string format;
+			line >> format;
+			if (format == "binary_little_endian") {
+				*out_bigEndian = false;
+			} else if (format == "binary_big_endian") {
+				*out_bigEndian = true;
+			} else {
+				printf("Unsupported PLY format [%s]. Only binary PLY files are supported\n", format.c_str());
+				return false;
+			}
+			hasFormat = true;
+		} else if (keyword == "element") {
+			PlyElement element;
+			line >> element.Name >> element.Count;
+			if (line.fail()) {
+				printf("Invalid PLY element\n");
+				return false;
+			}
+			out_elements->push_back(element);
+		} else if (keyword == "property") {
+			if (out_elements->empty()) {
+				printf("PLY property before any element\n");
+				return false;
+			}
+
+			PlyHeaderProperty property;
+			std::string type;
+			line >> type;
+			if (type == "list") {
+				std::string countType;
+				line >> countType >> type;
+				property.IsList = true;
+				property.CountType = ParsePlyType(countType);
+			} else {
+				property.IsList = false;
+				property.CountType = PlyType::None;
+			}
+			property.Type = ParsePlyType(type);
+			line >> property.Name;
+
+			if (line.fail() || property.Type == PlyType::None || (property.IsList && property.CountType == PlyType::None)) {
+				printf("Invalid PLY property\n");
+				return false;
+			}
+			out_elements->back().Properties.push_back(property);
+		}
+		// Comments and obj_info lines are ignored
+	}
+
+	printf("The PLY file doesn't have an end_header line\n");
+	return false;
+}
+
+/**
+ * Finds the size of each record of an element that doesn't have any list properties
+ *
+ * @return    The size, or 0 if the element has list properties
+ */
+static uint FixedRecordSize(const PlyElement &element) {
+	uint size = 0;
+	for (const PlyHeaderProperty &property : element.Properties) {
+		if (property.IsList) {
+			return 0;
+		}
+		size += PlyTypeSize(property.Type);
+	}
+	return size;
+}
+
+/**
+ * Walks over each record of an element that has list properties, to find where it ends
+ */
+static bool SkipVariableElement(const byte *data, std::size_t size, const PlyElement &element, bool bigEndian, uint64 *offset) {
+	for (uint64 i = 0; i < element.Count; ++i) {
+		for (const PlyHeaderProperty &property : element.Properties) {
+			if (!property.IsList) {
+				*offset += PlyTypeSize(property.Type);
+				continue;
+			}
+
+			if (*offset + PlyTypeSize(property.CountType) > size) {
+				return false;
+			}
+			int64 count = ReadPlyCount(data + *offset, property.CountType, bigEndian);
+			if (count < 0) {
+				return false;
+			}
+			*offset += PlyTypeSize(property.CountType) + (uint64)count * PlyTypeSize(property.Type);
+		}
+		if (*offset > size) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static uint64 FaceSize(const PlyScan &scan, uint64 numVertices) {
+	return scan.FaceBytesBefore + PlyTypeSize(scan.FaceCountType) + numVertices * PlyTypeSize(scan.FaceIndexType) + scan.FaceBytesAfter;
+}
+
+/**
+ * Splits the faces into chunks, and counts the triangles in each
+ *
+ * @param offset    The start of the faces. Moved to the end of them
+ */
+static bool ScanFaces(const byte *data, std::size_t size, PlyScan *scan, uint64 *offset) {
+	const uint countOffset = scan->FaceBytesBefore;
+	const uint countSize = PlyTypeSize(scan->FaceCountType);
+	if (scan->NumFaces == 0) {
+		return true;
+	}
+	if (*offset > size || countOffset + countSize > size - *offset) {
+		return false;
+	}
+
+	// Most files only have triangles, or only quads. Then every face is the same size, so the chunks can be
+	// found without walking the faces. Each chunk just has to check its faces really are that size
+	int64 firstCount = ReadPlyCount(data + *offset + countOffset, scan->FaceCountType, scan->BigEndian);
+	if (firstCount >= 0) {
+		const uint64 faceSize = FaceSize(*scan, firstCount);
+		if (faceSize <= size - *offset && scan->NumFaces <= (size - *offset) / faceSize) {
+			const uint64 numChunks = (scan->NumFaces + kPlyFaceChunkSize - 1) / kPlyFaceChunkSize;
+			std::atomic<bool> uniform(true);
+			tbb::parallel_for(uint64(0), numChunks, [&](uint64 i) {
+				uint64 first = i * kPlyFaceChunkSize;
+				uint64 last = std::min(first + kPlyFaceChunkSize, scan->NumFaces);
+				for (uint64 face = first; face < last && uniform.load(std::memory_order_relaxed); ++face) {
+					if (ReadPlyCount(data + *offset + face * faceSize + countOffset, scan->FaceCountType, scan->BigEndian) != firstCount) {
+						uniform.store(false, std::memory_order_relaxed);
+					}
+				}
+			});
+
+			if (uniform.load()) {
+				const uint64 trianglesPerFace = firstCount >= 3 ? firstCount - 2 : 0;
+				for (uint64 i = 0; i < numChunks; ++i) {
+					PlyFaceChunk chunk;
+					chunk.Offset = *offset + i * kPlyFaceChunkSize * faceSize;
+					chunk.NumFaces = std::min(kPlyFaceChunkSize, scan->NumFaces - i * kPlyFaceChunkSize);
+					chunk.FirstTriangle = i * kPlyFaceChunkSize * trianglesPerFace;
+					chunk.NumTriangles = chunk.NumFaces * trianglesPerFace;
+					scan->FaceChunks.push_back(chunk);
+				}
+				scan->NumTriangles = scan->NumFaces * trianglesPerFace;
+				*offset += scan->NumFaces * faceSize;
+
+				return true;
+			}
+		}
+	}
+
+	// The faces are different sizes, so they have to be walked to find where each chunk starts
+	scan->NumTriangles = 0;
+	for (uint64 face = 0; face < scan->NumFaces; ++face) {
+		if (face % kPlyFaceChunkSize == 0) {
+			PlyFaceChunk chunk;
+			chunk.Offset = *offset;
+			chunk.NumFaces = std::min(kPlyFaceChunkSize, scan->NumFaces - face);
+			chunk.FirstTriangle = scan->NumTriangles;
+			chunk.NumTriangles = 0;
+			scan->FaceChunks.push_back(chunk);
+		}
+
+		if (*offset + countOffset + countSize > size) {
+			return false;
+		}
+		int64 count = ReadPlyCount(data + *offset + countOffset, scan->FaceCountType, scan->BigEndian);
+		if (count < 0) {
+			return false;
+		}
+		*offset += FaceSize(*scan, count);
+		if (*offset > size) {
+			return false;
+		}
+
+		uint64 numTriangles = count >= 3 ? count - 2 : 0;
+		scan->FaceChunks.back().NumTriangles += numTriangles;
+		scan->NumTriangles += numTriangles;
+	}
+
+	return true;
+}
+
+bool ScanPly(const byte *data, std::size_t size, PlyScan *scan) {
+	std::vector<PlyElement> elements;
+	std::size_t dataOffset;
+	if (!ParsePlyHeader(data, size, &elements, &scan->BigEndian, &dataOffset)) {
+		return false;
+	}
+
+	scan->NumVertices = 0;
+	scan->NumFaces = 0;
+	scan->NumTriangles = 0;
+	scan->FaceChunks.clear();
+	bool hasVertices = false;
+	bool hasFaces = false;
+
+	// Find where each element starts
+	uint64 offset = dataOffset;
+	for (const PlyElement &element : elements) {
+		if (element.Name == "vertex") {
+			scan->VertexStride = FixedRecordSize(element);
+			if (scan->VertexStride == 0) {
+				printf("PLY vertices with list properties aren't supported\n");
+				return false;
+			}
+
+			uint propertyOffset = 0;
+			for (const PlyHeaderProperty &property : element.Properties) {
+				PlyProperty *target = nullptr;
+				const std::string &name = property.Name;
+				if (name == "x" || name == "y" || name == "z") {
+					target = &scan->Positions[name[0] - 'x'];
+				} else if (name == "nx" || name == "ny" || name == "nz") {
+					target = &scan->Normals[name[1] - 'x'];
+				} else if (name == "u" || name == "s" || name == "texture_u" || name == "texture_s") {
+					target = &scan->TexCoords[0];
+				} else if (name == "v" || name == "t" || name == "texture_v" || name == "texture_t") {
+					target = &scan->TexCoords[1];
+				}
+				if (target != nullptr) {
+					target->Offset = propertyOffset;
+					target->Type = property.Type;
+				}
+
+				propertyOffset += PlyTypeSize(property.Type);
+			}
+
+			scan->NumVertices = element.Count;
+			scan->VertexOffset = offset;
+			if (element.Count > (size - std::min<uint64>(offset, size)) / scan->VertexStride) {
+				printf("The PLY file is too short for its vertices\n");
+				return false;
+			}
+			offset += element.Count * scan->VertexStride;
+			hasVertices = true;
+		} else if (element.Name == "face") {
+			scan->FaceBytesBefore = 0;
+			scan->FaceBytesAfter = 0;
+			bool foundIndices = false;
+			for (const PlyHeaderProperty &property : element.Properties) {
+				if (property.IsList && (property.Name == "vertex_indices" || property.Name == "vertex_index") && !foundIndices) {
+					scan->FaceCountType = property.CountType;
+					scan->FaceIndexType = property.Type;
+					foundIndices = true;
+				} else if (property.IsList) {
+					printf("PLY faces with list properties other than their vertex indices aren't supported\n");
+					return false;
+				} else {
+					(foundIndices ? scan->FaceBytesAfter : scan->FaceBytesBefore) += PlyTypeSize(property.Type);
+				}
+			}
+			if (!foundIndices) {
+				printf("The PLY faces don't have vertex indices\n");
+				return false;
+			}
+			if (scan->FaceIndexType == PlyType::Float32 || scan->FaceIndexType == PlyType::Float64) {
+				printf("PLY vertex indices must be integers\n");
+				return false;
+			}
+
+			scan->NumFaces = element.Count;
+			if (!ScanFaces(data, size, scan, &offset)) {
+				printf("The PLY file is too short for its faces\n");
+				return false;
+			}
+			hasFaces = true;
+		} else {
+			// Skip over anything else
+			uint recordSize = FixedRecordSize(element);
+			if (recordSize != 0) {
+				offset += element.Count * recordSize;
+			} else if (!SkipVariableElement(data, size, element, scan->BigEndian, &offset)) {
+				printf("The PLY file is too short for its [%s] elements\n", element.Name.c_str());
+				return false;
+			}
+		}
+	}
+
+	if (!hasVertices || scan->Positions[0].Type == PlyType::None || scan->Positions[1].Type == PlyType::None || scan->Positions[2].Type == PlyType::None) {
+		printf("The PLY file doesn't have vertex positions\n");
+		return false;
+	}
+	if (!hasFaces || scan->NumTriangles == 0) {
+		printf("The PLY file doesn't have any faces\n");
+		return false;
+	}
+	if (scan->NumVertices > (uint64)UINT32_MAX) {
+		printf("The PLY file has [%llu] vertices. LMF files can only index [%u]\n", (unsigned long long)scan->NumVertices, UINT32_MAX);
+		return false;
+	}
+
+	return true;
+}
+
+static bool HasAll(const PlyProperty *properties, uint count) {
+	for (uint i = 0; i < count; ++i) {
+		if (properties[i].Type == PlyType::None) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool ConvertVertexChunk(const byte *data, const PlyScan &scan, uint64 first, uint64 count, MeshSink *sink) {
+	bool hasNormals = HasAll(scan.Normals, 3);
+	bool hasTexCoords = HasAll(scan.TexCoords, 2);
+
+	std::vector<float> positions(count * 3);
+	std::vector<float> normals(hasNormals ? count * 3 : 0);
+	std::vector<float> texCoords(hasTexCoords ? count * 2 : 0);
+	for (uint64 i = 0; i < count; ++i) {
+		const byte *record = data + scan.VertexOffset + (first + i) * scan.VertexStride;
+		for (uint j = 0; j < 3; ++j) {
+			positions[i * 3 + j] = (float)ReadPlyValue(record + scan.Positions[j].Offset, scan.Positions[j].Type, scan.BigEndian);
+		}
+		if (hasNormals) {
+			for (uint j = 0; j < 3; ++j) {
+				normals[i * 3 + j] = (float)ReadPlyValue(record + scan.Normals[j].Offset, scan.Normals[j].Type, scan.BigEndian);
+			}
+		}
+		if (hasTexCoords) {
+			for (uint j = 0; j < 2; ++j) {
+				texCoords[i * 2 + j] = (float)ReadPlyValue(record + scan.TexCoords[j].Offset, scan.TexCoords[j].Type, scan.BigEndian);
+			}
+		}
+	}
+
+	return sink->WritePositions(first, positions.data(), count) &&
+	       sink->WriteNormals(first, normals.data(), normals.size() / 3) &&
+	       sink->WriteTexCoords(first, texCoords.data(), texCoords.size() / 2);
+}
+
+static bool ConvertFaceChunk(const byte *data, const PlyScan &scan, const PlyFaceChunk &chunk, MeshSink *sink) {
+	const uint countSize = PlyTypeSize(scan.FaceCountType);
+	const uint indexSize = PlyTypeSize(scan.FaceIndexType);
+
+	std::vector<uint32> indices;
+	indices.reserve(chunk.NumTriangles * 3);
+	std::vector<uint32> face;
+
+	const byte *record = data + chunk.Offset;
+	for (uint64 i = 0; i < chunk.NumFaces; ++i) {
+		const byte *list = record + scan.FaceBytesBefore;
+		int64 count = ReadPlyCount(list, scan.FaceCountType, scan.BigEndian);
+		list += countSize;
+
+		face.clear();
+		for (int64 j = 0; j < count; ++j) {
+			double index = ReadPlyValue(list + j * indexSize, scan.FaceIndexType, scan.BigEndian);
+			if (index < 0.0 || index >= (double)scan.NumVertices) {
+				printf("Face vertex [%.0f] is out of range. The PLY file has [%llu] vertices\n", index, (unsigned long long)scan.NumVertices);
+				return false;
+			}
+			face.push_back((uint32)index);
+		}
+
+		// Split the polygon into a fan of triangles
+		for (std::size_t j = 2; j < face.size(); ++j) {
+			indices.push_back(face[0]);
+			indices.push_back(face[j - 1]);
+			indices.push_back(face[j]);
+		}
+
+		record += FaceSize(scan, count);
+	}
+
+	return sink->WriteIndices(chunk.FirstTriangle * 3, indices.data(), indices.size());
+}
+
+bool ConvertPly(const byte *data, const PlyScan &scan, MeshSink *sink) {
+	uint64 numNormals = HasAll(scan.Normals, 3) ? scan.NumVertices : 0;
+	uint64 numTexCoords = HasAll(scan.TexCoords, 2) ? scan.NumVertices : 0;
+	if (!sink->Begin(3, scan.NumVertices, scan.NumTriangles * 3, numNormals, numTexCoords)) {
+		return false;
+	}
+
+	// The vertices and faces are converted in the same loop, so neither has to wait for the other
+	const uint64 numVertexChunks = (scan.NumVertices + kPlyVertexChunkSize - 1) / kPlyVertexChunkSize;
+	const uint64 numChunks = numVertexChunks + scan.FaceChunks.size();
+	std::atomic<bool> failed(false);
+	tbb::parallel_for(uint64(0), numChunks, [&](uint64 i) {
+		if (failed.load(std::memory_order_relaxed)) {
+			return;
+		}
+
+		bool success;
+		if (i < numVertexChunks) {
+			uint64 first = i * kPlyVertexChunkSize;
+			success = ConvertVertexChunk(data, scan, first, std::min(kPlyVertexChunkSize, scan.NumVertices - first), sink);
+		} else {
+			success = ConvertFaceChunk(data, scan, scan.FaceChunks[i - numVertexChunks], sink);
+		}
+		if (!success) {
+			failed.store(true, std::memory_order_relaxed);
+		}
+	});
+
+	return !failed.load();
+}
+
+} // End of namespace Lantern
@@ -0,0 +1,103 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#pragma once
+
+#include "mesh_sink.h"
+
+#include "math/int_types.h"
+
+#include <cstddef>
+#include <vector>
+
+
+namespace Lantern {
+
+enum class PlyType {
+	None,
+	Int8,
+	UInt8,
+	Int16,
+	UInt16,
+	Int32,
+	UInt32,
+	Float32,
+	Float64
+};
+
+/**
+ * Where a property is in each record of an element
+ */
+struct PlyProperty {
+	PlyProperty()
+		: Offset(0),
+		  Type(PlyType::None) {
+	}
+
+	uint Offset;
+	// PlyType::None if the element doesn't have the property
+	PlyType Type;
+};
+
+/**
+ * A range of faces, and where they go in the model
+ */
+struct PlyFaceChunk {
+	uint64 Offset;
+	uint64 NumFaces;
+	uint64 FirstTriangle;
+	uint64 NumTriangles;
+};
+
+/**
+ * The layout of a binary PLY file, and how its faces are split into chunks
+ */
+struct PlyScan {
+	bool BigEndian;
+
+	uint64 NumVertices;
+	uint64 VertexOffset;
+	uint VertexStride;
+	PlyProperty Positions[3];
+	PlyProperty Normals[3];
+	PlyProperty TexCoords[2];
+
+	uint64 NumFaces;
+	// Each face is the bytes of any properties before the index list, the list, and then any properties after it
+	uint FaceBytesBefore;
+	uint FaceBytesAfter;
+	PlyType FaceCountType;
+	PlyType FaceIndexType;
+	std::vector<PlyFaceChunk> FaceChunks;
+	uint64 NumTriangles;
+};
+
+/**
+ * Reads the header of a binary PLY file, and finds the records of its vertices and faces
+ *
+ * When every face has the same number of vertices, the faces are split into chunks without reading them.
+ * Otherwise, they have to be walked once to find where each chunk starts
+ *
+ * @param data    The file
+ * @param size    The size of the file in bytes
+ * @param scan    Filled with the layout of the file
+ * @return        False if the file isn't a binary PLY file with vertices and faces
+ */
+bool ScanPly(const byte *data, std::size_t size, PlyScan *scan);
+
+/**
+ * Converts the vertices and faces of a binary PLY file in parallel chunks, and writes them straight into the sink
+ *
+ * Polygons are split into fans of triangles
+ *
+ * @param data    The file
+ * @param scan    The result of ScanPly()
+ * @param sink    Where to write the model
+ * @return        False if the file couldn't be converted
+ */
+bool ConvertPly(const byte *data, const PlyScan &scan, MeshSink *sink);
+
+} // End of namespace Lantern
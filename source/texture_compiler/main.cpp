@@ -0,0 +1,116 @@
+/* Lantern - A path tracer
+*
+* Lantern is the legal property of Adrian Astley
+* Copyright Adrian Astley 2015 - 2016
+*/
+
+#include "io/lantern_texture_file.h"
+
+#include "argparse.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+struct TextureCompilerOpts {
+	const char *InputPath = nullptr;
+	const char *OutputPath = nullptr;
+	const char *Format = nullptr;
+	bool SRGB = false;
+};
+
+bool ParseCommandLine(int argc, const char *argv[], TextureCompilerOpts *opts);
+bool ConvertImageToLTF(TextureCompilerOpts *opts);
+
+int main(int argc, const char *argv[]) {
+	TextureCompilerOpts options;
+
+	if (!ParseCommandLine(argc, argv, &options)) {
+		return 1;
+	}
+	return ConvertImageToLTF(&options) ? 0 : 1;
+}
+
+bool ParseCommandLine(int argc, const char *argv[], TextureCompilerOpts *opts) {
+	const char *const usage[] = {
+		"texture_compiler [options] [--] <input_file>",
+		NULL,
+	};
+
+	struct argparse_option parseOptions[] = {
+		OPT_HELP(),
+		OPT_GROUP("Basic options"),
+		OPT_STRING('o', "output", &opts->OutputPath, "Output Path for the .ltf file. Defaults to the input path, with the extension changed to .ltf"),
+		OPT_STRING('f', "format", &opts->Format, "How to store the texels. Either 'srgb' (8-bit sRGB), 'rgba8' (8-bit linear), 'half' (half-float), or 'bc1' (block compressed, sRGB with --srgb). Defaults to 'half' for HDR images, and to 'srgb' with --srgb, or 'rgba8' otherwise"),
+		OPT_BOOLEAN(0, "srgb", &opts->SRGB, "The image is sRGB encoded, rather than linear. The same as \"color_space\": \"srgb\" in a scene file"),
+		OPT_END(),
+	};
+
+	argparse argparse;
+	argparse_init(&argparse, parseOptions, usage, 0);
+	argparse_describe(&argparse, "Converts PNG, JPG, HDR, and other images into mip-mapped, tiled Lantern Texture Files", "Example:\ntexture_compiler -o brick.ltf brick.png");
+
+	argc = argparse_parse(&argparse, argc, argv);
+
+	// Check that we have the correct number of arguments
+	if (argc != 1) {
+		printf("ERROR: Got an unexpected number of arguments.\n\n");
+		argparse_usage(&argparse);
+		return false;
+	}
+
+	opts->InputPath = argv[0];
+	return true;
+}
+
+bool ConvertImageToLTF(TextureCompilerOpts *opts) {
+	Lantern::TexelFormat format = Lantern::DefaultTexelFormat(opts->InputPath, !opts->SRGB, false);
+	if (opts->Format != nullptr) {
+		if (strcmp(opts->Format, "srgb") == 0) {
+			format = Lantern::TexelFormat::RGBA8_sRGB;
+		} else if (strcmp(opts->Format, "rgba8") == 0) {
+			format = Lantern::TexelFormat::RGBA8;
+		} else if (strcmp(opts->Format, "half") == 0) {
+			format = Lantern::TexelFormat::RGBA16F;
+		} else if (strcmp(opts->Format, "bc1") == 0) {
+			format = opts->SRGB ? Lantern::TexelFormat::BC1_sRGB : Lantern::TexelFormat::BC1;
+		} else {
+			printf("Unknown format [%s]\n", opts->Format);
+			return false;
+		}
+	}
+
+	std::string outputPath;
+	if (opts->OutputPath != nullptr) {
+		outputPath = opts->OutputPath;
+	} else {
+		outputPath = opts->InputPath;
+		std::size_t extension = outputPath.find_last_of('.');
+		std::size_t directory = outputPath.find_last_of("/\\");
+		if (extension != std::string::npos && (directory == std::string::npos || extension > directory)) {
+			outputPath.erase(extension);
+		}
+		outputPath += ".ltf";
+	}
+
+	Lantern::LanternTextureFile ltf;
+	if (!Lantern::CreateLTF(opts->InputPath, format, !opts->SRGB, &ltf)) {
+		return false;
+	}
+
+	FILE *file = fopen(outputPath.c_str(), "wb");
+	if (!file) {
+		printf("Unable to open \"%s\" for writing\n", outputPath.c_str());
+		return false;
+	}
+
+	bool success = Lantern::WriteLTF(file, &ltf);
+	fclose(file);
+	if (!success) {
+		printf("Unable to write \"%s\"\n", outputPath.c_str());
+		return false;
+	}
+
+	printf("Wrote \"%s\": %ux%u, %u mip levels\n", outputPath.c_str(), ltf.XSize, ltf.YSize, (uint)ltf.Levels.size());
+	return true;
+}